@@ -0,0 +1,40 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Memory reserved and locked at startup, handed out as arenas
+//
+//--------------------------------------------------------------------
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define ARENA_RESERVE_SIZE (1024 * 1024)        // locked once armed, every arena is carved from it
+#define SCRATCH_ARENA_SIZE (64 * 1024)          // per thread that samples or dumps
+#define ARENA_ALIGNMENT 16
+
+// Bump allocator over a fixed block. Nothing is freed individually;
+// the owner resets it at the start of each unit of work (a sample, a
+// scanned process, a dump) or, for the objects of a monitored target,
+// when its configuration is freed.
+struct Arena {
+    char *Base;
+    size_t Size;
+    size_t Used;
+};
+
+int ReserveArenaMemory(size_t Size);
+void LockArenaMemory();
+int InitArena(struct Arena *Arena, size_t Size);
+void InitArenaOver(struct Arena *Arena, void *Memory, size_t Size);
+void *ArenaAlloc(struct Arena *Arena, size_t Size);
+void *ArenaCalloc(struct Arena *Arena, size_t Size);
+char *ArenaStrdup(struct Arena *Arena, const char *String);
+void ResetArena(struct Arena *Arena);
+struct Arena *ScratchArena();
+
+#endif // ARENA_H
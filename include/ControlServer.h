@@ -0,0 +1,51 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Control socket: on-demand dumps and live reconfiguration
+//
+//--------------------------------------------------------------------
+
+#ifndef CONTROL_SERVER_H
+#define CONTROL_SERVER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "EventLoop.h"
+#include "WorkerPool.h"
+
+#define CONTROL_CLIENTS 4
+#define CONTROL_REQUEST_SIZE 256
+#define CONTROL_RESPONSE_SIZE 2048
+#define CONTROL_NAME_WIDTH 256          // of the process name in a status reply
+#define CONTROL_SOCKET_MODE 0600        // commands dump and reconfigure the target: owner only
+
+struct ControlServer;
+struct CoreDumpWriter;
+struct ProcDumpConfiguration;
+
+// A connection waiting for its command line on the loop
+struct ControlClient {
+    struct EventSource Source;
+    struct ControlServer *Server;
+    size_t RequestLength;
+    char Request[CONTROL_REQUEST_SIZE];
+};
+
+struct ControlServer {
+    struct ProcDumpConfiguration *Config;
+    struct EventSource Listener;
+    char *Path;
+    struct ControlClient Clients[CONTROL_CLIENTS];
+
+    struct CoreDumpWriter *Writer;          // manual dumps
+    struct WorkItem DumpWork;
+    bool bDumpPending;
+};
+
+int StartControlServer(struct ControlServer *Server, struct ProcDumpConfiguration *Config, const char *Path);
+void StopControlServer(struct ControlServer *Server);
+
+#endif // CONTROL_SERVER_H
@@ -11,13 +11,18 @@
 #define CORE_DUMP_WRITER_H
 
 #include <ctype.h>
+#include <poll.h>
 #include <pthread.h>
-#include <semaphore.h>
 #include <signal.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
 
+#include "DumpReport.h"
 #include "Handle.h"
+#include "Metrics.h"
+#include "MiniDump.h"
 #include "ProcDumpConfiguration.h"
 
 #define DATE_LENGTH 26
@@ -28,12 +33,16 @@ enum ECoreDumpType {
     COMMIT,
     CPU,
     TIME,
+    BLOCKED,
     MANUAL
 };
 
+extern const char *CoreDumpTypeStrings[];
+
 struct CoreDumpWriter {
     struct ProcDumpConfiguration *Config;
     enum ECoreDumpType Type;
+    uint64_t TriggeredAt;           // MetricClock() when the pending dump was triggered
 };
 
 struct CoreDumpWriter *NewCoreDumpWriter(enum ECoreDumpType type, struct ProcDumpConfiguration *config);
@@ -0,0 +1,87 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Daemon mode: many targets described by a configuration file
+//
+//--------------------------------------------------------------------
+
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "ProcDumpConfiguration.h"
+#include "TimerWheel.h"
+
+#define DAEMON_SCAN_INTERVAL 2000           // ms between two scans of /proc for new matches
+#define DAEMON_NAME_LENGTH 64
+#define DAEMON_MAX_DIRECTORY 512
+#define DAEMON_PROCESS_NAME_LENGTH 256      // longer names are cut short in logs and dump names
+
+// One [section] of the configuration file. Every selector that is given
+// must match; each matching process is monitored with the rule's settings.
+struct TargetRule {
+    char Name[DAEMON_NAME_LENGTH];
+
+    // selectors
+    pid_t Pid;                              // NO_PID for any
+    char *ProcessName;                      // as for -w
+    uid_t Uid;
+    bool bUid;
+    char *Cgroup;                           // the cgroup or any below it
+
+    // settings, as for the command line options
+    int CpuThreshold;
+    bool bCpuTriggerBelowValue;
+    int MemoryThreshold;
+    bool bMemoryTriggerBelowValue;
+    int BlockedThreshold;                   // -1 for none
+    int BlockedSeconds;
+    bool bBlockedOnWchan;
+    int ThresholdSeconds;
+    int NumberOfDumpsToCollect;             // per process
+    bool bTimerThreshold;
+    char *OutputDirectory;
+    int CoredumpFilter;                     // -1 to leave it alone
+    struct DumpQuota Quota;                 // shared by all the rule's processes
+    int DumpPriority;                       // -1 for the -b default
+    bool bMiniDump;
+
+    int nTargets;                           // monitored processes still referencing the rule
+    bool bRetired;                          // removed or changed by a reload
+    struct TargetRule *Next;
+};
+
+// A process matched by a rule. Targets are recycled through the daemon's
+// free list, and the config's strings live in the target or the rule, so
+// a match does not allocate once the pool has grown to the peak number of
+// targets.
+struct MonitoredTarget {
+    struct ProcDumpConfiguration *Config;   // &Storage
+    struct TargetRule *Rule;
+    bool bReleased;                         // triggers done and freed, kept so it isn't matched again
+    struct MonitoredTarget *Next;
+    char ProcessName[DAEMON_PROCESS_NAME_LENGTH];
+    struct ProcDumpConfiguration Storage;
+};
+
+struct Daemon {
+    struct ProcDumpConfiguration *Defaults;
+    struct TargetRule *Rules;
+    struct MonitoredTarget *Targets;
+    struct MonitoredTarget *FreeTargets;    // reaped, reused by the next match
+    struct WheelTimer ScanTimer;
+    DIR *Proc;                      // kept open and rewound for every scan
+    bool bStopping;
+};
+
+int LoadTargetRules(const char *Path, struct TargetRule **Rules);
+void FreeTargetRules(struct TargetRule *Rules);
+int RunDaemon(struct ProcDumpConfiguration *self);
+
+#endif // DAEMON_H
@@ -0,0 +1,86 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Node wide dump budget shared by every procdump through a mapped file
+//
+//--------------------------------------------------------------------
+
+#ifndef DUMP_BUDGET_H
+#define DUMP_BUDGET_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#define DUMP_BUDGET_MAGIC "PDBUDGET"
+#define DUMP_BUDGET_VERSION 2
+#define DUMP_BUDGET_SLOTS 32                // dumps running or queued on the node
+#define DUMP_BUDGET_POLL 100                // ms between admission and I/O share checks
+#define DUMP_BUDGET_MAX_WAIT 600            // s a queued dump waits before it is dropped
+#define DUMP_PRIORITY_DEFAULT 5             // 0 (lowest) to 9
+
+enum DumpAdmission {
+    DUMP_ADMITTED,
+    DUMP_DROPPED,                           // byte budget spent, queue full or waited too long
+    DUMP_CANCELLED                          // quit while queued
+};
+
+// What this procdump asked for with -b path[:key=value,...]
+struct DumpBudgetLimits {
+    char *Path;
+    int MaxConcurrent;                      // -1 keeps the node's current setting
+    int64_t MbPerHour;                      // -1 keeps it, 0 is unlimited
+    int64_t IoMbPerSecond;                  // -1 keeps it, 0 is unlimited
+    int Priority;                           // of this procdump's dumps
+};
+
+struct DumpBudgetSlot {
+    pthread_mutex_t Owner;                  // robust, held by the dump worker using the slot
+    pid_t Pid;                              // procdump holding the slot (in its own pid namespace), 0 when free
+    int Priority;
+    uint64_t Ticket;                        // arrival order within a priority
+    bool bRunning;                          // false while queued
+    bool bEvicted;                          // queued dump asked to give its slot to a higher priority one
+};
+
+// The mapped file. Lock is robust, so a procdump dying with it held does
+// not wedge the node, and slots whose Owner died are reclaimed.
+struct DumpBudgetShared {
+    char Magic[8];
+    uint32_t Version;
+    uint32_t Size;
+    pthread_mutex_t Lock;
+    int Generation;                         // futex word, bumped whenever a slot frees up
+    int MaxConcurrent;
+    uint64_t BytesPerHour;                  // 0 unlimited
+    uint64_t IoBytesPerSecond;              // 0 unlimited, split evenly among running dumps
+    int64_t Tokens;                         // bytes that may still be written, refilled at BytesPerHour
+    uint64_t RefilledAt;                    // CLOCK_MONOTONIC ns
+    uint64_t NextTicket;
+    struct DumpBudgetSlot Slots[DUMP_BUDGET_SLOTS];
+};
+
+struct DumpBudget {
+    struct DumpBudgetShared *Shared;        // NULL when there is no budget
+    int Priority;
+};
+
+// I/O share enforcement for one running dump
+struct DumpThrottle {
+    uint64_t StartedAt;
+    bool bStopped;
+};
+
+int ParseDumpBudget(const char *Spec, struct DumpBudgetLimits *Limits);
+int OpenDumpBudget(struct DumpBudget *Budget, const char *Spec);
+void CloseDumpBudget(struct DumpBudget *Budget);
+
+enum DumpAdmission AcquireDumpSlot(struct DumpBudget *Budget, int Priority, int *Quit, int *Slot);
+void ReleaseDumpSlot(struct DumpBudget *Budget, int Slot, uint64_t Bytes);
+bool IsDumpThrottled(struct DumpBudget *Budget);
+void ThrottleDump(struct DumpBudget *Budget, struct DumpThrottle *Throttle, pid_t Group, uint64_t Written);
+
+#endif // DUMP_BUDGET_H
@@ -0,0 +1,43 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Per-dump performance report, written next to each dump as JSON
+//
+//--------------------------------------------------------------------
+
+#ifndef DUMP_REPORT_H
+#define DUMP_REPORT_H
+
+#include <stdint.h>
+#include <unistd.h>
+
+#define DUMP_REPORT_EXTENSION ".json"
+
+// Timestamps are MetricClock() (CLOCK_MONOTONIC) ns, 0 when not taken
+struct DumpReport {
+    pid_t Pid;
+    const char *Trigger;
+    const char *CoreFile;
+
+    uint64_t TriggeredAt;           // trigger decided a dump was due
+    uint64_t StartedAt;             // dump slot acquired
+    uint64_t GcoreStartedAt;        // gcore spawned
+    uint64_t GcoreEndedAt;          // gcore exited
+    uint64_t EndedAt;
+
+    uint64_t CoreBytes;             // logical size of the core file
+    uint64_t DiskBytes;             // blocks allocated for it
+    uint64_t BytesRead;             // by gcore and its children
+    uint64_t BytesWritten;
+    int Regions;                    // mappings in the target, -1 if unknown
+    int Threads;
+    long PeakRssKb;                 // procdump
+    long GcorePeakRssKb;            // largest of gcore and its children
+};
+
+int WriteDumpReport(const struct DumpReport *Report, const char *Path);
+void LogDumpReport(const struct DumpReport *Report);
+
+#endif // DUMP_REPORT_H
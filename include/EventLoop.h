@@ -0,0 +1,62 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Single threaded epoll based event loop
+//
+//--------------------------------------------------------------------
+
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/types.h>
+
+#include "TimerWheel.h"
+
+#define MAX_LOOP_EVENTS 16
+#define NO_FD -1
+
+struct EventSource;
+
+// Called on the loop thread whenever the source's fd is ready
+typedef void (*EventHandler)(struct EventSource *Source, uint32_t Events);
+
+struct EventSource {
+    int fd;
+    EventHandler Handler;
+    void *Context;
+};
+
+// The loop keeps running while anything holds a reference on it
+// (an armed trigger, an in-flight dump, ...) and returns once the last one is dropped.
+// Every timed activity lives on the loop's timer wheel; the loop sleeps in
+// epoll_wait until the wheel's next deadline, so there is no fd per timer.
+struct EventLoop {
+    int epollFd;
+    int nRefs;
+    struct TimerWheel Timers;
+};
+
+int InitEventLoop(struct EventLoop *Loop);
+void DestroyEventLoop(struct EventLoop *Loop);
+int RunEventLoop(struct EventLoop *Loop);
+void RetainEventLoop(struct EventLoop *Loop);
+void ReleaseEventLoop(struct EventLoop *Loop);
+
+int AddEventSource(struct EventLoop *Loop, struct EventSource *Source, uint32_t Events);
+int ModifyEventSource(struct EventLoop *Loop, struct EventSource *Source, uint32_t Events);
+void RemoveEventSource(struct EventLoop *Loop, struct EventSource *Source);
+
+int InitSignalSource(struct EventSource *Source, const sigset_t *Signals, EventHandler Handler, void *Context);
+int InitListenerSource(struct EventSource *Source, const char *Path, mode_t Mode, int Backlog, EventHandler Handler, void *Context);
+int AcceptConnection(struct EventSource *Listener);
+
+#endif // EVENT_LOOP_H
@@ -22,21 +22,20 @@
 
 #define MANUAL_RESET_EVENT_INITIALIZER(NAME) \
     {\
-    .mutex          = PTHREAD_MUTEX_INITIALIZER,\
-    .cond           = PTHREAD_COND_INITIALIZER,\
-    .bManualReset   = true,\
-    .bTriggered     = false,\
+    .State          = 0,\
     .nWaiters       = 0,\
+    .bManualReset   = true,\
     .Name           = NAME\
     }
 
+// An event is a single futex word (State) plus a count of threads sleeping on it.
+// Setting or testing an uncontended event is one atomic operation; the futex
+// syscall is only made when somebody actually has to sleep or be woken.
 struct Event {
-    pthread_mutex_t mutex;
-    pthread_cond_t cond;
-    bool bTriggered;
+    int State;          // 1 when triggered, 0 otherwise (futex word)
+    int nWaiters;       // number of threads about to sleep / sleeping on State
     bool bManualReset;
     char Name[MAX_EVENT_NAME];
-    int nWaiters;
 };
 
 struct Event *CreateEvent(bool IsManualReset, bool InitialState);
@@ -46,5 +45,7 @@ void InitNamedEvent(struct Event *Event, bool IsManualReset, bool InitialState,
 void DestroyEvent(struct Event *Event);
 bool SetEvent(struct Event *Event);
 bool ResetEvent(struct Event *Event);
+bool IsEventSet(struct Event *Event);
+int WaitForEvent(struct Event *Event, const struct timespec *Deadline);
 
 #endif // EVENTS_H
\ No newline at end of file
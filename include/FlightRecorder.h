@@ -0,0 +1,75 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Memory mapped ring of target samples, snapshotted next to each dump
+//
+//--------------------------------------------------------------------
+
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "Arena.h"
+#include "EventLoop.h"
+#include "Process.h"
+#include "TimerWheel.h"
+
+#define FLIGHT_RECORDER_MAGIC "PDFLIGHT"
+#define FLIGHT_RECORDER_VERSION 1
+#define FLIGHT_RECORDER_SAMPLES 3600        // one hour at the default sampling interval
+#define FLIGHT_RECORDER_INTERVAL 1000       // ms between samples
+#define FLIGHT_SNAPSHOT_SECONDS 600         // history written next to each dump
+#define FLIGHT_SNAPSHOT_CHUNK 64            // records copied out per write
+#define FLIGHT_RECORDER_EXTENSION ".samples"
+
+// One sample of the target, fixed size and little endian as written by the
+// host. Sequence is index + 1 once the record is complete and 0 while it is
+// being rewritten, so readers can tell a torn record from a good one.
+struct SampleRecord {
+    uint64_t Sequence;
+    uint64_t Timestamp;             // CLOCK_REALTIME, ns
+    uint64_t UserTicks;             // utime, clock ticks
+    uint64_t SystemTicks;           // stime, clock ticks
+    uint64_t RssPages;
+    uint64_t VirtualBytes;
+    uint64_t MinorFaults;
+    uint64_t MajorFaults;
+    uint32_t Threads;
+    int32_t Processor;              // CPU last run on
+    char State;                     // R, S, D, ... from /proc/[pid]/stat
+    char Reserved[7];
+};
+
+// Both the ring file and the per-dump snapshots start with this header.
+// In a snapshot the records are the Head newest samples, oldest first.
+struct FlightRecorderHeader {
+    char Magic[8];
+    uint32_t Version;
+    uint32_t RecordSize;
+    uint32_t Capacity;              // records in the ring
+    int32_t Pid;
+    uint64_t Head;                  // records ever appended
+};
+
+struct FlightRecorder {
+    struct FlightRecorderHeader *Header;    // NULL when not recording
+    struct SampleRecord *Records;
+    size_t MappedSize;
+    char *Path;                             // ring file, unlinked on close; in the caller's arena
+    pid_t Pid;
+    struct TimerWheel *Wheel;
+    struct WheelTimer Timer;
+};
+
+int OpenFlightRecorder(struct FlightRecorder *Recorder, pid_t Pid, const char *Path, struct Arena *Arena);
+void CloseFlightRecorder(struct FlightRecorder *Recorder);
+void StartFlightRecorder(struct FlightRecorder *Recorder, struct EventLoop *Loop);
+void RecordSample(struct FlightRecorder *Recorder, const struct ProcessStat *Stat);
+int SnapshotFlightRecorder(struct FlightRecorder *Recorder, const char *Path, int Seconds, struct Arena *Arena);
+
+#endif // FLIGHT_RECORDER_H
@@ -0,0 +1,122 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Thin wrappers around the futex(2) system call
+//
+//--------------------------------------------------------------------
+
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define FUTEX_WAKE_ALL INT_MAX
+
+// All timed waits are measured against this clock so wall clock steps (NTP, settimeofday)
+// can neither stall nor burst the trigger loops; futex deadlines follow it
+#define WAIT_CLOCK CLOCK_MONOTONIC
+#define FUTEX_WAIT_CLOCK ((WAIT_CLOCK) == CLOCK_REALTIME ? FUTEX_CLOCK_REALTIME : 0)
+
+//--------------------------------------------------------------------
+//
+// DeadlinePassed - True if Deadline (WAIT_CLOCK) is already behind us
+//
+//      A futex wait on a passed deadline still arms a timer and sleeps out
+//      the timer slack (50us by default): polls with a 0 ms timeout skip it.
+//
+//--------------------------------------------------------------------
+static inline bool DeadlinePassed(const struct timespec *Deadline)
+{
+    struct timespec now;
+
+    if (Deadline == NULL || clock_gettime(WAIT_CLOCK, &now) != 0) {
+        return false;
+    }
+    return now.tv_sec > Deadline->tv_sec || (now.tv_sec == Deadline->tv_sec && now.tv_nsec >= Deadline->tv_nsec);
+}
+
+//--------------------------------------------------------------------
+//
+// FutexWait - Sleep on Address as long as it still holds Expected
+//
+// Parameters:
+//      -Address -> the futex word
+//      -Expected -> the value the caller last observed
+//      -Deadline -> absolute WAIT_CLOCK deadline, NULL is infinite
+//
+// Return - 0 when woken (or the word no longer held Expected),
+//          ETIMEDOUT when the deadline passed, EINTR on a signal
+//
+//--------------------------------------------------------------------
+static inline int FutexWait(int *Address, int Expected, const struct timespec *Deadline)
+{
+    long rc;
+
+    if (DeadlinePassed(Deadline)) {
+        return ETIMEDOUT;
+    }
+
+    rc = syscall(SYS_futex, Address, FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG | FUTEX_WAIT_CLOCK,
+                 Expected, Deadline, NULL, FUTEX_BITSET_MATCH_ANY);
+
+    if (rc == -1) {
+        if (errno == EAGAIN) {
+            return 0; // value changed before we could sleep, caller re-checks
+        }
+        return errno;
+    }
+
+    return 0;
+}
+
+//--------------------------------------------------------------------
+//
+// FutexWake - Wake up to Count threads sleeping on Address
+//
+//--------------------------------------------------------------------
+static inline void FutexWake(int *Address, int Count)
+{
+    syscall(SYS_futex, Address, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, Count, NULL, NULL, 0);
+}
+
+//--------------------------------------------------------------------
+//
+// FutexWaitShared / FutexWakeShared - As above, for a futex word in memory
+//      shared with other processes (a MAP_SHARED file)
+//
+//--------------------------------------------------------------------
+static inline int FutexWaitShared(int *Address, int Expected, const struct timespec *Deadline)
+{
+    long rc;
+
+    if (DeadlinePassed(Deadline)) {
+        return ETIMEDOUT;
+    }
+
+    rc = syscall(SYS_futex, Address, FUTEX_WAIT_BITSET | FUTEX_WAIT_CLOCK,
+                 Expected, Deadline, NULL, FUTEX_BITSET_MATCH_ANY);
+
+    if (rc == -1) {
+        if (errno == EAGAIN) {
+            return 0;
+        }
+        return errno;
+    }
+
+    return 0;
+}
+
+static inline void FutexWakeShared(int *Address, int Count)
+{
+    syscall(SYS_futex, Address, FUTEX_WAKE, Count, NULL, NULL, 0);
+}
+
+#endif // FUTEX_H
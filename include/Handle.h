@@ -11,12 +11,13 @@
 #define HANDLE_H
 
 #include <pthread.h>
-#include <semaphore.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
 
 #include "Events.h"
+#include "Futex.h"
+#include "Semaphores.h"
 #include "Logging.h"
 
 #define INFINITE_WAIT -1
@@ -24,15 +25,15 @@
 #define WAIT_TIMEOUT ETIMEDOUT
 #define WAIT_ABANDONED 0x80
 
+// WAIT_CLOCK, the clock of every timed wait, is defined with the futex calls
+
 #define HANDLE_MANUAL_RESET_EVENT_INITIALIZER(NAME) \
 {\
     {\
         .event = {\
-            .mutex          = PTHREAD_MUTEX_INITIALIZER,\
-            .cond           = PTHREAD_COND_INITIALIZER,\
-            .bManualReset   = true,\
-            .bTriggered     = false,\
+            .State          = 0,\
             .nWaiters       = 0,\
+            .bManualReset   = true,\
             .Name           = NAME\
         }\
     },\
@@ -47,11 +48,12 @@ enum EHandleType {
 struct Handle {
     union {
         struct Event event;
-        sem_t semaphore;
+        struct Semaphore semaphore;
     };
     enum EHandleType type;
 };
 
+void GetWaitDeadline(int Milliseconds, struct timespec *Deadline);
 int WaitForSingleObject(struct Handle *Handle, int Milliseconds);
 int WaitForMultipleObjects(int Count, struct Handle **Handles, bool WaitAll, int Milliseconds);
 
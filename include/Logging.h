@@ -18,6 +18,9 @@
 #include <string.h>
 #include <stdarg.h>
 #include <time.h>
+#include <stdint.h>
+
+#include "Events.h"
 
 #define INTERNAL_ERROR "Internal Error has occurred. If problem continues to occur run procudmp with -d flag to trace issue"
 
@@ -37,13 +40,55 @@ enum LogLevel{
     error
 };
 
-void Log(enum LogLevel logLevel, const char *message, ...);
+#define LOG_RING_SIZE 256           // records, power of two
+#define LOG_RECORD_SIZE 512         // bytes of captured arguments, and of formatted message
+#define LOG_BATCH_SIZE 16384        // bytes of stdout written per flush
+
+// A message waiting in the log ring. Turn is 2 * lap while the slot is free
+// for that lap's producer and 2 * lap + 1 once it is published.
+// The arguments are kept in binary form (strings copied inline) and only run
+// through Format when the record is written out.
+struct LogRecord {
+    unsigned long Turn;
+    enum LogLevel Level;
+    time_t Time;
+    const char *Format;             // always a string literal, see Log()
+    unsigned short ArgsLen;
+    bool bTruncated;                // Args ran out of room
+    char Args[LOG_RECORD_SIZE];
+};
+
+// Producers claim ring slots with a CAS and never block, allocate or format;
+// a single flusher thread formats the records and batches the writes to stdout/syslog.
+// Until StartLogger (and after StopLogger) the logging thread drains the ring itself.
+struct Logger {
+    struct LogRecord Ring[LOG_RING_SIZE];
+    unsigned long EnqueuePos;
+    unsigned long DequeuePos;       // only touched by whoever holds bDraining
+    unsigned long nDropped;
+    bool bDraining;
+    bool bRunning;
+    bool bStop;
+    struct Event evtPending;
+    pthread_t Flusher;
+};
+
+// The message must be a literal: it is formatted after Log() has returned
+#define Log(logLevel, message, ...) \
+    LogMessage(logLevel, "" message, ##__VA_ARGS__)
+
+void LogMessage(enum LogLevel logLevel, const char *message, ...) __attribute__((format(printf, 2, 3)));
+
+int StartLogger();
+void StopLogger();
+void FlushLog();
 
-pthread_mutex_t LoggerLock;
+extern bool g_DiagTraceEnabled;     // -d
 
-void DiagTrace(const char* message, ...);
+void DiagTrace(const char* message, ...) __attribute__((format(printf, 1, 2)));
 
+// Disabled tracing costs one predictable branch; the arguments are not evaluated
 #define Trace(format, ...) \
-    DiagTrace(format " %s", ##__VA_ARGS__, LOCATION);
+    do { if (__builtin_expect(g_DiagTraceEnabled, false)) DiagTrace(format " " LOCATION, ##__VA_ARGS__); } while (0)
 
 #endif // LOGGING_H
\ No newline at end of file
@@ -0,0 +1,103 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Counters, gauges and histograms exported in Prometheus text format
+//
+//--------------------------------------------------------------------
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "EventLoop.h"
+
+#define METRIC_TRIGGER_TYPES 5          // one label value per ECoreDumpType
+#define METRIC_THREAD_SLOTS 32          // threads with a private slot, the rest share one
+#define METRIC_CLIENTS 4                // concurrent scrapes
+#define METRIC_SOCKET_MODE 0777         // any local scraper, less the umask
+#define METRIC_LABEL_SIZE 160           // an escaped rule name
+#define METRIC_REQUEST_SIZE 1024
+#define METRIC_RESPONSE_SIZE 16384      // counters and histograms
+#define METRIC_TARGET_RESPONSE_SIZE (METRIC_GAUGES * METRIC_TRIGGER_TYPES * (128 + METRIC_LABEL_SIZE))  // gauges of one target
+#define METRIC_HEADER_SIZE 128           // room for the HTTP response header ahead of the body
+
+enum MetricCounter {
+    METRIC_SAMPLES,                     // trigger evaluations
+    METRIC_TRIGGERS_FIRED,
+    METRIC_DUMPS,
+    METRIC_DUMP_FAILURES,
+    METRIC_DUMP_BYTES,
+    METRIC_DUMPS_DROPPED,               // refused by the node's dump budget
+    METRIC_COUNTERS
+};
+
+enum MetricGauge {
+    METRIC_TRIGGER_VALUE,               // last sampled value (CPU %, commit MB, blocked threads)
+    METRIC_TRIGGER_THRESHOLD,
+    METRIC_GAUGES
+};
+
+enum MetricHistogram {
+    METRIC_SAMPLE_DURATION,
+    METRIC_DUMP_DURATION,
+    METRIC_TIME_TO_ARMED,               // start of monitoring to the trigger's first sample
+    METRIC_TARGET_STOPPED,              // target stopped while dumped, from the dump report
+    METRIC_HISTOGRAMS
+};
+
+// The gauges of one monitored target, exported with its pid (and daemon
+// rule) as labels while registered. Loop thread only.
+struct MetricTarget {
+    pid_t Pid;
+    const char *Rule;                   // daemon rule, NULL on the command line
+    int64_t Gauges[METRIC_GAUGES][METRIC_TRIGGER_TYPES];
+    int Set;                            // bit per gauge/trigger pair that has a value
+    bool bRegistered;
+    struct MetricTarget *Next;
+    struct MetricTarget *Prev;
+};
+
+struct MetricsServer;
+
+// A scrape connection on the loop: first waiting for its request, then
+// (ResponseEnd != 0) for the socket to take the rest of the response
+struct MetricsClient {
+    struct EventSource Source;
+    struct MetricsServer *Server;
+    size_t RequestLength;
+    size_t ResponseStart;               // next byte of Response to send
+    size_t ResponseEnd;
+    char Request[METRIC_REQUEST_SIZE];
+    char *Response;                     // grown to fit the registered targets, kept between scrapes
+    size_t ResponseSize;
+};
+
+struct MetricsServer {
+    struct EventLoop *Loop;
+    struct EventSource Listener;
+    char *Path;
+    struct MetricsClient Clients[METRIC_CLIENTS];
+};
+
+// Hot path updates: lock-free, no allocation, no syscalls
+void CountMetric(enum MetricCounter Counter, int Trigger, uint64_t Delta);
+void SetMetricGauge(struct MetricTarget *Target, enum MetricGauge Gauge, int Trigger, int64_t Value);
+void ObserveMetric(enum MetricHistogram Histogram, int Trigger, uint64_t Nanoseconds);
+uint64_t MetricClock();
+
+void RegisterMetricTarget(struct MetricTarget *Target, pid_t Pid, const char *Rule);
+void UnregisterMetricTarget(struct MetricTarget *Target);
+
+size_t FormatMetrics(char *Buffer, size_t Size);
+
+int StartMetricsServer(struct MetricsServer *Server, struct EventLoop *Loop, const char *Path);
+void StopMetricsServer(struct MetricsServer *Server);
+
+#endif // METRICS_H
@@ -0,0 +1,38 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Stack only ELF core: thread state, the top of each stack and the
+// module map, written by procdump itself instead of gcore
+//
+//--------------------------------------------------------------------
+
+#ifndef MINI_DUMP_H
+#define MINI_DUMP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#define MINI_DUMP_STACK_SIZE (256 * 1024)   // bytes of stack kept per thread, from its stack pointer up
+#define MINI_DUMP_RED_ZONE 128              // below the stack pointer, still the innermost frame's on x86_64
+#define MINI_DUMP_MAX_THREADS 4096
+#define MINI_DUMP_MAPS_SIZE (4 * 1024 * 1024)   // of /proc/<pid>/maps read, the rest of the modules are left out
+#define MINI_DUMP_COPY_SIZE (64 * 1024)     // bytes copied out of the target per process_vm_readv
+#define MINI_DUMP_STOP_TIMEOUT 100          // ms a thread may take to stop before it is dumped asleep
+
+// What went into a mini dump, for the dump report
+struct MiniDumpResult {
+    int Threads;
+    int Asleep;                             // of them, did not stop: in an uninterruptible sleep
+    int Modules;                            // file mappings in the NT_FILE note
+    uint64_t StoppedAt;                     // MetricClock() when the first thread was interrupted
+    uint64_t ResumedAt;                     // and when the last one was let go
+    uint64_t BytesRead;                     // stack and vdso bytes copied out of the target
+    uint64_t BytesWritten;
+};
+
+int WriteMiniDump(pid_t Pid, const char *Path, struct MiniDumpResult *Result);
+
+#endif // MINI_DUMP_H
@@ -25,20 +25,38 @@
 #include <limits.h>
 #include <dirent.h>
 #include <errno.h>
-
+#include <sys/syscall.h>
+#include <sys/un.h>
+
+#include "Arena.h"
+#include "ControlServer.h"
+#include "DumpBudget.h"
+#include "EventLoop.h"
+#include "FlightRecorder.h"
+#include "Metrics.h"
 #include "Handle.h"
 #include "TriggerThreadProcs.h"
+#include "WorkerPool.h"
 #include "Process.h"
+#include "Profiler.h"
+#include "ThreadRole.h"
 #include "Logging.h"
 
+#define FLIGHT_RECORDER_RING_FORMAT "procdump_%d%s.flight"     // pid, then "_<rule>" in daemon mode
 #define MAX_TRIGGERS 3
 #define NO_PID INT_MAX
 #define MAX_CMDLINE_LEN 4096+1
 #define EMPTY_PROC_NAME "null"
 #define MIN_KERNEL_VERSION 3
 #define MIN_KERNEL_PATCH 5
+#define TARGET_ARENA_SIZE 2048              // the triggers, writers and sample ring path of one target
+#define PROCDUMP_OOM_SCORE_ADJ -900         // well behind the target, short of exempt (-1000)
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434                  // same number on every architecture, missing from older headers
+#endif
 
-struct ProcDumpConfiguration g_config;  // backbone of the program
+struct ProcDumpConfiguration g_config;  // backbone of the program, and in daemon mode the defaults
 
 long HZ;                                // clock ticks per second
 int MAXIMUM_CPU;                        // maximum cpu usage percentage (# cores * 100)
@@ -47,11 +65,16 @@ int MAXIMUM_CPU;                        // maximum cpu usage percentage (# cores
 // Structs
 // -------------------
 
+// Bytes of dumps a daemon target may write, shared by all the processes it matches
+struct DumpQuota {
+    uint64_t LimitBytes;
+    uint64_t UsedBytes;             // updated by the dump workers
+};
+
 struct ProcDumpConfiguration {
     // Process and System info
     pid_t ProcessId;
     char *ProcessName;
-    struct sysinfo SystemInfo;
 
     // Runtime Values
     int NumberOfDumpsCollecting; // Number of dumps we're collecting
@@ -73,16 +96,47 @@ struct ProcDumpConfiguration {
     bool bCpuTriggerBelowValue;     // -c
     int MemoryThreshold;            // -M
     bool bMemoryTriggerBelowValue;  // -m
+    int BlockedThreshold;           // -B, more threads than this blocked; -1 for none
+    int BlockedSeconds;             // -B threads:seconds they stay blocked for
+    bool bBlockedOnWchan;           // -B threads:wchan, also count threads sleeping on one wait channel
     int ThresholdSeconds;           // -s
+    int SamplingInterval;           // -i, ms between samples
     bool bTimerThreshold;           // -s
     int NumberOfDumpsToCollect;     // -n
     bool WaitingForProcessName;     // -w
     bool DiagnosticsLoggingEnabled; // -d
+    char *MetricsSocket;            // -u
+    char *ControlSocket;            // -k
+    char *DaemonConfig;             // -D
+    char *DumpBudgetSpec;           // -b
+    int ProfileHz;                  // -P, 0 to not profile
+    bool bProfileWhileTriggered;    // -P hz:triggered
+    bool bMiniDump;                 // -S, stack only cores written without gcore
+
+    // per target settings from the daemon configuration
+    char *OutputDirectory;          // NULL for the current directory
+    int CoredumpFilter;             // coredump_filter while dumping, -1 to leave it alone
+    struct DumpQuota *Quota;        // NULL for no limit
+    int DumpPriority;               // in the node's dump budget, -1 for the -b default
+    const char *RuleName;           // the daemon rule matched, NULL on the command line
+
+    // monitoring runtime
+    // every trigger is a timer on one event loop, dumps are written by the worker pool
+    struct EventLoop *Loop;
+    struct WorkerPool *DumpWorkers;
+    int nTriggers;
+    struct Trigger *Triggers[MAX_TRIGGERS];
+    struct EventSource TargetSource;        // pidfd, readable once the target exits
+    struct FlightRecorder Recorder;         // sample history, snapshotted with each dump
+    struct Profiler Profiler;               // -P, Memory is NULL when not profiling
+    struct DumpBudget *Budget;              // node wide limits every dump is admitted by
+    struct MetricTarget Metrics;            // gauges, exported while the triggers exist
+    struct Arena TargetArena;               // over TargetMemory, reset when the config is freed
+    char TargetMemory[TARGET_ARENA_SIZE];
+    uint64_t StartedAt;                     // MetricClock() when monitoring the target was asked for
+    uint64_t ArmedAt;                       // every trigger has taken its first sample, 0 until then
 
-    // multithreading
     // set max number of concurrent dumps on init (default to 1)
-    int nThreads;
-    pthread_t Threads[MAX_TRIGGERS];
     struct Handle semAvailableDumpSlots; 
 
     // Events
@@ -91,21 +145,26 @@ struct ProcDumpConfiguration {
     struct Handle evtBannerPrinted;
     struct Handle evtConfigurationPrinted;
     struct Handle evtDebugThreadInitialized;
-    struct Handle evtStartMonitoring;
 
     // External
     pid_t gcorePid;
 };
 
 int GetOptions(struct ProcDumpConfiguration *self, int argc, char *argv[]);
-char * GetProcessName(pid_t pid);
+char * GetProcessName(pid_t pid, struct Arena *Arena);
+char * ParseProcessName(const char *fileBuffer, ssize_t charactersRead, struct Arena *Arena);
 bool LookupProcessByPid(struct ProcDumpConfiguration *self);
 bool WaitForProcessName(struct ProcDumpConfiguration *self);
 int CreateProcessViaDebugThreadAndWaitUntilLaunched(struct ProcDumpConfiguration *self);
-int CreateTriggerThreads(struct ProcDumpConfiguration *self);
+int CreateTriggers(struct ProcDumpConfiguration *self);
+int StartMonitoringRuntime(struct ProcDumpConfiguration *self, const sigset_t *Signals, EventHandler Handler, void *Context);
+int CreateTargetTriggers(struct ProcDumpConfiguration *self);
+bool IsMonitoringBusy(struct ProcDumpConfiguration *self);
+void ReleaseTargetTriggers(struct ProcDumpConfiguration *self);
 int WaitForQuit(struct ProcDumpConfiguration *self, int milliseconds);
 int WaitForQuitOrEvent(struct ProcDumpConfiguration *self, struct Handle *handle, int milliseconds);
-int WaitForAllThreadsToTerminate(struct ProcDumpConfiguration *self);
+int RunMonitoring(struct ProcDumpConfiguration *self);
+void StopMonitoring(struct ProcDumpConfiguration *self);
 bool IsQuit(struct ProcDumpConfiguration *self);
 int SetQuit(struct ProcDumpConfiguration *self, int quit);
 bool PrintConfiguration(struct ProcDumpConfiguration *self);
@@ -114,8 +173,10 @@ bool BeginMonitoring(struct ProcDumpConfiguration *self);
 
 void FreeProcDumpConfiguration(struct ProcDumpConfiguration *self);
 void InitProcDumpConfiguration(struct ProcDumpConfiguration *self);
+void InitTargetConfiguration(struct ProcDumpConfiguration *self);
 void InitProcDump();
 void ExitProcDump();
+void PrepareForLowMemory();
 
 void PrintBanner();
 int PrintUsage(struct ProcDumpConfiguration *self);
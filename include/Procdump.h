@@ -19,6 +19,7 @@
 #include <signal.h>
 #include <zconf.h>
 
+#include "Daemon.h"
 #include "ProcDumpConfiguration.h"
 #include "Logging.h"
 
@@ -11,6 +11,7 @@
 #define PROCFSLIB_PROCESS_H
 
 #include <linux/version.h>
+#include <dirent.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdbool.h>
@@ -265,11 +266,65 @@ struct ProcessStatus {
     int nonvoluntary_ctxt_switches;    //Number of involuntary context switches.
 };
 
+//
+// Struct for /proc/[pid]/io
+// Counts include the process' waited-for children
+//
+struct ProcessIo {
+    unsigned long long rchar;       // Bytes read through read(2) and friends, cached or not
+    unsigned long long wchar;       // Bytes written through write(2) and friends
+    unsigned long long syscr;       // Read syscalls
+    unsigned long long syscw;       // Write syscalls
+    unsigned long long read_bytes;  // Bytes actually fetched from storage
+    unsigned long long write_bytes; // Bytes sent to storage
+};
+
+//
+// Who a process is, for matching it against daemon targets
+//
+struct ProcessIdentity {
+    pid_t ppid;
+    pid_t pgrp;
+    uid_t uid;      // owner of /proc/[pid], the real uid
+};
+
+//
+// Threads of a process that are off CPU waiting, from /proc/[pid]/task/*/stat and wchan
+//
+#define BLOCKED_WCHAN_LENGTH 64
+#define BLOCKED_MAX_LISTED 16       // blocked threads named, the rest are only counted
+#define BLOCKED_MAX_WCHANS 64       // distinct wait channels counted, threads on others are not
+
+struct BlockedThread {
+    pid_t tid;
+    char state;                             // D, or S when counted by wait channel
+    char wchan[BLOCKED_WCHAN_LENGTH];       // kernel function it sleeps in, empty if not shown
+};
+
+struct BlockedThreads {
+    int threads;                            // threads scanned
+    int uninterruptible;                    // in D state
+    int onWchan;                            // sleeping in the most shared wait channel, if asked for
+    char wchan[BLOCKED_WCHAN_LENGTH];       // that wait channel
+    int listed;
+    struct BlockedThread list[BLOCKED_MAX_LISTED]; // the D state threads
+};
+
 // -----------------------------------------------------------
 // a series of functions for collecting infromation from /procfs
 // -----------------------------------------------------------
 
+ssize_t ReadProcFile(const char *path, char *buffer, size_t size);
 bool GetProcessStat(pid_t pid, struct ProcessStat *proc);
+bool ParseProcessStat(char *fileBuffer, struct ProcessStat *proc);
 bool GetProcessStatus(pid_t pid, struct ProcessStatus *proc);
+bool GetProcessIo(pid_t pid, struct ProcessIo *io);
+int GetProcessMapCount(pid_t pid);
+bool GetProcessIdentity(pid_t pid, struct ProcessIdentity *id);
+bool GetProcessCgroup(pid_t pid, char *cgroup, size_t size);
+bool GetBlockedThreads(pid_t pid, DIR *tasks, bool byWchan, struct BlockedThreads *blocked);
+bool GetCoredumpFilter(pid_t pid, unsigned int *filter);
+bool SetCoredumpFilter(pid_t pid, unsigned int filter);
+bool SetOomScoreAdj(pid_t pid, int value);
 
 #endif // PROCFSLIB_PROCESS_H
\ No newline at end of file
@@ -0,0 +1,128 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Sampling profiler: the target's thread stacks as folded stacks
+//
+//--------------------------------------------------------------------
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <dirent.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "EventLoop.h"
+#include "TimerWheel.h"
+
+#define PROFILE_MAX_HZ 100
+#define PROFILE_MAX_DEPTH 64                // frames unwound per thread
+#define PROFILE_MAX_STACKS 8192             // distinct stacks, a power of two; samples of new ones beyond 3/4 are dropped
+#define PROFILE_FRAME_POOL (PROFILE_MAX_STACKS * 32)
+#define PROFILE_MAX_THREADS 1024            // sampled per tick
+#define PROFILE_MAX_LAGGING 64
+#define PROFILE_STACK_COPY (16 * 1024)      // bytes of stack read per thread in one process_vm_readv
+#define PROFILE_STOP_TIMEOUT 5              // ms a thread gets to stop once interrupted
+#define PROFILE_WRITE_INTERVAL 10000        // ms between rewrites of the folded stacks
+#define PROFILE_MAX_MODULES 128             // ELF files with a cached symbol index
+#define PROFILE_MAX_LOADS 8                 // PT_LOAD segments kept per ELF file
+#define PROFILE_SYMBOL_LENGTH 256
+#define PROFILE_OUTPUT_FORMAT "procdump_%d%s.folded"     // pid, then "_<rule>" in daemon mode
+
+// A distinct stack and how often it was seen; Depth 0 marks a free slot
+struct ProfileStack {
+    uint64_t Hash;
+    uint32_t Frames;                        // index of the innermost frame in the frame pool
+    uint32_t Depth;
+    uint64_t Count;
+};
+
+struct ProfileSymbol {
+    uint64_t Address;                       // link time address
+    uint64_t Size;
+    const char *Name;                       // in the mapped image
+};
+
+// Function symbols of one ELF file, loaded the first time one of its
+// addresses is symbolized and kept for the rest of the run
+struct SymbolIndex {
+    char *Path;
+    void *Image;                            // the file, mapped read only, NULL if it could not be read
+    size_t ImageSize;
+    struct ProfileSymbol *Symbols;          // sorted by Address
+    size_t nSymbols;
+    struct {
+        uint64_t Offset;                    // in the file
+        uint64_t Address;                   // link time
+        uint64_t Size;
+    } Loads[PROFILE_MAX_LOADS];
+    int nLoads;
+};
+
+// A thread interrupted in the sample in progress
+struct ProfileThread {
+    pid_t Tid;
+    bool bWaiting;                          // interrupted, not seen stopped yet
+    bool bRegisters;                        // stopped, registers read and detached
+    uint64_t Pc;
+    uint64_t Fp;
+    uint64_t Sp;
+};
+
+// An executable mapping of the target and the file it maps
+struct ProfileMapping {
+    uint64_t Start;
+    uint64_t End;
+    uint64_t Offset;                        // of Start in the file
+    int Module;                             // index into Modules
+};
+
+struct Profiler {
+    pid_t Pid;
+    const char *Name;                       // root frame of every stack
+    char Path[PATH_MAX];                    // folded output
+    int Period;                             // ms between samples
+    struct EventLoop *Loop;                 // NULL when not started
+    struct WheelTimer SampleTimer;
+    struct WheelTimer WriteTimer;
+    bool (*Gate)(void *Context);            // sample only while it returns true, NULL to always sample
+    void *Context;
+
+    DIR *Tasks;                             // /proc/<pid>/task, rewound every sample
+    pid_t Lagging[PROFILE_MAX_LAGGING];     // seized threads that did not stop in time
+    int nLagging;
+
+    // one mapping, faulted in as it fills
+    void *Memory;
+    size_t MemorySize;
+    struct ProfileStack *Stacks;            // open addressed on Hash
+    uint64_t *Pool;                         // frames, innermost first
+    struct ProfileThread *Threads;          // PROFILE_MAX_THREADS
+    char *StackCopy;
+    size_t nStacks;
+    size_t nFrames;
+
+    uint64_t nSamples;                      // stacks recorded
+    uint64_t nDropped;                      // unwound but not recorded: the table was full
+
+    // symbolization, done when the folded stacks are written; heap allocated
+    struct ProfileMapping *Maps;            // as of the last write the target was still alive for
+    size_t nMaps;
+    struct SymbolIndex *Modules;            // PROFILE_MAX_MODULES
+    int nModules;
+    bool bDenied;                           // ptrace refused, logged once
+};
+
+int ParseProfileSpec(const char *Spec, int *Hz, bool *bWhileTriggered);
+int OpenProfiler(struct Profiler *Profiler, pid_t Pid, const char *Name, int Hz, const char *Path);
+void StartProfiler(struct Profiler *Profiler, struct EventLoop *Loop);
+void StopProfiler(struct Profiler *Profiler);
+void CloseProfiler(struct Profiler *Profiler);
+int SampleProfiler(struct Profiler *Profiler);
+int WriteProfile(struct Profiler *Profiler);
+
+#endif // PROFILER_H
@@ -0,0 +1,28 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Quick counting semaphore implementation
+//
+//--------------------------------------------------------------------
+
+#ifndef SEMAPHORES_H
+#define SEMAPHORES_H
+
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+
+// The count is the futex word; waiters only enter the kernel when it is 0.
+struct Semaphore {
+    int Count;          // available slots (futex word)
+    int nWaiters;       // number of threads about to sleep / sleeping on Count
+};
+
+void InitSemaphore(struct Semaphore *Semaphore, int InitialCount);
+void DestroySemaphore(struct Semaphore *Semaphore);
+bool ReleaseSemaphore(struct Semaphore *Semaphore);
+int WaitForSemaphore(struct Semaphore *Semaphore, const struct timespec *Deadline);
+
+#endif // SEMAPHORES_H
@@ -0,0 +1,60 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Scheduling, CPU affinity and I/O priority of procdump's own threads
+//
+//--------------------------------------------------------------------
+
+#ifndef THREAD_ROLE_H
+#define THREAD_ROLE_H
+
+#include <limits.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#ifndef SCHED_BATCH
+#define SCHED_BATCH 3                       // only declared by sched.h with _GNU_SOURCE
+#endif
+#ifndef SCHED_IDLE
+#define SCHED_IDLE 5
+#endif
+
+// no glibc wrapper for ioprio_set, see linux/ioprio.h
+#define IOPRIO_CLASS_NONE 0
+#define IOPRIO_CLASS_RT 1
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+
+#define THREAD_ROLE_MAX_CPUS 1024
+#define THREAD_NICE_UNCHANGED INT_MAX
+#define THREAD_POLICY_UNCHANGED -1
+
+enum ThreadRole {
+    THREAD_ROLE_SAMPLER,                    // the event loop: sampling, triggers, metrics and control requests
+    THREAD_ROLE_WRITER,                     // dump workers; the gcore and gdb they start keep only the I/O priority
+    THREAD_ROLE_LOGGER,                     // log flusher
+    THREAD_ROLES
+};
+
+// -T role:key=value,... ; anything not given is inherited from procdump
+struct ThreadTuning {
+    int Policy;                             // SCHED_OTHER, SCHED_BATCH or SCHED_IDLE
+    int Nice;
+    int IoClass;                            // IOPRIO_CLASS_NONE leaves it alone
+    int IoLevel;                            // 0 (highest) to 7 within RT and BE
+    int nCpus;                              // 0 leaves the affinity alone
+    unsigned long Cpus[THREAD_ROLE_MAX_CPUS / (8 * sizeof(unsigned long))];
+};
+
+int ParseThreadTuning(const char *Spec, enum ThreadRole *Role, struct ThreadTuning *Tuning);
+void SetThreadTuning(enum ThreadRole Role, const struct ThreadTuning *Tuning);
+int EnterThreadRole(enum ThreadRole Role);
+void LeaveThreadRole(enum ThreadRole Role);
+
+#endif // THREAD_ROLE_H
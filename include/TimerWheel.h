@@ -0,0 +1,62 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Hierarchical timer wheel for trigger sampling, snooze and timed dumps
+//
+//--------------------------------------------------------------------
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)          // slots per level
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 5                          // 1ms ticks, 2^30 ms (~12 days) range
+#define WHEEL_RANGE (1ULL << (WHEEL_BITS * WHEEL_LEVELS))
+#define NO_TIMER -1
+
+struct WheelTimer;
+
+// Called from AdvanceTimerWheel once the timer expires; the timer is already unlinked
+typedef void (*TimerCallback)(struct WheelTimer *Timer);
+
+struct WheelTimer {
+    struct WheelTimer *Next;
+    struct WheelTimer **Prev;       // points at whatever points at us, for O(1) cancel
+    uint64_t Expires;               // absolute tick
+    TimerCallback Callback;
+    void *Context;
+    signed char Level;              // where the timer is linked, NO_TIMER when idle
+    unsigned char Slot;
+};
+
+// Level L slot S holds timers expiring in the S-th 64^L tick block, so a timer
+// is moved down a level (cascaded) at most WHEEL_LEVELS - 1 times before it fires.
+struct TimerWheel {
+    uint64_t Next;                  // next tick to be processed
+    struct timespec Base;           // CLOCK_MONOTONIC time of tick 0
+    int nTimers;
+    struct WheelTimer *Expired;     // timers whose callbacks are being run
+    uint64_t Occupied[WHEEL_LEVELS];                    // bit per non-empty slot
+    struct WheelTimer *Slots[WHEEL_LEVELS][WHEEL_SLOTS];
+};
+
+void InitTimerWheel(struct TimerWheel *Wheel);
+void InitWheelTimer(struct WheelTimer *Timer, TimerCallback Callback, void *Context);
+void ScheduleTimer(struct TimerWheel *Wheel, struct WheelTimer *Timer, uint64_t Milliseconds);
+void ScheduleTimerAt(struct TimerWheel *Wheel, struct WheelTimer *Timer, uint64_t Expires);
+void RescheduleTimer(struct TimerWheel *Wheel, struct WheelTimer *Timer, uint64_t Period);
+void CancelTimer(struct TimerWheel *Wheel, struct WheelTimer *Timer);
+void RunTimerNow(struct TimerWheel *Wheel, struct WheelTimer *Timer);
+bool IsTimerScheduled(struct WheelTimer *Timer);
+void AdvanceTimerWheel(struct TimerWheel *Wheel, uint64_t Now);
+int64_t NextTimerDelay(struct TimerWheel *Wheel, uint64_t Now);
+uint64_t TimerWheelClock(struct TimerWheel *Wheel);
+
+#endif // TIMER_WHEEL_H
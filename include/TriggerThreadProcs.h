@@ -3,7 +3,7 @@
 
 //--------------------------------------------------------------------
 //
-// header - thread processes
+// header - trigger processes
 //
 //--------------------------------------------------------------------
 
@@ -22,14 +22,53 @@
 #include <unistd.h>
 
 #include "CoreDumpWriter.h"
+#include "EventLoop.h"
 #include "Events.h"
 #include "ProcDumpConfiguration.h"
 #include "Process.h"
 #include "Logging.h"
+#include "Metrics.h"
+#include "TimerWheel.h"
+#include "WorkerPool.h"
 
-// worker thread process for monitoring memory commit
-void *CommitThread(void *thread_args /* struct ProcDumpConfiguration* */);
-void *CpuThread(void *thread_args /* struct ProcDumpConfiguration* */);
-void *TimerThread(void *thread_args /* struct ProcDumpConfiguration* */);
+#define SAMPLING_INTERVAL 1000              // ms between two samples of the target (-i)
+#define MIN_SAMPLING_INTERVAL 10
+#define MAX_SAMPLING_INTERVAL 60000
+#define BLOCKED_DEFAULT_SECONDS 5           // -B threads without :seconds
+#define BLOCKED_MAX_THREADS 100000
 
-#endif // TRIGGER_THREAD_PROCS_H
\ No newline at end of file
+// A trigger is a timer on the monitoring loop's timer wheel. Every tick samples
+// the target; when the condition holds the dump is handed to the dump workers and
+// the timer is re-armed for the snooze period once the dump has completed.
+struct Trigger {
+    struct WheelTimer Timer;                // sampling period and post-dump snooze
+    struct WorkItem DumpWork;               // dump request handed to the dump workers
+    struct ProcDumpConfiguration *Config;
+    struct CoreDumpWriter *Writer;
+    bool (*Evaluate)(struct Trigger *self); // samples the target, true when a dump is due
+    int SamplingInterval;                   // ms between samples, 0 for one-shot (timed dumps)
+    bool bActive;
+    bool bArmed;                            // first sample taken
+    bool bPaused;                           // keeps ticking but does not evaluate (control socket)
+    bool bDumpPending;                      // DumpWork queued and not completed yet
+    bool bConditionHeld;                    // at the last sample, what -P hz:triggered profiles on
+    uint64_t HeldSince;                     // MetricClock() since a condition that must last (-B) holds, 0 if not
+    DIR *Tasks;                             // -B: /proc/<pid>/task, opened on the first sample
+};
+
+struct Trigger *NewTrigger(struct CoreDumpWriter *writer);
+int StartTrigger(struct Trigger *self);
+void StopTrigger(struct Trigger *self);
+void FreeTrigger(struct Trigger *self);
+
+// trigger conditions for monitoring memory commit, cpu, elapsed time and blocked threads
+bool CommitTrigger(struct Trigger *self);
+bool CpuTrigger(struct Trigger *self);
+bool TimerTrigger(struct Trigger *self);
+bool BlockedTrigger(struct Trigger *self);
+
+int ParseBlockedSpec(const char *Spec, int *Threads, int *Seconds, bool *bOnWchan);
+
+bool IsQuotaExhausted(struct ProcDumpConfiguration *config);
+
+#endif // TRIGGER_THREAD_PROCS_H
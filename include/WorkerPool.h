@@ -0,0 +1,53 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Worker threads for blocking work (dump writing) driven by the event loop
+//
+//--------------------------------------------------------------------
+
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <sys/eventfd.h>
+
+#include "EventLoop.h"
+#include "Handle.h"
+#include "ThreadRole.h"
+
+#define DEFAULT_DUMP_WORKERS 1
+
+struct WorkItem {
+    void (*Work)(struct WorkItem *Item);        // runs on a pool thread, may block
+    void (*Complete)(struct WorkItem *Item);    // runs on the loop thread once Work returns
+    void *Context;
+    int Result;
+    struct WorkItem *Next;
+};
+
+struct WorkerPool {
+    struct EventLoop *Loop;
+    int nThreads;
+    pthread_t *Threads;
+    enum ThreadRole Role;                       // tuning the workers apply when they start
+    bool bShutdown;
+
+    // pending work, producers are on the loop thread
+    pthread_mutex_t QueueLock;
+    struct WorkItem *QueueHead;
+    struct WorkItem *QueueTail;
+    struct Handle semWorkAvailable;
+
+    // finished work, pushed lock-free by the workers and drained by the loop
+    struct WorkItem *Completed;
+    struct EventSource CompletionSource;        // eventfd, readable when Completed is non-empty
+};
+
+int InitWorkerPool(struct WorkerPool *Pool, struct EventLoop *Loop, int nThreads, enum ThreadRole Role);
+void DestroyWorkerPool(struct WorkerPool *Pool);
+void QueueWorkItem(struct WorkerPool *Pool, struct WorkItem *Item);
+
+#endif // WORKER_POOL_H
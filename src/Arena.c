@@ -0,0 +1,211 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Memory reserved and locked at startup, handed out as arenas
+//
+//      The memory trigger fires when the host is short of memory, which
+//      is exactly when a malloc is likely to fail or fault procdump into
+//      the OOM killer's sights. So everything a sample or a dump needs
+//      comes from one block that is mapped at startup and faulted in
+//      and mlock'd as soon as the first target is armed (not before,
+//      that would delay the first sample); arenas are carved from it
+//      once and reset, never freed.
+//
+//--------------------------------------------------------------------
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "Arena.h"
+#include "Logging.h"
+
+static struct {
+    char *Base;
+    size_t Size;
+    size_t Used;                    // carved so far, bumped atomically
+    bool bLocked;
+} reserve;
+
+static __thread struct Arena scratch;
+
+//--------------------------------------------------------------------
+//
+// ReserveArenaMemory - Map Size bytes for the arenas, LockArenaMemory
+//                      makes them resident
+//
+// Returns: 0 on success, errno otherwise
+//
+//--------------------------------------------------------------------
+int ReserveArenaMemory(size_t Size)
+{
+    void *base = mmap(NULL, Size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (base == MAP_FAILED) {
+        Trace("ReserveArenaMemory: mmap failed.");
+        return errno;
+    }
+
+    reserve.Base = (char *)base;
+    reserve.Size = Size;
+    reserve.bLocked = false;
+    __atomic_store_n(&reserve.Used, 0, __ATOMIC_RELEASE);
+    return 0;
+}
+
+//--------------------------------------------------------------------
+//
+// LockArenaMemory - Fault in and lock the reserve, once
+//
+//      Not being able to lock it (RLIMIT_MEMLOCK) is logged, the memory
+//      is still faulted in.
+//
+//--------------------------------------------------------------------
+void LockArenaMemory()
+{
+    if (reserve.Base == NULL || reserve.bLocked) {
+        return;
+    }
+    reserve.bLocked = true;
+
+    if (mlock(reserve.Base, reserve.Size) != 0) {
+        Log(warn, "Unable to lock %zu KB of working memory: %s", reserve.Size / 1024, strerror(errno));
+        for (size_t offset = 0; offset < reserve.Size; offset += sysconf(_SC_PAGESIZE)) {
+            reserve.Base[offset] = 0;
+        }
+    }
+}
+
+//--------------------------------------------------------------------
+//
+// InitArena - Carve a Size byte arena out of the reserve
+//
+//      Without a reserve (the tests and benchmarks) or once it is used
+//      up, the arena gets its own mapping instead.
+//
+// Returns: 0 on success, ENOMEM otherwise
+//
+//--------------------------------------------------------------------
+int InitArena(struct Arena *Arena, size_t Size)
+{
+    size_t offset;
+
+    Size = (Size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    Arena->Size = Size;
+    Arena->Used = 0;
+
+    if (reserve.Base != NULL) {
+        offset = __atomic_fetch_add(&reserve.Used, Size, __ATOMIC_RELAXED);
+        if (offset + Size <= reserve.Size) {
+            Arena->Base = reserve.Base + offset;
+            return 0;
+        }
+        Log(warn, "Working memory reserve exhausted, arena of %zu KB is not locked", Size / 1024);
+    }
+
+    Arena->Base = mmap(NULL, Size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (Arena->Base == MAP_FAILED) {
+        Arena->Base = NULL;
+        Arena->Size = 0;
+        return ENOMEM;
+    }
+    return 0;
+}
+
+//--------------------------------------------------------------------
+//
+// InitArenaOver - An arena over memory the caller owns, e.g. part of a struct
+//
+//--------------------------------------------------------------------
+void InitArenaOver(struct Arena *Arena, void *Memory, size_t Size)
+{
+    size_t skew = (ARENA_ALIGNMENT - (size_t)Memory % ARENA_ALIGNMENT) % ARENA_ALIGNMENT;
+
+    Arena->Base = (char *)Memory + skew;
+    Arena->Size = Size > skew ? Size - skew : 0;
+    Arena->Used = 0;
+}
+
+//--------------------------------------------------------------------
+//
+// ArenaAlloc - Size bytes, ARENA_ALIGNMENT aligned
+//
+// Returns: the memory, or NULL once the arena is full
+//
+//--------------------------------------------------------------------
+void *ArenaAlloc(struct Arena *Arena, size_t Size)
+{
+    size_t used = (Arena->Used + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+    if (used > Arena->Size || Size > Arena->Size - used) {
+        return NULL;
+    }
+    Arena->Used = used + Size;
+    return Arena->Base + used;
+}
+
+//--------------------------------------------------------------------
+//
+// ArenaCalloc - Size zeroed bytes
+//
+// Returns: the memory, or NULL once the arena is full
+//
+//--------------------------------------------------------------------
+void *ArenaCalloc(struct Arena *Arena, size_t Size)
+{
+    void *memory = ArenaAlloc(Arena, Size);
+
+    if (memory != NULL) {
+        memset(memory, 0, Size);
+    }
+    return memory;
+}
+
+//--------------------------------------------------------------------
+//
+// ArenaStrdup - strdup into Arena
+//
+// Returns: the copy, or NULL once the arena is full
+//
+//--------------------------------------------------------------------
+char *ArenaStrdup(struct Arena *Arena, const char *String)
+{
+    size_t length = strlen(String) + 1;
+    char *copy = (char *)ArenaAlloc(Arena, length);
+
+    if (copy != NULL) {
+        memcpy(copy, String, length);
+    }
+    return copy;
+}
+
+//--------------------------------------------------------------------
+//
+// ResetArena - Make everything allocated from Arena available again
+//
+//--------------------------------------------------------------------
+void ResetArena(struct Arena *Arena)
+{
+    Arena->Used = 0;
+}
+
+//--------------------------------------------------------------------
+//
+// ScratchArena - The calling thread's arena, carved on first use
+//
+//      Whoever starts a unit of work on the thread (a sample, a scanned
+//      process, a dump) resets it; nothing may be kept across one.
+//
+//--------------------------------------------------------------------
+struct Arena *ScratchArena()
+{
+    if (scratch.Base == NULL && InitArena(&scratch, SCRATCH_ARENA_SIZE) != 0) {
+        Log(error, INTERNAL_ERROR);
+        Trace("ScratchArena: failed to map scratch memory.");
+        exit(-1);
+    }
+    return &scratch;
+}
@@ -0,0 +1,406 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Control socket: on-demand dumps and live reconfiguration
+//
+//      One command per connection, one line each; the reply is written
+//      and the connection closed. Everything runs on the monitoring loop,
+//      so commands see and change the same state the triggers use
+//      without any locking.
+//
+//          dump                request a manual dump now
+//          pause / resume      stop / restart evaluating the triggers
+//          set cpu <percent>   change a configured CPU threshold
+//          set memory <MB>     change a configured commit threshold
+//          set blocked <n>     change a configured blocked threads threshold
+//          set seconds <n>     change the time between dumps
+//          status              report the monitoring state
+//
+//      Replies start with "ok" or "error". Only procdump's own user and
+//      root may connect.
+//
+//--------------------------------------------------------------------
+
+#include <sys/socket.h>
+
+#include "ControlServer.h"
+#include "ProcDumpConfiguration.h"
+
+// struct ucred is only declared by sys/socket.h with _GNU_SOURCE
+struct PeerCredentials {
+    pid_t pid;
+    uid_t uid;
+    gid_t gid;
+};
+
+static bool IsTrustedPeer(int fd);
+static void ControlAccept(struct EventSource *Source, uint32_t Events);
+static void ControlRequest(struct EventSource *Source, uint32_t Events);
+static void ManualDumpWork(struct WorkItem *Item);
+static void ManualDumpComplete(struct WorkItem *Item);
+
+//--------------------------------------------------------------------
+//
+// StartControlServer - Accept commands for Config on the Unix domain socket Path
+//
+//      The listener does not hold a reference on the loop.
+//
+// Returns: 0 on success, errno otherwise
+//
+//--------------------------------------------------------------------
+int StartControlServer(struct ControlServer *Server, struct ProcDumpConfiguration *Config, const char *Path)
+{
+    int rc;
+
+    Server->Config = Config;
+    Server->Path = NULL;
+    Server->Writer = NULL;
+    Server->bDumpPending = false;
+    for (int i = 0; i < CONTROL_CLIENTS; i++) {
+        Server->Clients[i].Source.fd = NO_FD;
+        Server->Clients[i].Source.Handler = ControlRequest;
+        Server->Clients[i].Source.Context = &Server->Clients[i];
+        Server->Clients[i].Server = Server;
+    }
+
+    if ((rc = InitListenerSource(&Server->Listener, Path, CONTROL_SOCKET_MODE, CONTROL_CLIENTS, ControlAccept, Server)) != 0) {
+        return rc;
+    }
+
+    if ((rc = AddEventSource(Config->Loop, &Server->Listener, EPOLLIN)) != 0) {
+        close(Server->Listener.fd);
+        Server->Listener.fd = NO_FD;
+        unlink(Path);
+        return rc;
+    }
+
+    Server->Writer = NewCoreDumpWriter(MANUAL, Config);
+    Server->DumpWork.Work = ManualDumpWork;
+    Server->DumpWork.Complete = ManualDumpComplete;
+    Server->DumpWork.Context = Server;
+
+    Server->Path = strdup(Path);
+    return 0;
+}
+
+//--------------------------------------------------------------------
+//
+// StopControlServer - Close the listener and any connection in progress
+//
+//      Call once the dump workers are gone, a manual dump may still be queued until then.
+//
+//--------------------------------------------------------------------
+void StopControlServer(struct ControlServer *Server)
+{
+    if (Server->Path == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < CONTROL_CLIENTS; i++) {
+        RemoveEventSource(Server->Config->Loop, &Server->Clients[i].Source);
+    }
+    RemoveEventSource(Server->Config->Loop, &Server->Listener);
+
+    Server->Writer = NULL;      // in the config's target arena
+
+    unlink(Server->Path);
+    free(Server->Path);
+    Server->Path = NULL;
+}
+
+//--------------------------------------------------------------------
+//
+// IsTrustedPeer - True if the process at the other end runs as our euid or as root
+//
+//--------------------------------------------------------------------
+static bool IsTrustedPeer(int fd)
+{
+    struct PeerCredentials peer;
+    socklen_t length = sizeof(peer);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &length) == -1 || length != sizeof(peer)) {
+        Trace("IsTrustedPeer: SO_PEERCRED failed.");
+        return false;
+    }
+
+    if (peer.uid != geteuid() && peer.uid != 0) {
+        Log(warn, "Refused a control connection from pid %d, uid %d", peer.pid, peer.uid);
+        return false;
+    }
+
+    return true;
+}
+
+//--------------------------------------------------------------------
+//
+// ControlAccept - New connection; wait for its command on the loop
+//
+//--------------------------------------------------------------------
+static void ControlAccept(struct EventSource *Source, uint32_t Events)
+{
+    struct ControlServer *server = (struct ControlServer *)Source->Context;
+    int fd;
+
+    while ((fd = AcceptConnection(Source)) != -1) {
+        struct ControlClient *client = NULL;
+
+        if (!IsTrustedPeer(fd)) {
+            close(fd);
+            continue;
+        }
+
+        for (int i = 0; i < CONTROL_CLIENTS && client == NULL; i++) {
+            if (server->Clients[i].Source.fd == NO_FD) {
+                client = &server->Clients[i];
+            }
+        }
+
+        if (client == NULL) {
+            close(fd); // too many connections at once
+            continue;
+        }
+
+        client->Source.fd = fd;
+        client->RequestLength = 0;
+        if (AddEventSource(server->Config->Loop, &client->Source, EPOLLIN) != 0) {
+            close(fd);
+            client->Source.fd = NO_FD;
+        }
+    }
+}
+
+//--------------------------------------------------------------------
+//
+// SetThreshold - Parse and apply "set <name> <value>"
+//
+//--------------------------------------------------------------------
+static int SetThreshold(struct ControlServer *Server, const char *Name, const char *Value, char *Response, size_t Size)
+{
+    struct ProcDumpConfiguration *config = Server->Config;
+    int value;
+
+    if (Value == NULL || *Value == '\0' || !IsValidNumberArg(Value)) {
+        return snprintf(Response, Size, "error invalid value\n");
+    }
+    value = atoi(Value);
+
+    if (strcmp(Name, "cpu") == 0) {
+        if (config->CpuThreshold == -1) {
+            return snprintf(Response, Size, "error no cpu trigger\n");
+        }
+        if (value > MAXIMUM_CPU) {
+            return snprintf(Response, Size, "error cpu threshold must be between 0 and %d\n", MAXIMUM_CPU);
+        }
+        config->CpuThreshold = value;
+        SetMetricGauge(&config->Metrics, METRIC_TRIGGER_THRESHOLD, CPU, value);
+    } else if (strcmp(Name, "memory") == 0) {
+        if (config->MemoryThreshold == -1) {
+            return snprintf(Response, Size, "error no memory trigger\n");
+        }
+        config->MemoryThreshold = value;
+        SetMetricGauge(&config->Metrics, METRIC_TRIGGER_THRESHOLD, COMMIT, value);
+    } else if (strcmp(Name, "blocked") == 0) {
+        if (config->BlockedThreshold == -1) {
+            return snprintf(Response, Size, "error no blocked trigger\n");
+        }
+        if (value > BLOCKED_MAX_THREADS) {
+            return snprintf(Response, Size, "error blocked threshold must be between 0 and %d\n", BLOCKED_MAX_THREADS);
+        }
+        config->BlockedThreshold = value;
+        SetMetricGauge(&config->Metrics, METRIC_TRIGGER_THRESHOLD, BLOCKED, value);
+    } else if (strcmp(Name, "seconds") == 0) {
+        if (value == 0) {
+            return snprintf(Response, Size, "error seconds must be at least 1\n");
+        }
+        config->ThresholdSeconds = value; // takes effect from the next dump's snooze
+    } else {
+        return snprintf(Response, Size, "error unknown setting %s\n", Name);
+    }
+
+    Log(info, "Control: %s set to %d", Name, value);
+    return snprintf(Response, Size, "ok %s %d\n", Name, value);
+}
+
+//--------------------------------------------------------------------
+//
+// FormatStatus - Monitoring state as "key: value" lines
+//
+// Returns: bytes written to Response (output is cut short if it does not fit)
+//
+//--------------------------------------------------------------------
+static int FormatStatus(struct ControlServer *Server, char *Response, size_t Size)
+{
+    struct ProcDumpConfiguration *config = Server->Config;
+    size_t len = 0;
+    int n;
+
+#define APPEND(...) \
+    do { \
+        n = snprintf(Response + len, Size - len, __VA_ARGS__); \
+        if (n < 0 || (size_t)n >= Size - len) { return (int)len; } \
+        len += n; \
+    } while (0)
+
+    // the name is the target's argv[0] or -w, either may be longer than the whole reply
+    APPEND("ok\npid: %d\nname: %.*s\ndumps: %d of %d\nseconds: %d\nmanual dump: %s\n",
+           config->ProcessId, CONTROL_NAME_WIDTH, config->ProcessName,
+           config->NumberOfDumpsCollected, config->NumberOfDumpsToCollect,
+           config->ThresholdSeconds,
+           Server->bDumpPending ? "pending" : "idle");
+    if (config->ArmedAt != 0) {
+        APPEND("armed: %.2f ms\n", (config->ArmedAt - config->StartedAt) / 1e6);
+    } else {
+        APPEND("armed: pending\n");
+    }
+
+    for (int i = 0; i < config->nTriggers; i++) {
+        struct Trigger *trigger = config->Triggers[i];
+        const char *state = !trigger->bActive ? "stopped" : trigger->bPaused ? "paused" : "active";
+
+        switch (trigger->Writer->Type) {
+            case CPU:
+                APPEND("trigger cpu: %s, %s %d%%\n", state,
+                       config->bCpuTriggerBelowValue ? "below" : "at or above", config->CpuThreshold);
+                break;
+            case COMMIT:
+                APPEND("trigger memory: %s, %s %d MB\n", state,
+                       config->bMemoryTriggerBelowValue ? "below" : "at or above", config->MemoryThreshold);
+                break;
+            case BLOCKED:
+                APPEND("trigger blocked: %s, above %d threads for %d s%s\n", state,
+                       config->BlockedThreshold, config->BlockedSeconds, config->bBlockedOnWchan ? ", by wait channel" : "");
+                break;
+            default:
+                APPEND("trigger %s: %s\n", CoreDumpTypeStrings[trigger->Writer->Type], state);
+                break;
+        }
+    }
+
+#undef APPEND
+
+    return (int)len;
+}
+
+//--------------------------------------------------------------------
+//
+// RunCommand - Execute one command line and format its reply
+//
+// Returns: length of the reply
+//
+//--------------------------------------------------------------------
+static int RunCommand(struct ControlServer *Server, char *Command, char *Response, size_t Size)
+{
+    struct ProcDumpConfiguration *config = Server->Config;
+    char *savePtr = NULL;
+    char *verb = strtok_r(Command, " \t\r\n", &savePtr);
+    char *arg1 = strtok_r(NULL, " \t\r\n", &savePtr);
+    char *arg2 = strtok_r(NULL, " \t\r\n", &savePtr);
+    bool bPause;
+
+    if (verb == NULL) {
+        return snprintf(Response, Size, "error empty command\n");
+    }
+
+    if (strcmp(verb, "status") == 0) {
+        return FormatStatus(Server, Response, Size);
+    }
+
+    if (strcmp(verb, "set") == 0 && arg1 != NULL) {
+        return SetThreshold(Server, arg1, arg2, Response, Size);
+    }
+
+    if (strcmp(verb, "dump") == 0) {
+        if (WaitForQuit(config, 0) != WAIT_TIMEOUT) {
+            return snprintf(Response, Size, "error monitoring has stopped\n");
+        }
+        if (Server->bDumpPending) {
+            return snprintf(Response, Size, "error a manual dump is already pending\n");
+        }
+
+        Log(info, "Manual:");
+        Server->bDumpPending = true;
+        Server->Writer->TriggeredAt = MetricClock();
+        CountMetric(METRIC_TRIGGERS_FIRED, MANUAL, 1);
+        QueueWorkItem(config->DumpWorkers, &Server->DumpWork);
+        return snprintf(Response, Size, "ok dump queued\n");
+    }
+
+    if ((bPause = strcmp(verb, "pause") == 0) || strcmp(verb, "resume") == 0) {
+        for (int i = 0; i < config->nTriggers; i++) {
+            config->Triggers[i]->bPaused = bPause;
+        }
+        Log(info, "Control: triggers %s", bPause ? "paused" : "resumed");
+        return snprintf(Response, Size, "ok %s\n", bPause ? "paused" : "resumed");
+    }
+
+    return snprintf(Response, Size, "error unknown command %s\n", verb);
+}
+
+//--------------------------------------------------------------------
+//
+// ControlRequest - Run the command once its line has arrived
+//
+//--------------------------------------------------------------------
+static void ControlRequest(struct EventSource *Source, uint32_t Events)
+{
+    struct ControlClient *client = (struct ControlClient *)Source->Context;
+    char response[CONTROL_RESPONSE_SIZE];
+    int length;
+    ssize_t n;
+
+    n = read(Source->fd, client->Request + client->RequestLength, sizeof(client->Request) - 1 - client->RequestLength);
+    if (n == -1) {
+        if (errno != EAGAIN && errno != EINTR) {
+            RemoveEventSource(client->Server->Config->Loop, Source);
+        }
+        return;
+    }
+
+    client->RequestLength += n;
+    client->Request[client->RequestLength] = '\0';
+
+    // wait for the whole line unless the peer is done sending
+    if (n > 0 && strchr(client->Request, '\n') == NULL && client->RequestLength < sizeof(client->Request) - 1) {
+        return;
+    }
+
+    length = RunCommand(client->Server, client->Request, response, sizeof(response));
+    if (length >= (int)sizeof(response)) {
+        length = sizeof(response) - 1;
+    }
+    send(Source->fd, response, length, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+    RemoveEventSource(client->Server->Config->Loop, Source);
+}
+
+//--------------------------------------------------------------------
+//
+// ManualDumpWork - Runs on a dump worker
+//
+//--------------------------------------------------------------------
+static void ManualDumpWork(struct WorkItem *Item)
+{
+    struct ControlServer *server = (struct ControlServer *)Item->Context;
+    uint64_t start = MetricClock();
+
+    Item->Result = WriteCoreDump(server->Writer);
+    ObserveMetric(METRIC_DUMP_DURATION, MANUAL, MetricClock() - start);
+}
+
+//--------------------------------------------------------------------
+//
+// ManualDumpComplete - Back on the loop; a manual dump counts toward -n
+//
+//--------------------------------------------------------------------
+static void ManualDumpComplete(struct WorkItem *Item)
+{
+    struct ControlServer *server = (struct ControlServer *)Item->Context;
+
+    server->bDumpPending = false;
+
+    if (WaitForQuit(server->Config, 0) != WAIT_TIMEOUT) {
+        StopMonitoring(server->Config);
+    }
+}
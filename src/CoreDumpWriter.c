@@ -10,23 +10,28 @@
 
 #include "CoreDumpWriter.h"
 
-char *sanitize(char *processName);
+char *sanitize(struct Arena *arena, char *processName);
 
-static const char *CoreDumpTypeStrings[] = { "commit", "cpu", "time", "manual" };
+const char *CoreDumpTypeStrings[] = { "commit", "cpu", "time", "blocked", "manual" };
 
 int WriteCoreDumpInternal(struct CoreDumpWriter *self);
-FILE *popen2(const char *command, const char *type, pid_t *pid);
+int popen2(const char *command, const char *type, pid_t *pid);
+static char *ReadLine(int fd, char *buffer, size_t size);
+static void RunGcore(struct CoreDumpWriter *self, const char *command, const char *coreDumpFileName, struct DumpReport *report, struct Arena *scratch, int budgetSlot);
+static void RunMiniDump(struct CoreDumpWriter *self, const char *coreDumpFileName, struct DumpReport *report);
 
 //--------------------------------------------------------------------
 //
 // NewCoreDumpWriter - Helper function for newing a struct CoreDumpWriter
 //
+//      Allocated from config's target arena, it lives as long as config.
+//
 // Returns: struct CoreDumpWriter *
 //
 //--------------------------------------------------------------------
 struct CoreDumpWriter *NewCoreDumpWriter(enum ECoreDumpType type, struct ProcDumpConfiguration *config)
 {
-    struct CoreDumpWriter *writer = (struct CoreDumpWriter *)malloc(sizeof(struct CoreDumpWriter));
+    struct CoreDumpWriter *writer = (struct CoreDumpWriter *)ArenaAlloc(&config->TargetArena, sizeof(struct CoreDumpWriter));
     if (writer == NULL) {
         Log(error, INTERNAL_ERROR);
         Trace("NewCoreDumpWriter: failed to allocate memory.");
@@ -35,6 +40,7 @@ struct CoreDumpWriter *NewCoreDumpWriter(enum ECoreDumpType type, struct ProcDum
 
     writer->Config = config;
     writer->Type = type;
+    writer->TriggeredAt = 0;
 
     return writer;
 }
@@ -72,9 +78,9 @@ int WriteCoreDump(struct CoreDumpWriter *self)
         case WAIT_OBJECT_0+1: // We got a dump slot!
             if ((rc = WriteCoreDumpInternal(self)) == 0) {
                 // We're done here, unlock (increment) the sem
-                if(sem_post(&self->Config->semAvailableDumpSlots.semaphore) == -1){
+                if(!ReleaseSemaphore(&self->Config->semAvailableDumpSlots.semaphore)){
                     Log(error, INTERNAL_ERROR);
-                    Trace("WriteCoreDump: failed sem_post.");
+                    Trace("WriteCoreDump: failed ReleaseSemaphore.");
                     exit(-1);
                 }
             }
@@ -103,30 +109,48 @@ int WriteCoreDumpInternal(struct CoreDumpWriter *self)
 {
     char date[DATE_LENGTH];
     char command[BUFFER_LENGTH];
-    char ** outputBuffer;
-    char lineBuffer[BUFFER_LENGTH];
+    struct Arena *scratch = ScratchArena();
     char coreDumpFileName[BUFFER_LENGTH];
-    int  lineLength;
-    int  i;
+    char sampleFileName[BUFFER_LENGTH + sizeof(FLIGHT_RECORDER_EXTENSION)];
+    char reportFileName[BUFFER_LENGTH + sizeof(DUMP_REPORT_EXTENSION)];
     int  rc = 0;
     time_t rawTime;
-
-    pid_t gcorePid;
+    struct stat coreStat;
+    struct DumpReport report = {0};
+    struct ProcessStat proc = {0};
+    struct rusage usage;
     struct tm* timerInfo = NULL;
-    FILE *commandPipe = NULL;
 
     const char *desc = CoreDumpTypeStrings[self->Type];
-    char *name = sanitize(self->Config->ProcessName);
+    char *name;
     pid_t pid = self->Config->ProcessId;
-
-    // allocate output buffer
-    outputBuffer = (char**)malloc(sizeof(char*) * MAX_LINES);
-    if(outputBuffer == NULL){
-        Log(error, INTERNAL_ERROR);
-        Trace("WriteCoreDumpInternal: failed gcore output buffer allocation");
-        exit(-1);
+    const char *directory = self->Config->OutputDirectory ? self->Config->OutputDirectory : "";
+    struct DumpBudget *budget = self->Config->Budget;
+    uint64_t coreBytes = 0;
+    int budgetSlot;
+    int priority = self->Config->DumpPriority != -1 ? self->Config->DumpPriority : budget->Priority;
+
+    // everything this dump needs is taken from the worker's locked scratch arena
+    ResetArena(scratch);
+    name = sanitize(scratch, self->Config->ProcessName);
+
+    // wait for the node's dump budget; time queued counts as trigger latency
+    switch(AcquireDumpSlot(budget, priority, &self->Config->nQuit, &budgetSlot)){
+        case DUMP_DROPPED:
+            CountMetric(METRIC_DUMPS_DROPPED, self->Type, 1);
+            return 0;
+        case DUMP_CANCELLED:
+            return 0;
+        case DUMP_ADMITTED:
+            break;
     }
 
+    report.StartedAt = MetricClock();
+    report.TriggeredAt = self->TriggeredAt;
+    report.Pid = pid;
+    report.Trigger = desc;
+    report.CoreFile = coreDumpFileName;
+
     // get time for current dump generated
     rawTime = time(NULL);
     if((timerInfo = localtime(&rawTime)) == NULL){
@@ -137,51 +161,201 @@ int WriteCoreDumpInternal(struct CoreDumpWriter *self)
     strftime(date, 26, "%Y-%m-%d_%H:%M:%S", timerInfo);
 
     // assemble the command
-    if(sprintf(command, "gcore -o %s_%s_%s %d 2>&1", name, desc, date, pid) < 0){
+    if(sprintf(command, "gcore -o '%s%s%s_%s_%s' %d 2>&1", directory, *directory ? "/" : "", name, desc, date, pid) < 0){
         Log(error, INTERNAL_ERROR);
         Trace("WriteCoreDumpInternal: failed sprintf gcore command");
         exit(-1);
     }
 
     // assemble filename
-    if(sprintf(coreDumpFileName, "%s_%s_%s.%d", name, desc, date, pid) < 0){
+    if(sprintf(coreDumpFileName, "%s%s%s_%s_%s.%d", directory, *directory ? "/" : "", name, desc, date, pid) < 0){
         Log(error, INTERNAL_ERROR);
         Trace("WriteCoreDumpInternal: failed sprintf core file name");
         exit(-1);
     }
 
+    // keep the samples leading up to the trigger next to the dump
+    sprintf(sampleFileName, "%s%s", coreDumpFileName, FLIGHT_RECORDER_EXTENSION);
+    if(SnapshotFlightRecorder(&self->Config->Recorder, sampleFileName, FLIGHT_SNAPSHOT_SECONDS, scratch) != 0){
+        Log(warn, "Unable to save sample history %s", sampleFileName);
+    }
+
+    // shape of the target going in, before gdb stops it
+    report.Regions = GetProcessMapCount(pid);
+    if(GetProcessStat(pid, &proc)){
+        report.Threads = proc.num_threads;
+    }
+
+    if(self->Config->bMiniDump){
+        RunMiniDump(self, coreDumpFileName, &report);
+    } else {
+        RunGcore(self, command, coreDumpFileName, &report, scratch, budgetSlot);
+    }
+
+    self->Config->NumberOfDumpsCollected++; // safe to increment in crit section
+    if (self->Config->NumberOfDumpsCollected >= self->Config->NumberOfDumpsToCollect) {
+        SetEvent(&self->Config->evtQuit.event); // shut it down, we're done here
+        rc = 1;
+    }
+
+    // validate that core dump file was generated
+    if(access(coreDumpFileName, F_OK) != -1) {
+        if(self->Config->nQuit){
+            // if we are in a quit state from interrupt delete partially generated core dump file
+            int ret = unlink(coreDumpFileName);
+            if (ret < 0 && errno != ENOENT) {
+                Trace("WriteCoreDumpInternal: Failed to remove partial core dump");
+                exit(-1);
+            }
+        }
+        else{
+            // log out sucessful core dump generated
+            Log(info, "Core dump %d generated: %s", self->Config->NumberOfDumpsCollected, coreDumpFileName);
+            CountMetric(METRIC_DUMPS, self->Type, 1);
+            if(stat(coreDumpFileName, &coreStat) == 0){
+                CountMetric(METRIC_DUMP_BYTES, self->Type, coreStat.st_size);
+                report.CoreBytes = coreStat.st_size;
+                coreBytes = coreStat.st_size;
+                if(self->Config->Quota != NULL){
+                    __atomic_add_fetch(&self->Config->Quota->UsedBytes, coreStat.st_size, __ATOMIC_RELAXED);
+                }
+                report.DiskBytes = (uint64_t)coreStat.st_blocks * 512;
+            }
+
+            if(getrusage(RUSAGE_SELF, &usage) == 0){
+                report.PeakRssKb = usage.ru_maxrss;
+            }
+            report.EndedAt = MetricClock();
+
+            sprintf(reportFileName, "%s%s", coreDumpFileName, DUMP_REPORT_EXTENSION);
+            if(WriteDumpReport(&report, reportFileName) != 0){
+                Log(warn, "Unable to save dump report %s", reportFileName);
+            }
+            LogDumpReport(&report);
+            if(report.GcoreStartedAt != 0 && report.GcoreEndedAt > report.GcoreStartedAt){
+                ObserveMetric(METRIC_TARGET_STOPPED, self->Type, report.GcoreEndedAt - report.GcoreStartedAt);
+            }
+        }
+    }
+    else if(!self->Config->nQuit){
+        CountMetric(METRIC_DUMP_FAILURES, self->Type, 1);
+    }
+
+    if(self->Config->nQuit){
+        unlink(sampleFileName);     // history of a dump that was never written
+    }
+
+    ReleaseDumpSlot(budget, budgetSlot, coreBytes);
+
+    return rc;
+}
+
+//--------------------------------------------------------------------
+//
+// RunGcore - Write the full core with gcore, holding it to the node's
+//            dump budget; the target is stopped for as long as gdb is
+//            attached
+//
+//--------------------------------------------------------------------
+static void RunGcore(struct CoreDumpWriter *self, const char *command, const char *coreDumpFileName, struct DumpReport *report, struct Arena *scratch, int budgetSlot)
+{
+    char ** outputBuffer;
+    char lineBuffer[BUFFER_LENGTH];
+    int  i;
+    struct stat coreStat;
+    struct ProcessIo gcoreIo;
+    struct rusage usage;
+    siginfo_t gcoreExit;
+    pid_t gcorePid;
+    int commandPipe;
+    pid_t pid = self->Config->ProcessId;
+    unsigned int savedFilter;
+    bool bFilterSet = false;
+    bool bFailed = false;
+    struct DumpBudget *budget = self->Config->Budget;
+    struct DumpThrottle throttle = {0};
+    struct pollfd gcoreOutput;
+
+    // allocate output buffer
+    outputBuffer = (char**)ArenaAlloc(scratch, sizeof(char*) * MAX_LINES);
+    if(outputBuffer == NULL){
+        Log(error, INTERNAL_ERROR);
+        Trace("RunGcore: failed gcore output buffer allocation");
+        exit(-1);
+    }
+
+    // narrow what gdb includes for this dump only
+    if(self->Config->CoredumpFilter != -1 && GetCoredumpFilter(pid, &savedFilter)){
+        bFilterSet = SetCoredumpFilter(pid, self->Config->CoredumpFilter);
+    }
+
     // generate core dump for given process
+    report->GcoreStartedAt = MetricClock();
     commandPipe = popen2(command, "r", &gcorePid);
     self->Config->gcorePid = gcorePid;
     
-    if(commandPipe == NULL){
+    if(commandPipe == -1){
         Log(error, "An error occured while generating the core dump");      
         Trace("WriteCoreDumpInternal: Failed to open pipe to gcore");
         exit(1);
     }
+
+    throttle.StartedAt = report->GcoreStartedAt;
+    gcoreOutput.fd = commandPipe;
+    gcoreOutput.events = POLLIN;
     
-    // read all output from gcore command
-    for(i = 0; i < MAX_LINES && fgets(lineBuffer, sizeof(lineBuffer), commandPipe) != NULL; i++) {
-        lineLength = strlen(lineBuffer);                                // get # of characters read
-
-        outputBuffer[i] = (char*)malloc(sizeof(char) * lineLength);
-        if(outputBuffer[i] != NULL) {
-            strncpy(outputBuffer[i], lineBuffer, lineLength - 1);           // trim newline off
-            outputBuffer[i][lineLength-1] = '\0';                           // append null character
+    // read all output from gcore command; gdb's [New LWP] lines can run past
+    // MAX_LINES, so keep draining (and throttling) until EOF but only keep the first
+    i = 0;
+    for(;;) {
+        // while gcore is quiet, hold it to this dump's share of the node's I/O budget
+        while(IsDumpThrottled(budget) && poll(&gcoreOutput, 1, DUMP_BUDGET_POLL) == 0){
+            if(stat(coreDumpFileName, &coreStat) == 0){
+                ThrottleDump(budget, &throttle, gcorePid, (uint64_t)coreStat.st_blocks * 512);
+            }
+        }
+        if(ReadLine(commandPipe, lineBuffer, sizeof(lineBuffer)) == NULL){
+            break;
+        }
+
+        bFailed = strstr(lineBuffer, "gcore: failed") != NULL;     // gcore reports last
+        if(i == MAX_LINES && !bFailed){
+            continue;
+        }
+        if(i == MAX_LINES){
+            i--;                // the failure replaces the last kept line
         }
-        else {
+        if((outputBuffer[i++] = ArenaStrdup(scratch, lineBuffer)) == NULL) {
             Log(error, INTERNAL_ERROR);
             Trace("WriteCoreDumpInternal: failed to allocate gcore error message buffer");
             exit(-1);
         }
     }
     
+    if(throttle.bStopped){
+        kill(-gcorePid, SIGCONT);
+    }
+
     // close pipe reading from gcore
     self->Config->gcorePid = NO_PID;                // reset gcore pid so that signal handler knows we aren't dumping
-    pclose(commandPipe);
+    close(commandPipe);
+
+    // reap gcore; its I/O counters (which include gdb's) are only readable until then
+    if(waitid(P_PID, gcorePid, &gcoreExit, WEXITED | WNOWAIT) == 0 && GetProcessIo(gcorePid, &gcoreIo)){
+        report->BytesRead = gcoreIo.rchar;
+        report->BytesWritten = gcoreIo.wchar;
+    }
+    if(wait4(gcorePid, NULL, 0, &usage) == gcorePid){
+        report->GcorePeakRssKb = usage.ru_maxrss;
+    }
+    report->GcoreEndedAt = MetricClock();
+
+    if(bFilterSet){
+        SetCoredumpFilter(pid, savedFilter);
+    }
 
     // check if gcore was able to generate the dump
-    if(strstr(outputBuffer[i-1], "gcore: failed") != NULL){
+    if(bFailed){
         Log(error, "An error occured while generating the core dump");
                 
         // log gcore message
@@ -191,39 +365,36 @@ int WriteCoreDumpInternal(struct CoreDumpWriter *self)
             }
         }
 
+        ReleaseDumpSlot(budget, budgetSlot, 0);
         exit(1);
     }
+}
 
-    for(int j = 0; j < i; j++) {
-        free(outputBuffer[j]);
-    }
-    free(outputBuffer);
+//--------------------------------------------------------------------
+//
+// RunMiniDump - Write a stack only core (-S) without gcore; the target
+//               is stopped for milliseconds
+//
+//--------------------------------------------------------------------
+static void RunMiniDump(struct CoreDumpWriter *self, const char *coreDumpFileName, struct DumpReport *report)
+{
+    struct MiniDumpResult result;
+    int rc;
 
-    self->Config->NumberOfDumpsCollected++; // safe to increment in crit section
-    if (self->Config->NumberOfDumpsCollected >= self->Config->NumberOfDumpsToCollect) {
-        SetEvent(&self->Config->evtQuit.event); // shut it down, we're done here
-        rc = 1;
+    if((rc = WriteMiniDump(self->Config->ProcessId, coreDumpFileName, &result)) != 0){
+        Log(error, "An error occured while generating the mini dump: %s", strerror(rc));
+        return;
     }
 
-    // validate that core dump file was generated
-    if(access(coreDumpFileName, F_OK) != -1) {
-        if(self->Config->nQuit){
-            // if we are in a quit state from interrupt delete partially generated core dump file
-            int ret = unlink(coreDumpFileName);
-            if (ret < 0 && errno != ENOENT) {
-                Trace("WriteCoreDumpInternal: Failed to remove partial core dump");
-                exit(-1);
-            }
-        }
-        else{
-            // log out sucessful core dump generated
-            Log(info, "Core dump %d generated: %s", self->Config->NumberOfDumpsCollected, coreDumpFileName);
-        }
+    // the threads were stopped from the first interrupt to the last detach, as they are while gdb is attached
+    report->GcoreStartedAt = result.StoppedAt;
+    report->GcoreEndedAt = result.ResumedAt;
+    report->BytesRead = result.BytesRead;
+    report->BytesWritten = result.BytesWritten;
+    report->Threads = result.Threads;
+    if(result.Asleep > 0){
+        Log(info, "%d of %d threads did not stop, they are dumped asleep in the kernel", result.Asleep, result.Threads);
     }
-
-    free(name);
-
-    return rc;
 }
 
 //--------------------------------------------------------------------
@@ -234,10 +405,11 @@ int WriteCoreDumpInternal(struct CoreDumpWriter *self)
 //             type (const char *) - either "r" for read or "w" for write
 //             pid (pidt_t *) - out variable containing the pid of the spawned process
 //
-// Returns: FILE* pointing to the r or w of the pip between this thread and the spawned
+// Returns: the file descriptor of the r or w end of the pipe between this thread and the spawned
+//          process; no FILE, so nothing is allocated while the host may be short of memory
 //
 //--------------------------------------------------------------------
-FILE *popen2(const char *command, const char *type, pid_t *pid)
+int popen2(const char *command, const char *type, pid_t *pid)
 {
     // per man page: "...opens a process by creating a pipe, forking, and invoking the shell..."
     int pipefd[2]; // 0 -> read, 1 -> write
@@ -259,6 +431,8 @@ FILE *popen2(const char *command, const char *type, pid_t *pid)
     if (childPid == 0) {
         // Child
         setpgid(0,0); // give the child and descendants their own pgid so we can terminate gcore separately
+        SetOomScoreAdj(getpid(), 0); // gdb can grow large; it must not share procdump's protection from the OOM killer
+        LeaveThreadRole(THREAD_ROLE_WRITER); // an idle or niced gdb would keep the target stopped for longer
 
         if (type[0] == 'r') {
             close(pipefd[0]);
@@ -269,7 +443,7 @@ FILE *popen2(const char *command, const char *type, pid_t *pid)
         }
 
         execl("/bin/bash", "bash", "-c", command, (char *)NULL); // won't return
-        return NULL; // will never be hit; just for static analyzers
+        return -1; // will never be hit; just for static analyzers
     } else {
         // parent
         setpgid(childPid, childPid); // give the child and descendants their own pgid so we can terminate gcore separately
@@ -277,15 +451,47 @@ FILE *popen2(const char *command, const char *type, pid_t *pid)
 
         if (type[0] == 'r') {
             close(pipefd[1]);
-            return fdopen(pipefd[0], "r");
+            return pipefd[0];
         } else {
             close(pipefd[0]);
-            return fdopen(pipefd[1], "w");
+            return pipefd[1];
         }
 
     }
 }
 
+//--------------------------------------------------------------------
+//
+// ReadLine - fgets for a pipe file descriptor, without the newline
+//
+// Returns: buffer, or NULL at end of file with nothing read
+//
+//--------------------------------------------------------------------
+static char *ReadLine(int fd, char *buffer, size_t size)
+{
+    size_t length = 0;
+    ssize_t n;
+    char c;
+
+    // gcore prints a handful of short lines, a byte at a time is fine
+    while(length < size - 1 && (n = read(fd, &c, 1)) != 0){
+        if(n == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            break;
+        }
+        if(c == '\n'){
+            buffer[length] = '\0';
+            return buffer;
+        }
+        buffer[length++] = c;
+    }
+
+    buffer[length] = '\0';
+    return length > 0 ? buffer : NULL;
+}
+
 //--------------------------------------------------------------------
 //
 // sanitize - Helper function for removing all non-alphanumeric characters from process name
@@ -294,14 +500,19 @@ FILE *popen2(const char *command, const char *type, pid_t *pid)
 //
 //--------------------------------------------------------------------
 // remove all non alphanumeric characters from process name and replace with '_'
-char *sanitize(char * processName)
+char *sanitize(struct Arena *arena, char * processName)
 {
     if(processName == NULL){
         Log(error, "NULL process name.\n");
         exit(-1);
     }
 
-    char *sanitizedProcessName = strdup(processName);
+    char *sanitizedProcessName = ArenaStrdup(arena, processName);
+    if(sanitizedProcessName == NULL){
+        Log(error, INTERNAL_ERROR);
+        Trace("sanitize: scratch arena exhausted.");
+        exit(-1);
+    }
     for (int i = 0; i < strlen(sanitizedProcessName); i++)
     {
         if (!isalnum(sanitizedProcessName[i]))
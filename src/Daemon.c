@@ -0,0 +1,718 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Daemon mode: many targets described by a configuration file
+//
+//      One scan of /proc every DAEMON_SCAN_INTERVAL matches processes
+//      against the rules; every match gets its own configuration and
+//      triggers on the shared monitoring loop and dump workers.
+//      SIGHUP reloads the file: rules that did not change keep their
+//      processes, trigger state and quota usage.
+//
+//      [web]                   # a rule, named for the logs
+//      name = nginx            # selectors: pid, name, uid, cgroup
+//      uid = 33
+//      cpu = 80                # -C, or cpu_below for -c
+//      memory = 2048           # -M, or memory_below for -m
+//      blocked = 8:30:wchan    # -B
+//      seconds = 30            # -s
+//      dumps = 2               # -n, per process
+//      directory = /var/crash  # where dumps go
+//      filter = 0x33           # coredump_filter while dumping
+//      quota_mb = 4096         # bytes of dumps all of the rule's processes may write
+//      priority = 7            # in the node's dump budget (-b)
+//
+//--------------------------------------------------------------------
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "Procdump.h"
+#include "Daemon.h"
+
+static struct Daemon daemonState;
+
+static void ScanTick(struct WheelTimer *Timer);
+
+//--------------------------------------------------------------------
+//
+// NewTargetRule - Helper function for newing a rule with the command line defaults
+//
+// Returns: struct TargetRule *
+//
+//--------------------------------------------------------------------
+static struct TargetRule *NewTargetRule(const char *Name)
+{
+    struct TargetRule *rule = (struct TargetRule *)calloc(1, sizeof(struct TargetRule));
+    if (rule == NULL) {
+        Log(error, INTERNAL_ERROR);
+        Trace("NewTargetRule: failed to allocate memory.");
+        exit(-1);
+    }
+
+    snprintf(rule->Name, sizeof(rule->Name), "%s", Name);
+    rule->Pid = NO_PID;
+    rule->CpuThreshold = -1;
+    rule->MemoryThreshold = -1;
+    rule->BlockedThreshold = -1;
+    rule->BlockedSeconds = BLOCKED_DEFAULT_SECONDS;
+    rule->ThresholdSeconds = DEFAULT_DELTA_TIME;
+    rule->NumberOfDumpsToCollect = DEFAULT_NUMBER_OF_DUMPS;
+    rule->CoredumpFilter = -1;
+    rule->DumpPriority = -1;
+
+    return rule;
+}
+
+//--------------------------------------------------------------------
+//
+// FreeTargetRules - Free a list of rules
+//
+//--------------------------------------------------------------------
+void FreeTargetRules(struct TargetRule *Rules)
+{
+    while (Rules != NULL) {
+        struct TargetRule *next = Rules->Next;
+
+        free(Rules->ProcessName);
+        free(Rules->Cgroup);
+        free(Rules->OutputDirectory);
+        free(Rules);
+        Rules = next;
+    }
+}
+
+//--------------------------------------------------------------------
+//
+// SetRuleOption - Apply one "key = value" line to Rule
+//
+// Returns: NULL on success, otherwise what is wrong with the line
+//
+//--------------------------------------------------------------------
+static const char *SetRuleOption(struct TargetRule *Rule, const char *Key, const char *Value)
+{
+    char *end;
+
+    if (strcmp(Key, "name") == 0) {
+        free(Rule->ProcessName);
+        Rule->ProcessName = strdup(Value);
+        return NULL;
+    }
+
+    if (strcmp(Key, "cgroup") == 0) {
+        if (Value[0] != '/') {
+            return "cgroup must be an absolute path";
+        }
+        free(Rule->Cgroup);
+        Rule->Cgroup = strdup(Value);
+        for (size_t length = strlen(Rule->Cgroup); length > 1 && Rule->Cgroup[length - 1] == '/'; length--) {
+            Rule->Cgroup[length - 1] = '\0';
+        }
+        return NULL;
+    }
+
+    if (strcmp(Key, "directory") == 0) {
+        if (strlen(Value) >= DAEMON_MAX_DIRECTORY || strchr(Value, '\'') != NULL) {
+            return "invalid directory";
+        }
+        free(Rule->OutputDirectory);
+        Rule->OutputDirectory = strdup(Value);
+        return NULL;
+    }
+
+    if (strcmp(Key, "blocked") == 0) {
+        if (Rule->BlockedThreshold != -1 ||
+            ParseBlockedSpec(Value, &Rule->BlockedThreshold, &Rule->BlockedSeconds, &Rule->bBlockedOnWchan) != 0) {
+            return "blocked must be threads[:seconds][:wchan]";
+        }
+        return NULL;
+    }
+
+    if (strcmp(Key, "filter") == 0) {
+        unsigned long filter = strtoul(Value, &end, 0);
+        if (*end != '\0' || end == Value || filter > 0x1ff) {
+            return "filter must be a coredump_filter mask such as 0x33";
+        }
+        Rule->CoredumpFilter = (int)filter;
+        return NULL;
+    }
+
+    // the rest are numbers
+    if (!IsValidNumberArg(Value) || *Value == '\0') {
+        return "value must be a number";
+    }
+
+    if (strcmp(Key, "pid") == 0) {
+        Rule->Pid = (pid_t)atoi(Value);
+    } else if (strcmp(Key, "uid") == 0) {
+        Rule->Uid = (uid_t)strtoul(Value, NULL, 10);
+        Rule->bUid = true;
+    } else if (strcmp(Key, "cpu") == 0 || strcmp(Key, "cpu_below") == 0) {
+        if (Rule->CpuThreshold != -1 || (Rule->CpuThreshold = atoi(Value)) > MAXIMUM_CPU) {
+            return "invalid CPU threshold";
+        }
+        Rule->bCpuTriggerBelowValue = strcmp(Key, "cpu_below") == 0;
+    } else if (strcmp(Key, "memory") == 0 || strcmp(Key, "memory_below") == 0) {
+        if (Rule->MemoryThreshold != -1) {
+            return "invalid memory threshold";
+        }
+        Rule->MemoryThreshold = atoi(Value);
+        Rule->bMemoryTriggerBelowValue = strcmp(Key, "memory_below") == 0;
+    } else if (strcmp(Key, "seconds") == 0) {
+        if ((Rule->ThresholdSeconds = atoi(Value)) == 0) {
+            return "invalid time threshold";
+        }
+    } else if (strcmp(Key, "dumps") == 0) {
+        Rule->NumberOfDumpsToCollect = atoi(Value);
+    } else if (strcmp(Key, "priority") == 0) {
+        if ((Rule->DumpPriority = atoi(Value)) > 9) {
+            return "priority must be between 0 and 9";
+        }
+    } else if (strcmp(Key, "mini") == 0) {
+        Rule->bMiniDump = atoi(Value) != 0;
+    } else if (strcmp(Key, "quota_mb") == 0) {
+        Rule->Quota.LimitBytes = strtoull(Value, NULL, 10) << 20;
+    } else {
+        return "unknown setting";
+    }
+
+    return NULL;
+}
+
+//--------------------------------------------------------------------
+//
+// Trim - Strip leading and trailing white space in place
+//
+//--------------------------------------------------------------------
+static char *Trim(char *Text)
+{
+    char *end;
+
+    while (isspace((unsigned char)*Text)) {
+        Text++;
+    }
+    end = Text + strlen(Text);
+    while (end > Text && isspace((unsigned char)end[-1])) {
+        *--end = '\0';
+    }
+
+    return Text;
+}
+
+//--------------------------------------------------------------------
+//
+// LoadTargetRules - Parse the configuration file at Path
+//
+//      Errors are logged with their line number; nothing is returned
+//      for a file with any error, so a bad reload keeps the old rules.
+//      The rules' output directories are created once the file is valid.
+//
+// Returns: 0 on success, -1 otherwise
+//
+//--------------------------------------------------------------------
+int LoadTargetRules(const char *Path, struct TargetRule **Rules)
+{
+    char lineBuffer[1024];
+    struct TargetRule *head = NULL;
+    struct TargetRule **tail = &head;
+    struct TargetRule *rule = NULL;
+    const char *problem = NULL;
+    int lineNumber = 0;
+    FILE *file;
+
+    if ((file = fopen(Path, "r")) == NULL) {
+        Log(error, "Unable to open configuration %s: %s", Path, strerror(errno));
+        return -1;
+    }
+
+    while (problem == NULL && fgets(lineBuffer, sizeof(lineBuffer), file) != NULL) {
+        char *line;
+        char *value;
+
+        lineNumber++;
+        lineBuffer[strcspn(lineBuffer, "#\n")] = '\0';
+        line = Trim(lineBuffer);
+
+        if (*line == '\0') {
+            continue;
+        }
+
+        if (*line == '[') {
+            char *close = strchr(line, ']');
+            if (close == NULL || close[1] != '\0' || close == line + 1 || close - line - 1 >= DAEMON_NAME_LENGTH) {
+                problem = "invalid section name";
+                break;
+            }
+            *close = '\0';
+
+            for (struct TargetRule *other = head; other != NULL; other = other->Next) {
+                if (strcmp(other->Name, line + 1) == 0) {
+                    problem = "duplicate section name";
+                }
+            }
+
+            rule = NewTargetRule(line + 1);
+            *tail = rule;
+            tail = &rule->Next;
+            continue;
+        }
+
+        if (rule == NULL) {
+            problem = "setting outside of a [section]";
+        } else if ((value = strchr(line, '=')) == NULL) {
+            problem = "expected key = value";
+        } else {
+            *value++ = '\0';
+            problem = SetRuleOption(rule, Trim(line), Trim(value));
+        }
+    }
+    fclose(file);
+
+    if (problem != NULL) {
+        Log(error, "%s:%d: %s", Path, lineNumber, problem);
+        FreeTargetRules(head);
+        return -1;
+    }
+
+    for (rule = head; rule != NULL; rule = rule->Next) {
+        if (rule->Pid == NO_PID && rule->ProcessName == NULL && !rule->bUid && rule->Cgroup == NULL) {
+            Log(error, "%s: [%s] needs at least one of pid, name, uid or cgroup", Path, rule->Name);
+            FreeTargetRules(head);
+            return -1;
+        }
+
+        // as on the command line, no threshold means dumps on a timer
+        rule->bTimerThreshold = rule->CpuThreshold == -1 && rule->MemoryThreshold == -1 && rule->BlockedThreshold == -1;
+    }
+
+    for (rule = head; rule != NULL; rule = rule->Next) {
+        if (rule->OutputDirectory != NULL && mkdir(rule->OutputDirectory, 0755) != 0 && errno != EEXIST) {
+            Log(warn, "[%s] Unable to create %s: %s", rule->Name, rule->OutputDirectory, strerror(errno));
+        }
+    }
+
+    *Rules = head;
+    return 0;
+}
+
+//--------------------------------------------------------------------
+//
+// SameString / SameRule - Did a reload leave the rule as it was?
+//
+//--------------------------------------------------------------------
+static bool SameString(const char *a, const char *b)
+{
+    return (a == NULL || b == NULL) ? a == b : strcmp(a, b) == 0;
+}
+
+static bool SameRule(const struct TargetRule *a, const struct TargetRule *b)
+{
+    return strcmp(a->Name, b->Name) == 0 &&
+           a->Pid == b->Pid &&
+           SameString(a->ProcessName, b->ProcessName) &&
+           a->bUid == b->bUid && (!a->bUid || a->Uid == b->Uid) &&
+           SameString(a->Cgroup, b->Cgroup) &&
+           a->CpuThreshold == b->CpuThreshold &&
+           a->bCpuTriggerBelowValue == b->bCpuTriggerBelowValue &&
+           a->MemoryThreshold == b->MemoryThreshold &&
+           a->bMemoryTriggerBelowValue == b->bMemoryTriggerBelowValue &&
+           a->BlockedThreshold == b->BlockedThreshold &&
+           a->BlockedSeconds == b->BlockedSeconds &&
+           a->bBlockedOnWchan == b->bBlockedOnWchan &&
+           a->ThresholdSeconds == b->ThresholdSeconds &&
+           a->NumberOfDumpsToCollect == b->NumberOfDumpsToCollect &&
+           SameString(a->OutputDirectory, b->OutputDirectory) &&
+           a->CoredumpFilter == b->CoredumpFilter &&
+           a->Quota.LimitBytes == b->Quota.LimitBytes &&
+           a->DumpPriority == b->DumpPriority &&
+           a->bMiniDump == b->bMiniDump;
+}
+
+//--------------------------------------------------------------------
+//
+// StartTarget - Monitor Pid with Rule's settings
+//
+//--------------------------------------------------------------------
+static void StartTarget(struct TargetRule *Rule, pid_t Pid, const char *ProcessName)
+{
+    struct MonitoredTarget *target;
+    struct ProcDumpConfiguration *config;
+
+    if ((target = daemonState.FreeTargets) != NULL) {
+        daemonState.FreeTargets = target->Next;
+    } else if ((target = (struct MonitoredTarget *)malloc(sizeof(struct MonitoredTarget))) == NULL) {
+        Log(error, INTERNAL_ERROR);
+        Trace("StartTarget: failed to allocate memory.");
+        exit(-1);
+    }
+
+    config = &target->Storage;
+    memset(config, 0, sizeof(*config));
+    InitTargetConfiguration(config);
+    snprintf(target->ProcessName, sizeof(target->ProcessName), "%s", ProcessName);
+    config->ProcessId = Pid;
+    config->ProcessName = target->ProcessName;
+    config->CpuThreshold = Rule->CpuThreshold;
+    config->bCpuTriggerBelowValue = Rule->bCpuTriggerBelowValue;
+    config->MemoryThreshold = Rule->MemoryThreshold;
+    config->bMemoryTriggerBelowValue = Rule->bMemoryTriggerBelowValue;
+    config->BlockedThreshold = Rule->BlockedThreshold;
+    config->BlockedSeconds = Rule->BlockedSeconds;
+    config->bBlockedOnWchan = Rule->bBlockedOnWchan;
+    config->ThresholdSeconds = Rule->ThresholdSeconds;
+    config->NumberOfDumpsToCollect = Rule->NumberOfDumpsToCollect;
+    config->bTimerThreshold = Rule->bTimerThreshold;
+    config->OutputDirectory = Rule->OutputDirectory;     // the rule outlives its targets
+    config->CoredumpFilter = Rule->CoredumpFilter;
+    config->Quota = &Rule->Quota;
+    config->DumpPriority = Rule->DumpPriority;
+    config->RuleName = Rule->Name;
+    config->bMiniDump = Rule->bMiniDump;
+    config->SamplingInterval = daemonState.Defaults->SamplingInterval;
+    config->Loop = daemonState.Defaults->Loop;
+    config->DumpWorkers = daemonState.Defaults->DumpWorkers;
+
+    target->Config = config;
+    target->Rule = Rule;
+    target->bReleased = false;
+    target->Next = daemonState.Targets;
+    daemonState.Targets = target;
+    Rule->nTargets++;
+
+    Log(info, "[%s] Monitoring %s (%d)", Rule->Name, config->ProcessName, Pid);
+    if (CreateTargetTriggers(config) != 0 || !BeginMonitoring(config)) {
+        Log(error, "[%s] Unable to monitor %d", Rule->Name, Pid);
+        StopMonitoring(config);
+    }
+}
+
+//--------------------------------------------------------------------
+//
+// ReapTargets - Release finished targets and forget those that are gone
+//
+//      A target that reached its dump limit stays on the list (without
+//      triggers) while its process lives, so it is not matched again.
+//
+//--------------------------------------------------------------------
+static void ReapTargets()
+{
+    struct MonitoredTarget **link = &daemonState.Targets;
+
+    while (*link != NULL) {
+        struct MonitoredTarget *target = *link;
+        struct ProcDumpConfiguration *config = target->Config;
+
+        if (IsMonitoringBusy(config)) {
+            link = &target->Next;
+            continue;
+        }
+
+        if (!target->bReleased) {
+            ReleaseTargetTriggers(config);
+            target->bReleased = true;
+            Log(info, "[%s] Stopped monitoring %d", target->Rule->Name, config->ProcessId);
+        }
+
+        if (!target->Rule->bRetired && !daemonState.bStopping && kill(config->ProcessId, 0) == 0) {
+            link = &target->Next;
+            continue;
+        }
+
+        *link = target->Next;
+        if (--target->Rule->nTargets == 0 && target->Rule->bRetired) {
+            target->Rule->Next = NULL;
+            FreeTargetRules(target->Rule);
+        }
+
+        // the strings are the target's and the rule's, not the heap's
+        config->ProcessName = NULL;
+        config->OutputDirectory = NULL;
+        FreeProcDumpConfiguration(config);
+        target->Next = daemonState.FreeTargets;
+        daemonState.FreeTargets = target;
+    }
+}
+
+//--------------------------------------------------------------------
+//
+// IsOwnHelper - Is pid procdump itself or one of its gcore/gdb processes?
+//
+//--------------------------------------------------------------------
+static bool IsOwnHelper(pid_t Pid, const struct ProcessIdentity *Id)
+{
+    if (Pid == getpid() || Id->ppid == getpid()) {
+        return true;
+    }
+
+    // gcore runs in its own process group, see popen2
+    for (struct MonitoredTarget *target = daemonState.Targets; target != NULL; target = target->Next) {
+        if (target->Config->gcorePid != NO_PID && Id->pgrp == target->Config->gcorePid) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//--------------------------------------------------------------------
+//
+// ScanProcesses - Match every process against the rules, start new matches
+//
+//      The name and cgroup are only read when some rule needs them.
+//
+//--------------------------------------------------------------------
+static void ScanProcesses()
+{
+    struct Arena *scratch = ScratchArena();
+    struct dirent *entry;
+
+    rewinddir(daemonState.Proc);
+    while ((entry = readdir(daemonState.Proc)) != NULL) {
+        struct ProcessIdentity id;
+        char cgroup[PATH_MAX] = "";
+        bool bCgroupRead = false;
+        char *name = NULL;
+        pid_t pid;
+
+        if (!isdigit((unsigned char)entry->d_name[0])) {
+            continue;
+        }
+        pid = (pid_t)atoi(entry->d_name);
+        ResetArena(scratch);
+        if (!GetProcessIdentity(pid, &id) || IsOwnHelper(pid, &id)) {
+            continue;
+        }
+
+        for (struct TargetRule *rule = daemonState.Rules; rule != NULL; rule = rule->Next) {
+            bool bMonitored = false;
+
+            if ((rule->Pid != NO_PID && rule->Pid != pid) || (rule->bUid && rule->Uid != id.uid)) {
+                continue;
+            }
+
+            if (rule->Cgroup != NULL) {
+                size_t length = strlen(rule->Cgroup);
+                if (!bCgroupRead) {
+                    bCgroupRead = GetProcessCgroup(pid, cgroup, sizeof(cgroup));
+                }
+                if (strncmp(cgroup, rule->Cgroup, length) != 0 ||
+                    (cgroup[length] != '\0' && cgroup[length] != '/' && length > 1)) {
+                    continue;
+                }
+            }
+
+            if (name == NULL) {
+                name = GetProcessName(pid, scratch);
+            }
+            if (strcmp(name, EMPTY_PROC_NAME) == 0 ||
+                (rule->ProcessName != NULL && strcmp(name, rule->ProcessName) != 0)) {
+                continue;   // kernel threads have no cmdline and cannot be dumped
+            }
+
+            for (struct MonitoredTarget *target = daemonState.Targets; target != NULL && !bMonitored; target = target->Next) {
+                bMonitored = target->Rule == rule && target->Config->ProcessId == pid;
+            }
+            if (!bMonitored) {
+                StartTarget(rule, pid, name);
+            }
+        }
+    }
+}
+
+//--------------------------------------------------------------------
+//
+// ScanTick - Periodic reap and match on the loop thread
+//
+//--------------------------------------------------------------------
+static void ScanTick(struct WheelTimer *Timer)
+{
+    ReapTargets();
+    ScanProcesses();
+    RescheduleTimer(&daemonState.Defaults->Loop->Timers, &daemonState.ScanTimer, DAEMON_SCAN_INTERVAL);
+}
+
+//--------------------------------------------------------------------
+//
+// ReloadRules - Re-read the configuration file (SIGHUP)
+//
+//      Unchanged rules are kept along with their targets; the targets of
+//      changed or removed rules are stopped and matched again under the
+//      new rules once their dumps in flight complete.
+//
+//--------------------------------------------------------------------
+static void ReloadRules()
+{
+    struct TargetRule *rules;
+    struct TargetRule **link;
+    int nKept = 0, nNew = 0;
+
+    if (LoadTargetRules(daemonState.Defaults->DaemonConfig, &rules) != 0) {
+        Log(error, "Keeping the current configuration");
+        return;
+    }
+
+    // swap in the old rule wherever it did not change
+    for (link = &rules; *link != NULL; link = &(*link)->Next) {
+        struct TargetRule **old;
+
+        for (old = &daemonState.Rules; *old != NULL && !SameRule(*old, *link); old = &(*old)->Next);
+        if (*old != NULL) {
+            struct TargetRule *kept = *old;
+            struct TargetRule *fresh = *link;
+
+            *old = kept->Next;
+            kept->Next = fresh->Next;
+            *link = kept;
+            fresh->Next = NULL;
+            FreeTargetRules(fresh);
+            nKept++;
+        } else {
+            nNew++;
+        }
+    }
+
+    // whatever is left of the old rules is retired
+    while (daemonState.Rules != NULL) {
+        struct TargetRule *retired = daemonState.Rules;
+
+        daemonState.Rules = retired->Next;
+        retired->Next = NULL;
+        retired->bRetired = true;
+
+        for (struct MonitoredTarget *target = daemonState.Targets; target != NULL; target = target->Next) {
+            if (target->Rule == retired) {
+                StopMonitoring(target->Config);
+            }
+        }
+        if (retired->nTargets == 0) {
+            FreeTargetRules(retired);
+        }
+    }
+
+    daemonState.Rules = rules;
+    Log(info, "Reloaded %s: %d rules unchanged, %d new or changed", daemonState.Defaults->DaemonConfig, nKept, nNew);
+
+    ReapTargets();
+    ScanProcesses();
+}
+
+//--------------------------------------------------------------------
+//
+// StopDaemon - Quit every target; the loop ends once their dumps complete
+//
+//--------------------------------------------------------------------
+static void StopDaemon()
+{
+    if (daemonState.bStopping) {
+        return;
+    }
+    daemonState.bStopping = true;
+
+    for (struct MonitoredTarget *target = daemonState.Targets; target != NULL; target = target->Next) {
+        SetQuit(target->Config, 1);
+        if (target->Config->gcorePid != NO_PID) {
+            Log(info, "Shutting down gcore");
+            if (kill(-target->Config->gcorePid, SIGKILL) != 0) {     // the whole gcore process group
+                Log(error, "Failed to shutdown gcore.");
+            }
+        }
+        StopMonitoring(target->Config);
+    }
+
+    CancelTimer(&daemonState.Defaults->Loop->Timers, &daemonState.ScanTimer);
+    ReleaseEventLoop(daemonState.Defaults->Loop);
+}
+
+//--------------------------------------------------------------------
+//
+// DaemonSignalHandler - SIGINT/SIGTERM quit, SIGHUP reloads
+//
+//--------------------------------------------------------------------
+static void DaemonSignalHandler(struct EventSource *Source, uint32_t Events)
+{
+    struct signalfd_siginfo sigInfo;
+
+    if (read(Source->fd, &sigInfo, sizeof(sigInfo)) != sizeof(sigInfo)) {
+        return;
+    }
+
+    switch (sigInfo.ssi_signo)
+    {
+    case SIGHUP:
+        if (!daemonState.bStopping) {
+            ReloadRules();
+        }
+        break;
+    case SIGINT:
+    case SIGTERM:
+        Log(info, "Quit");
+        StopDaemon();
+        break;
+    default:
+        fprintf (stderr, "\nUnexpected signal %d\n", sigInfo.ssi_signo);
+        break;
+    }
+}
+
+//--------------------------------------------------------------------
+//
+// RunDaemon - Monitor everything self->DaemonConfig describes until SIGINT/SIGTERM
+//
+//--------------------------------------------------------------------
+int RunDaemon(struct ProcDumpConfiguration *self)
+{
+    sigset_t sig_set;
+    int nRules = 0;
+    int rc;
+
+    daemonState.Defaults = self;
+    daemonState.Targets = NULL;
+    daemonState.FreeTargets = NULL;
+    daemonState.bStopping = false;
+
+    if (LoadTargetRules(self->DaemonConfig, &daemonState.Rules) != 0) {
+        return -1;
+    }
+    for (struct TargetRule *rule = daemonState.Rules; rule != NULL; rule = rule->Next) {
+        nRules++;
+    }
+
+    if ((daemonState.Proc = opendir("/proc")) == NULL) {
+        Log(error, "Unable to scan /proc: %s", strerror(errno));
+        FreeTargetRules(daemonState.Rules);
+        return -1;
+    }
+
+    sigemptyset(&sig_set);
+    sigaddset(&sig_set, SIGINT);
+    sigaddset(&sig_set, SIGTERM);
+    sigaddset(&sig_set, SIGHUP);
+    if ((rc = StartMonitoringRuntime(self, &sig_set, DaemonSignalHandler, &daemonState)) != 0) {
+        return rc;
+    }
+
+    Log(info, "Daemon started with %d rules from %s", nRules, self->DaemonConfig);
+
+    // the daemon itself keeps the loop running until it is told to quit
+    RetainEventLoop(self->Loop);
+    InitWheelTimer(&daemonState.ScanTimer, ScanTick, &daemonState);
+    ScanProcesses();
+    ScheduleTimer(&self->Loop->Timers, &daemonState.ScanTimer, DAEMON_SCAN_INTERVAL);
+
+    rc = RunMonitoring(self);
+
+    // the dump workers are gone, nothing is busy any more
+    ReapTargets();
+    while (daemonState.FreeTargets != NULL) {
+        struct MonitoredTarget *target = daemonState.FreeTargets;
+        daemonState.FreeTargets = target->Next;
+        free(target);
+    }
+    FreeTargetRules(daemonState.Rules);
+    daemonState.Rules = NULL;
+    closedir(daemonState.Proc);
+
+    return rc;
+}
@@ -0,0 +1,544 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Node wide dump budget shared by every procdump through a mapped file
+//
+//      Every procdump (and every daemon target) given the same -b file
+//      takes a slot before running gcore. The file holds the limits:
+//
+//          concurrent      dumps running at once on the node
+//          mb_per_hour     bytes of dumps written, as a token bucket
+//          io_mb_per_s     write bandwidth, split evenly among running
+//                          dumps; gcore is paused (SIGSTOP) while ahead
+//                          of its share, which also keeps the target
+//                          stopped for longer
+//
+//      Dumps waiting for a slot are admitted by priority, then arrival.
+//      When every slot is taken, a dump evicts the lowest priority queued
+//      one below its own priority. A dump is dropped when the byte budget
+//      is spent, no slot is free to queue in or evict, it was evicted, or
+//      it waited DUMP_BUDGET_MAX_WAIT.
+//
+//      A slot is owned through its robust Owner mutex rather than its pid,
+//      which means nothing to procdumps in another pid namespace.
+//
+//--------------------------------------------------------------------
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "DumpBudget.h"
+#include "Futex.h"
+#include "Handle.h"
+#include "Logging.h"
+#include "Metrics.h"
+
+#define NS_PER_SECOND 1000000000ULL
+#define NS_PER_HOUR (3600ULL * NS_PER_SECOND)
+
+//--------------------------------------------------------------------
+//
+// ParseDumpBudget - Split "path[:key=value,...]" into Limits
+//
+//      Limits->Path is allocated and owned by the caller.
+//
+// Returns: 0 on success, EINVAL otherwise
+//
+//--------------------------------------------------------------------
+int ParseDumpBudget(const char *Spec, struct DumpBudgetLimits *Limits)
+{
+    const char *options = strchr(Spec, ':');
+    char *copy, *pair, *savePtr = NULL;
+    int rc = 0;
+
+    Limits->MaxConcurrent = -1;
+    Limits->MbPerHour = -1;
+    Limits->IoMbPerSecond = -1;
+    Limits->Priority = DUMP_PRIORITY_DEFAULT;
+    Limits->Path = options ? strndup(Spec, options - Spec) : strdup(Spec);
+
+    if (Limits->Path == NULL || *Limits->Path == '\0') {
+        free(Limits->Path);
+        Limits->Path = NULL;
+        return EINVAL;
+    }
+    if (options == NULL) {
+        return 0;
+    }
+
+    copy = strdup(options + 1);
+    for (pair = strtok_r(copy, ",", &savePtr); pair != NULL && rc == 0; pair = strtok_r(NULL, ",", &savePtr)) {
+        char *value = strchr(pair, '=');
+        char *end;
+        long long number;
+
+        if (value == NULL) {
+            rc = EINVAL;
+            break;
+        }
+        *value++ = '\0';
+        number = strtoll(value, &end, 10);
+        if (*value == '\0' || *end != '\0' || number < 0) {
+            rc = EINVAL;
+        } else if (strcmp(pair, "concurrent") == 0 && number >= 1 && number <= DUMP_BUDGET_SLOTS) {
+            Limits->MaxConcurrent = (int)number;
+        } else if (strcmp(pair, "mb_per_hour") == 0) {
+            Limits->MbPerHour = number;
+        } else if (strcmp(pair, "io_mb_per_s") == 0) {
+            Limits->IoMbPerSecond = number;
+        } else if (strcmp(pair, "priority") == 0 && number <= 9) {
+            Limits->Priority = (int)number;
+        } else {
+            rc = EINVAL;
+        }
+    }
+    free(copy);
+
+    if (rc != 0) {
+        free(Limits->Path);
+        Limits->Path = NULL;
+    }
+    return rc;
+}
+
+//--------------------------------------------------------------------
+//
+// LockBudget - Take the shared lock, recovering it from a dead holder
+//
+//--------------------------------------------------------------------
+static void LockBudget(struct DumpBudgetShared *Shared)
+{
+    if (pthread_mutex_lock(&Shared->Lock) == EOWNERDEAD) {
+        // the slots are consistent at every store, only the lock needs repair
+        pthread_mutex_consistent(&Shared->Lock);
+    }
+}
+
+//--------------------------------------------------------------------
+//
+// RefillTokens / ReclaimDeadSlots - Bookkeeping done under the lock
+//
+//--------------------------------------------------------------------
+static void RefillTokens(struct DumpBudgetShared *Shared, uint64_t Now)
+{
+    if (Shared->BytesPerHour != 0 && Now > Shared->RefilledAt) {
+        Shared->Tokens += (int64_t)((double)(Now - Shared->RefilledAt) * Shared->BytesPerHour / NS_PER_HOUR);
+        if (Shared->Tokens > (int64_t)Shared->BytesPerHour) {
+            Shared->Tokens = Shared->BytesPerHour;
+        }
+    }
+    Shared->RefilledAt = Now;
+}
+
+static void ReclaimDeadSlots(struct DumpBudgetShared *Shared)
+{
+    for (int i = 0; i < DUMP_BUDGET_SLOTS; i++) {
+        struct DumpBudgetSlot *slot = &Shared->Slots[i];
+        int rc;
+
+        if (slot->Pid == 0 || (rc = pthread_mutex_trylock(&slot->Owner)) == EBUSY) {
+            continue;
+        }
+        if (rc == EOWNERDEAD) {
+            pthread_mutex_consistent(&slot->Owner);
+        }
+        pthread_mutex_unlock(&slot->Owner);
+        slot->Pid = 0;
+        slot->bRunning = false;
+        Shared->Generation++;
+    }
+}
+
+//--------------------------------------------------------------------
+//
+// TakeSlot / FreeSlot / EvictSlot - Slot changes done under the lock
+//
+//--------------------------------------------------------------------
+static struct DumpBudgetSlot *TakeSlot(struct DumpBudgetShared *Shared, int Priority, int *Slot)
+{
+    for (int i = 0; i < DUMP_BUDGET_SLOTS; i++) {
+        struct DumpBudgetSlot *slot = &Shared->Slots[i];
+        int rc;
+
+        if (slot->Pid != 0 || (rc = pthread_mutex_trylock(&slot->Owner)) == EBUSY) {
+            continue;
+        }
+        if (rc == EOWNERDEAD) {
+            pthread_mutex_consistent(&slot->Owner);
+        }
+        slot->Priority = Priority;
+        slot->Ticket = Shared->NextTicket++;
+        slot->bRunning = false;
+        slot->bEvicted = false;
+        slot->Pid = getpid();
+        *Slot = i;
+        return slot;
+    }
+    return NULL;
+}
+
+static void FreeSlot(struct DumpBudgetShared *Shared, struct DumpBudgetSlot *Slot)
+{
+    Slot->bRunning = false;
+    Slot->bEvicted = false;
+    Slot->Pid = 0;
+    pthread_mutex_unlock(&Slot->Owner);
+    Shared->Generation++;
+}
+
+// Returns: true when a queued dump below Priority was asked to leave, or one already is
+static bool EvictSlot(struct DumpBudgetShared *Shared, int Priority)
+{
+    struct DumpBudgetSlot *victim = NULL;
+
+    for (int i = 0; i < DUMP_BUDGET_SLOTS; i++) {
+        struct DumpBudgetSlot *slot = &Shared->Slots[i];
+
+        if (slot->Pid == 0 || slot->bRunning) {
+            continue;
+        }
+        if (slot->bEvicted) {
+            if (slot->Priority < Priority) {
+                return true;
+            }
+            continue;
+        }
+        // the lowest priority, and within it the latest to arrive
+        if (slot->Priority < Priority && (victim == NULL || slot->Priority < victim->Priority ||
+                                          (slot->Priority == victim->Priority && slot->Ticket > victim->Ticket))) {
+            victim = slot;
+        }
+    }
+
+    if (victim == NULL) {
+        return false;
+    }
+    victim->bEvicted = true;
+    Shared->Generation++;
+    return true;
+}
+
+//--------------------------------------------------------------------
+//
+// OpenDumpBudget - Map (creating if needed) the budget file named by Spec
+//                  and apply the limits it gives
+//
+// Returns: 0 on success, errno otherwise
+//
+//--------------------------------------------------------------------
+int OpenDumpBudget(struct DumpBudget *Budget, const char *Spec)
+{
+    struct DumpBudgetLimits limits;
+    struct DumpBudgetShared *shared;
+    struct stat st;
+    bool bCreator = true;
+    int fd;
+    int rc;
+
+    Budget->Shared = NULL;
+    if ((rc = ParseDumpBudget(Spec, &limits)) != 0) {
+        return rc;
+    }
+    Budget->Priority = limits.Priority;
+
+    if ((fd = open(limits.Path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600)) == -1 && errno == EEXIST) {
+        bCreator = false;
+        fd = open(limits.Path, O_RDWR | O_CLOEXEC);
+    }
+    if (fd == -1) {
+        rc = errno;
+        Trace("OpenDumpBudget: failed to open %s.", limits.Path);
+        free(limits.Path);
+        return rc;
+    }
+
+    if (bCreator && ftruncate(fd, sizeof(struct DumpBudgetShared)) == -1) {
+        rc = errno;
+        close(fd);
+        unlink(limits.Path);
+        free(limits.Path);
+        return rc;
+    }
+
+    // another procdump may be creating it right now
+    for (int i = 0; !bCreator && i < 100 && fstat(fd, &st) == 0 && st.st_size != sizeof(struct DumpBudgetShared); i++) {
+        usleep(10000);
+    }
+
+    shared = mmap(NULL, sizeof(struct DumpBudgetShared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    rc = errno;
+    close(fd);
+    if (shared == MAP_FAILED) {
+        Trace("OpenDumpBudget: failed to map %s.", limits.Path);
+        free(limits.Path);
+        return rc;
+    }
+
+    if (bCreator) {
+        pthread_mutexattr_t attr;
+
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&shared->Lock, &attr);
+        for (int i = 0; i < DUMP_BUDGET_SLOTS; i++) {
+            pthread_mutex_init(&shared->Slots[i].Owner, &attr);
+        }
+        pthread_mutexattr_destroy(&attr);
+
+        shared->Version = DUMP_BUDGET_VERSION;
+        shared->Size = sizeof(struct DumpBudgetShared);
+        shared->MaxConcurrent = 1;
+        shared->RefilledAt = MetricClock();
+
+        // published last; openers wait for it
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        memcpy(shared->Magic, DUMP_BUDGET_MAGIC, sizeof(shared->Magic));
+    } else {
+        for (int i = 0; i < 100 && memcmp(shared->Magic, DUMP_BUDGET_MAGIC, sizeof(shared->Magic)) != 0; i++) {
+            usleep(10000);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (memcmp(shared->Magic, DUMP_BUDGET_MAGIC, sizeof(shared->Magic)) != 0 ||
+            shared->Version != DUMP_BUDGET_VERSION || shared->Size != sizeof(struct DumpBudgetShared)) {
+            Log(error, "%s is not a dump budget of this version", limits.Path);
+            munmap(shared, sizeof(struct DumpBudgetShared));
+            free(limits.Path);
+            return EINVAL;
+        }
+    }
+
+    // the node's limits are whatever the last procdump to set them asked for
+    LockBudget(shared);
+    if (limits.MaxConcurrent != -1) {
+        shared->MaxConcurrent = limits.MaxConcurrent;
+    }
+    if (limits.MbPerHour != -1 && ((uint64_t)limits.MbPerHour << 20) != shared->BytesPerHour) {
+        // settle the bucket at the old rate: a procdump joining with the same
+        // limit must not hand out another hour's worth of dumps. A new limit
+        // starts full, a changed one keeps what is left, up to the new cap
+        RefillTokens(shared, MetricClock());
+        if (shared->BytesPerHour == 0 || shared->Tokens > (int64_t)((uint64_t)limits.MbPerHour << 20)) {
+            shared->Tokens = (uint64_t)limits.MbPerHour << 20;
+        }
+        shared->BytesPerHour = (uint64_t)limits.MbPerHour << 20;
+    }
+    if (limits.IoMbPerSecond != -1) {
+        shared->IoBytesPerSecond = (uint64_t)limits.IoMbPerSecond << 20;
+    }
+    Log(info, "Dump budget %s: %d concurrent, %llu MB per hour, %llu MB/s", limits.Path, shared->MaxConcurrent,
+        (unsigned long long)(shared->BytesPerHour >> 20), (unsigned long long)(shared->IoBytesPerSecond >> 20));
+    pthread_mutex_unlock(&shared->Lock);
+
+    Budget->Shared = shared;
+    free(limits.Path);
+    return 0;
+}
+
+//--------------------------------------------------------------------
+//
+// CloseDumpBudget - Unmap the budget (the file stays for the other procdumps)
+//
+//--------------------------------------------------------------------
+void CloseDumpBudget(struct DumpBudget *Budget)
+{
+    if (Budget->Shared != NULL) {
+        munmap(Budget->Shared, sizeof(struct DumpBudgetShared));
+        Budget->Shared = NULL;
+    }
+}
+
+//--------------------------------------------------------------------
+//
+// AcquireDumpSlot - Queue for a slot and wait until the dump may run
+//
+//      Blocks the calling dump worker; wakes up when any slot on the node
+//      frees up and at least every DUMP_BUDGET_POLL to notice a quit. The
+//      slot is owned by the calling thread, which must also release it.
+//
+// Returns: DUMP_ADMITTED with *Slot to release, DUMP_DROPPED or DUMP_CANCELLED
+//
+//--------------------------------------------------------------------
+enum DumpAdmission AcquireDumpSlot(struct DumpBudget *Budget, int Priority, int *Quit, int *Slot)
+{
+    struct DumpBudgetShared *shared = Budget->Shared;
+    struct DumpBudgetSlot *slot = NULL;
+    uint64_t giveUpAt = MetricClock() + DUMP_BUDGET_MAX_WAIT * NS_PER_SECOND;
+    struct timespec deadline;
+    int generation;
+
+    *Slot = -1;
+    if (shared == NULL) {
+        return DUMP_ADMITTED;
+    }
+
+    // a full node makes room by evicting a lower priority queued dump
+    while (true) {
+        bool bEvicting;
+
+        LockBudget(shared);
+        ReclaimDeadSlots(shared);
+        if ((slot = TakeSlot(shared, Priority, Slot)) != NULL) {
+            pthread_mutex_unlock(&shared->Lock);
+            break;
+        }
+        bEvicting = EvictSlot(shared, Priority);
+        generation = shared->Generation;
+        pthread_mutex_unlock(&shared->Lock);
+
+        if (!bEvicting) {
+            Log(warn, "Dump dropped: %d dumps already running or queued on the node", DUMP_BUDGET_SLOTS);
+            return DUMP_DROPPED;
+        }
+        FutexWakeShared(&shared->Generation, FUTEX_WAKE_ALL);
+
+        if (__atomic_load_n(Quit, __ATOMIC_RELAXED) != 0) {
+            return DUMP_CANCELLED;
+        }
+        if (MetricClock() >= giveUpAt) {
+            Log(warn, "Dump dropped: waited %d seconds for the node's dump budget", DUMP_BUDGET_MAX_WAIT);
+            return DUMP_DROPPED;
+        }
+        GetWaitDeadline(DUMP_BUDGET_POLL, &deadline);
+        FutexWaitShared(&shared->Generation, generation, &deadline);
+    }
+
+    while (true) {
+        uint64_t now = MetricClock();
+        int running = 0;
+        bool bFirst = true;
+
+        LockBudget(shared);
+        ReclaimDeadSlots(shared);
+        RefillTokens(shared, now);
+
+        if (slot->bEvicted) {
+            FreeSlot(shared, slot);
+            pthread_mutex_unlock(&shared->Lock);
+            FutexWakeShared(&shared->Generation, FUTEX_WAKE_ALL);
+            Log(warn, "Dump dropped: a higher priority dump on the node took its place in the queue");
+            *Slot = -1;
+            return DUMP_DROPPED;
+        }
+
+        if (shared->BytesPerHour != 0 && shared->Tokens <= 0) {
+            FreeSlot(shared, slot);
+            pthread_mutex_unlock(&shared->Lock);
+            FutexWakeShared(&shared->Generation, FUTEX_WAKE_ALL);
+            Log(warn, "Dump dropped: the node's budget of %llu MB per hour is spent",
+                (unsigned long long)(shared->BytesPerHour >> 20));
+            *Slot = -1;
+            return DUMP_DROPPED;
+        }
+
+        for (int i = 0; i < DUMP_BUDGET_SLOTS; i++) {
+            struct DumpBudgetSlot *other = &shared->Slots[i];
+            if (other->Pid == 0 || other == slot) {
+                continue;
+            }
+            if (other->bRunning) {
+                running++;
+            } else if (other->Priority > Priority || (other->Priority == Priority && other->Ticket < slot->Ticket)) {
+                bFirst = false;
+            }
+        }
+
+        if (bFirst && running < shared->MaxConcurrent) {
+            slot->bRunning = true;
+            pthread_mutex_unlock(&shared->Lock);
+            return DUMP_ADMITTED;
+        }
+
+        generation = shared->Generation;
+        pthread_mutex_unlock(&shared->Lock);
+
+        if (__atomic_load_n(Quit, __ATOMIC_RELAXED) != 0 || now >= giveUpAt) {
+            bool bQuit = __atomic_load_n(Quit, __ATOMIC_RELAXED) != 0;
+
+            ReleaseDumpSlot(Budget, *Slot, 0);
+            *Slot = -1;
+            if (!bQuit) {
+                Log(warn, "Dump dropped: waited %d seconds for the node's dump budget", DUMP_BUDGET_MAX_WAIT);
+            }
+            return bQuit ? DUMP_CANCELLED : DUMP_DROPPED;
+        }
+
+        GetWaitDeadline(DUMP_BUDGET_POLL, &deadline);
+        FutexWaitShared(&shared->Generation, generation, &deadline);
+    }
+}
+
+//--------------------------------------------------------------------
+//
+// ReleaseDumpSlot - Give the slot back and charge Bytes to the byte budget
+//
+//--------------------------------------------------------------------
+void ReleaseDumpSlot(struct DumpBudget *Budget, int Slot, uint64_t Bytes)
+{
+    struct DumpBudgetShared *shared = Budget->Shared;
+
+    if (shared == NULL || Slot < 0) {
+        return;
+    }
+
+    LockBudget(shared);
+    RefillTokens(shared, MetricClock());
+    if (shared->BytesPerHour != 0) {
+        shared->Tokens -= (int64_t)Bytes;
+    }
+    FreeSlot(shared, &shared->Slots[Slot]);
+    pthread_mutex_unlock(&shared->Lock);
+
+    FutexWakeShared(&shared->Generation, FUTEX_WAKE_ALL);
+}
+
+//--------------------------------------------------------------------
+//
+// IsDumpThrottled - Does the node limit dump write bandwidth?
+//
+//--------------------------------------------------------------------
+bool IsDumpThrottled(struct DumpBudget *Budget)
+{
+    return Budget->Shared != NULL && __atomic_load_n(&Budget->Shared->IoBytesPerSecond, __ATOMIC_RELAXED) != 0;
+}
+
+//--------------------------------------------------------------------
+//
+// ThrottleDump - Pause or resume the gcore process group so that the
+//                dump's Written bytes stay within its I/O share
+//
+//      Called every DUMP_BUDGET_POLL while the dump runs.
+//
+//--------------------------------------------------------------------
+void ThrottleDump(struct DumpBudget *Budget, struct DumpThrottle *Throttle, pid_t Group, uint64_t Written)
+{
+    struct DumpBudgetShared *shared = Budget->Shared;
+    uint64_t now = MetricClock();
+    uint64_t share;
+    int running = 0;
+    bool bAhead;
+
+    if (shared == NULL) {
+        return;
+    }
+
+    LockBudget(shared);
+    for (int i = 0; i < DUMP_BUDGET_SLOTS; i++) {
+        running += shared->Slots[i].Pid != 0 && shared->Slots[i].bRunning;
+    }
+    share = shared->IoBytesPerSecond / (running > 0 ? running : 1);
+    pthread_mutex_unlock(&shared->Lock);
+
+    bAhead = share != 0 && Written > (uint64_t)((double)share * (now - Throttle->StartedAt) / NS_PER_SECOND);
+
+    if (bAhead && !Throttle->bStopped) {
+        Throttle->bStopped = kill(-Group, SIGSTOP) == 0;
+    } else if (!bAhead && Throttle->bStopped) {
+        kill(-Group, SIGCONT);
+        Throttle->bStopped = false;
+    }
+}
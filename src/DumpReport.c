@@ -0,0 +1,161 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Per-dump performance report, written next to each dump as JSON
+//
+//      The target is stopped for as long as gdb is attached, so the gcore
+//      wall time is reported as an upper bound on the stop time.
+//
+//--------------------------------------------------------------------
+
+#include <errno.h>
+#include <stdio.h>
+
+#include "DumpReport.h"
+#include "Logging.h"
+
+#define NS_PER_MS 1000000.0
+
+//--------------------------------------------------------------------
+//
+// ElapsedMs - Milliseconds between two report timestamps, -1 if either is missing
+//
+//--------------------------------------------------------------------
+static double ElapsedMs(uint64_t From, uint64_t To)
+{
+    if (From == 0 || To == 0 || To < From) {
+        return -1;
+    }
+    return (To - From) / NS_PER_MS;
+}
+
+//--------------------------------------------------------------------
+//
+// Throughput - Core bytes per second of gcore time, in MB/s
+//
+//--------------------------------------------------------------------
+static double Throughput(const struct DumpReport *Report)
+{
+    double ms = ElapsedMs(Report->GcoreStartedAt, Report->GcoreEndedAt);
+
+    if (ms <= 0) {
+        return 0;
+    }
+    return (Report->CoreBytes / (1024.0 * 1024.0)) / (ms / 1000.0);
+}
+
+//--------------------------------------------------------------------
+//
+// CompressionRatio - Logical size over allocated size (sparse cores are > 1)
+//
+//--------------------------------------------------------------------
+static double CompressionRatio(const struct DumpReport *Report)
+{
+    if (Report->DiskBytes == 0) {
+        return 1;
+    }
+    return (double)Report->CoreBytes / Report->DiskBytes;
+}
+
+//--------------------------------------------------------------------
+//
+// WriteJsonString - Write Value as a quoted JSON string
+//
+//--------------------------------------------------------------------
+static void WriteJsonString(FILE *File, const char *Value)
+{
+    fputc('"', File);
+    for (const char *c = Value; c != NULL && *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(File, "\\%c", *c);
+        } else if ((unsigned char)*c < 0x20) {
+            fprintf(File, "\\u%04x", *c);
+        } else {
+            fputc(*c, File);
+        }
+    }
+    fputc('"', File);
+}
+
+//--------------------------------------------------------------------
+//
+// WriteDumpReport - Write Report to Path as a single JSON object
+//
+//      Durations are milliseconds and -1 when not measured.
+//
+// Returns: 0 on success, errno otherwise
+//
+//--------------------------------------------------------------------
+int WriteDumpReport(const struct DumpReport *Report, const char *Path)
+{
+    FILE *file;
+    int rc = 0;
+
+    if ((file = fopen(Path, "w")) == NULL) {
+        rc = errno;
+        Trace("WriteDumpReport: failed to create %s.", Path);
+        return rc;
+    }
+
+    fprintf(file, "{\n  \"pid\": %d,\n  \"trigger\": ", Report->Pid);
+    WriteJsonString(file, Report->Trigger);
+    fprintf(file, ",\n  \"core_file\": ");
+    WriteJsonString(file, Report->CoreFile);
+    fprintf(file,
+        ",\n"
+        "  \"trigger_latency_ms\": %.3f,\n"
+        "  \"target_stopped_ms\": %.3f,\n"
+        "  \"wall_ms\": %.3f,\n"
+        "  \"core_bytes\": %llu,\n"
+        "  \"disk_bytes\": %llu,\n"
+        "  \"bytes_read\": %llu,\n"
+        "  \"bytes_written\": %llu,\n"
+        "  \"regions\": %d,\n"
+        "  \"threads\": %d,\n"
+        "  \"compression_ratio\": %.3f,\n"
+        "  \"throughput_mb_per_s\": %.3f,\n"
+        "  \"procdump_peak_rss_kb\": %ld,\n"
+        "  \"gcore_peak_rss_kb\": %ld\n"
+        "}\n",
+        ElapsedMs(Report->TriggeredAt, Report->StartedAt),
+        ElapsedMs(Report->GcoreStartedAt, Report->GcoreEndedAt),
+        ElapsedMs(Report->StartedAt, Report->EndedAt),
+        (unsigned long long)Report->CoreBytes,
+        (unsigned long long)Report->DiskBytes,
+        (unsigned long long)Report->BytesRead,
+        (unsigned long long)Report->BytesWritten,
+        Report->Regions,
+        Report->Threads,
+        CompressionRatio(Report),
+        Throughput(Report),
+        Report->PeakRssKb,
+        Report->GcorePeakRssKb);
+
+    if (ferror(file)) {
+        rc = EIO;
+        Trace("WriteDumpReport: failed to write %s.", Path);
+    }
+    if (fclose(file) != 0 && rc == 0) {
+        rc = errno;
+    }
+
+    return rc;
+}
+
+//--------------------------------------------------------------------
+//
+// LogDumpReport - One line summary of Report
+//
+//--------------------------------------------------------------------
+void LogDumpReport(const struct DumpReport *Report)
+{
+    Log(info, "Dump report: latency %.1f ms, stopped %.1f ms, %llu bytes at %.1f MB/s, %d regions, %d threads",
+        ElapsedMs(Report->TriggeredAt, Report->StartedAt),
+        ElapsedMs(Report->GcoreStartedAt, Report->GcoreEndedAt),
+        (unsigned long long)Report->CoreBytes,
+        Throughput(Report),
+        Report->Regions,
+        Report->Threads);
+}
@@ -0,0 +1,280 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Single threaded epoll based event loop
+//
+//--------------------------------------------------------------------
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "EventLoop.h"
+#include "Logging.h"
+
+
+//--------------------------------------------------------------------
+//
+// InitEventLoop - Create the epoll instance backing the loop
+//
+// Returns: 0 on success, errno otherwise
+//
+//--------------------------------------------------------------------
+int InitEventLoop(struct EventLoop *Loop)
+{
+    Loop->nRefs = 0;
+    InitTimerWheel(&Loop->Timers);
+    if ((Loop->epollFd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        Trace("InitEventLoop: epoll_create1 failed.");
+        return errno;
+    }
+
+    return 0;
+}
+
+
+//--------------------------------------------------------------------
+//
+// DestroyEventLoop - Close the epoll instance
+//
+//--------------------------------------------------------------------
+void DestroyEventLoop(struct EventLoop *Loop)
+{
+    if (Loop->epollFd != NO_FD) {
+        close(Loop->epollFd);
+        Loop->epollFd = NO_FD;
+    }
+}
+
+
+//--------------------------------------------------------------------
+//
+// RetainEventLoop / ReleaseEventLoop - Keep the loop running while there is work
+//
+//      Only ever called from the loop thread (or before it starts)
+//
+//--------------------------------------------------------------------
+void RetainEventLoop(struct EventLoop *Loop)
+{
+    Loop->nRefs++;
+}
+
+void ReleaseEventLoop(struct EventLoop *Loop)
+{
+    Loop->nRefs--;
+}
+
+
+//--------------------------------------------------------------------
+//
+// RunEventLoop - Dispatch ready sources and expired timers until nothing
+//                holds the loop anymore
+//
+// Returns: 0 once the last reference is released, errno on failure
+//
+//--------------------------------------------------------------------
+int RunEventLoop(struct EventLoop *Loop)
+{
+    struct epoll_event events[MAX_LOOP_EVENTS];
+
+    while (Loop->nRefs > 0) {
+        uint64_t now = TimerWheelClock(&Loop->Timers);
+        int64_t delay;
+
+        AdvanceTimerWheel(&Loop->Timers, now);
+        if (Loop->nRefs == 0) {
+            break;
+        }
+
+        // sleep until the next timer deadline or until a source is ready
+        delay = NextTimerDelay(&Loop->Timers, now);
+        int nReady = epoll_wait(Loop->epollFd, events, MAX_LOOP_EVENTS, (delay < 0) ? -1 : (delay > INT_MAX) ? INT_MAX : (int)delay);
+        if (nReady == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            Trace("RunEventLoop: epoll_wait failed.");
+            return errno;
+        }
+
+        for (int i = 0; i < nReady; i++) {
+            struct EventSource *source = (struct EventSource *)events[i].data.ptr;
+
+            // an earlier handler in this batch may have removed the source
+            if (source->fd != NO_FD) {
+                source->Handler(source, events[i].events);
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+//--------------------------------------------------------------------
+//
+// AddEventSource - Start watching Source->fd for Events (EPOLLIN, ...)
+//
+// Returns: 0 on success, errno otherwise
+//
+//--------------------------------------------------------------------
+int AddEventSource(struct EventLoop *Loop, struct EventSource *Source, uint32_t Events)
+{
+    struct epoll_event event = { .events = Events, .data.ptr = Source };
+
+    if (epoll_ctl(Loop->epollFd, EPOLL_CTL_ADD, Source->fd, &event) == -1) {
+        Trace("AddEventSource: epoll_ctl failed.");
+        return errno;
+    }
+
+    return 0;
+}
+
+
+//--------------------------------------------------------------------
+//
+// ModifyEventSource - Change the events a source is watched for
+//
+// Returns: 0 on success, errno otherwise
+//
+//--------------------------------------------------------------------
+int ModifyEventSource(struct EventLoop *Loop, struct EventSource *Source, uint32_t Events)
+{
+    struct epoll_event event = { .events = Events, .data.ptr = Source };
+
+    if (epoll_ctl(Loop->epollFd, EPOLL_CTL_MOD, Source->fd, &event) == -1) {
+        Trace("ModifyEventSource: epoll_ctl failed.");
+        return errno;
+    }
+
+    return 0;
+}
+
+
+//--------------------------------------------------------------------
+//
+// RemoveEventSource - Stop watching and close the source's fd
+//
+//--------------------------------------------------------------------
+void RemoveEventSource(struct EventLoop *Loop, struct EventSource *Source)
+{
+    if (Source->fd == NO_FD) {
+        return;
+    }
+
+    epoll_ctl(Loop->epollFd, EPOLL_CTL_DEL, Source->fd, NULL);
+    close(Source->fd);
+    Source->fd = NO_FD;
+}
+
+
+//--------------------------------------------------------------------
+//
+// InitSignalSource - Route Signals through a signalfd instead of async handlers
+//
+//      The signals are blocked for the calling thread and every thread it
+//      creates afterwards, so call this before any other thread is started.
+//
+//--------------------------------------------------------------------
+int InitSignalSource(struct EventSource *Source, const sigset_t *Signals, EventHandler Handler, void *Context)
+{
+    int rc;
+
+    Source->Handler = Handler;
+    Source->Context = Context;
+    Source->fd = NO_FD;
+
+    if ((rc = pthread_sigmask(SIG_BLOCK, Signals, NULL)) != 0) {
+        Trace("InitSignalSource: pthread_sigmask failed.");
+        return rc;
+    }
+
+    if ((Source->fd = signalfd(-1, Signals, SFD_NONBLOCK | SFD_CLOEXEC)) == -1) {
+        Source->fd = NO_FD;
+        Trace("InitSignalSource: signalfd failed.");
+        return errno;
+    }
+
+    return 0;
+}
+
+//--------------------------------------------------------------------
+//
+// InitListenerSource - Listen for stream connections on the Unix domain socket Path
+//
+//      A stale socket left at Path by an earlier run is replaced; any other
+//      file there is left alone and the bind fails. The socket is created
+//      with Mode (less the umask) from the start, so it is never reachable
+//      with wider permissions. The caller adds the source to a loop and
+//      unlinks Path when done.
+//
+// Returns: 0 on success, errno otherwise
+//
+//--------------------------------------------------------------------
+int InitListenerSource(struct EventSource *Source, const char *Path, mode_t Mode, int Backlog, EventHandler Handler, void *Context)
+{
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    struct stat st;
+    int rc;
+
+    Source->Handler = Handler;
+    Source->Context = Context;
+    Source->fd = NO_FD;
+
+    if (strlen(Path) >= sizeof(address.sun_path)) {
+        return ENAMETOOLONG;
+    }
+    strcpy(address.sun_path, Path);
+
+    if ((Source->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+        Source->fd = NO_FD;
+        Trace("InitListenerSource: socket failed.");
+        return errno;
+    }
+
+    // the path takes the socket inode's mode at bind time
+    if (fchmod(Source->fd, Mode) == -1) {
+        rc = errno;
+        Trace("InitListenerSource: fchmod failed.");
+        close(Source->fd);
+        Source->fd = NO_FD;
+        return rc;
+    }
+
+    if (lstat(Path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(Path);
+    }
+    if (bind(Source->fd, (struct sockaddr *)&address, sizeof(address)) == -1 ||
+        listen(Source->fd, Backlog) == -1) {
+        rc = errno;
+        Trace("InitListenerSource: failed to listen on %s.", Path);
+        close(Source->fd);
+        Source->fd = NO_FD;
+        return rc;
+    }
+
+    return 0;
+}
+
+//--------------------------------------------------------------------
+//
+// AcceptConnection - Accept a pending connection on a listener source
+//
+// Returns: a non-blocking, close-on-exec fd, or -1 when none is pending
+//
+//--------------------------------------------------------------------
+int AcceptConnection(struct EventSource *Listener)
+{
+    int fd;
+
+    if ((fd = accept(Listener->fd, NULL, NULL)) != -1) {
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+
+    return fd;
+}
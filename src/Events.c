@@ -8,6 +8,7 @@
 //--------------------------------------------------------------------
 
 #include "Events.h"
+#include "Futex.h"
 #include "Logging.h"
 
 
@@ -70,18 +71,12 @@ void InitNamedEvent(struct Event *Event, bool IsManualReset, bool InitialState,
 {
     static int unamedEventId = 0; // ID for logging purposes
 
-    pthread_mutex_init(&(Event->mutex), NULL);
-    if(pthread_cond_init(&(Event->cond), NULL) != 0){
-        Log(error, INTERNAL_ERROR);
-        Trace("InitNamedEvent: failed pthread_cond_init.");
-        exit(-1);
-    }
     Event->bManualReset = IsManualReset;
-    Event->bTriggered = InitialState;
     Event->nWaiters = 0;
+    __atomic_store_n(&Event->State, InitialState ? 1 : 0, __ATOMIC_RELEASE);
 
     if (Name == NULL) {
-        sprintf(Event->Name, "Unamed Event %d", ++unamedEventId);  
+        sprintf(Event->Name, "Unamed Event %d", __atomic_add_fetch(&unamedEventId, 1, __ATOMIC_RELAXED));
     } else if (strlen(Name) >= MAX_EVENT_NAME) {
         strncpy(Event->Name, Name, MAX_EVENT_NAME);
         Event->Name[MAX_EVENT_NAME - 1] = '\0'; // null terminate
@@ -98,73 +93,104 @@ void InitNamedEvent(struct Event *Event, bool IsManualReset, bool InitialState,
 //--------------------------------------------------------------------
 void DestroyEvent(struct Event *Event)
 {
-    // destroy mutex and cond
-    if(pthread_cond_destroy(&(Event->cond)) != 0){
-        Log(error, INTERNAL_ERROR);
-        Trace("DestroyEvent: failed pthread_cond_destroy.");        
-        exit(-1);
-    }
-    if(pthread_mutex_destroy(&(Event->mutex)) != 0){
-        Log(error, INTERNAL_ERROR);
-        Trace("DestroyEvent: failed pthread_mutex_destroy.");        
-        exit(-1);
+    // The event owns no resources; just note if somebody is still parked on it
+    if (__atomic_load_n(&Event->nWaiters, __ATOMIC_ACQUIRE) != 0) {
+        Trace("DestroyEvent: %s destroyed while threads are waiting on it.", Event->Name);
     }
 }
 
 //--------------------------------------------------------------------
 //
-// SetEvent - Attempts to trigger the event and set Event.bTriggered to true
+// SetEvent - Attempts to trigger the event
+//
+//      Manual-reset events wake every waiter and stay triggered.
+//      Auto-reset events wake a single waiter, which consumes the trigger.
 //
 // Return - A boolean indicating success of firing the event
 //
 //--------------------------------------------------------------------
 bool SetEvent(struct Event *Event)
 {
-    int success = 0;
-
-    if ((success = pthread_mutex_lock(&(Event->mutex))) == 0) {     
-        Event->bTriggered = true;
-        Event->bManualReset ? // Are we a manual-reset?
-            pthread_cond_broadcast(&(Event->cond)) :    // signal everyone!
-            pthread_cond_signal(&(Event->cond));        // Signal first in line!
-        pthread_mutex_unlock(&(Event->mutex));
-    }
-    else
-    {
-        Log(error, INTERNAL_ERROR);
-        Trace("SetEvent: failed pthread_mutex_lock.");        
-        exit(-1);
+    __atomic_exchange_n(&Event->State, 1, __ATOMIC_SEQ_CST);
+
+    // Only enter the kernel if somebody is (about to be) asleep on the word
+    if (__atomic_load_n(&Event->nWaiters, __ATOMIC_SEQ_CST) != 0) {
+        FutexWake(&Event->State, Event->bManualReset ? FUTEX_WAKE_ALL : 1);
     }
 
-    return (success == 0);
+    return true;
 }
 
 //--------------------------------------------------------------------
 //
 // ResetEvent - For Events with bManualReset == true
 //
-// Return - A boolean indicating success of reseting the event (i.e., Event.bTriggered == false)
+// Return - A boolean indicating success of reseting the event
 //
 //--------------------------------------------------------------------
 bool ResetEvent(struct Event *Event)
 {
-    int success = 0;
-
-    if ((success = pthread_mutex_lock(&(Event->mutex))) == 0) {
-        Event->bTriggered = false;
-        if(pthread_mutex_unlock(&(Event->mutex)) != 0){
-            Log(error, INTERNAL_ERROR);
-            Trace("ResetEvent: failed pthread_mutex_unlock.");        
-            exit(-1);        
-        }
-    }
-    else{
-        Log(error, INTERNAL_ERROR);
-        Trace("ResetEvent: failed pthread_mutex_lock.");        
-        exit(-1);        
+    __atomic_store_n(&Event->State, 0, __ATOMIC_SEQ_CST);
+
+    return true;
+}
+
+//--------------------------------------------------------------------
+//
+// IsEventSet - Non-consuming check of the event state (single atomic load)
+//
+//--------------------------------------------------------------------
+bool IsEventSet(struct Event *Event)
+{
+    return __atomic_load_n(&Event->State, __ATOMIC_ACQUIRE) != 0;
+}
+
+//--------------------------------------------------------------------
+//
+// TryAcquireEvent - Check (manual-reset) or consume (auto-reset) the trigger
+//
+//--------------------------------------------------------------------
+static bool TryAcquireEvent(struct Event *Event)
+{
+    int expected = 1;
+
+    if (Event->bManualReset) {
+        return IsEventSet(Event);
     }
 
-    return (success == 0);
+    return __atomic_compare_exchange_n(&Event->State, &expected, 0, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
 }
 
+//--------------------------------------------------------------------
+//
+// WaitForEvent - Block until the event is triggered or the deadline passes
+//
+// Parameters:
+//      -Event -> the event to wait for
+//      -Deadline -> absolute WAIT_CLOCK deadline, NULL waits forever
+//
+// Return - 0 on success, ETIMEDOUT on timeout, other errno on failure
+//
+//--------------------------------------------------------------------
+int WaitForEvent(struct Event *Event, const struct timespec *Deadline)
+{
+    int rc = 0;
+
+    while (!TryAcquireEvent(Event)) {
+        if (rc != 0 && rc != EINTR) {
+            return rc;
+        }
+
+        // a poll, or a deadline gone by, never sleeps: don't have setters wake us for nothing
+        if (DeadlinePassed(Deadline)) {
+            return ETIMEDOUT;
+        }
+
+        __atomic_add_fetch(&Event->nWaiters, 1, __ATOMIC_SEQ_CST);
+        rc = FutexWait(&Event->State, 0, Deadline);
+        __atomic_sub_fetch(&Event->nWaiters, 1, __ATOMIC_SEQ_CST);
+    }
+
+    return 0;
+}
 
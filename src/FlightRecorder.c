@@ -0,0 +1,304 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Memory mapped ring of target samples, snapshotted next to each dump
+//
+//      The ring lives in a MAP_SHARED file, so the history is in the page
+//      cache (and eventually on disk) even if procdump itself crashes. A clean
+//      shutdown removes it: each dump already carries its own .samples copy.
+//
+//--------------------------------------------------------------------
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "FlightRecorder.h"
+#include "Logging.h"
+
+static void SampleTick(struct WheelTimer *Timer);
+
+//--------------------------------------------------------------------
+//
+// OpenFlightRecorder - Map the ring file for Pid, creating it if needed
+//
+//      An existing ring for the same pid and layout is appended to, so the
+//      samples from before a procdump crash are kept. Path is copied into
+//      Arena, which must outlive the recorder.
+//
+// Returns: 0 on success, errno otherwise
+//
+//--------------------------------------------------------------------
+int OpenFlightRecorder(struct FlightRecorder *Recorder, pid_t Pid, const char *Path, struct Arena *Arena)
+{
+    size_t size = sizeof(struct FlightRecorderHeader) + FLIGHT_RECORDER_SAMPLES * sizeof(struct SampleRecord);
+    struct FlightRecorderHeader *header;
+    struct stat st;
+    int fd;
+    int rc;
+
+    Recorder->Header = NULL;
+    Recorder->Records = NULL;
+    Recorder->Path = NULL;
+    Recorder->Pid = Pid;
+    Recorder->Wheel = NULL;
+    InitWheelTimer(&Recorder->Timer, SampleTick, Recorder);
+
+    if ((fd = open(Path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) == -1) {
+        Trace("OpenFlightRecorder: failed to open %s.", Path);
+        return errno;
+    }
+
+    if (fstat(fd, &st) == -1 || (st.st_size != (off_t)size && ftruncate(fd, size) == -1)) {
+        rc = errno;
+        Trace("OpenFlightRecorder: failed to size %s.", Path);
+        close(fd);
+        return rc;
+    }
+
+    header = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    rc = errno;
+    close(fd);
+    if (header == MAP_FAILED) {
+        Trace("OpenFlightRecorder: failed to map %s.", Path);
+        return rc;
+    }
+
+    if (memcmp(header->Magic, FLIGHT_RECORDER_MAGIC, sizeof(header->Magic)) != 0 ||
+        header->Version != FLIGHT_RECORDER_VERSION ||
+        header->RecordSize != sizeof(struct SampleRecord) ||
+        header->Capacity != FLIGHT_RECORDER_SAMPLES ||
+        header->Pid != Pid) {
+        // new file or another target's history: start over. Records past
+        // Head are never read, so only the header is cleared; zeroing the
+        // whole ring would fault in every page of it before the first sample
+        memset(header, 0, sizeof(*header));
+        memcpy(header->Magic, FLIGHT_RECORDER_MAGIC, sizeof(header->Magic));
+        header->Version = FLIGHT_RECORDER_VERSION;
+        header->RecordSize = sizeof(struct SampleRecord);
+        header->Capacity = FLIGHT_RECORDER_SAMPLES;
+        header->Pid = Pid;
+        header->Head = 0;
+    }
+
+    Recorder->Header = header;
+    Recorder->Records = (struct SampleRecord *)(header + 1);
+    Recorder->MappedSize = size;
+    if ((Recorder->Path = ArenaStrdup(Arena, Path)) == NULL) {
+        Trace("OpenFlightRecorder: no room to keep %s, it will not be removed.", Path);
+    }
+    return 0;
+}
+
+//--------------------------------------------------------------------
+//
+// CloseFlightRecorder - Stop sampling, unmap the ring and remove its file
+//
+//--------------------------------------------------------------------
+void CloseFlightRecorder(struct FlightRecorder *Recorder)
+{
+    if (Recorder->Header == NULL) {
+        return;
+    }
+
+    if (Recorder->Wheel != NULL) {
+        CancelTimer(Recorder->Wheel, &Recorder->Timer);
+        Recorder->Wheel = NULL;
+    }
+
+    munmap(Recorder->Header, Recorder->MappedSize);
+    Recorder->Header = NULL;
+    Recorder->Records = NULL;
+
+    if (Recorder->Path != NULL) {
+        if (unlink(Recorder->Path) == -1 && errno != ENOENT) {
+            Trace("CloseFlightRecorder: failed to remove %s.", Recorder->Path);
+        }
+        Recorder->Path = NULL;
+    }
+}
+
+//--------------------------------------------------------------------
+//
+// StartFlightRecorder - Sample the target every FLIGHT_RECORDER_INTERVAL on Loop
+//
+//      The first sample is taken right away so that even a dump triggered
+//      immediately has one. The sampling timer does not hold a reference on the loop.
+//
+//--------------------------------------------------------------------
+void StartFlightRecorder(struct FlightRecorder *Recorder, struct EventLoop *Loop)
+{
+    struct ProcessStat proc = {0};
+
+    if (Recorder->Header == NULL) {
+        return;
+    }
+
+    if (GetProcessStat(Recorder->Pid, &proc)) {
+        RecordSample(Recorder, &proc);
+    }
+
+    Recorder->Wheel = &Loop->Timers;
+    ScheduleTimer(Recorder->Wheel, &Recorder->Timer, FLIGHT_RECORDER_INTERVAL);
+}
+
+//--------------------------------------------------------------------
+//
+// SampleTick - Append a sample on the loop thread
+//
+//--------------------------------------------------------------------
+static void SampleTick(struct WheelTimer *Timer)
+{
+    struct FlightRecorder *recorder = (struct FlightRecorder *)Timer->Context;
+    struct ProcessStat proc = {0};
+
+    if (GetProcessStat(recorder->Pid, &proc)) {
+        RecordSample(recorder, &proc);
+    }
+
+    RescheduleTimer(recorder->Wheel, &recorder->Timer, FLIGHT_RECORDER_INTERVAL);
+}
+
+//--------------------------------------------------------------------
+//
+// RecordSample - Append a sample to the ring
+//
+//      Single writer. The record is invalidated, copied in and then
+//      published, so a concurrent snapshot can detect a torn read.
+//
+//--------------------------------------------------------------------
+void RecordSample(struct FlightRecorder *Recorder, const struct ProcessStat *Stat)
+{
+    struct SampleRecord sample;
+    struct SampleRecord *slot;
+    struct timespec now;
+    uint64_t index;
+
+    if (Recorder->Header == NULL) {
+        return;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    sample.Timestamp = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    sample.UserTicks = Stat->utime;
+    sample.SystemTicks = Stat->stime;
+    sample.RssPages = Stat->rss;
+    sample.VirtualBytes = Stat->vsize;
+    sample.MinorFaults = Stat->minflt;
+    sample.MajorFaults = Stat->majflt;
+    sample.Threads = (uint32_t)Stat->num_threads;
+    sample.Processor = Stat->processor;
+    sample.State = Stat->state;
+    memset(sample.Reserved, 0, sizeof(sample.Reserved));
+
+    index = Recorder->Header->Head;
+    slot = &Recorder->Records[index % FLIGHT_RECORDER_SAMPLES];
+
+    __atomic_store_n(&slot->Sequence, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy((char *)slot + sizeof(slot->Sequence), (char *)&sample + sizeof(sample.Sequence), sizeof(sample) - sizeof(sample.Sequence));
+    __atomic_store_n(&slot->Sequence, index + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&Recorder->Header->Head, index + 1, __ATOMIC_RELEASE);
+}
+
+//--------------------------------------------------------------------
+//
+// SnapshotFlightRecorder - Write the last Seconds of samples to Path
+//
+//      Safe to call from a dump worker while the loop keeps appending;
+//      records overwritten during the copy are left out. Records are
+//      streamed out FLIGHT_SNAPSHOT_CHUNK at a time through a buffer
+//      taken from Arena, and the header is written last.
+//
+// Returns: 0 on success, errno otherwise
+//
+//--------------------------------------------------------------------
+int SnapshotFlightRecorder(struct FlightRecorder *Recorder, const char *Path, int Seconds, struct Arena *Arena)
+{
+    struct FlightRecorderHeader header;
+    struct SampleRecord *chunk;
+    struct timespec now;
+    uint64_t head, first, cutoff;
+    uint32_t nSamples = 0, nChunk = 0;
+    size_t chunkSize = FLIGHT_SNAPSHOT_CHUNK * sizeof(struct SampleRecord);
+    int fd;
+    int rc = 0;
+
+    if (Recorder->Header == NULL) {
+        return 0;
+    }
+
+    if ((chunk = (struct SampleRecord *)ArenaAlloc(Arena, chunkSize)) == NULL) {
+        Trace("SnapshotFlightRecorder: arena exhausted.");
+        return ENOMEM;
+    }
+
+    if ((fd = open(Path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1) {
+        rc = errno;
+        Trace("SnapshotFlightRecorder: failed to create %s.", Path);
+        return rc;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    cutoff = (uint64_t)(now.tv_sec - Seconds) * 1000000000ULL + now.tv_nsec;
+
+    head = __atomic_load_n(&Recorder->Header->Head, __ATOMIC_ACQUIRE);
+    first = (head > FLIGHT_RECORDER_SAMPLES) ? head - FLIGHT_RECORDER_SAMPLES : 0;
+
+    // records go after the header, which is only known at the end
+    if (lseek(fd, sizeof(header), SEEK_SET) == -1) {
+        rc = errno;
+    }
+
+    for (uint64_t index = first; index < head && rc == 0; index++) {
+        struct SampleRecord *slot = &Recorder->Records[index % FLIGHT_RECORDER_SAMPLES];
+        struct SampleRecord *copy = &chunk[nChunk];
+
+        if (__atomic_load_n(&slot->Sequence, __ATOMIC_ACQUIRE) != index + 1) {
+            continue;
+        }
+        memcpy(copy, slot, sizeof(*copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->Sequence, __ATOMIC_RELAXED) != index + 1 || copy->Sequence != index + 1) {
+            continue; // overwritten while we copied it
+        }
+
+        if (copy->Timestamp >= cutoff && ++nChunk == FLIGHT_SNAPSHOT_CHUNK) {
+            if (write(fd, chunk, chunkSize) != (ssize_t)chunkSize) {
+                rc = EIO;
+            }
+            nSamples += nChunk;
+            nChunk = 0;
+        }
+    }
+
+    if (rc == 0 && nChunk > 0) {
+        if (write(fd, chunk, nChunk * sizeof(struct SampleRecord)) != (ssize_t)(nChunk * sizeof(struct SampleRecord))) {
+            rc = EIO;
+        }
+        nSamples += nChunk;
+    }
+
+    memcpy(header.Magic, FLIGHT_RECORDER_MAGIC, sizeof(header.Magic));
+    header.Version = FLIGHT_RECORDER_VERSION;
+    header.RecordSize = sizeof(struct SampleRecord);
+    header.Capacity = nSamples;
+    header.Pid = Recorder->Pid;
+    header.Head = nSamples;
+
+    if (rc == 0 && pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+        rc = EIO;
+    }
+    if (rc != 0) {
+        Trace("SnapshotFlightRecorder: failed to write %s.", Path);
+    }
+    if (close(fd) != 0 && rc == 0) {
+        rc = errno;
+    }
+
+    return rc;
+}
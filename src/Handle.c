@@ -9,6 +9,30 @@
 
 #include "Handle.h"
 
+#define NANOSECONDS_PER_SECOND 1000000000L
+#define WAITER_SLICE 5000 // ms a WaitForMultipleObjects waiter blocks before checking it is still needed
+
+//--------------------------------------------------------------------
+//
+// GetWaitDeadline - Convert a relative timeout into an absolute WAIT_CLOCK deadline
+//
+// Parameters:
+//      -Milliseconds -> the time to wait (in milliseconds)
+//      -Deadline -> out, normalized so that tv_nsec < 1e9
+//
+//--------------------------------------------------------------------
+void GetWaitDeadline(int Milliseconds, struct timespec *Deadline)
+{
+    clock_gettime(WAIT_CLOCK, Deadline);
+    Deadline->tv_sec  += Milliseconds / 1000;              // ms->sec
+    Deadline->tv_nsec += (Milliseconds % 1000) * 1000000L; // remaining ms->ns
+
+    if (Deadline->tv_nsec >= NANOSECONDS_PER_SECOND) {
+        Deadline->tv_sec++;
+        Deadline->tv_nsec -= NANOSECONDS_PER_SECOND;
+    }
+}
+
 //--------------------------------------------------------------------
 //
 // WaitForSingleObject - Blocks the current thread until
@@ -34,39 +58,16 @@ int WaitForSingleObject(struct Handle *Handle, int Milliseconds)
     // Get current time and add wait time
     if (Milliseconds != INFINITE_WAIT)
     { // We aren't waiting infinitely
-        clock_gettime(CLOCK_REALTIME, &ts);
-        ts.tv_sec += Milliseconds / 1000;              // ms->sec
-        ts.tv_nsec += (Milliseconds % 1000) * 1000000; // remaining ms->ns
+        GetWaitDeadline(Milliseconds, &ts);
     }
 
     switch (Handle->type) {
     case EVENT:
-        if ((rc = pthread_mutex_lock(&(Handle->event.mutex))) == 0)
-        {
-            Handle->event.nWaiters++;
-            while (!Handle->event.bTriggered && rc == 0)
-            {
-                rc = (Milliseconds == INFINITE_WAIT) ? // either wait
-                    pthread_cond_wait(&(Handle->event.cond), &(Handle->event.mutex)) :  // infinitely
-                    pthread_cond_timedwait(&(Handle->event.cond), &(Handle->event.mutex), &ts); // or till specified time passes
-            }
-            Handle->event.nWaiters--;
-
-            // Check if we should reset
-            if (Handle->event.nWaiters == 0 && !Handle->event.bManualReset)
-            {
-                Handle->event.bTriggered = false;
-            }
-            pthread_mutex_unlock(&(Handle->event.mutex));
-        }
-
-        
+        rc = WaitForEvent(&(Handle->event), (Milliseconds == INFINITE_WAIT) ? NULL : &ts);
         break;
 
     case SEMAPHORE:
-        rc = (Milliseconds == INFINITE_WAIT) ? 
-            sem_wait(&(Handle->semaphore)) :
-            sem_timedwait(&(Handle->semaphore), &ts);
+        rc = WaitForSemaphore(&(Handle->semaphore), (Milliseconds == INFINITE_WAIT) ? NULL : &ts);
         break;
     
     default:
@@ -86,10 +87,12 @@ struct thread_result {
 struct coordinator {
     pthread_cond_t condEventTriggered;
     pthread_mutex_t mutexEventTriggered;
-    struct thread_result *results;
+    struct thread_result *results; // the handles that fired, in order
     int numberTriggered; // behind mutex
-    int nWaiters; // when 0, delete the struct
-    int stopIssued; // when != 0, proceed to cleanup
+    int numberFailed; // behind mutex, waits that timed out or errored
+    int firstError; // behind mutex
+    int nWaiters; // behind mutex, waiter threads plus the caller; when 0, delete the struct
+    int stopIssued; // atomic, when != 0, proceed to cleanup
     struct Handle evtCanCleanUp; // trigger when we leave main wait thread
     struct Handle evtStartWaiting;
 };
@@ -102,52 +105,81 @@ struct thread_args {
     int threadIndex;
 };
 
+//--------------------------------------------------------------------
+//
+// ReleaseCoordinator - Drop a reference to the coordinator, the last one frees it
+//
+//      The caller of WaitForMultipleObjects holds one too, so the coordinator
+//      outlives its SetEvent of evtCanCleanUp.
+//
+//--------------------------------------------------------------------
+static void ReleaseCoordinator(struct coordinator *coordinator)
+{
+    pthread_mutex_lock(&coordinator->mutexEventTriggered);
+    coordinator->nWaiters--;
+
+    if (coordinator->nWaiters == 0) { // if we're the last one, turn the lights out
+        pthread_mutex_unlock(&coordinator->mutexEventTriggered);
+        pthread_mutex_destroy(&coordinator->mutexEventTriggered);
+        pthread_cond_destroy(&coordinator->condEventTriggered);
+        free(coordinator->results);
+        free(coordinator);
+    } else {
+        pthread_mutex_unlock(&coordinator->mutexEventTriggered);
+    }
+}
+
 void *WaiterThread(void *thread_args)
 {
     int rc;
     struct thread_args *input = (struct thread_args *)thread_args;
+    struct coordinator *coordinator = input->coordinator;
+    struct timespec deadline;
+    bool bLastSlice = false;
 
     // Wait for go signal
-    if ((rc = WaitForSingleObject(&(input->coordinator->evtStartWaiting), 2000)) != WAIT_OBJECT_0) {
+    if ((rc = WaitForSingleObject(&(coordinator->evtStartWaiting), 2000)) != WAIT_OBJECT_0) {
         // we messed up and the thread can't start...
     }
 
-    // wait on the event, and then let parent know if we signal
-    if (input->milliseconds == INFINITE_WAIT) {
-        do {
-            rc = WaitForSingleObject(input->handle, 5000); // loop every 5 seconds to make sure we can get out and cleanup if we don't need to wait anymore
-        } while (!input->coordinator->stopIssued && rc == ETIMEDOUT);
-    } else {
-        rc = WaitForSingleObject(input->handle, input->milliseconds); // blocks till timeout, error, or success
+    // wait on the event, and then let parent know if we signal;
+    // in slices, so we get out and cleanup soon after the parent stopped needing us, timed or not
+    if (input->milliseconds != INFINITE_WAIT) {
+        GetWaitDeadline(input->milliseconds, &deadline);
     }
+    do {
+        int slice = WAITER_SLICE;
+
+        if (input->milliseconds != INFINITE_WAIT) {
+            struct timespec now;
+            long long remaining;
+
+            clock_gettime(WAIT_CLOCK, &now);
+            remaining = (deadline.tv_sec - now.tv_sec) * NANOSECONDS_PER_SECOND + (deadline.tv_nsec - now.tv_nsec);
+            remaining = remaining > 0 ? (remaining + 999999) / 1000000 : 0; // round up, never time out early
+            bLastSlice = remaining <= WAITER_SLICE;
+            slice = bLastSlice ? (int)remaining : WAITER_SLICE;
+        }
+        rc = WaitForSingleObject(input->handle, slice);
+    } while (rc == ETIMEDOUT && !bLastSlice && !__atomic_load_n(&coordinator->stopIssued, __ATOMIC_ACQUIRE));
 
 
-    pthread_mutex_lock(&input->coordinator->mutexEventTriggered);
-    struct thread_result result = { .retVal = rc, .threadIndex = input->threadIndex };
-    input->coordinator->results[input->coordinator->numberTriggered++] = result;
-    pthread_mutex_unlock(&input->coordinator->mutexEventTriggered);
-    pthread_cond_signal(&input->coordinator->condEventTriggered);
+    // only a handle that fired is a result; a wait that timed out or failed only counts against the caller's
+    pthread_mutex_lock(&coordinator->mutexEventTriggered);
+    if (rc == 0) {
+        struct thread_result result = { .retVal = rc, .threadIndex = input->threadIndex };
+        coordinator->results[coordinator->numberTriggered++] = result;
+    } else if (coordinator->numberFailed++ == 0) {
+        coordinator->firstError = rc;
+    }
+    pthread_mutex_unlock(&coordinator->mutexEventTriggered);
+    pthread_cond_signal(&coordinator->condEventTriggered);
 
     // Wait for the cleanup signal!
-    WaitForSingleObject(&input->coordinator->evtCanCleanUp, INFINITE_WAIT);
-
-    // Lock mutex to make sure each thread gets a chance to check status
-    pthread_mutex_lock(&input->coordinator->mutexEventTriggered);
-    input->coordinator->nWaiters--;
-
-    if (input->coordinator->nWaiters == 0) { // if we're the last one, turn the lights out
-        pthread_mutex_unlock(&input->coordinator->mutexEventTriggered);
-        pthread_mutex_destroy(&input->coordinator->mutexEventTriggered);
-        pthread_cond_destroy(&input->coordinator->condEventTriggered);
-        free(input->coordinator->results);
-        free(input->coordinator);
-        free(input);
+    WaitForSingleObject(&coordinator->evtCanCleanUp, INFINITE_WAIT);
 
-    } else { // otherwise only clean up your own memory
-        pthread_mutex_unlock(&input->coordinator->mutexEventTriggered);
-        free(input);
-
-    }
+    free(input);
+    ReleaseCoordinator(coordinator);
 
     pthread_exit(NULL);
 }
@@ -195,22 +227,27 @@ int WaitForMultipleObjects(int Count, struct Handle **Handles, bool WaitAll, int
     }
 
     coordinator->numberTriggered = 0;
+    coordinator->numberFailed = 0;
+    coordinator->firstError = 0;
+    coordinator->nWaiters = Count + 1; // the waiters and us
     coordinator->stopIssued = 0;
 
     coordinator->evtCanCleanUp.type = EVENT;
     coordinator->evtStartWaiting.type = EVENT;
     InitNamedEvent(&(coordinator->evtCanCleanUp.event), true, false, "CanCleanUp");
     InitNamedEvent(&(coordinator->evtStartWaiting.event), true, false, "StartWaiting");
-    pthread_cond_init(&coordinator->condEventTriggered, NULL);
+    pthread_condattr_t condAttr;
+    pthread_condattr_init(&condAttr);
+    pthread_condattr_setclock(&condAttr, WAIT_CLOCK); // timed waits below use WAIT_CLOCK deadlines
+    pthread_cond_init(&coordinator->condEventTriggered, &condAttr);
+    pthread_condattr_destroy(&condAttr);
     pthread_mutex_init(&coordinator->mutexEventTriggered, NULL);
 
     results = coordinator->results = (struct thread_result *)malloc(sizeof(struct thread_result) * Count);
 
     // Get current time and add wait time
     if (Milliseconds != -1) { // We aren't waiting infinitely
-        clock_gettime(CLOCK_REALTIME, &ts);
-        ts.tv_sec  += Milliseconds / 1000;              // ms->sec
-        ts.tv_nsec += (Milliseconds % 1000) * 1000000;  // remaining ms->ns
+        GetWaitDeadline(Milliseconds, &ts);
     }
 
     // Create our threads
@@ -233,13 +270,16 @@ int WaitForMultipleObjects(int Count, struct Handle **Handles, bool WaitAll, int
         }
     }
 
-    coordinator->nWaiters = Count;
     SetEvent(&(coordinator->evtStartWaiting.event));
     
     // listen to our threads in no particular order
     while (((WaitAll && coordinator->numberTriggered < Count) ||
            (!WaitAll && coordinator->numberTriggered == 0)) &&
            rc == 0) {
+        if ((WaitAll && coordinator->numberFailed > 0) || coordinator->numberFailed == Count) {
+            rc = coordinator->firstError; // a handle that has to fire won't
+            break;
+        }
         if (Milliseconds == INFINITE_WAIT) {
             if ((rc = pthread_cond_wait(&coordinator->condEventTriggered, &coordinator->mutexEventTriggered)) != 0) {
                 break; // we either errored or timed out, go cleanup
@@ -253,7 +293,15 @@ int WaitForMultipleObjects(int Count, struct Handle **Handles, bool WaitAll, int
     }
     
     
-    coordinator->stopIssued = 1;
+    // rc will be non-zero if we timed/errored out
+    // retVal will be WAIT_OBJECT_0 + threadIndex that fired first (e.g., WAIT_OBJECT_0 + 1)
+    if (rc) {
+        retVal = rc;
+    } else {
+        retVal = (WaitAll) ? WAIT_OBJECT_0 : WAIT_OBJECT_0 + results[0].threadIndex;
+    }
+
+    __atomic_store_n(&coordinator->stopIssued, 1, __ATOMIC_RELEASE);
     pthread_mutex_unlock(&coordinator->mutexEventTriggered);
     
     // cleanup threads
@@ -263,17 +311,10 @@ int WaitForMultipleObjects(int Count, struct Handle **Handles, bool WaitAll, int
 
     // free everything!
     SetEvent(&(coordinator->evtCanCleanUp.event));
+    ReleaseCoordinator(coordinator);
     
     free(threads); // we don't need handles on those threads anymore
     free(thread_args); // each thread has already got their copy and is in charge of freeing it
-    
-    // rc will be non-zero if we timed/errored out
-    // retVal will be <wait code> + threadIndex that fired first (e.g., WAIT_OBJECT_0 + 1, WAIT_ABANDONED + 2)
-    if (rc) {
-        retVal = rc;
-    } else {
-        retVal = (WaitAll) ? rc : results[0].retVal + results[0].threadIndex;
-    }
 
     return retVal;
 }
@@ -4,58 +4,623 @@
 //--------------------------------------------------------------------
 //
 // A simple logging library for log generation and debugging
-// 
+//
 //--------------------------------------------------------------------
 
+#include <sched.h>
+#include <stddef.h>
+#include <sys/types.h>
+
 #include "Logging.h"
-#include "ProcDumpConfiguration.h"
+#include "ThreadRole.h"
 
-static const char *LogLevelStrings[] = { "DEBUG", "INFO", "WARN", "CRITICAL", "ERROR" }; 
+static const char *LogLevelStrings[] = { "DEBUG", "INFO", "WARN", "CRITICAL", "ERROR" };
 
-void LogFormatter(enum LogLevel logLevel, const char *message, va_list args)
+static struct Logger logger;
+
+bool g_DiagTraceEnabled = false;
+
+#define SPEC_NONE -1
+#define SPEC_STAR -2
+#define MAX_SPEC_FLAGS 6
+
+enum LengthModifier { LEN_NONE, LEN_HH, LEN_H, LEN_L, LEN_LL, LEN_J, LEN_Z, LEN_T, LEN_LONG_DOUBLE };
+
+// One parsed printf conversion: %[flags][width][.precision][length]conversion
+struct FormatSpec {
+    char Flags[MAX_SPEC_FLAGS + 1];
+    int Width;                      // SPEC_NONE, SPEC_STAR or the value
+    int Precision;
+    enum LengthModifier Length;
+    char Conversion;                // '\0' for a dangling '%'
+};
+
+//--------------------------------------------------------------------
+//
+// ParseFormatSpec - Parse the conversion starting at the '%' Format points to
+//
+// Returns: pointer just past the conversion
+//
+//--------------------------------------------------------------------
+static const char *ParseFormatSpec(const char *Format, struct FormatSpec *Spec)
+{
+    const char *p = Format + 1;
+    int nFlags = 0;
+
+    while (*p != '\0' && strchr("-+ #0'", *p) != NULL) {
+        if (nFlags < MAX_SPEC_FLAGS) {
+            Spec->Flags[nFlags++] = *p;
+        }
+        p++;
+    }
+    Spec->Flags[nFlags] = '\0';
+
+    Spec->Width = SPEC_NONE;
+    if (*p == '*') {
+        Spec->Width = SPEC_STAR;
+        p++;
+    } else if (*p >= '0' && *p <= '9') {
+        for (Spec->Width = 0; *p >= '0' && *p <= '9'; p++) {
+            Spec->Width = Spec->Width * 10 + (*p - '0');
+        }
+    }
+
+    Spec->Precision = SPEC_NONE;
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            Spec->Precision = SPEC_STAR;
+            p++;
+        } else {
+            for (Spec->Precision = 0; *p >= '0' && *p <= '9'; p++) {
+                Spec->Precision = Spec->Precision * 10 + (*p - '0');
+            }
+        }
+    }
+
+    Spec->Length = LEN_NONE;
+    switch (*p) {
+        case 'h': Spec->Length = (p[1] == 'h') ? LEN_HH : LEN_H; p += (p[1] == 'h') ? 2 : 1; break;
+        case 'l': Spec->Length = (p[1] == 'l') ? LEN_LL : LEN_L; p += (p[1] == 'l') ? 2 : 1; break;
+        case 'q': Spec->Length = LEN_LL; p++; break;
+        case 'j': Spec->Length = LEN_J; p++; break;
+        case 'z': Spec->Length = LEN_Z; p++; break;
+        case 't': Spec->Length = LEN_T; p++; break;
+        case 'L': Spec->Length = LEN_LONG_DOUBLE; p++; break;
+    }
+
+    Spec->Conversion = *p;
+    return (*p == '\0') ? p : p + 1;
+}
+
+//--------------------------------------------------------------------
+//
+// PutArg / GetArg - Append/read one binary argument of the record
+//
+//--------------------------------------------------------------------
+static bool PutArg(struct LogRecord *Record, const void *Value, size_t Size)
+{
+    if (Record->ArgsLen + Size > LOG_RECORD_SIZE) {
+        Record->bTruncated = true;
+        return false;
+    }
+
+    memcpy(Record->Args + Record->ArgsLen, Value, Size);
+    Record->ArgsLen += Size;
+    return true;
+}
+
+static bool GetArg(const struct LogRecord *Record, size_t *Offset, void *Value, size_t Size)
+{
+    if (*Offset + Size > Record->ArgsLen) {
+        return false;
+    }
+
+    memcpy(Value, Record->Args + *Offset, Size);
+    *Offset += Size;
+    return true;
+}
+
+//--------------------------------------------------------------------
+//
+// CaptureArgs - Copy the arguments Format consumes into the record
+//
+//      Integers are widened to (unsigned) long long after being narrowed to
+//      their declared length, so they print the same with an "ll" modifier.
+//
+//--------------------------------------------------------------------
+static void CaptureArgs(struct LogRecord *Record, const char *Format, va_list args)
 {
-    char timeBuff[64];
-    time_t rawTime;
-    struct tm *timeInfo=NULL;
-    char* trace=NULL;
+    const char *p = Format;
 
-    va_list copy;
-    va_copy(copy, args);
+    Record->ArgsLen = 0;
+    Record->bTruncated = false;
 
-    pthread_mutex_lock(&LoggerLock);
+    while ((p = strchr(p, '%')) != NULL && !Record->bTruncated) {
+        struct FormatSpec spec;
+        p = ParseFormatSpec(p, &spec);
 
-    rawTime = time(NULL);
-    timeInfo = localtime(&rawTime);
-    strftime(timeBuff, 64, "%T", timeInfo);
+        if (spec.Width == SPEC_STAR) {
+            int width = va_arg(args, int);
+            PutArg(Record, &width, sizeof(width));
+        }
+        if (spec.Precision == SPEC_STAR) {
+            int precision = va_arg(args, int);
+            PutArg(Record, &precision, sizeof(precision));
+        }
 
-    int traceLen = snprintf(NULL, 0, "[%s - %s]: ", timeBuff, LogLevelStrings[logLevel]);
-    int argsLen = vsnprintf(NULL, 0, message, copy);
-    if(!(trace = malloc(traceLen+argsLen+1)))
-    {
-        pthread_mutex_unlock(&LoggerLock);
-        va_end(copy);
+        switch (spec.Conversion) {
+            case 'd': case 'i': case 'c': {
+                long long value;
+                switch (spec.Length) {
+                    case LEN_HH: value = (signed char)va_arg(args, int); break;
+                    case LEN_H: value = (short)va_arg(args, int); break;
+                    case LEN_L: value = va_arg(args, long); break;
+                    case LEN_LL: value = va_arg(args, long long); break;
+                    case LEN_J: value = va_arg(args, intmax_t); break;
+                    case LEN_Z: value = va_arg(args, ssize_t); break;
+                    case LEN_T: value = va_arg(args, ptrdiff_t); break;
+                    default: value = va_arg(args, int); break;
+                }
+                PutArg(Record, &value, sizeof(value));
+                break;
+            }
+
+            case 'u': case 'o': case 'x': case 'X': {
+                unsigned long long value;
+                switch (spec.Length) {
+                    case LEN_HH: value = (unsigned char)va_arg(args, unsigned int); break;
+                    case LEN_H: value = (unsigned short)va_arg(args, unsigned int); break;
+                    case LEN_L: value = va_arg(args, unsigned long); break;
+                    case LEN_LL: value = va_arg(args, unsigned long long); break;
+                    case LEN_J: value = va_arg(args, uintmax_t); break;
+                    case LEN_Z: value = va_arg(args, size_t); break;
+                    case LEN_T: value = (size_t)va_arg(args, ptrdiff_t); break;
+                    default: value = va_arg(args, unsigned int); break;
+                }
+                PutArg(Record, &value, sizeof(value));
+                break;
+            }
+
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+                if (spec.Length == LEN_LONG_DOUBLE) {
+                    long double value = va_arg(args, long double);
+                    PutArg(Record, &value, sizeof(value));
+                } else {
+                    double value = va_arg(args, double);
+                    PutArg(Record, &value, sizeof(value));
+                }
+                break;
+
+            case 'p': {
+                void *value = va_arg(args, void *);
+                PutArg(Record, &value, sizeof(value));
+                break;
+            }
+
+            case 's': {
+                const char *value = va_arg(args, const char *);
+                size_t room = LOG_RECORD_SIZE - Record->ArgsLen;
+                size_t len;
+
+                if (value == NULL) {
+                    value = "(null)";
+                }
+
+                // strings are copied inline, cut short if they do not fit
+                len = strnlen(value, room);
+                if (len == room) {
+                    if (room == 0) {
+                        Record->bTruncated = true;
+                        break;
+                    }
+                    len = room - 1;
+                    Record->bTruncated = true;
+                }
+                memcpy(Record->Args + Record->ArgsLen, value, len);
+                Record->Args[Record->ArgsLen + len] = '\0';
+                Record->ArgsLen += len + 1;
+                break;
+            }
+
+            case 'n':
+                (void)va_arg(args, int *); // never written through
+                break;
+
+            default:
+                break; // "%%", or something we do not know how to consume
+        }
+    }
+}
+
+//--------------------------------------------------------------------
+//
+// RenderRecord - Format a record's captured arguments into Buffer
+//
+// Returns: length of the message written to Buffer
+//
+//--------------------------------------------------------------------
+static int RenderRecord(const struct LogRecord *Record, char *Buffer, size_t Size)
+{
+    const char *p = Record->Format;
+    size_t offset = 0;
+    size_t len = 0;
+
+    while (*p != '\0' && len + 1 < Size) {
+        const char *next = strchr(p, '%');
+        struct FormatSpec spec;
+        char specBuff[48];
+        int width = 0;
+        int precision = 0;
+        int n = 0;
+
+        // literal text up to the next conversion
+        size_t literal = (next != NULL) ? (size_t)(next - p) : strlen(p);
+        if (literal > Size - 1 - len) {
+            literal = Size - 1 - len;
+        }
+        memcpy(Buffer + len, p, literal);
+        len += literal;
+        if (next == NULL || len + 1 >= Size) {
+            break;
+        }
+
+        p = ParseFormatSpec(next, &spec);
+        if (spec.Conversion == '%') {
+            Buffer[len++] = '%';
+            continue;
+        }
+
+        if ((spec.Width == SPEC_STAR && !GetArg(Record, &offset, &width, sizeof(width))) ||
+            (spec.Precision == SPEC_STAR && !GetArg(Record, &offset, &precision, sizeof(precision)))) {
+            break;
+        }
+        if (spec.Width != SPEC_STAR) {
+            width = spec.Width;
+        }
+        if (spec.Precision != SPEC_STAR) {
+            precision = spec.Precision;
+        }
+
+        // rebuild the conversion with explicit width/precision and the widened length
+        n = snprintf(specBuff, sizeof(specBuff), "%%%s", spec.Flags);
+        if (width != SPEC_NONE) {
+            n += snprintf(specBuff + n, sizeof(specBuff) - n, "%d", width);
+        }
+        if (precision != SPEC_NONE) {
+            n += snprintf(specBuff + n, sizeof(specBuff) - n, ".%d", (precision < 0) ? 0 : precision);
+        }
+
+        switch (spec.Conversion) {
+            case 'd': case 'i': case 'c': {
+                long long value;
+                if (!GetArg(Record, &offset, &value, sizeof(value))) {
+                    goto done;
+                }
+                if (spec.Conversion == 'c') {
+                    snprintf(specBuff + n, sizeof(specBuff) - n, "c");
+                    n = snprintf(Buffer + len, Size - len, specBuff, (int)value);
+                } else {
+                    snprintf(specBuff + n, sizeof(specBuff) - n, "ll%c", spec.Conversion);
+                    n = snprintf(Buffer + len, Size - len, specBuff, value);
+                }
+                break;
+            }
+
+            case 'u': case 'o': case 'x': case 'X': {
+                unsigned long long value;
+                if (!GetArg(Record, &offset, &value, sizeof(value))) {
+                    goto done;
+                }
+                snprintf(specBuff + n, sizeof(specBuff) - n, "ll%c", spec.Conversion);
+                n = snprintf(Buffer + len, Size - len, specBuff, value);
+                break;
+            }
+
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+                if (spec.Length == LEN_LONG_DOUBLE) {
+                    long double value;
+                    if (!GetArg(Record, &offset, &value, sizeof(value))) {
+                        goto done;
+                    }
+                    snprintf(specBuff + n, sizeof(specBuff) - n, "L%c", spec.Conversion);
+                    n = snprintf(Buffer + len, Size - len, specBuff, value);
+                } else {
+                    double value;
+                    if (!GetArg(Record, &offset, &value, sizeof(value))) {
+                        goto done;
+                    }
+                    snprintf(specBuff + n, sizeof(specBuff) - n, "%c", spec.Conversion);
+                    n = snprintf(Buffer + len, Size - len, specBuff, value);
+                }
+                break;
+
+            case 'p': {
+                void *value;
+                if (!GetArg(Record, &offset, &value, sizeof(value))) {
+                    goto done;
+                }
+                snprintf(specBuff + n, sizeof(specBuff) - n, "p");
+                n = snprintf(Buffer + len, Size - len, specBuff, value);
+                break;
+            }
+
+            case 's': {
+                const char *value = Record->Args + offset;
+                if (offset >= Record->ArgsLen) {
+                    goto done;
+                }
+                offset += strlen(value) + 1;
+                snprintf(specBuff + n, sizeof(specBuff) - n, "s");
+                n = snprintf(Buffer + len, Size - len, specBuff, value);
+                break;
+            }
+
+            default:
+                n = 0;
+                break;
+        }
+
+        len += (n < 0) ? 0 : ((size_t)n >= Size - len) ? Size - 1 - len : (size_t)n;
+    }
+
+done:
+    if (Record->bTruncated && len + 4 < Size) {
+        memcpy(Buffer + len, "...", 3);
+        len += 3;
+    }
+    Buffer[len] = '\0';
+    return (int)len;
+}
+
+//--------------------------------------------------------------------
+//
+// ClaimRecord - Reserve the next free ring slot for a producer
+//
+// Returns: the slot (publish it with PublishRecord), NULL if the ring is full
+//
+//--------------------------------------------------------------------
+static struct LogRecord *ClaimRecord()
+{
+    unsigned long pos = __atomic_load_n(&logger.EnqueuePos, __ATOMIC_RELAXED);
+
+    for (;;) {
+        struct LogRecord *record = &logger.Ring[pos & (LOG_RING_SIZE - 1)];
+        unsigned long turn = __atomic_load_n(&record->Turn, __ATOMIC_ACQUIRE);
+        unsigned long lap = 2 * (pos / LOG_RING_SIZE);
+
+        if (turn == lap) {
+            if (__atomic_compare_exchange_n(&logger.EnqueuePos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                return record;
+            }
+            // pos was reloaded by the failed CAS
+        } else if ((long)(turn - lap) < 0) {
+            return NULL; // the flusher has not consumed the previous lap yet
+        } else {
+            pos = __atomic_load_n(&logger.EnqueuePos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void PublishRecord(struct LogRecord *Record)
+{
+    __atomic_store_n(&Record->Turn, Record->Turn + 1, __ATOMIC_RELEASE);
+}
+
+//--------------------------------------------------------------------
+//
+// WriteRecords - Drain every published record, batching the stdout writes
+//
+//      Caller must hold logger.bDraining.
+//
+//--------------------------------------------------------------------
+static void WriteRecords()
+{
+    static char batch[LOG_BATCH_SIZE];
+    static time_t cachedTime = -1;
+    static char timeBuff[64];
+    size_t batchLen = 0;
+    unsigned long dropped;
+    char line[LOG_RECORD_SIZE + 96];
+
+    if ((dropped = __atomic_exchange_n(&logger.nDropped, 0, __ATOMIC_RELAXED)) != 0) {
+        batchLen = snprintf(batch, sizeof(batch), "[%s]: %lu log messages dropped (log ring full)\n", LogLevelStrings[warn], dropped);
+        syslog(LOG_WARNING, "%s", batch);
+    }
+
+    for (;;) {
+        struct LogRecord *record = &logger.Ring[logger.DequeuePos & (LOG_RING_SIZE - 1)];
+        unsigned long turn = 2 * (logger.DequeuePos / LOG_RING_SIZE) + 1;
+        int lineLen;
+
+        if (__atomic_load_n(&record->Turn, __ATOMIC_ACQUIRE) != turn) {
+            break;
+        }
+
+        // localtime takes glibc's tz lock; only the drainer calls it, when the second changes
+        if (record->Time != cachedTime) {
+            struct tm timeInfo;
+            cachedTime = record->Time;
+            localtime_r(&cachedTime, &timeInfo);
+            strftime(timeBuff, sizeof(timeBuff), "%T", &timeInfo);
+        }
+
+        lineLen = snprintf(line, sizeof(line), "[%s - %s]: ", timeBuff, LogLevelStrings[record->Level]);
+        lineLen += RenderRecord(record, line + lineLen, sizeof(line) - lineLen);
+
+        // If a log entry is not 'debug' it simply goes to stdout.
+        // If you want an entry to only go to the syslog, use 'debug'
+        if (record->Level != debug) {
+            if (batchLen + lineLen + 1 > sizeof(batch)) {
+                fwrite(batch, 1, batchLen, stdout);
+                batchLen = 0;
+            }
+            memcpy(batch + batchLen, line, lineLen);
+            batchLen += lineLen;
+            batch[batchLen++] = '\n';
+        }
+
+        // All log entries also go to the syslog
+        syslog(LOG_DEBUG, "%s", line);
+
+        // hand the slot to the next lap's producer
+        __atomic_store_n(&record->Turn, turn + 1, __ATOMIC_RELEASE);
+        logger.DequeuePos++;
+    }
+
+    if (batchLen > 0) {
+        fwrite(batch, 1, batchLen, stdout);
+        fflush(stdout);
+    }
+}
+
+//--------------------------------------------------------------------
+//
+// DrainLog - Write out pending records unless someone else already is
+//
+//      Wait - spin until the current drainer is done instead of leaving it
+//             the records (used when the caller needs them written now)
+//
+//--------------------------------------------------------------------
+static void DrainLog(bool Wait)
+{
+    for (;;) {
+        if (__atomic_exchange_n(&logger.bDraining, true, __ATOMIC_ACQUIRE)) {
+            if (!Wait) {
+                return; // the drainer rechecks the ring after letting go
+            }
+            sched_yield();
+            continue;
+        }
+
+        WriteRecords();
+        __atomic_store_n(&logger.bDraining, false, __ATOMIC_RELEASE);
+
+        // a record published while we were letting go would otherwise be stranded
+        struct LogRecord *next = &logger.Ring[__atomic_load_n(&logger.DequeuePos, __ATOMIC_RELAXED) & (LOG_RING_SIZE - 1)];
+        if (__atomic_load_n(&next->Turn, __ATOMIC_ACQUIRE) % 2 == 0) {
+            return;
+        }
+    }
+}
+
+//--------------------------------------------------------------------
+//
+// FlusherThread - Sleep until records are published, then write them out
+//
+//--------------------------------------------------------------------
+static void *FlusherThread(void *arg)
+{
+    EnterThreadRole(THREAD_ROLE_LOGGER);
+
+    while (!__atomic_load_n(&logger.bStop, __ATOMIC_ACQUIRE)) {
+        WaitForEvent(&logger.evtPending, NULL);
+        DrainLog(false);
+    }
+
+    return NULL;
+}
+
+//--------------------------------------------------------------------
+//
+// StartLogger - Hand log writing to a background flusher thread
+//
+//      Call after blocking any signals that are read from a signalfd.
+//
+// Returns: 0 on success, errno otherwise
+//
+//--------------------------------------------------------------------
+int StartLogger()
+{
+    static bool bAtExit = false;
+    int rc;
+
+    if (logger.bRunning) {
+        return 0;
+    }
+
+    if (!bAtExit) {
+        atexit(FlushLog); // exit(-1) on an error path must not lose its messages
+        bAtExit = true;
+    }
+
+    InitEvent(&logger.evtPending, false, false);
+    logger.bStop = false;
+    if ((rc = pthread_create(&logger.Flusher, NULL, FlusherThread, NULL)) != 0) {
+        return rc;
+    }
+
+    __atomic_store_n(&logger.bRunning, true, __ATOMIC_RELEASE);
+    return 0;
+}
+
+//--------------------------------------------------------------------
+//
+// StopLogger - Stop the flusher and write out everything still queued
+//
+//--------------------------------------------------------------------
+void StopLogger()
+{
+    if (!logger.bRunning) {
         return;
     }
-    
-    sprintf(trace, "[%s - %s]: ", timeBuff, LogLevelStrings[logLevel]);
-    vsprintf(trace+traceLen, message, args);
 
-    // If a log entry is not 'debug' it simply goes to stdout. 
-    // If you want an entry to only go to the syslog, use 'debug' 
-    if(logLevel != debug)
-    {
-        puts(trace);
+    __atomic_store_n(&logger.bRunning, false, __ATOMIC_RELEASE);
+    __atomic_store_n(&logger.bStop, true, __ATOMIC_RELEASE);
+    SetEvent(&logger.evtPending);
+    pthread_join(logger.Flusher, NULL);
+
+    FlushLog();
+}
+
+//--------------------------------------------------------------------
+//
+// FlushLog - Synchronously write out every queued record
+//
+//--------------------------------------------------------------------
+void FlushLog()
+{
+    DrainLog(true);
+}
+
+//--------------------------------------------------------------------
+//
+// LogFormatter - Capture a message and its arguments into the log ring
+//
+//      With the flusher running this never blocks: a full ring drops the
+//      message (the count is reported). Without it the caller writes the
+//      ring out itself, the way logging always worked during startup.
+//
+//--------------------------------------------------------------------
+void LogFormatter(enum LogLevel logLevel, const char *message, va_list args)
+{
+    struct LogRecord *record;
+    struct timespec now;
+
+    while ((record = ClaimRecord()) == NULL) {
+        if (__atomic_load_n(&logger.bRunning, __ATOMIC_ACQUIRE)) {
+            __atomic_add_fetch(&logger.nDropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        DrainLog(true);
     }
 
-    // All log entries also go to the syslog
-    syslog(LOG_DEBUG, "%s", trace);
+    // a coarse clock read is enough for a seconds timestamp
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+    record->Level = logLevel;
+    record->Time = now.tv_sec;
+    record->Format = message;
+    CaptureArgs(record, message, args);
+    PublishRecord(record);
 
-    va_end(copy);
-    free(trace);
-    pthread_mutex_unlock(&LoggerLock);
+    if (__atomic_load_n(&logger.bRunning, __ATOMIC_ACQUIRE)) {
+        SetEvent(&logger.evtPending);
+    } else {
+        DrainLog(false);
+    }
 }
 
-void Log(enum LogLevel logLevel, const char *message, ...)
+void LogMessage(enum LogLevel logLevel, const char *message, ...)
 {
     va_list args;
     va_start(args, message);
@@ -68,6 +633,6 @@ void DiagTrace(const char *message, ...)
 {
     va_list args;
     va_start(args, message);
-    if(g_config.DiagnosticsLoggingEnabled) LogFormatter(debug, message, args);
+    if(g_DiagTraceEnabled) LogFormatter(debug, message, args);
     va_end(args);
 }
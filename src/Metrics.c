@@ -0,0 +1,518 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Counters, gauges and histograms exported in Prometheus text format
+//
+//      Every thread updates its own cache line aligned slot with relaxed
+//      atomics; a scrape sums the slots. Gauges belong to a target and are
+//      only set on the monitoring loop, like the scrapes, which are served
+//      from it over a Unix domain socket.
+//
+//--------------------------------------------------------------------
+
+#include <sys/socket.h>
+
+#include "Metrics.h"
+#include "CoreDumpWriter.h"
+#include "Logging.h"
+
+#define METRIC_BUCKETS 14
+
+// histogram bucket upper bounds, ns
+static const uint64_t BucketBounds[METRIC_BUCKETS] = {
+    100000ULL, 500000ULL, 1000000ULL, 5000000ULL, 10000000ULL, 50000000ULL, 100000000ULL,
+    500000000ULL, 1000000000ULL, 5000000000ULL, 10000000000ULL, 30000000000ULL, 60000000000ULL, 300000000000ULL
+};
+
+static const struct {
+    const char *Name;
+    const char *Help;
+} CounterInfo[METRIC_COUNTERS] = {
+    { "procdump_samples_total", "Trigger evaluations" },
+    { "procdump_triggers_fired_total", "Trigger evaluations that requested a dump" },
+    { "procdump_dumps_total", "Core dumps written" },
+    { "procdump_dump_failures_total", "Dumps that did not produce a core file" },
+    { "procdump_dump_bytes_total", "Bytes of core dumps written" },
+    { "procdump_dumps_dropped_total", "Dumps dropped by the node's dump budget" },
+}, GaugeInfo[METRIC_GAUGES] = {
+    { "procdump_trigger_value", "Last sampled value (CPU percent, commit MB)" },
+    { "procdump_trigger_threshold", "Configured threshold (CPU percent, commit MB)" },
+}, HistogramInfo[METRIC_HISTOGRAMS] = {
+    { "procdump_sample_duration_seconds", "Time taken to sample the target and evaluate the trigger" },
+    { "procdump_dump_duration_seconds", "Time taken to write a core dump" },
+    { "procdump_time_to_armed_seconds", "Time from starting to monitor the target to the trigger's first sample" },
+    { "procdump_target_stopped_seconds", "Time the target was stopped while a dump was written" },
+};
+
+struct MetricSlot {
+    uint64_t Counters[METRIC_COUNTERS][METRIC_TRIGGER_TYPES];
+    uint64_t Buckets[METRIC_HISTOGRAMS][METRIC_TRIGGER_TYPES][METRIC_BUCKETS + 1];
+    uint64_t Sums[METRIC_HISTOGRAMS][METRIC_TRIGGER_TYPES];
+} __attribute__((aligned(64)));
+
+static struct MetricSlot slots[METRIC_THREAD_SLOTS + 1];    // the last one is shared
+static int nSlots = 0;
+static __thread struct MetricSlot *threadSlot = NULL;
+
+static struct MetricTarget *targets = NULL;     // registered, newest first
+static int nTargets = 0;
+
+static void MetricsAccept(struct EventSource *Source, uint32_t Events);
+static void MetricsRequest(struct EventSource *Source, uint32_t Events);
+static void MetricsFlush(struct MetricsClient *Client);
+
+//--------------------------------------------------------------------
+//
+// ThreadSlot - The calling thread's slot, claimed on first use
+//
+//--------------------------------------------------------------------
+static struct MetricSlot *ThreadSlot()
+{
+    if (threadSlot == NULL) {
+        int index = __atomic_fetch_add(&nSlots, 1, __ATOMIC_RELAXED);
+        threadSlot = &slots[(index < METRIC_THREAD_SLOTS) ? index : METRIC_THREAD_SLOTS];
+    }
+
+    return threadSlot;
+}
+
+static bool IsValidTrigger(int Trigger)
+{
+    return Trigger >= 0 && Trigger < METRIC_TRIGGER_TYPES;
+}
+
+//--------------------------------------------------------------------
+//
+// CountMetric - Add Delta to a counter
+//
+//--------------------------------------------------------------------
+void CountMetric(enum MetricCounter Counter, int Trigger, uint64_t Delta)
+{
+    if (IsValidTrigger(Trigger)) {
+        __atomic_fetch_add(&ThreadSlot()->Counters[Counter][Trigger], Delta, __ATOMIC_RELAXED);
+    }
+}
+
+//--------------------------------------------------------------------
+//
+// SetMetricGauge - Set one of Target's gauges
+//
+//--------------------------------------------------------------------
+void SetMetricGauge(struct MetricTarget *Target, enum MetricGauge Gauge, int Trigger, int64_t Value)
+{
+    if (!IsValidTrigger(Trigger)) {
+        return;
+    }
+
+    Target->Gauges[Gauge][Trigger] = Value;
+    Target->Set |= 1 << (Gauge * METRIC_TRIGGER_TYPES + Trigger);
+}
+
+//--------------------------------------------------------------------
+//
+// RegisterMetricTarget - Export Target's gauges, labelled with Pid and Rule
+//
+//      Rule must outlive the registration. The gauges start out unset.
+//
+//--------------------------------------------------------------------
+void RegisterMetricTarget(struct MetricTarget *Target, pid_t Pid, const char *Rule)
+{
+    if (Target->bRegistered) {
+        UnregisterMetricTarget(Target);
+    }
+
+    Target->Pid = Pid;
+    Target->Rule = Rule;
+    Target->Set = 0;
+    Target->Prev = NULL;
+    Target->Next = targets;
+    if (targets != NULL) {
+        targets->Prev = Target;
+    }
+    targets = Target;
+    nTargets++;
+    Target->bRegistered = true;
+}
+
+//--------------------------------------------------------------------
+//
+// UnregisterMetricTarget - Stop exporting Target's gauges
+//
+//--------------------------------------------------------------------
+void UnregisterMetricTarget(struct MetricTarget *Target)
+{
+    if (!Target->bRegistered) {
+        return;
+    }
+
+    if (Target->Prev != NULL) {
+        Target->Prev->Next = Target->Next;
+    } else {
+        targets = Target->Next;
+    }
+    if (Target->Next != NULL) {
+        Target->Next->Prev = Target->Prev;
+    }
+    Target->Next = Target->Prev = NULL;
+    nTargets--;
+    Target->bRegistered = false;
+}
+
+//--------------------------------------------------------------------
+//
+// EscapeLabel - Value as a Prometheus label value, cut short to fit Size
+//
+//--------------------------------------------------------------------
+static void EscapeLabel(const char *Value, char *Buffer, size_t Size)
+{
+    size_t len = 0;
+
+    for (const char *c = Value; *c != '\0' && len + 3 < Size; c++) {
+        if (*c == '"' || *c == '\\') {
+            Buffer[len++] = '\\';
+            Buffer[len++] = *c;
+        } else if (*c == '\n') {
+            Buffer[len++] = '\\';
+            Buffer[len++] = 'n';
+        } else {
+            Buffer[len++] = *c;
+        }
+    }
+    Buffer[len] = '\0';
+}
+
+//--------------------------------------------------------------------
+//
+// ObserveMetric - Record a duration in a histogram
+//
+//--------------------------------------------------------------------
+void ObserveMetric(enum MetricHistogram Histogram, int Trigger, uint64_t Nanoseconds)
+{
+    struct MetricSlot *slot;
+    int bucket = 0;
+
+    if (!IsValidTrigger(Trigger)) {
+        return;
+    }
+
+    while (bucket < METRIC_BUCKETS && Nanoseconds > BucketBounds[bucket]) {
+        bucket++;
+    }
+
+    slot = ThreadSlot();
+    __atomic_fetch_add(&slot->Buckets[Histogram][Trigger][bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&slot->Sums[Histogram][Trigger], Nanoseconds, __ATOMIC_RELAXED);
+}
+
+//--------------------------------------------------------------------
+//
+// MetricClock - CLOCK_MONOTONIC in ns, for timing what goes into histograms
+//
+//--------------------------------------------------------------------
+uint64_t MetricClock()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+//--------------------------------------------------------------------
+//
+// FormatMetrics - Sum every slot into Prometheus text exposition format
+//
+//      The per-target gauges come last, so that a Buffer too small for
+//      every target still gets the counters and histograms.
+//
+// Returns: bytes written to Buffer (output is cut short if it does not fit)
+//
+//--------------------------------------------------------------------
+size_t FormatMetrics(char *Buffer, size_t Size)
+{
+    int used = __atomic_load_n(&nSlots, __ATOMIC_RELAXED);
+    char rule[METRIC_LABEL_SIZE];
+    size_t len = 0;
+    int n;
+
+#define APPEND(...) \
+    do { \
+        n = snprintf(Buffer + len, Size - len, __VA_ARGS__); \
+        if (n < 0 || (size_t)n >= Size - len) { \
+            Log(warn, "Metrics response cut short at %zu bytes", len); \
+            return len; \
+        } \
+        len += n; \
+    } while (0)
+
+    used = (used < METRIC_THREAD_SLOTS) ? used : METRIC_THREAD_SLOTS + 1;
+
+    for (int c = 0; c < METRIC_COUNTERS; c++) {
+        APPEND("# HELP %s %s\n# TYPE %s counter\n", CounterInfo[c].Name, CounterInfo[c].Help, CounterInfo[c].Name);
+        for (int t = 0; t < METRIC_TRIGGER_TYPES; t++) {
+            uint64_t total = 0;
+            for (int s = 0; s < used; s++) {
+                total += __atomic_load_n(&slots[s].Counters[c][t], __ATOMIC_RELAXED);
+            }
+            if (total != 0) {
+                APPEND("%s{trigger=\"%s\"} %llu\n", CounterInfo[c].Name, CoreDumpTypeStrings[t], (unsigned long long)total);
+            }
+        }
+    }
+
+    for (int h = 0; h < METRIC_HISTOGRAMS; h++) {
+        APPEND("# HELP %s %s\n# TYPE %s histogram\n", HistogramInfo[h].Name, HistogramInfo[h].Help, HistogramInfo[h].Name);
+        for (int t = 0; t < METRIC_TRIGGER_TYPES; t++) {
+            uint64_t buckets[METRIC_BUCKETS + 1] = {0};
+            uint64_t sum = 0;
+            uint64_t count = 0;
+
+            for (int s = 0; s < used; s++) {
+                for (int b = 0; b <= METRIC_BUCKETS; b++) {
+                    buckets[b] += __atomic_load_n(&slots[s].Buckets[h][t][b], __ATOMIC_RELAXED);
+                }
+                sum += __atomic_load_n(&slots[s].Sums[h][t], __ATOMIC_RELAXED);
+            }
+            for (int b = 0; b <= METRIC_BUCKETS; b++) {
+                count += buckets[b];
+            }
+            if (count == 0) {
+                continue;
+            }
+
+            // Prometheus buckets are cumulative
+            count = 0;
+            for (int b = 0; b < METRIC_BUCKETS; b++) {
+                count += buckets[b];
+                APPEND("%s_bucket{trigger=\"%s\",le=\"%g\"} %llu\n", HistogramInfo[h].Name, CoreDumpTypeStrings[t],
+                       BucketBounds[b] / 1e9, (unsigned long long)count);
+            }
+            count += buckets[METRIC_BUCKETS];
+            APPEND("%s_bucket{trigger=\"%s\",le=\"+Inf\"} %llu\n", HistogramInfo[h].Name, CoreDumpTypeStrings[t], (unsigned long long)count);
+            APPEND("%s_sum{trigger=\"%s\"} %.9f\n", HistogramInfo[h].Name, CoreDumpTypeStrings[t], sum / 1e9);
+            APPEND("%s_count{trigger=\"%s\"} %llu\n", HistogramInfo[h].Name, CoreDumpTypeStrings[t], (unsigned long long)count);
+        }
+    }
+
+    for (int g = 0; g < METRIC_GAUGES; g++) {
+        APPEND("# HELP %s %s\n# TYPE %s gauge\n", GaugeInfo[g].Name, GaugeInfo[g].Help, GaugeInfo[g].Name);
+        for (struct MetricTarget *target = targets; target != NULL; target = target->Next) {
+            EscapeLabel(target->Rule != NULL ? target->Rule : "", rule, sizeof(rule));
+            for (int t = 0; t < METRIC_TRIGGER_TYPES; t++) {
+                if (!(target->Set & (1 << (g * METRIC_TRIGGER_TYPES + t)))) {
+                    continue;
+                }
+                if (target->Rule != NULL) {
+                    APPEND("%s{trigger=\"%s\",pid=\"%d\",rule=\"%s\"} %lld\n", GaugeInfo[g].Name, CoreDumpTypeStrings[t],
+                           target->Pid, rule, (long long)target->Gauges[g][t]);
+                } else {
+                    APPEND("%s{trigger=\"%s\",pid=\"%d\"} %lld\n", GaugeInfo[g].Name, CoreDumpTypeStrings[t],
+                           target->Pid, (long long)target->Gauges[g][t]);
+                }
+            }
+        }
+    }
+
+#undef APPEND
+
+    return len;
+}
+
+//--------------------------------------------------------------------
+//
+// StartMetricsServer - Listen for scrapes on the Unix domain socket Path
+//
+//      A stale socket left at Path by an earlier run is replaced.
+//      The listener does not hold a reference on the loop.
+//
+// Returns: 0 on success, errno otherwise
+//
+//--------------------------------------------------------------------
+int StartMetricsServer(struct MetricsServer *Server, struct EventLoop *Loop, const char *Path)
+{
+    int rc;
+
+    Server->Loop = Loop;
+    Server->Path = NULL;
+    for (int i = 0; i < METRIC_CLIENTS; i++) {
+        Server->Clients[i].Source.fd = NO_FD;
+        Server->Clients[i].Source.Handler = MetricsRequest;
+        Server->Clients[i].Source.Context = &Server->Clients[i];
+        Server->Clients[i].Server = Server;
+        Server->Clients[i].Response = NULL;
+        Server->Clients[i].ResponseSize = 0;
+    }
+
+    if ((rc = InitListenerSource(&Server->Listener, Path, METRIC_SOCKET_MODE, METRIC_CLIENTS, MetricsAccept, Server)) != 0) {
+        return rc;
+    }
+
+    if ((rc = AddEventSource(Loop, &Server->Listener, EPOLLIN)) != 0) {
+        close(Server->Listener.fd);
+        Server->Listener.fd = NO_FD;
+        unlink(Path);
+        return rc;
+    }
+
+    Server->Path = strdup(Path);
+    return 0;
+}
+
+//--------------------------------------------------------------------
+//
+// StopMetricsServer - Close the listener and any scrape in progress
+//
+//--------------------------------------------------------------------
+void StopMetricsServer(struct MetricsServer *Server)
+{
+    if (Server->Path == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < METRIC_CLIENTS; i++) {
+        RemoveEventSource(Server->Loop, &Server->Clients[i].Source);
+        free(Server->Clients[i].Response);
+        Server->Clients[i].Response = NULL;
+        Server->Clients[i].ResponseSize = 0;
+    }
+    RemoveEventSource(Server->Loop, &Server->Listener);
+
+    unlink(Server->Path);
+    free(Server->Path);
+    Server->Path = NULL;
+}
+
+//--------------------------------------------------------------------
+//
+// MetricsAccept - New scrape connection; wait for its request on the loop
+//
+//--------------------------------------------------------------------
+static void MetricsAccept(struct EventSource *Source, uint32_t Events)
+{
+    struct MetricsServer *server = (struct MetricsServer *)Source->Context;
+    int fd;
+
+    while ((fd = AcceptConnection(Source)) != -1) {
+        struct MetricsClient *client = NULL;
+
+        for (int i = 0; i < METRIC_CLIENTS && client == NULL; i++) {
+            if (server->Clients[i].Source.fd == NO_FD) {
+                client = &server->Clients[i];
+            }
+        }
+
+        if (client == NULL) {
+            close(fd); // too many scrapes at once
+            continue;
+        }
+
+        client->Source.fd = fd;
+        client->RequestLength = 0;
+        client->ResponseStart = 0;
+        client->ResponseEnd = 0;
+        if (AddEventSource(server->Loop, &client->Source, EPOLLIN) != 0) {
+            close(fd);
+            client->Source.fd = NO_FD;
+        }
+    }
+}
+
+//--------------------------------------------------------------------
+//
+// MetricsRequest - Answer a scrape once its request has arrived
+//
+//      Requests that look like HTTP get an HTTP/1.0 response, anything else
+//      (e.g. "nc -U") gets the bare exposition text. A response the socket
+//      does not take at once is sent as the peer drains it (EPOLLOUT).
+//
+//--------------------------------------------------------------------
+static void MetricsRequest(struct EventSource *Source, uint32_t Events)
+{
+    struct MetricsClient *client = (struct MetricsClient *)Source->Context;
+    char header[METRIC_HEADER_SIZE];
+    size_t bodyLength;
+    size_t size;
+    int headerLength = 0;
+    ssize_t n;
+
+    if (client->ResponseEnd != 0) {
+        MetricsFlush(client);
+        return;
+    }
+
+    n = read(Source->fd, client->Request + client->RequestLength, sizeof(client->Request) - 1 - client->RequestLength);
+    if (n == -1) {
+        if (errno != EAGAIN && errno != EINTR) {
+            RemoveEventSource(client->Server->Loop, Source);
+        }
+        return;
+    }
+    if (n > 0) {
+        client->RequestLength += n;
+        client->Request[client->RequestLength] = '\0';
+
+        // wait for the end of the HTTP request headers
+        if (strncmp(client->Request, "GET ", 4) == 0 && strstr(client->Request, "\r\n\r\n") == NULL &&
+            client->RequestLength < sizeof(client->Request) - 1) {
+            return;
+        }
+    }
+
+    client->Request[client->RequestLength] = '\0';
+
+    size = METRIC_HEADER_SIZE + METRIC_RESPONSE_SIZE + (size_t)nTargets * METRIC_TARGET_RESPONSE_SIZE;
+    if (client->ResponseSize < size) {
+        char *response = realloc(client->Response, size);
+        if (response == NULL) {
+            Trace("MetricsRequest: failed to grow the response to %zu bytes.", size);
+            RemoveEventSource(client->Server->Loop, Source);
+            return;
+        }
+        client->Response = response;
+        client->ResponseSize = size;
+    }
+
+    // the body is formatted in place and the header, once its length is known, put right before it
+    bodyLength = FormatMetrics(client->Response + METRIC_HEADER_SIZE, client->ResponseSize - METRIC_HEADER_SIZE);
+    if (strncmp(client->Request, "GET ", 4) == 0) {
+        headerLength = snprintf(header, sizeof(header),
+                                "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", bodyLength);
+        memcpy(client->Response + METRIC_HEADER_SIZE - headerLength, header, headerLength);
+    }
+    client->ResponseStart = METRIC_HEADER_SIZE - headerLength;
+    client->ResponseEnd = METRIC_HEADER_SIZE + bodyLength;
+
+    MetricsFlush(client);
+}
+
+//--------------------------------------------------------------------
+//
+// MetricsFlush - Send as much of the response as the socket takes
+//
+//      The connection is closed once everything is out or the peer is gone;
+//      otherwise the client waits for EPOLLOUT to send the rest.
+//
+//--------------------------------------------------------------------
+static void MetricsFlush(struct MetricsClient *Client)
+{
+    struct EventLoop *loop = Client->Server->Loop;
+    ssize_t n;
+
+    while (Client->ResponseStart < Client->ResponseEnd) {
+        n = send(Client->Source.fd, Client->Response + Client->ResponseStart, Client->ResponseEnd - Client->ResponseStart,
+                 MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN && ModifyEventSource(loop, &Client->Source, EPOLLOUT) == 0) {
+                return;
+            }
+            break;
+        }
+        Client->ResponseStart += n;
+    }
+
+    RemoveEventSource(loop, &Client->Source);
+}
@@ -0,0 +1,899 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Stack only ELF core
+//
+//      Every thread of the target is seized and interrupted, and while
+//      they are all stopped procdump writes an ELF core file itself:
+//
+//          PT_NOTE     NT_PRSTATUS and NT_FPREGSET per thread (the main
+//                      thread first, as the kernel does), NT_PRPSINFO,
+//                      NT_AUXV and NT_FILE, the file mappings
+//          PT_LOAD     the top MINI_DUMP_STACK_SIZE bytes of each
+//                      thread's stack, and the vdso
+//
+//      gdb, lldb and elfutils read it like any other core: registers
+//      and backtraces of every thread, with the executable and shared
+//      libraries found through NT_FILE and the auxiliary vector. There
+//      is no heap, so anything that points off the stacks reads as
+//      unavailable. The file is a few MB at most and the target is
+//      stopped for milliseconds.
+//
+//      A thread in an uninterruptible sleep (D) cannot stop until it
+//      wakes, which may be never. After MINI_DUMP_STOP_TIMEOUT it is
+//      dumped as it sleeps: /proc gives its system call, stack pointer
+//      and program counter, enough for a debugger to unwind it. The
+//      threads are seized from a thread of their own, so the ones that
+//      never stopped are let go when it exits.
+//
+//      Nothing here allocates from the heap: the bookkeeping lives in
+//      one mapping made per dump.
+//
+//--------------------------------------------------------------------
+
+#include <dirent.h>
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/procfs.h>
+#include <sys/ptrace.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+
+#include "Logging.h"
+#include "Metrics.h"
+#include "MiniDump.h"
+#include "Process.h"
+
+#ifndef NT_FILE
+#define NT_FILE 0x46494c45
+#endif
+
+#define NOTE_NAME "CORE"
+#define NOTE_ALIGN(n) (((n) + 3) & ~(size_t)3)
+#define MAX_COPY_PAGES (MINI_DUMP_COPY_SIZE / 4096)
+#define STOP_POLL_INTERVAL 20000            // ns between checks for stopped threads
+
+struct MiniThread {
+    pid_t Tid;
+    int Signal;                             // stopped with, handed back on detach
+    bool bWaiting;                          // seized, interrupted, not stopped yet
+    bool bStopped;                          // seized and stopped, must be detached
+    bool bAsleep;                           // seized but did not stop in time, released when the seizing thread exits
+    bool bRegisters;
+    struct elf_prstatus Status;
+    elf_fpregset_t FpRegs;
+    bool bFpValid;
+};
+
+struct MiniSegment {
+    uint64_t Start;
+    uint64_t End;
+    uint32_t Flags;
+};
+
+// One line of /proc/<pid>/maps; Path is not NUL terminated
+struct MiniMapping {
+    uint64_t Start;
+    uint64_t End;
+    uint64_t Offset;
+    bool bReadable;
+    const char *Path;
+    size_t PathLength;
+};
+
+// What WriteMiniDump hands its dump thread
+struct MiniDumpRequest {
+    pid_t Pid;
+    const char *Path;
+    struct MiniDumpResult *Result;
+    int rc;
+};
+
+struct MiniDump {
+    pid_t Pid;
+    long PageSize;
+    void *Memory;
+    size_t MemorySize;
+    struct MiniThread *Threads;
+    int nThreads;
+    struct MiniSegment *Segments;
+    int nSegments;
+    char *Maps;                             // /proc/<pid>/maps, read once all threads are stopped
+    char *Copy;                             // target memory on its way to the file
+    char *Out;                              // everything else on its way to the file
+    size_t OutUsed;
+    int fd;
+    uint64_t Offset;
+    int Error;
+};
+
+//--------------------------------------------------------------------
+//
+// Emit / Flush - Buffered writes to the core file; the first error sticks
+//
+//--------------------------------------------------------------------
+static void WriteAll(struct MiniDump *Dump, const void *Data, size_t Size)
+{
+    const char *data = (const char *)Data;
+
+    while (Size > 0 && Dump->Error == 0) {
+        ssize_t n = write(Dump->fd, data, Size);
+        if (n == -1) {
+            if (errno != EINTR) {
+                Dump->Error = errno;
+            }
+            continue;
+        }
+        data += n;
+        Size -= n;
+    }
+}
+
+static void Flush(struct MiniDump *Dump)
+{
+    WriteAll(Dump, Dump->Out, Dump->OutUsed);
+    Dump->OutUsed = 0;
+}
+
+static void Emit(struct MiniDump *Dump, const void *Data, size_t Size)
+{
+    if (Dump->OutUsed + Size > MINI_DUMP_COPY_SIZE) {
+        Flush(Dump);
+    }
+    if (Size > MINI_DUMP_COPY_SIZE) {
+        WriteAll(Dump, Data, Size);
+    } else {
+        memcpy(Dump->Out + Dump->OutUsed, Data, Size);
+        Dump->OutUsed += Size;
+    }
+    Dump->Offset += Size;
+}
+
+static void EmitZeros(struct MiniDump *Dump, size_t Size)
+{
+    static const char zeros[64] = {0};
+
+    while (Size > 0) {
+        size_t n = Size < sizeof(zeros) ? Size : sizeof(zeros);
+        Emit(Dump, zeros, n);
+        Size -= n;
+    }
+}
+
+//--------------------------------------------------------------------
+//
+// NoteSize / EmitNote - An ELF note named CORE
+//
+//--------------------------------------------------------------------
+static size_t NoteSize(size_t DescSize)
+{
+    return sizeof(Elf64_Nhdr) + NOTE_ALIGN(sizeof(NOTE_NAME)) + NOTE_ALIGN(DescSize);
+}
+
+static void EmitNoteHeader(struct MiniDump *Dump, uint32_t Type, size_t DescSize)
+{
+    Elf64_Nhdr header = { sizeof(NOTE_NAME), (Elf64_Word)DescSize, Type };
+    char name[NOTE_ALIGN(sizeof(NOTE_NAME))] = NOTE_NAME;
+
+    Emit(Dump, &header, sizeof(header));
+    Emit(Dump, name, sizeof(name));
+}
+
+static void EmitNote(struct MiniDump *Dump, uint32_t Type, const void *Desc, size_t DescSize)
+{
+    EmitNoteHeader(Dump, Type, DescSize);
+    Emit(Dump, Desc, DescSize);
+    EmitZeros(Dump, NOTE_ALIGN(DescSize) - DescSize);
+}
+
+//--------------------------------------------------------------------
+//
+// NextMapping - Parse the next line of the maps text at *Cursor
+//
+// Returns: false at the end of the text
+//
+//--------------------------------------------------------------------
+static bool NextMapping(const char **Cursor, struct MiniMapping *Mapping)
+{
+    const char *line = *Cursor;
+    char *field;
+
+    // "start-end perms offset dev inode   path", by hand: sscanf would
+    // measure the rest of the text on every line
+    while (*line != '\0') {
+        const char *next = line + strcspn(line, "\n");
+        next += (*next == '\n');
+
+        Mapping->Start = strtoull(line, &field, 16);
+        if (*field == '-') {
+            Mapping->End = strtoull(field + 1, &field, 16);
+            Mapping->bReadable = field[0] == ' ' && field[1] == 'r';
+            field += strcspn(field + 1, " \n") + 1;
+            Mapping->Offset = strtoull(field, &field, 16);
+            for (int skip = 0; skip < 2; skip++) {
+                field += strspn(field, " ");
+                field += strcspn(field, " \n");
+            }
+            field += strspn(field, " ");
+            Mapping->Path = field;
+            Mapping->PathLength = strcspn(field, "\n");
+            *Cursor = next;
+            return true;
+        }
+        line = next;
+    }
+
+    *Cursor = line;
+    return false;
+}
+
+//--------------------------------------------------------------------
+//
+// StackPointer - of a thread whose registers were read
+//
+//--------------------------------------------------------------------
+static uint64_t StackPointer(struct MiniThread *Thread)
+{
+    struct user_regs_struct *regs = (struct user_regs_struct *)&Thread->Status.pr_reg;
+
+#if defined(__x86_64__)
+    return regs->rsp;
+#else
+    return regs->sp;
+#endif
+}
+
+//--------------------------------------------------------------------
+//
+// StopThreads - Seize and interrupt every thread, wait until all have stopped
+//
+//      Threads created meanwhile are picked up by scanning again until a
+//      scan finds no new ones; once every thread is stopped none can be
+//      created. A thread still not stopped after MINI_DUMP_STOP_TIMEOUT
+//      is asleep in the kernel and is left as it is.
+//
+// Returns: 0 if at least one thread stopped, errno otherwise
+//
+//--------------------------------------------------------------------
+static int StopThreads(struct MiniDump *Dump)
+{
+    char tasksPath[32];
+    struct dirent *entry;
+    bool bNew = true;
+    uint64_t deadline;
+    int rc = ESRCH;
+    DIR *tasks;
+
+    snprintf(tasksPath, sizeof(tasksPath), "/proc/%d/task", Dump->Pid);
+    if ((tasks = opendir(tasksPath)) == NULL) {
+        return errno;
+    }
+
+    while (bNew && Dump->nThreads < MINI_DUMP_MAX_THREADS) {
+        int first = Dump->nThreads;
+        bNew = false;
+
+        rewinddir(tasks);
+        while ((entry = readdir(tasks)) != NULL && Dump->nThreads < MINI_DUMP_MAX_THREADS) {
+            pid_t tid = (pid_t)atoi(entry->d_name);
+            bool bKnown = false;
+
+            for (int i = 0; i < Dump->nThreads && !bKnown; i++) {
+                bKnown = Dump->Threads[i].Tid == tid;
+            }
+            if (entry->d_name[0] == '.' || bKnown) {
+                continue;
+            }
+
+            if (ptrace(PTRACE_SEIZE, tid, NULL, NULL) != 0) {
+                rc = errno;
+                Trace("StopThreads: failed to seize thread %d: %s", tid, strerror(errno));
+                continue;
+            }
+            ptrace(PTRACE_INTERRUPT, tid, NULL, NULL);
+            Dump->Threads[Dump->nThreads].Tid = tid;
+            Dump->Threads[Dump->nThreads].bWaiting = true;
+            Dump->nThreads++;
+            bNew = true;
+        }
+
+        // polled, as a blocking wait on a sleeping thread would never return
+        deadline = MetricClock() + MINI_DUMP_STOP_TIMEOUT * 1000000ULL;
+        for (int waiting = Dump->nThreads - first; waiting > 0; ) {
+            struct timespec poll = { 0, STOP_POLL_INTERVAL };
+
+            waiting = 0;
+            for (int i = first; i < Dump->nThreads; i++) {
+                struct MiniThread *thread = &Dump->Threads[i];
+                int status;
+                pid_t waited;
+
+                if (!thread->bWaiting) {
+                    continue;
+                }
+                if ((waited = waitpid(thread->Tid, &status, __WALL | WNOHANG)) == 0 || (waited == -1 && errno == EINTR)) {
+                    waiting++;
+                    continue;
+                }
+                thread->bWaiting = false;
+                if (waited == thread->Tid && WIFSTOPPED(status)) {
+                    thread->bStopped = true;
+                    thread->Signal = ((status >> 16) == PTRACE_EVENT_STOP) ? 0 : WSTOPSIG(status);
+                }
+            }
+
+            if (waiting > 0 && MetricClock() >= deadline) {
+                for (int i = first; i < Dump->nThreads; i++) {
+                    Dump->Threads[i].bAsleep = Dump->Threads[i].bWaiting;
+                    Dump->Threads[i].bWaiting = false;
+                }
+                break;
+            }
+            if (waiting > 0) {
+                nanosleep(&poll, NULL);
+            }
+        }
+    }
+
+    closedir(tasks);
+
+    for (int i = 0; i < Dump->nThreads; i++) {
+        if (Dump->Threads[i].bStopped || Dump->Threads[i].bAsleep) {
+            return 0;
+        }
+    }
+    return rc;
+}
+
+//--------------------------------------------------------------------
+//
+// ResumeThreads - Detach every stopped thread, handing back its signal
+//
+//--------------------------------------------------------------------
+static void ResumeThreads(struct MiniDump *Dump)
+{
+    for (int i = 0; i < Dump->nThreads; i++) {
+        if (Dump->Threads[i].bStopped) {
+            ptrace(PTRACE_DETACH, Dump->Threads[i].Tid, NULL, (void *)(long)Dump->Threads[i].Signal);
+            Dump->Threads[i].bStopped = false;
+        }
+    }
+}
+
+//--------------------------------------------------------------------
+//
+// ReadSleepingRegisters - What /proc shows of a thread that did not stop
+//
+//      /proc/<pid>/task/<tid>/syscall is the system call it sleeps in,
+//      its arguments, then the user stack pointer and program counter;
+//      or -1, the stack pointer and program counter if it sleeps outside
+//      of one (a page fault). The other registers read as zero.
+//
+// Returns: true if the stack pointer and program counter were read
+//
+//--------------------------------------------------------------------
+static bool ReadSleepingRegisters(struct MiniDump *Dump, struct MiniThread *Thread)
+{
+    struct user_regs_struct *regs = (struct user_regs_struct *)&Thread->Status.pr_reg;
+    unsigned long long field[9];
+    char path[64];
+    char buffer[256];
+    long long nr;
+    int n;
+
+    snprintf(path, sizeof(path), "/proc/%d/task/%d/syscall", Dump->Pid, Thread->Tid);
+    if (ReadProcFile(path, buffer, sizeof(buffer)) <= 0 ||
+        (n = sscanf(buffer, "%lld %llx %llx %llx %llx %llx %llx %llx %llx", &nr,
+                    &field[0], &field[1], &field[2], &field[3], &field[4], &field[5], &field[6], &field[7])) < 3) {
+        return false;                       // "running": it woke up after all
+    }
+    if (n != 9) {
+        field[6] = field[0];
+        field[7] = field[1];
+        memset(field, 0, 6 * sizeof(field[0]));
+    }
+
+#if defined(__x86_64__)
+    regs->orig_rax = nr;
+    regs->rdi = field[0];
+    regs->rsi = field[1];
+    regs->rdx = field[2];
+    regs->r10 = field[3];
+    regs->r8 = field[4];
+    regs->r9 = field[5];
+    regs->rsp = field[6];
+    regs->rip = field[7];
+#elif defined(__aarch64__)
+    for (int i = 0; i < 6; i++) {
+        regs->regs[i] = field[i];
+    }
+    regs->regs[8] = nr;
+    regs->sp = field[6];
+    regs->pc = field[7];
+#endif
+    return true;
+}
+
+//--------------------------------------------------------------------
+//
+// ReadThreadState - Registers of every seized thread, as NT_PRSTATUS wants them
+//
+//      The main thread is moved first; debuggers take the first
+//      NT_PRSTATUS as the current thread.
+//
+//--------------------------------------------------------------------
+static void ReadThreadState(struct MiniDump *Dump, pid_t Ppid, pid_t Pgrp, pid_t Sid)
+{
+    for (int i = 1; i < Dump->nThreads; i++) {
+        if (Dump->Threads[i].Tid == Dump->Pid) {
+            struct MiniThread main = Dump->Threads[i];
+            Dump->Threads[i] = Dump->Threads[0];
+            Dump->Threads[0] = main;
+        }
+    }
+
+    for (int i = 0; i < Dump->nThreads; i++) {
+        struct MiniThread *thread = &Dump->Threads[i];
+        struct iovec regs = { &thread->Status.pr_reg, sizeof(thread->Status.pr_reg) };
+        struct iovec fpregs = { &thread->FpRegs, sizeof(thread->FpRegs) };
+
+        memset(&thread->Status, 0, sizeof(thread->Status));
+        if (thread->bAsleep) {
+            if (!ReadSleepingRegisters(Dump, thread)) {
+                continue;
+            }
+        } else if (!thread->bStopped) {
+            continue;
+        } else if (ptrace(PTRACE_GETREGSET, thread->Tid, (void *)NT_PRSTATUS, &regs) != 0 || regs.iov_len != sizeof(thread->Status.pr_reg)) {
+            Trace("ReadThreadState: failed to read the registers of thread %d.", thread->Tid);
+            continue;
+        } else {
+            thread->bFpValid = ptrace(PTRACE_GETREGSET, thread->Tid, (void *)NT_FPREGSET, &fpregs) == 0 && fpregs.iov_len == sizeof(thread->FpRegs);
+        }
+
+        thread->Status.pr_info.si_signo = thread->Signal;
+        thread->Status.pr_cursig = thread->Signal;
+        thread->Status.pr_pid = thread->Tid;
+        thread->Status.pr_ppid = Ppid;
+        thread->Status.pr_pgrp = Pgrp;
+        thread->Status.pr_sid = Sid;
+        thread->Status.pr_fpvalid = thread->bFpValid;
+        thread->bRegisters = true;
+    }
+}
+
+//--------------------------------------------------------------------
+//
+// ReadProcessInfo - NT_PRPSINFO from /proc/<pid>/stat and cmdline
+//
+//--------------------------------------------------------------------
+static void ReadProcessInfo(pid_t Pid, struct elf_prpsinfo *Info)
+{
+    char path[32];
+    char buffer[1024];
+    const char *comm, *afterComm;
+    struct stat procStat;
+    int ppid = 0, pgrp = 0, session = 0;
+    long nice = 0;
+    char state = 'R';
+    ssize_t length;
+
+    memset(Info, 0, sizeof(*Info));
+    Info->pr_pid = Pid;
+
+    snprintf(path, sizeof(path), "/proc/%d", Pid);
+    if (stat(path, &procStat) == 0) {
+        Info->pr_uid = procStat.st_uid;
+        Info->pr_gid = procStat.st_gid;
+    }
+
+    // (2) comm is parenthesized and may contain anything, (3)-(6) and (19) follow it
+    snprintf(path, sizeof(path), "/proc/%d/stat", Pid);
+    if (ReadProcFile(path, buffer, sizeof(buffer)) > 0 &&
+        (comm = strchr(buffer, '(')) != NULL && (afterComm = strrchr(buffer, ')')) != NULL) {
+        size_t commLength = afterComm - comm - 1;
+        memcpy(Info->pr_fname, comm + 1, commLength < sizeof(Info->pr_fname) - 1 ? commLength : sizeof(Info->pr_fname) - 1);
+        sscanf(afterComm + 1, " %c %d %d %d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %ld",
+               &state, &ppid, &pgrp, &session, &nice);
+    }
+    Info->pr_sname = state;
+    Info->pr_state = (strchr("RSDTZW", state) != NULL) ? (char)(strchr("RSDTZW", state) - "RSDTZW") : 0;
+    Info->pr_zomb = state == 'Z';
+    Info->pr_nice = (char)nice;
+    Info->pr_ppid = ppid;
+    Info->pr_pgrp = pgrp;
+    Info->pr_sid = session;
+
+    // the arguments, NUL separated
+    snprintf(path, sizeof(path), "/proc/%d/cmdline", Pid);
+    if ((length = ReadProcFile(path, buffer, sizeof(Info->pr_psargs))) > 0) {
+        for (ssize_t i = 0; i < length - 1; i++) {
+            buffer[i] = buffer[i] ? buffer[i] : ' ';
+        }
+        memcpy(Info->pr_psargs, buffer, length);
+    }
+}
+
+//--------------------------------------------------------------------
+//
+// CompareSegments - qsort order of the PT_LOAD segments
+//
+//--------------------------------------------------------------------
+static int CompareSegments(const void *a, const void *b)
+{
+    const struct MiniSegment *x = (const struct MiniSegment *)a;
+    const struct MiniSegment *y = (const struct MiniSegment *)b;
+
+    return (x->Start > y->Start) - (x->Start < y->Start);
+}
+
+//--------------------------------------------------------------------
+//
+// PlanSegments - What memory goes in: the top of each thread's stack
+//                and the vdso
+//
+//      Each stack segment runs from just below the stack pointer up to
+//      the end of its mapping, at most MINI_DUMP_STACK_SIZE bytes; the
+//      outermost frames of a very deep stack are left out.
+//
+//--------------------------------------------------------------------
+static void PlanSegments(struct MiniDump *Dump)
+{
+    struct MiniMapping mapping;
+    const char *cursor = Dump->Maps;
+    int merged = 0;
+
+    while (NextMapping(&cursor, &mapping)) {
+        if (!mapping.bReadable) {
+            continue;
+        }
+
+        if (mapping.PathLength == strlen("[vdso]") && strncmp(mapping.Path, "[vdso]", mapping.PathLength) == 0) {
+            Dump->Segments[Dump->nSegments].Start = mapping.Start;
+            Dump->Segments[Dump->nSegments].End = mapping.End;
+            Dump->Segments[Dump->nSegments].Flags = PF_R | PF_X;
+            Dump->nSegments++;
+            continue;
+        }
+
+        for (int i = 0; i < Dump->nThreads; i++) {
+            uint64_t sp, start;
+
+            if (!Dump->Threads[i].bRegisters) {
+                continue;
+            }
+            sp = StackPointer(&Dump->Threads[i]);
+            if (sp < mapping.Start || sp >= mapping.End) {
+                continue;
+            }
+
+            start = (sp - MINI_DUMP_RED_ZONE) & ~(uint64_t)(Dump->PageSize - 1);
+            start = (sp < MINI_DUMP_RED_ZONE || start < mapping.Start) ? mapping.Start : start;
+            Dump->Segments[Dump->nSegments].Start = start;
+            Dump->Segments[Dump->nSegments].End = (mapping.End - start > MINI_DUMP_STACK_SIZE) ? start + MINI_DUMP_STACK_SIZE : mapping.End;
+            Dump->Segments[Dump->nSegments].Flags = PF_R | PF_W;
+            Dump->nSegments++;
+        }
+    }
+
+    // threads on one stack (signal stacks, coroutines) share a segment
+    qsort(Dump->Segments, Dump->nSegments, sizeof(struct MiniSegment), CompareSegments);
+    for (int i = 0; i < Dump->nSegments; i++) {
+        if (merged > 0 && Dump->Segments[i].Start <= Dump->Segments[merged - 1].End) {
+            if (Dump->Segments[i].End > Dump->Segments[merged - 1].End) {
+                Dump->Segments[merged - 1].End = Dump->Segments[i].End;
+            }
+            Dump->Segments[merged - 1].Flags |= Dump->Segments[i].Flags;
+        } else {
+            Dump->Segments[merged++] = Dump->Segments[i];
+        }
+    }
+    Dump->nSegments = merged;
+}
+
+//--------------------------------------------------------------------
+//
+// ReadPages - process_vm_readv of whole pages
+//
+//      Every page is its own iovec, so an unreadable page (a guard page)
+//      cuts the read short there instead of failing all of it.
+//
+// Returns: bytes read, 0 if the first page can't be
+//
+//--------------------------------------------------------------------
+static size_t ReadPages(struct MiniDump *Dump, uint64_t Address, char *Buffer, size_t Size)
+{
+    struct iovec local = { Buffer, Size };
+    struct iovec remote[MAX_COPY_PAGES];
+    int nRemote = 0;
+    long n;
+
+    for (size_t offset = 0; offset < Size && nRemote < MAX_COPY_PAGES; offset += Dump->PageSize) {
+        remote[nRemote].iov_base = (void *)(uintptr_t)(Address + offset);
+        remote[nRemote].iov_len = Dump->PageSize;
+        nRemote++;
+    }
+    local.iov_len = nRemote * Dump->PageSize;
+
+    n = syscall(SYS_process_vm_readv, Dump->Pid, &local, 1, remote, nRemote, 0);
+    return (n > 0) ? (size_t)n : 0;
+}
+
+//--------------------------------------------------------------------
+//
+// EmitSegment - Copy one segment of the target's memory into the file
+//
+// Returns: bytes read from the target; unreadable pages are written as zeros
+//
+//--------------------------------------------------------------------
+static uint64_t EmitSegment(struct MiniDump *Dump, const struct MiniSegment *Segment)
+{
+    uint64_t bytesRead = 0;
+
+    Flush(Dump);
+    for (uint64_t address = Segment->Start; address < Segment->End && Dump->Error == 0; ) {
+        size_t size = (Segment->End - address < MINI_DUMP_COPY_SIZE) ? Segment->End - address : MINI_DUMP_COPY_SIZE;
+        size_t done = 0;
+
+        while (done < size) {
+            size_t n = ReadPages(Dump, address + done, Dump->Copy + done, size - done);
+            if (n == 0) {
+                memset(Dump->Copy + done, 0, Dump->PageSize);
+                n = Dump->PageSize;
+            } else {
+                bytesRead += n;
+            }
+            done += n;
+        }
+
+        WriteAll(Dump, Dump->Copy, size);
+        Dump->Offset += size;
+        address += size;
+    }
+
+    return bytesRead;
+}
+
+//--------------------------------------------------------------------
+//
+// EmitCore - Write the ELF header, program headers, notes and segments
+//
+//--------------------------------------------------------------------
+static void EmitCore(struct MiniDump *Dump, const struct elf_prpsinfo *Info, const char *Auxv, size_t AuxvSize, struct MiniDumpResult *Result)
+{
+    Elf64_Ehdr header = {0};
+    Elf64_Phdr note = {0};
+    struct MiniMapping mapping;
+    const char *cursor;
+    size_t fileNoteSize = 2 * sizeof(uint64_t);
+    size_t notesSize = 0;
+    uint64_t offset;
+    uint64_t count[2];
+    int nFiles = 0;
+    int nThreads = 0;
+
+    // NT_FILE: count and page size, then start, end and page offset of each file mapping, then their paths
+    for (cursor = Dump->Maps; NextMapping(&cursor, &mapping); ) {
+        if (mapping.Path[0] == '/') {
+            fileNoteSize += 3 * sizeof(uint64_t) + mapping.PathLength + 1;
+            nFiles++;
+        }
+    }
+
+    for (int i = 0; i < Dump->nThreads; i++) {
+        if (Dump->Threads[i].bRegisters) {
+            notesSize += NoteSize(sizeof(struct elf_prstatus));
+            notesSize += Dump->Threads[i].bFpValid ? NoteSize(sizeof(elf_fpregset_t)) : 0;
+            nThreads++;
+        }
+    }
+    notesSize += NoteSize(sizeof(struct elf_prpsinfo)) + NoteSize(fileNoteSize);
+    notesSize += (AuxvSize > 0) ? NoteSize(AuxvSize) : 0;
+
+    memcpy(header.e_ident, ELFMAG, SELFMAG);
+    header.e_ident[EI_CLASS] = ELFCLASS64;
+    header.e_ident[EI_DATA] = ELFDATA2LSB;
+    header.e_ident[EI_VERSION] = EV_CURRENT;
+    header.e_ident[EI_OSABI] = ELFOSABI_NONE;
+    header.e_type = ET_CORE;
+#if defined(__x86_64__)
+    header.e_machine = EM_X86_64;
+#else
+    header.e_machine = EM_AARCH64;
+#endif
+    header.e_version = EV_CURRENT;
+    header.e_phoff = sizeof(Elf64_Ehdr);
+    header.e_ehsize = sizeof(Elf64_Ehdr);
+    header.e_phentsize = sizeof(Elf64_Phdr);
+    header.e_phnum = 1 + Dump->nSegments;
+    Emit(Dump, &header, sizeof(header));
+
+    note.p_type = PT_NOTE;
+    note.p_offset = sizeof(Elf64_Ehdr) + header.e_phnum * sizeof(Elf64_Phdr);
+    note.p_filesz = notesSize;
+    note.p_align = 4;
+    Emit(Dump, &note, sizeof(note));
+
+    // memory starts page aligned after the notes
+    offset = (note.p_offset + notesSize + Dump->PageSize - 1) & ~(uint64_t)(Dump->PageSize - 1);
+    for (int i = 0; i < Dump->nSegments; i++) {
+        Elf64_Phdr load = {0};
+        load.p_type = PT_LOAD;
+        load.p_flags = Dump->Segments[i].Flags;
+        load.p_offset = offset;
+        load.p_vaddr = Dump->Segments[i].Start;
+        load.p_filesz = Dump->Segments[i].End - Dump->Segments[i].Start;
+        load.p_memsz = load.p_filesz;
+        load.p_align = Dump->PageSize;
+        Emit(Dump, &load, sizeof(load));
+        offset += load.p_filesz;
+    }
+
+    // notes in the kernel's order: the first thread's, the process', then the other threads'
+    for (int i = 0; i < Dump->nThreads; i++) {
+        struct MiniThread *thread = &Dump->Threads[i];
+        bool bFirst = (Result->Threads == 0);
+
+        if (!thread->bRegisters) {
+            continue;
+        }
+        EmitNote(Dump, NT_PRSTATUS, &thread->Status, sizeof(thread->Status));
+
+        if (bFirst) {
+            EmitNote(Dump, NT_PRPSINFO, Info, sizeof(*Info));
+            if (AuxvSize > 0) {
+                EmitNote(Dump, NT_AUXV, Auxv, AuxvSize);
+            }
+
+            EmitNoteHeader(Dump, NT_FILE, fileNoteSize);
+            count[0] = nFiles;
+            count[1] = Dump->PageSize;
+            Emit(Dump, count, sizeof(count));
+            for (cursor = Dump->Maps; NextMapping(&cursor, &mapping); ) {
+                if (mapping.Path[0] == '/') {
+                    uint64_t range[3] = { mapping.Start, mapping.End, mapping.Offset / Dump->PageSize };
+                    Emit(Dump, range, sizeof(range));
+                }
+            }
+            for (cursor = Dump->Maps; NextMapping(&cursor, &mapping); ) {
+                if (mapping.Path[0] == '/') {
+                    Emit(Dump, mapping.Path, mapping.PathLength);
+                    EmitZeros(Dump, 1);
+                }
+            }
+            EmitZeros(Dump, NOTE_ALIGN(fileNoteSize) - fileNoteSize);
+        }
+
+        if (thread->bFpValid) {
+            EmitNote(Dump, NT_FPREGSET, &thread->FpRegs, sizeof(thread->FpRegs));
+        }
+        Result->Threads++;
+        Result->Asleep += thread->bAsleep;
+    }
+    Result->Modules = nFiles;
+
+    EmitZeros(Dump, (Dump->PageSize - Dump->Offset % Dump->PageSize) % Dump->PageSize);
+    for (int i = 0; i < Dump->nSegments; i++) {
+        Result->BytesRead += EmitSegment(Dump, &Dump->Segments[i]);
+    }
+    Flush(Dump);
+}
+
+//--------------------------------------------------------------------
+//
+// DumpThread - Write the core, as the tracer of the target's threads
+//
+//      All of the target's threads are stopped from the first interrupt
+//      until the file is written, which for a few MB of stacks is
+//      milliseconds.
+//
+//--------------------------------------------------------------------
+static void *DumpThread(void *Context)
+{
+    struct MiniDumpRequest *request = (struct MiniDumpRequest *)Context;
+    struct MiniDumpResult *Result = request->Result;
+    const char *Path = request->Path;
+    pid_t Pid = request->Pid;
+    struct MiniDump dump = {0};
+    struct elf_prpsinfo info;
+    char auxv[4096];
+    ssize_t auxvSize;
+    char procPath[32];
+    int rc;
+
+#if !defined(__x86_64__) && !defined(__aarch64__)
+    Trace("WriteMiniDump: only implemented for x86_64 and aarch64.");
+    request->rc = ENOTSUP;
+    return NULL;
+#endif
+
+    dump.Pid = Pid;
+    dump.PageSize = sysconf(_SC_PAGESIZE);
+    dump.MemorySize = MINI_DUMP_MAX_THREADS * sizeof(struct MiniThread) +
+                      (MINI_DUMP_MAX_THREADS + 1) * sizeof(struct MiniSegment) +
+                      MINI_DUMP_MAPS_SIZE + 2 * MINI_DUMP_COPY_SIZE;
+    dump.Memory = mmap(NULL, dump.MemorySize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (dump.Memory == MAP_FAILED) {
+        request->rc = errno;
+        return NULL;
+    }
+    dump.Copy = (char *)dump.Memory;
+    dump.Out = dump.Copy + MINI_DUMP_COPY_SIZE;
+    dump.Threads = (struct MiniThread *)(dump.Out + MINI_DUMP_COPY_SIZE);
+    dump.Segments = (struct MiniSegment *)(dump.Threads + MINI_DUMP_MAX_THREADS);
+    dump.Maps = (char *)(dump.Segments + MINI_DUMP_MAX_THREADS + 1);
+
+    if ((dump.fd = open(Path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644)) == -1) {
+        request->rc = errno;
+        munmap(dump.Memory, dump.MemorySize);
+        return NULL;
+    }
+
+    // process wide state that does not change while the threads are stopped is read first
+    ReadProcessInfo(Pid, &info);
+    snprintf(procPath, sizeof(procPath), "/proc/%d/auxv", Pid);
+    if ((auxvSize = ReadProcFile(procPath, auxv, sizeof(auxv))) < 0) {
+        auxvSize = 0;
+    }
+
+    Result->StoppedAt = MetricClock();
+    if ((rc = StopThreads(&dump)) == 0) {
+        snprintf(procPath, sizeof(procPath), "/proc/%d/maps", Pid);
+        if (ReadProcFile(procPath, dump.Maps, MINI_DUMP_MAPS_SIZE) < 0) {
+            dump.Maps[0] = '\0';
+        }
+        ReadThreadState(&dump, info.pr_ppid, info.pr_pgrp, info.pr_sid);
+        PlanSegments(&dump);
+        EmitCore(&dump, &info, auxv, auxvSize, Result);
+        rc = dump.Error;
+    }
+    ResumeThreads(&dump);
+    Result->ResumedAt = MetricClock();
+    Result->BytesWritten = dump.Offset;
+
+    if (close(dump.fd) != 0 && rc == 0) {
+        rc = errno;
+    }
+    if (rc != 0) {
+        unlink(Path);
+    }
+    munmap(dump.Memory, dump.MemorySize);
+    request->rc = rc;
+    return NULL;
+}
+
+//--------------------------------------------------------------------
+//
+// WriteMiniDump - Write a stack only core of Pid to Path
+//
+//      Runs on a dump worker, which waits for a thread of its own to
+//      write the core: the threads that never stopped are let go when
+//      that thread exits, as PTRACE_DETACH only works on stopped ones.
+//
+// Returns: 0 on success, errno otherwise (Path is removed)
+//
+//--------------------------------------------------------------------
+int WriteMiniDump(pid_t Pid, const char *Path, struct MiniDumpResult *Result)
+{
+    struct MiniDumpRequest request = { Pid, Path, Result, 0 };
+    pthread_t thread;
+    int rc;
+
+    memset(Result, 0, sizeof(*Result));
+    if ((rc = pthread_create(&thread, NULL, DumpThread, &request)) != 0) {
+        return rc;
+    }
+    pthread_join(thread, NULL);
+    return request.rc;
+}
@@ -12,27 +12,32 @@
 
 struct Handle g_evtConfigurationInitialized = HANDLE_MANUAL_RESET_EVENT_INITIALIZER("ConfigurationInitialized");
 
-static sigset_t sig_set;
-static pthread_t sig_thread_id;
+static struct EventLoop monitorLoop;
+static struct WorkerPool dumpWorkers;
+static struct EventSource signalSource;
+static struct MetricsServer metricsServer;
+static struct ControlServer controlServer;
+static struct DumpBudget dumpBudget;
 
 //--------------------------------------------------------------------
 //
-// SignalThread - Thread for hanlding graceful Async signals (e.g., SIGINT, SIGTERM)
+// SignalHandler - Loop handler for graceful Async signals (e.g., SIGINT, SIGTERM)
 //
 //--------------------------------------------------------------------
-void *SignalThread(void *input)
+static void SignalHandler(struct EventSource *Source, uint32_t Events)
 {
-    struct ProcDumpConfiguration *self = (struct ProcDumpConfiguration *)input;
-    int sig_caught, rc;
+    struct ProcDumpConfiguration *self = (struct ProcDumpConfiguration *)Source->Context;
+    struct signalfd_siginfo sigInfo;
+    int rc;
 
-    if ((rc = sigwait(&sig_set, &sig_caught)) != 0) {
-        Log(error, "Failed to wait on signal");
-        exit(-1);
+    if (read(Source->fd, &sigInfo, sizeof(sigInfo)) != sizeof(sigInfo)) {
+        return;
     }
-    
-    switch (sig_caught)
+
+    switch (sigInfo.ssi_signo)
     {
     case SIGINT:
+    case SIGTERM:
         SetQuit(self, 1);
         if(self->gcorePid != NO_PID) {
             Log(info, "Shutting down gcore");
@@ -41,13 +46,57 @@ void *SignalThread(void *input)
             }
         }
         Log(info, "Quit");
+        StopMonitoring(self);
         break;
     default:
-        fprintf (stderr, "\nUnexpected signal %d\n", sig_caught);
+        fprintf (stderr, "\nUnexpected signal %d\n", sigInfo.ssi_signo);
         break;
     }
+}
+
+//--------------------------------------------------------------------
+//
+// TargetExitHandler - The target's pidfd became readable, i.e. it exited
+//
+//--------------------------------------------------------------------
+static void TargetExitHandler(struct EventSource *Source, uint32_t Events)
+{
+    struct ProcDumpConfiguration *self = (struct ProcDumpConfiguration *)Source->Context;
+
+    RemoveEventSource(self->Loop, Source);
+    if (!self->bTerminated) {
+        self->bTerminated = true;
+        Log(error, "Target process is no longer alive");
+    }
+    StopMonitoring(self);
+}
+
+//--------------------------------------------------------------------
+//
+// ProfilerGate - Sample the target now?
+//
+//      Not while it is being dumped, gcore has it traced; with -P
+//      hz:triggered only while a trigger's condition held at its last
+//      sample.
+//
+//--------------------------------------------------------------------
+static bool ProfilerGate(void *Context)
+{
+    struct ProcDumpConfiguration *self = (struct ProcDumpConfiguration *)Context;
+    bool bConditionHeld = false;
+
+    if (self->gcorePid != NO_PID || controlServer.bDumpPending) {
+        return false;
+    }
 
-    pthread_exit(NULL);
+    for (int i = 0; i < self->nTriggers; i++) {
+        if (self->Triggers[i]->bDumpPending) {
+            return false;
+        }
+        bConditionHeld |= self->Triggers[i]->bConditionHeld;
+    }
+
+    return !self->bProfileWhileTriggered || bConditionHeld;
 }
 
 //--------------------------------------------------------------------
@@ -57,14 +106,51 @@ void *SignalThread(void *input)
 //--------------------------------------------------------------------
 void InitProcDump()
 {
+    uint64_t startedAt = MetricClock();
+
     openlog("ProcDump", LOG_PID, LOG_USER);
     if(CheckKernelVersion() == false)
     {
         Log(error, "Kernel version lower than 3.5+.");
         exit(-1);
     }
+
+    // locked by PrepareForLowMemory once armed
+    if(ReserveArenaMemory(ARENA_RESERVE_SIZE) != 0){
+        Log(error, INTERNAL_ERROR);
+        Trace("InitProcDump: failed to reserve working memory.");
+        exit(-1);
+    }
+
     InitProcDumpConfiguration(&g_config);
-    pthread_mutex_init(&LoggerLock, NULL);
+    g_config.StartedAt = startedAt;
+}
+
+//--------------------------------------------------------------------
+//
+// PrepareForLowMemory - Lock the working memory and lower oom_score_adj
+//
+//      The memory trigger fires when the host is short of memory, be
+//      ready for it. Done once the first target is armed rather than at
+//      startup, so neither delays its first sample; later calls return.
+//
+//--------------------------------------------------------------------
+void PrepareForLowMemory()
+{
+    static bool bPrepared = false;
+
+    if(bPrepared){
+        return;
+    }
+    bPrepared = true;
+
+    LockArenaMemory();
+    if(!SetOomScoreAdj(getpid(), PROCDUMP_OOM_SCORE_ADJ)){
+        if(geteuid() == 0){
+            Log(warn, "Unable to lower procdump's oom_score_adj: %s", strerror(errno));
+        }
+        Trace("PrepareForLowMemory: unable to lower oom_score_adj.");
+    }
 }
 
 //--------------------------------------------------------------------
@@ -74,14 +160,14 @@ void InitProcDump()
 //--------------------------------------------------------------------
 void ExitProcDump()
 {
-    pthread_mutex_destroy(&LoggerLock);
+    StopLogger();
     closelog();
     FreeProcDumpConfiguration(&g_config);
 }
 
 //--------------------------------------------------------------------
 //
-// InitProcDumpConfiguration - initalize a config
+// InitProcDumpConfiguration - initalize the global config
 //
 //--------------------------------------------------------------------
 void InitProcDumpConfiguration(struct ProcDumpConfiguration *self)
@@ -93,8 +179,19 @@ void InitProcDumpConfiguration(struct ProcDumpConfiguration *self)
     MAXIMUM_CPU = 100 * (int)sysconf(_SC_NPROCESSORS_ONLN);
     HZ = sysconf(_SC_CLK_TCK);
 
-    sysinfo(&(self->SystemInfo));
+    InitTargetConfiguration(self);
+
+    SetEvent(&g_evtConfigurationInitialized.event); // We've initialized and are now re-entrant safe
+}
 
+
+//--------------------------------------------------------------------
+//
+// InitTargetConfiguration - initalize a config with the defaults, one per monitored process
+//
+//--------------------------------------------------------------------
+void InitTargetConfiguration(struct ProcDumpConfiguration *self)
+{
     InitNamedEvent(&(self->evtCtrlHandlerCleanupComplete.event), true, false, "CtrlHandlerCleanupComplete");
     self->evtCtrlHandlerCleanupComplete.type = EVENT;
 
@@ -110,27 +207,50 @@ void InitProcDumpConfiguration(struct ProcDumpConfiguration *self)
     InitNamedEvent(&(self->evtQuit.event), true, false, "Quit");
     self->evtQuit.type = EVENT;
 
-    InitNamedEvent(&(self->evtStartMonitoring.event), true, false, "StartMonitoring");
-    self->evtStartMonitoring.type = EVENT;
-
-    sem_init(&(self->semAvailableDumpSlots.semaphore), 0, 1);
+    InitSemaphore(&(self->semAvailableDumpSlots.semaphore), 1);
     self->semAvailableDumpSlots.type = SEMAPHORE;
 
+    InitArenaOver(&self->TargetArena, self->TargetMemory, sizeof(self->TargetMemory));
+
     // Additional initialization
     self->ProcessId =                   NO_PID;
+    self->ProcessName =                 NULL;
     self->NumberOfDumpsCollected =      0;
     self->NumberOfDumpsToCollect =      DEFAULT_NUMBER_OF_DUMPS;
     self->CpuThreshold =                -1;
     self->MemoryThreshold =             -1;
+    self->BlockedThreshold =            -1;
+    self->BlockedSeconds =              BLOCKED_DEFAULT_SECONDS;
+    self->bBlockedOnWchan =             false;
     self->ThresholdSeconds =            DEFAULT_DELTA_TIME;
+    self->SamplingInterval =            SAMPLING_INTERVAL;
     self->bCpuTriggerBelowValue =       false;
     self->bMemoryTriggerBelowValue =    false;
     self->bTimerThreshold =             false;
     self->WaitingForProcessName =       false;
     self->DiagnosticsLoggingEnabled =   false;
+    self->MetricsSocket =               NULL;
+    self->ControlSocket =               NULL;
+    self->DaemonConfig =                NULL;
+    self->OutputDirectory =             NULL;
+    self->CoredumpFilter =              -1;
+    self->Quota =                       NULL;
+    self->DumpPriority =                -1;
+    self->RuleName =                    NULL;
+    self->DumpBudgetSpec =              NULL;
+    self->ProfileHz =                   0;
+    self->bProfileWhileTriggered =      false;
+    self->bMiniDump =                   false;
+    self->Budget =                      &dumpBudget;
     self->gcorePid = NO_PID;
-
-    SetEvent(&g_evtConfigurationInitialized.event); // We've initialized and are now re-entrant safe
+    self->nTriggers = 0;
+    self->TargetSource.fd = NO_FD;
+    self->Recorder.Header = NULL;
+    self->Metrics.bRegistered = false;
+    self->Profiler.Memory = NULL;
+    self->Profiler.Loop = NULL;
+    self->StartedAt = MetricClock();
+    self->ArmedAt = 0;
 }
 
 
@@ -146,14 +266,40 @@ void FreeProcDumpConfiguration(struct ProcDumpConfiguration *self)
     DestroyEvent(&(self->evtConfigurationPrinted.event));
     DestroyEvent(&(self->evtDebugThreadInitialized.event));
     DestroyEvent(&(self->evtQuit.event));
-    DestroyEvent(&(self->evtStartMonitoring.event));
 
-    sem_destroy(&(self->semAvailableDumpSlots.semaphore));
+    DestroySemaphore(&(self->semAvailableDumpSlots.semaphore));
 
-    if(strcmp(self->ProcessName, EMPTY_PROC_NAME) != 0){
+    for (int i = 0; i < self->nTriggers; i++) {
+        FreeTrigger(self->Triggers[i]);
+    }
+    self->nTriggers = 0;
+    UnregisterMetricTarget(&self->Metrics);
+    ResetArena(&self->TargetArena);
+
+    if(self->ProcessName != NULL && strcmp(self->ProcessName, EMPTY_PROC_NAME) != 0){
         // The string constant is not on the heap.
         free(self->ProcessName);
     }
+
+    if (self->MetricsSocket) {
+        free(self->MetricsSocket);
+    }
+
+    if (self->ControlSocket) {
+        free(self->ControlSocket);
+    }
+
+    if (self->DaemonConfig) {
+        free(self->DaemonConfig);
+    }
+
+    if (self->DumpBudgetSpec) {
+        free(self->DumpBudgetSpec);
+    }
+
+    if (self->OutputDirectory) {
+        free(self->OutputDirectory);
+    }
 }
 
 //--------------------------------------------------------------------
@@ -177,16 +323,26 @@ int GetOptions(struct ProcDumpConfiguration *self, int argc, char *argv[])
     // parse arguments
 	int next_option;
     int option_index = 0;
-    const char* short_options = "+p:C:c:M:m:n:s:w:dh";
+    bool bDumpCountGiven = false;
+    const char* short_options = "+p:C:c:M:m:B:n:s:i:w:u:k:D:b:T:P:Sdh";
     const struct option long_options[] = {
     	{ "pid",                       required_argument,  NULL,           'p' },
     	{ "cpu",                       required_argument,  NULL,           'C' },
     	{ "lower-cpu",                 required_argument,  NULL,           'c' },
     	{ "memory",                    required_argument,  NULL,           'M' },
     	{ "lower-mem",                 required_argument,  NULL,           'm' },
+        { "blocked",                   required_argument,  NULL,           'B' },
         { "number-of-dumps",           required_argument,  NULL,           'n' },
         { "time-between-dumps",        required_argument,  NULL,           's' },
+        { "interval",                  required_argument,  NULL,           'i' },
         { "wait",                      required_argument,  NULL,           'w' },
+        { "metrics-socket",            required_argument,  NULL,           'u' },
+        { "control-socket",            required_argument,  NULL,           'k' },
+        { "daemon",                    required_argument,  NULL,           'D' },
+        { "budget",                    required_argument,  NULL,           'b' },
+        { "tune",                      required_argument,  NULL,           'T' },
+        { "profile",                   required_argument,  NULL,           'P' },
+        { "mini",                      no_argument,        NULL,           'S' },
         { "diag",                      no_argument,        NULL,           'd' },
         { "help",                      no_argument,        NULL,           'h' }
     };
@@ -238,12 +394,21 @@ int GetOptions(struct ProcDumpConfiguration *self, int argc, char *argv[])
                 self->bMemoryTriggerBelowValue = true;
                 break;
 
+            case 'B':
+                if (self->BlockedThreshold != -1 ||
+                    ParseBlockedSpec(optarg, &self->BlockedThreshold, &self->BlockedSeconds, &self->bBlockedOnWchan) != 0) {
+                    Log(error, "Invalid blocked threads specified, expected threads[:seconds][:wchan].");
+                    return PrintUsage(self);
+                }
+                break;
+
             case 'n':
                 if (!IsValidNumberArg(optarg) ||
                     (self->NumberOfDumpsToCollect = atoi(optarg)) < 0) {
                     Log(error, "Invalid dumps threshold specified.");
                     return PrintUsage(self);
                 }                
+                bDumpCountGiven = true;
                 break;
 
             case 's':
@@ -254,13 +419,79 @@ int GetOptions(struct ProcDumpConfiguration *self, int argc, char *argv[])
                 }
                 break;
 
+            case 'i':
+                if (!IsValidNumberArg(optarg) ||
+                    (self->SamplingInterval = atoi(optarg)) < MIN_SAMPLING_INTERVAL || self->SamplingInterval > MAX_SAMPLING_INTERVAL) {
+                    Log(error, "Invalid sampling interval specified, expected %d-%d ms.", MIN_SAMPLING_INTERVAL, MAX_SAMPLING_INTERVAL);
+                    return PrintUsage(self);
+                }
+                break;
+
             case 'w':
                 self->WaitingForProcessName = true;
                 self->ProcessName = strdup(optarg);
                 break;
 
+            case 'u':
+                if (self->MetricsSocket != NULL || strlen(optarg) >= sizeof(((struct sockaddr_un *)0)->sun_path)) {
+                    Log(error, "Invalid metrics socket path specified.");
+                    return PrintUsage(self);
+                }
+                self->MetricsSocket = strdup(optarg);
+                break;
+
+            case 'k':
+                if (self->ControlSocket != NULL || strlen(optarg) >= sizeof(((struct sockaddr_un *)0)->sun_path)) {
+                    Log(error, "Invalid control socket path specified.");
+                    return PrintUsage(self);
+                }
+                self->ControlSocket = strdup(optarg);
+                break;
+
+            case 'D':
+                if (self->DaemonConfig != NULL) {
+                    Log(error, "Please only specify one daemon configuration");
+                    return PrintUsage(self);
+                }
+                self->DaemonConfig = strdup(optarg);
+                break;
+
+            case 'b': {
+                struct DumpBudgetLimits limits;
+                if (self->DumpBudgetSpec != NULL || ParseDumpBudget(optarg, &limits) != 0) {
+                    Log(error, "Invalid dump budget specified.");
+                    return PrintUsage(self);
+                }
+                free(limits.Path);
+                self->DumpBudgetSpec = strdup(optarg);
+                break;
+            }
+
+            case 'T': {
+                enum ThreadRole role;
+                struct ThreadTuning tuning;
+                if (ParseThreadTuning(optarg, &role, &tuning) != 0) {
+                    Log(error, "Invalid thread tuning specified.");
+                    return PrintUsage(self);
+                }
+                SetThreadTuning(role, &tuning);
+                break;
+            }
+
+            case 'P':
+                if (self->ProfileHz != 0 || ParseProfileSpec(optarg, &self->ProfileHz, &self->bProfileWhileTriggered) != 0) {
+                    Log(error, "Invalid profile specified, expected 1-%d samples per second, optionally followed by :triggered.", PROFILE_MAX_HZ);
+                    return PrintUsage(self);
+                }
+                break;
+
+            case 'S':
+                self->bMiniDump = true;
+                break;
+
             case 'd':
                 self->DiagnosticsLoggingEnabled = true;
+                g_DiagTraceEnabled = true;
                 break;
                 
             case 'h':
@@ -274,13 +505,34 @@ int GetOptions(struct ProcDumpConfiguration *self, int argc, char *argv[])
 
     // Check for multi-arg situations
 
-    // if number of dumps is set, but no thresholds, just go on timer
+    // in daemon mode targets and triggers come from the configuration file
+    if (self->DaemonConfig != NULL) {
+        if (self->ProcessId != NO_PID || self->WaitingForProcessName ||
+            self->CpuThreshold != -1 || self->MemoryThreshold != -1 || self->BlockedThreshold != -1 ||
+            self->ControlSocket != NULL || self->ProfileHz != 0) {
+            Log(error, "-D cannot be combined with -p, -w, -C, -c, -M, -m, -B, -k or -P");
+            return PrintUsage(self);
+        }
+        Trace("GetOpts and initial Configuration finished");
+        return 0;
+    }
+
+    // if number of dumps is set, but no thresholds, just go on timer;
+    // profiling alone takes no dumps unless -n asks for them
     if (self->NumberOfDumpsToCollect != -1 &&
         self->MemoryThreshold == -1 &&
-        self->CpuThreshold == -1) {
+        self->CpuThreshold == -1 &&
+        self->BlockedThreshold == -1 &&
+        (self->ProfileHz == 0 || bDumpCountGiven)) {
             self->bTimerThreshold = true;
         }
 
+    if (self->bProfileWhileTriggered && self->CpuThreshold == -1 && self->MemoryThreshold == -1 &&
+        self->BlockedThreshold == -1) {
+        Log(error, "-P hz:triggered needs a CPU, memory or blocked threads threshold");
+        return PrintUsage(self);
+    }
+
     if(self->ProcessId == NO_PID && !self->WaitingForProcessName){
         Log(error, "A valid PID or process name must be specified");
         return PrintUsage(self);
@@ -292,7 +544,7 @@ int GetOptions(struct ProcDumpConfiguration *self, int argc, char *argv[])
     }
 
     if(!self->WaitingForProcessName) {
-        self->ProcessName = GetProcessName(self->ProcessId);
+        self->ProcessName = GetProcessName(self->ProcessId, NULL);
     }
 
     Trace("GetOpts and initial Configuration finished");
@@ -327,7 +579,7 @@ bool LookupProcessByPid(struct ProcDumpConfiguration *self)
 
 //--------------------------------------------------------------------
 //
-// FilterForPid - Helper function for scandir to only return PIDs.
+// FilterForPid - Helper function for the /proc scan to only keep PIDs.
 //
 //--------------------------------------------------------------------
 static int FilterForPid(const struct dirent *entry)
@@ -342,15 +594,34 @@ static int FilterForPid(const struct dirent *entry)
 //--------------------------------------------------------------------
 bool WaitForProcessName(struct ProcDumpConfiguration *self)
 {
+    struct Arena *scratch = ScratchArena();
+    struct dirent *entry;
+    DIR *proc;
+
+    // one directory stream for every pass, so waiting doesn't touch the heap
+    if ((proc = opendir("/proc")) == NULL) {
+        Log(error, "Unable to scan /proc: %s", strerror(errno));
+        self->bTerminated = true;
+        return false;
+    }
+
     Log(info, "Waiting for process '%s' to launch...", self->ProcessName);
     while (true) {
-        struct dirent ** nameList;
         bool moreThanOne = false;
         pid_t matchingPid = NO_PID;
-        int numEntries = scandir("/proc/", &nameList, FilterForPid, alphasort);
-        for (int i = 0; i < numEntries; i++) {
-            pid_t procPid = atoi(nameList[i]->d_name);
-            char *nameForPid = GetProcessName(procPid);
+
+        rewinddir(proc);
+        while ((entry = readdir(proc)) != NULL && !moreThanOne) {
+            pid_t procPid;
+            char *nameForPid;
+
+            if (!FilterForPid(entry)) {
+                continue;
+            }
+            procPid = atoi(entry->d_name);
+
+            ResetArena(scratch);
+            nameForPid = GetProcessName(procPid, scratch);
             if (strcmp(nameForPid, EMPTY_PROC_NAME) == 0) {
                 continue;
             }
@@ -360,24 +631,19 @@ bool WaitForProcessName(struct ProcDumpConfiguration *self)
                 } else {
                     Log(error, "More than one matching process found, exiting...");
                     moreThanOne = true;
-                    free(nameForPid);
-                    break;
                 }
             }
-            free(nameForPid);
         }
-        // Cleanup
-        for (int i = 0; i < numEntries; i++) {
-            free(nameList[i]);
-        }
-        free(nameList);
 
         // Check for exactly one match
         if (moreThanOne) {
+            closedir(proc);
             self->bTerminated = true;
             return false;
         } else if (matchingPid != NO_PID) {
+            closedir(proc);
             self->ProcessId = matchingPid;
+            self->StartedAt = MetricClock();        // time to armed doesn't include the wait
             Log(info, "Found process with PID %d", matchingPid);
             return true;
         }
@@ -389,130 +655,272 @@ bool WaitForProcessName(struct ProcDumpConfiguration *self)
 // GetProcessName - Get process name using PID provided.
 //                  Returns EMPTY_PROC_NAME for null process name.
 //
+//      The name is allocated from Arena, or from the heap if Arena is NULL.
+//
+//--------------------------------------------------------------------
+char * GetProcessName(pid_t pid, struct Arena *Arena){
+    char procFilePath[32];
+    char fileBuffer[MAX_CMDLINE_LEN];
+    ssize_t charactersRead;
+
+    if(sprintf(procFilePath, "/proc/%d/cmdline", pid) < 0){
+        return EMPTY_PROC_NAME;
+    }
+
+    if((charactersRead = ReadProcFile(procFilePath, fileBuffer, sizeof(fileBuffer))) <= 0){
+        Log(debug, "Failed to read from %s.\n", procFilePath);
+        return EMPTY_PROC_NAME;
+    }
+
+    return ParseProcessName(fileBuffer, charactersRead, Arena);
+}
+
+//--------------------------------------------------------------------
+//
+// ParseProcessName - Extract the process name from the contents of a
+//                    /proc/[pid]/cmdline file
+//
+//      The name is allocated from Arena, or from the heap if Arena is NULL.
+//
 //--------------------------------------------------------------------
-char * GetProcessName(pid_t pid){
-	char procFilePath[32];
-	char fileBuffer[MAX_CMDLINE_LEN];
-	int charactersRead = 0;
-	int	itr = 0;
-	char * stringItr;
-	char * processName;
-	FILE * procFile;
-	
-	
-        if(sprintf(procFilePath, "/proc/%d/cmdline", pid) < 0){
-		return EMPTY_PROC_NAME;
-	}
-
-	procFile = fopen(procFilePath, "r");
-
-	if(procFile != NULL){
-		if(fgets(fileBuffer, MAX_CMDLINE_LEN, procFile) == NULL) {
-	    		fclose(procFile);
-			if(strlen(fileBuffer) == 0){
-                		Log(debug, "Empty cmdline.\n");
-            		}else{
-	        		Log(debug, "Failed to read from %s.\n", procFilePath);
-			}
-			return EMPTY_PROC_NAME;
-		}
-		// close file
-		fclose(procFile);
-	}
-	else{
-		Log(debug, "Failed to open %s.\n", procFilePath);
-		return EMPTY_PROC_NAME;
-	}
-	
-
-	// Extract process name
-	stringItr = fileBuffer;
-	charactersRead  = strlen(fileBuffer);
-	for(int i = 0; i <= charactersRead; i++){
-		if(fileBuffer[i] == '\0'){
-			itr = i - itr;
-			
-			if(strcmp(stringItr, "sudo") != 0){		// do we have the process name including filepath?
-				processName = strrchr(stringItr, '/');	// does this process include a filepath?
-				
-				if(processName != NULL){
-					return strdup(processName + 1);	// +1 to not include '/' character
-				}
-				else{
-					return strdup(stringItr);
-				}
-			}
-			else{
-				stringItr += (itr+1); 	// +1 to move past '\0'
-			}
-		}
-	}
-
-	Log(debug, "Failed to extract process name from /proc/PID/cmdline");
-	return EMPTY_PROC_NAME;
-}
-
-//--------------------------------------------------------------------
-//
-// CreateTriggerThreads - Create each of the threads that will be running as a trigger 
-//
-//--------------------------------------------------------------------
-int CreateTriggerThreads(struct ProcDumpConfiguration *self)
+char * ParseProcessName(const char *fileBuffer, ssize_t charactersRead, struct Arena *Arena){
+    const char * stringItr;
+    const char * processName;
+    char * copy;
+
+    // Extract process name: the first argument that isn't sudo
+    for(stringItr = fileBuffer; stringItr < fileBuffer + charactersRead; stringItr += strlen(stringItr) + 1){
+        if(*stringItr == '\0' || strcmp(stringItr, "sudo") == 0){
+            continue;
+        }
+
+        processName = strrchr(stringItr, '/');    // does this process include a filepath?
+        processName = processName != NULL ? processName + 1 : stringItr;   // +1 to not include '/' character
+
+        copy = Arena != NULL ? ArenaStrdup(Arena, processName) : strdup(processName);
+        return copy != NULL ? copy : EMPTY_PROC_NAME;
+    }
+
+    Log(debug, "Failed to extract process name from /proc/PID/cmdline");
+    return EMPTY_PROC_NAME;
+}
+
+//--------------------------------------------------------------------
+//
+// CreateTriggers - Set up the monitoring loop and a timer for each configured trigger
+//
+//      A single thread runs the loop (sampling, signals, target exit);
+//      blocking dump writing is handed to the dump worker pool.
+//
+//--------------------------------------------------------------------
+int CreateTriggers(struct ProcDumpConfiguration *self)
 {    
     int rc = 0;
-    self->nThreads = 0;
+    sigset_t sig_set;
 
-    if((rc=sigemptyset (&sig_set)) < 0)
-    {
-        Trace("CreateTriggerThreads: sigemptyset failed.");
+    // SIGINT/SIGTERM are read from a signalfd on the loop
+    sigemptyset(&sig_set);
+    sigaddset(&sig_set, SIGINT);
+    sigaddset(&sig_set, SIGTERM);
+    if ((rc = StartMonitoringRuntime(self, &sig_set, SignalHandler, self)) != 0) {
         return rc;
     }
-    if((rc=sigaddset (&sig_set, SIGINT)) < 0)
-    {
-        Trace("CreateTriggerThreads: sigaddset failed.");
+
+    if (self->ControlSocket != NULL &&
+        (rc = StartControlServer(&controlServer, self, self->ControlSocket)) != 0) {
+        Log(error, "Unable to listen for commands on %s: %s", self->ControlSocket, strerror(rc));
         return rc;
     }
-    if((rc=sigaddset (&sig_set, SIGTERM)) < 0)
-    {
-        Trace("CreateTriggerThreads: sigaddset failed.");
+
+    return CreateTargetTriggers(self);
+}
+
+
+//--------------------------------------------------------------------
+//
+// StartMonitoringRuntime - Create what every monitored process shares:
+//                          the loop, signal handling, dump workers, logger and metrics
+//
+//      Signals are blocked here, before any other thread exists, and
+//      delivered to Handler on the loop.
+//
+//--------------------------------------------------------------------
+int StartMonitoringRuntime(struct ProcDumpConfiguration *self, const sigset_t *Signals, EventHandler Handler, void *Context)
+{
+    int rc = 0;
+
+    if ((rc = InitEventLoop(&monitorLoop)) != 0) {
+        Trace("StartMonitoringRuntime: failed to create event loop.");
         return rc;
     }
+    self->Loop = &monitorLoop;
 
-    if((rc = pthread_sigmask (SIG_BLOCK, &sig_set, NULL)) != 0)
-    {
-        Trace("CreateTriggerThreads: pthread_sigmask failed.");
+    if ((rc = InitSignalSource(&signalSource, Signals, Handler, Context)) != 0 ||
+        (rc = AddEventSource(self->Loop, &signalSource, EPOLLIN)) != 0) {
+        Trace("StartMonitoringRuntime: failed to set up signal handling.");
         return rc;
     }
 
-    // create threads
-    if (self->CpuThreshold != -1) {
-        if ((rc = pthread_create(&self->Threads[self->nThreads++], NULL, CpuThread, (void *)self)) != 0) {
-            Trace("CreateTriggerThreads: failed to create CpuThread.");            
-            return rc;
+    if ((rc = InitWorkerPool(&dumpWorkers, self->Loop, DEFAULT_DUMP_WORKERS, THREAD_ROLE_WRITER)) != 0) {
+        Trace("StartMonitoringRuntime: failed to create dump workers.");
+        return rc;
+    }
+    self->DumpWorkers = &dumpWorkers;
+
+    // from here on sampling must not wait on stdout or the syslog socket
+    if ((rc = StartLogger()) != 0) {
+        Trace("StartMonitoringRuntime: failed to start the log flusher.");
+        return rc;
+    }
+
+    if (self->MetricsSocket != NULL &&
+        (rc = StartMetricsServer(&metricsServer, self->Loop, self->MetricsSocket)) != 0) {
+        Log(error, "Unable to serve metrics on %s: %s", self->MetricsSocket, strerror(rc));
+        return rc;
+    }
+
+    if (self->DumpBudgetSpec != NULL && (rc = OpenDumpBudget(&dumpBudget, self->DumpBudgetSpec)) != 0) {
+        Log(error, "Unable to join the dump budget %s: %s", self->DumpBudgetSpec, strerror(rc));
+        return rc;
+    }
+
+    // last, so the workers and the flusher don't inherit it
+    EnterThreadRole(THREAD_ROLE_SAMPLER);
+
+    return 0;
+}
+
+
+//--------------------------------------------------------------------
+//
+// TargetFilePath - Path of a file kept for the target while it is
+//                  monitored, named by Format from its pid and rule
+//
+//      Two daemon rules can match the same process; the rule name, with
+//      anything but [A-Za-z0-9._-] replaced, keeps their files apart.
+//
+//--------------------------------------------------------------------
+static void TargetFilePath(struct ProcDumpConfiguration *self, const char *Format, char *Buffer, size_t Size)
+{
+    char rule[NAME_MAX / 2] = "";
+    char name[NAME_MAX + 1];
+
+    if (self->RuleName != NULL) {
+        size_t len = 0;
+
+        rule[len++] = '_';
+        for (const char *c = self->RuleName; *c != '\0' && len < sizeof(rule) - 1; c++) {
+            rule[len++] = (isalnum((unsigned char)*c) || *c == '.' || *c == '-' || *c == '_') ? *c : '_';
         }
+        rule[len] = '\0';
     }
 
-    if (self->MemoryThreshold != -1) {
-        if ((rc = pthread_create(&self->Threads[self->nThreads++], NULL, CommitThread, (void *)self)) != 0) {
-            Trace("CreateTriggerThreads: failed to create CommitThread.");            
-            return rc;
+    snprintf(name, sizeof(name), Format, self->ProcessId, rule);
+    if (self->OutputDirectory != NULL) {
+        snprintf(Buffer, Size, "%s/%s", self->OutputDirectory, name);
+    } else {
+        snprintf(Buffer, Size, "%s", name);
+    }
+}
+
+//--------------------------------------------------------------------
+//
+// CreateTargetTriggers - Watch self->ProcessId on self->Loop and create its triggers
+//
+//      Loop and DumpWorkers must already be set; the triggers are armed by BeginMonitoring.
+//
+//--------------------------------------------------------------------
+int CreateTargetTriggers(struct ProcDumpConfiguration *self)
+{
+    int rc = 0;
+    char recorderPath[PATH_MAX];
+    self->nTriggers = 0;
+
+    // Target exit wakes the loop directly. Without pidfd support (< 5.3) we
+    // fall back to the liveness check done on every sample.
+    self->TargetSource.Handler = TargetExitHandler;
+    self->TargetSource.Context = self;
+    if ((self->TargetSource.fd = (int)syscall(SYS_pidfd_open, self->ProcessId, 0)) == -1) {
+        self->TargetSource.fd = NO_FD;
+        Trace("CreateTargetTriggers: pidfd_open unavailable, polling for target exit.");
+    } else if ((rc = AddEventSource(self->Loop, &self->TargetSource, EPOLLIN)) != 0) {
+        Trace("CreateTargetTriggers: failed to watch target pidfd.");
+        return rc;
+    }
+
+    // sample history for the dumps; monitoring goes on without it if the ring can't be mapped
+    TargetFilePath(self, FLIGHT_RECORDER_RING_FORMAT, recorderPath, sizeof(recorderPath));
+    if (OpenFlightRecorder(&self->Recorder, self->ProcessId, recorderPath, &self->TargetArena) != 0) {
+        Log(warn, "Unable to create sample history %s, dumps will not include it", recorderPath);
+    }
+    StartFlightRecorder(&self->Recorder, self->Loop);
+
+    // folded stacks next to the dumps; monitoring goes on without them if profiling is refused
+    if (self->ProfileHz != 0) {
+        char profilePath[PATH_MAX];
+        TargetFilePath(self, PROFILE_OUTPUT_FORMAT, profilePath, sizeof(profilePath));
+        if ((rc = OpenProfiler(&self->Profiler, self->ProcessId, self->ProcessName, self->ProfileHz, profilePath)) != 0) {
+            Log(warn, "Unable to profile %d: %s", self->ProcessId, strerror(rc));
         }
+        self->Profiler.Gate = ProfilerGate;
+        self->Profiler.Context = self;
+    }
+
+    // create triggers, each sets its threshold gauge
+    RegisterMetricTarget(&self->Metrics, self->ProcessId, self->RuleName);
+    if (self->CpuThreshold != -1) {
+        self->Triggers[self->nTriggers++] = NewTrigger(NewCoreDumpWriter(CPU, self));
+    }
+
+    if (self->MemoryThreshold != -1) {
+        self->Triggers[self->nTriggers++] = NewTrigger(NewCoreDumpWriter(COMMIT, self));
+    }
+
+    if (self->BlockedThreshold != -1) {
+        self->Triggers[self->nTriggers++] = NewTrigger(NewCoreDumpWriter(BLOCKED, self));
     }
 
     if (self->bTimerThreshold) {
-        if ((rc = pthread_create(&self->Threads[self->nThreads++], NULL, TimerThread, (void *)self)) != 0) {
-            Trace("CreateTriggerThreads: failed to create TimerThread.");
-            return rc;
+        self->Triggers[self->nTriggers++] = NewTrigger(NewCoreDumpWriter(TIME, self));
+    }
+
+    return 0;
+}
+
+
+//--------------------------------------------------------------------
+//
+// IsMonitoringBusy - Is any trigger still armed or any of its dumps in flight?
+//
+//--------------------------------------------------------------------
+bool IsMonitoringBusy(struct ProcDumpConfiguration *self)
+{
+    for (int i = 0; i < self->nTriggers; i++) {
+        if (self->Triggers[i]->bActive || self->Triggers[i]->bDumpPending) {
+            return true;
         }
     }
-    
-    if((rc = pthread_create(&sig_thread_id, NULL, SignalThread, (void *)self))!= 0)
-    {
-        Trace("CreateTriggerThreads: failed to create SignalThread.");
-        return rc;
+
+    return false;
+}
+
+
+//--------------------------------------------------------------------
+//
+// ReleaseTargetTriggers - Undo CreateTargetTriggers once monitoring is no longer busy
+//
+//--------------------------------------------------------------------
+void ReleaseTargetTriggers(struct ProcDumpConfiguration *self)
+{
+    for (int i = 0; i < self->nTriggers; i++) {
+        FreeTrigger(self->Triggers[i]);
     }
+    self->nTriggers = 0;
 
-    return 0;
+    UnregisterMetricTarget(&self->Metrics);
+    CloseProfiler(&self->Profiler);
+    CloseFlightRecorder(&self->Recorder);
+    RemoveEventSource(self->Loop, &self->TargetSource);
 }
 
 
@@ -580,29 +988,45 @@ int WaitForQuitOrEvent(struct ProcDumpConfiguration *self, struct Handle *handle
 
 //--------------------------------------------------------------------
 //
-// WaitForAllThreadsToTerminate - Wait for all threads to terminate  
+// RunMonitoring - Run the monitoring loop until every trigger has stopped
+//                 and every in-flight dump has completed
 //
 //--------------------------------------------------------------------
-int WaitForAllThreadsToTerminate(struct ProcDumpConfiguration *self)
+int RunMonitoring(struct ProcDumpConfiguration *self)
 {
     int rc = 0;
-    for (int i = 0; i < self->nThreads; i++) {
-        if ((rc = pthread_join(self->Threads[i], NULL)) != 0) {
-            Log(error, "An error occured while joining threads\n");
-            exit(-1);
-        }
-    }
-    if ((rc = pthread_cancel(sig_thread_id)) != 0) {
-        Log(error, "An error occured while canceling SignalThread.\n");
-        exit(-1);
-    }
-    if ((rc = pthread_join(sig_thread_id, NULL)) != 0) {
-        Log(error, "An error occured while joining SignalThread.\n");
+
+    if ((rc = RunEventLoop(self->Loop)) != 0) {
+        Log(error, "An error occured while running the monitoring loop\n");
         exit(-1);
     }
+
+    DestroyWorkerPool(self->DumpWorkers);
+    CloseProfiler(&self->Profiler);
+    CloseFlightRecorder(&self->Recorder);
+    StopMetricsServer(&metricsServer);
+    StopControlServer(&controlServer);
+    CloseDumpBudget(&dumpBudget);
+    RemoveEventSource(self->Loop, &self->TargetSource);
+    RemoveEventSource(self->Loop, &signalSource);
     return rc;
 }
 
+
+//--------------------------------------------------------------------
+//
+// StopMonitoring - Stop all triggers and the profiler; dumps already in
+//                  flight still complete
+//
+//--------------------------------------------------------------------
+void StopMonitoring(struct ProcDumpConfiguration *self)
+{
+    for (int i = 0; i < self->nTriggers; i++) {
+        StopTrigger(self->Triggers[i]);
+    }
+    StopProfiler(&self->Profiler);
+}
+
 //--------------------------------------------------------------------
 //
 // IsQuit - A check on the underlying value of whether we should quit  
@@ -666,12 +1090,30 @@ bool PrintConfiguration(struct ProcDumpConfiguration *self)
             printf("Commit Threshold:\tn/a\n");
         }
 
+        // blocked threads
+        if (self->BlockedThreshold != -1) {
+            printf("Blocked Threshold:\t>%d threads for %d s in D state%s\n", self->BlockedThreshold, self->BlockedSeconds,
+                   self->bBlockedOnWchan ? " or on one wait channel" : "");
+        } else {
+            printf("Blocked Threshold:\tn/a\n");
+        }
+
         // time
         printf("Threshold Seconds:\t%d\n", self->ThresholdSeconds);
+        printf("Sampling Interval:\t%d ms\n", self->SamplingInterval);
 
         // number of dumps and others
         printf("Number of Dumps:\t%d\n", self->NumberOfDumpsToCollect);
 
+        printf("Dump Type:\t\t%s\n", self->bMiniDump ? "mini (stacks only)" : "full");
+
+        // profile
+        if (self->ProfileHz != 0) {
+            printf("Profile:\t\t%d Hz%s\n", self->ProfileHz, self->bProfileWhileTriggered ? " while triggered" : "");
+        } else {
+            printf("Profile:\t\tn/a\n");
+        }
+
         SetEvent(&self->evtConfigurationPrinted.event);
         return true;
     }
@@ -711,12 +1153,19 @@ bool ContinueMonitoring(struct ProcDumpConfiguration *self)
 
 //--------------------------------------------------------------------
 //
-// BeginMonitoring - Sync up monitoring threads 
+// BeginMonitoring - Arm every trigger, and the profiler, on the monitoring loop 
 //
 //--------------------------------------------------------------------
 bool BeginMonitoring(struct ProcDumpConfiguration *self)
 {
-    return SetEvent(&(self->evtStartMonitoring.event));
+    for (int i = 0; i < self->nTriggers; i++) {
+        if (StartTrigger(self->Triggers[i]) != 0) {
+            return false;
+        }
+    }
+    StartProfiler(&self->Profiler, self->Loop);
+
+    return true;
 }
 
 //--------------------------------------------------------------------
@@ -763,7 +1212,7 @@ bool CheckKernelVersion()
     }
     else
     {
-        Log(error, strerror(errno));
+        Log(error, "%s", strerror(errno));
     }
     return false;
 }
@@ -798,12 +1247,21 @@ int PrintUsage(struct ProcDumpConfiguration *self)
     printf("      -c          CPU threshold below which to create a dump of the process from 0 to 100 * nCPU\n");
     printf("      -M          Memory commit threshold in MB at which to create a dump\n");
     printf("      -m          Trigger when memory commit drops below specified MB value.\n");
+    printf("      -B          Trigger when more than N threads are in D state for T seconds (default %d): N[:T][:wchan], wchan also counts threads sleeping on one wait channel\n", BLOCKED_DEFAULT_SECONDS);
     printf("      -n          Number of dumps to write before exiting (default is %d)\n", DEFAULT_NUMBER_OF_DUMPS);
     printf("      -s          Consecutive seconds before dump is written (default is %d)\n", DEFAULT_DELTA_TIME);
+    printf("      -i          Milliseconds between samples of the target, %d-%d (default is %d)\n", MIN_SAMPLING_INTERVAL, MAX_SAMPLING_INTERVAL, SAMPLING_INTERVAL);
+    printf("      -u          Serve Prometheus metrics on the given Unix domain socket\n");
+    printf("      -k          Accept commands (dump, pause, resume, set, status) on the given Unix domain socket\n");
+    printf("      -b          Share a node wide dump budget: path[:concurrent=N,mb_per_hour=N,io_mb_per_s=N,priority=0-9]\n");
+    printf("      -T          Tune procdump's threads: sampler|writer|logger:[sched=other|batch|idle,nice=N,ioprio=idle|be[:0-7]|rt[:0-7],cpus=0,2-3]\n");
+    printf("      -P          Profile the target at the given rate, 1-%d Hz, into folded stacks; hz:triggered only while a threshold is crossed\n", PROFILE_MAX_HZ);
+    printf("      -S          Write stack only (mini) dumps: thread registers, the top of each stack and the module list\n");
     printf("      -d          Writes diagnostic logs to syslog\n");
     printf("   TARGET must be exactly one of these:\n");
     printf("      -p          pid of the process\n");
-    printf("      -w          Name of the process executable\n\n");
+    printf("      -w          Name of the process executable\n");
+    printf("      -D          Daemon mode, monitor the targets described in the given configuration file\n\n");
 
     return -1;
 }
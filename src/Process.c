@@ -7,37 +7,81 @@
 //
 //--------------------------------------------------------------------
 
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
 #include "Process.h"
 
+//--------------------------------------------------------------------
+//
+// ReadProcFile - Read a /proc file into buffer, without stdio's heap buffers
+//
+//      The result is NUL terminated and cut short if it does not fit.
+//
+// Returns: the number of bytes read, or -1 if the file could not be read
+//
+//--------------------------------------------------------------------
+ssize_t ReadProcFile(const char *path, char *buffer, size_t size)
+{
+    ssize_t total = 0, n;
+    int fd;
+
+    if((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1){
+        return -1;
+    }
+
+    // procfs hands out at most a page per read
+    while((size_t)total < size - 1 && (n = read(fd, buffer + total, size - 1 - total)) != 0){
+        if(n == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            close(fd);
+            return -1;
+        }
+        total += n;
+    }
+
+    close(fd);
+    buffer[total] = '\0';
+    return total;
+}
+
 bool GetProcessStat(pid_t pid, struct ProcessStat *proc) {
     char procFilePath[32];
     char fileBuffer[1024];
-    char *token;
-    char *savePtr = NULL;
-
-    FILE *procFile = NULL;
 
     // Read /proc/[pid]/stat
     if(sprintf(procFilePath, "/proc/%d/stat", pid) < 0){
         return false;
     }
-    procFile = fopen(procFilePath, "r");
-    
-    if(procFile != NULL){
-        if(fgets(fileBuffer, sizeof(fileBuffer), procFile) == NULL) {
-            Log(error, "Failed to read from %s. Exiting...\n", procFilePath);
-            fclose(procFile);
-            return false;
+
+    errno = 0;
+    if(ReadProcFile(procFilePath, fileBuffer, sizeof(fileBuffer)) <= 0){
+        // a target that exited is for the caller to notice, not an error
+        if(errno == ENOENT || errno == ESRCH){
+            Trace("GetProcessStat: %s is gone.", procFilePath);
+        } else {
+            Log(error, "Failed to read from %s.\n", procFilePath);
         }
-        
-        // close file after reading this iteration of stats
-        fclose(procFile);
-    }
-    else{
-        Log(error, "Failed to open %s.\n", procFilePath);
         return false;
     }
-    
+
+    return ParseProcessStat(fileBuffer, proc);
+}
+
+//--------------------------------------------------------------------
+//
+// ParseProcessStat - Parse the contents of a /proc/[pid]/stat file
+//
+//      fileBuffer is tokenized in place.
+//
+//--------------------------------------------------------------------
+bool ParseProcessStat(char *fileBuffer, struct ProcessStat *proc) {
+    char *token;
+    char *savePtr = NULL;
+
     // (1) process ID
     proc->pid = (pid_t)atoi(fileBuffer);
 
@@ -490,3 +534,312 @@ bool GetProcessStat(pid_t pid, struct ProcessStat *proc) {
 
     return true;
 }
+
+//--------------------------------------------------------------------
+//
+// GetProcessIo - Read the I/O counters from /proc/[pid]/io
+//
+//      Readable for a zombie too, which is how the counters of a finished
+//      child (and everything it waited for) are collected before reaping it.
+//
+//--------------------------------------------------------------------
+bool GetProcessIo(pid_t pid, struct ProcessIo *io)
+{
+    char procFilePath[32];
+    char lineBuffer[128];
+    FILE *procFile = NULL;
+
+    if(sprintf(procFilePath, "/proc/%d/io", pid) < 0){
+        return false;
+    }
+
+    if((procFile = fopen(procFilePath, "r")) == NULL){
+        Trace("GetProcessIo: failed to open %s.", procFilePath);
+        return false;
+    }
+
+    memset(io, 0, sizeof(*io));
+    while(fgets(lineBuffer, sizeof(lineBuffer), procFile) != NULL){
+        char *value = strchr(lineBuffer, ':');
+        if(value == NULL){
+            continue;
+        }
+        *value++ = '\0';
+
+        if(strcmp(lineBuffer, "rchar") == 0) io->rchar = strtoull(value, NULL, 10);
+        else if(strcmp(lineBuffer, "wchar") == 0) io->wchar = strtoull(value, NULL, 10);
+        else if(strcmp(lineBuffer, "syscr") == 0) io->syscr = strtoull(value, NULL, 10);
+        else if(strcmp(lineBuffer, "syscw") == 0) io->syscw = strtoull(value, NULL, 10);
+        else if(strcmp(lineBuffer, "read_bytes") == 0) io->read_bytes = strtoull(value, NULL, 10);
+        else if(strcmp(lineBuffer, "write_bytes") == 0) io->write_bytes = strtoull(value, NULL, 10);
+    }
+
+    fclose(procFile);
+    return true;
+}
+
+//--------------------------------------------------------------------
+//
+// GetProcessMapCount - Number of memory mappings in /proc/[pid]/maps
+//
+// Returns: the count, or -1 if the maps could not be read
+//
+//--------------------------------------------------------------------
+int GetProcessMapCount(pid_t pid)
+{
+    char procFilePath[32];
+    char buffer[4096];
+    FILE *procFile = NULL;
+    size_t n;
+    int count = 0;
+
+    if(sprintf(procFilePath, "/proc/%d/maps", pid) < 0){
+        return -1;
+    }
+
+    if((procFile = fopen(procFilePath, "r")) == NULL){
+        Trace("GetProcessMapCount: failed to open %s.", procFilePath);
+        return -1;
+    }
+
+    // one mapping per line
+    while((n = fread(buffer, 1, sizeof(buffer), procFile)) > 0){
+        for(size_t i = 0; i < n; i++){
+            count += (buffer[i] == '\n');
+        }
+    }
+
+    fclose(procFile);
+    return count;
+}
+
+//--------------------------------------------------------------------
+//
+// GetProcessIdentity - Parent, process group and owner of pid
+//
+//      Quiet on failure: callers scanning /proc expect processes to exit under them.
+//
+//--------------------------------------------------------------------
+bool GetProcessIdentity(pid_t pid, struct ProcessIdentity *id)
+{
+    char procFilePath[32];
+    char fileBuffer[1024];
+    char *afterComm;
+    struct stat procStat;
+
+    if(sprintf(procFilePath, "/proc/%d", pid) < 0 || stat(procFilePath, &procStat) != 0){
+        return false;
+    }
+    id->uid = procStat.st_uid;
+
+    strcat(procFilePath, "/stat");
+    if(ReadProcFile(procFilePath, fileBuffer, sizeof(fileBuffer)) <= 0){
+        return false;
+    }
+
+    // (4) ppid and (5) pgrp follow the parenthesized comm, which may contain spaces
+    if((afterComm = strrchr(fileBuffer, ')')) == NULL ||
+       sscanf(afterComm + 1, " %*c %d %d", &id->ppid, &id->pgrp) != 2){
+        return false;
+    }
+
+    return true;
+}
+
+//--------------------------------------------------------------------
+//
+// GetProcessCgroup - The unified (v2) cgroup path of pid, e.g. /system.slice/foo.service
+//
+//      On a v1-only host the path of the first hierarchy listed is used.
+//
+//--------------------------------------------------------------------
+bool GetProcessCgroup(pid_t pid, char *cgroup, size_t size)
+{
+    char procFilePath[32];
+    char fileBuffer[PATH_MAX];
+    char *lineBuffer, *savePtr = NULL;
+    bool bFound = false;
+
+    if(sprintf(procFilePath, "/proc/%d/cgroup", pid) < 0){
+        return false;
+    }
+    if(ReadProcFile(procFilePath, fileBuffer, sizeof(fileBuffer)) <= 0){
+        return false;
+    }
+
+    // hierarchy-ID:controller-list:cgroup-path
+    for(lineBuffer = strtok_r(fileBuffer, "\n", &savePtr); lineBuffer != NULL; lineBuffer = strtok_r(NULL, "\n", &savePtr)){
+        char *path = strchr(lineBuffer, ':');
+        if(path == NULL || (path = strchr(path + 1, ':')) == NULL){
+            continue;
+        }
+        path++;
+
+        if(!bFound || strncmp(lineBuffer, "0::", 3) == 0){
+            snprintf(cgroup, size, "%s", path);
+            bFound = true;
+        }
+        if(strncmp(lineBuffer, "0::", 3) == 0){
+            break;
+        }
+    }
+
+    return bFound;
+}
+
+//--------------------------------------------------------------------
+//
+// GetBlockedThreads - Count pid's threads in uninterruptible sleep (D) and,
+//                     if byWchan, the most threads sleeping (S or D) in one
+//                     kernel wait channel
+//
+//      tasks is /proc/[pid]/task, opened once by the caller: opendir
+//      allocates, rewinddir does not. A thread that exits during the scan
+//      is skipped. Running threads have no wait channel, so the wait
+//      channels are only read for the sleeping ones.
+//
+// Returns: false if no thread could be read (the process is gone)
+//
+//--------------------------------------------------------------------
+bool GetBlockedThreads(pid_t pid, DIR *tasks, bool byWchan, struct BlockedThreads *blocked)
+{
+    char procFilePath[64];
+    char fileBuffer[512];
+    char wchan[BLOCKED_WCHAN_LENGTH];
+    struct {
+        char name[BLOCKED_WCHAN_LENGTH];
+        int count;
+    } wchans[BLOCKED_MAX_WCHANS];
+    int nWchans = 0;
+    struct dirent *entry;
+
+    memset(blocked, 0, sizeof(*blocked));
+    rewinddir(tasks);
+    while((entry = readdir(tasks)) != NULL){
+        pid_t tid = (pid_t)atoi(entry->d_name);
+        char *afterComm;
+        char state;
+
+        if(tid <= 0){
+            continue;
+        }
+
+        // (3) state follows the parenthesized comm, which may contain spaces
+        snprintf(procFilePath, sizeof(procFilePath), "/proc/%d/task/%d/stat", pid, tid);
+        if(ReadProcFile(procFilePath, fileBuffer, sizeof(fileBuffer)) <= 0 ||
+           (afterComm = strrchr(fileBuffer, ')')) == NULL || afterComm[1] != ' '){
+            continue;
+        }
+        state = afterComm[2];
+        blocked->threads++;
+
+        if(state != 'D' && !(byWchan && state == 'S')){
+            continue;
+        }
+
+        // "0" when the thread is not sleeping after all, or its wait channel is hidden
+        snprintf(procFilePath, sizeof(procFilePath), "/proc/%d/task/%d/wchan", pid, tid);
+        if(ReadProcFile(procFilePath, wchan, sizeof(wchan)) <= 0 || strcmp(wchan, "0") == 0){
+            wchan[0] = '\0';
+        }
+
+        if(state == 'D'){
+            blocked->uninterruptible++;
+            if(blocked->listed < BLOCKED_MAX_LISTED){
+                struct BlockedThread *thread = &blocked->list[blocked->listed++];
+                thread->tid = tid;
+                thread->state = state;
+                strcpy(thread->wchan, wchan);
+            }
+        }
+
+        if(byWchan && wchan[0] != '\0'){
+            int i;
+
+            for(i = 0; i < nWchans && strcmp(wchans[i].name, wchan) != 0; i++);
+            if(i == nWchans && nWchans < BLOCKED_MAX_WCHANS){
+                strcpy(wchans[nWchans].name, wchan);
+                wchans[nWchans++].count = 0;
+            }
+            if(i < nWchans && ++wchans[i].count > blocked->onWchan){
+                blocked->onWchan = wchans[i].count;
+                strcpy(blocked->wchan, wchan);
+            }
+        }
+    }
+
+    return blocked->threads != 0;
+}
+
+//--------------------------------------------------------------------
+//
+// GetCoredumpFilter / SetCoredumpFilter - /proc/[pid]/coredump_filter,
+//      the mapping types a dump includes (gdb's gcore honors it too)
+//
+//--------------------------------------------------------------------
+bool GetCoredumpFilter(pid_t pid, unsigned int *filter)
+{
+    char procFilePath[48];
+    FILE *procFile = NULL;
+    bool bRead;
+
+    if(sprintf(procFilePath, "/proc/%d/coredump_filter", pid) < 0){
+        return false;
+    }
+    if((procFile = fopen(procFilePath, "r")) == NULL){
+        return false;
+    }
+
+    bRead = fscanf(procFile, "%x", filter) == 1;
+    fclose(procFile);
+    return bRead;
+}
+
+bool SetCoredumpFilter(pid_t pid, unsigned int filter)
+{
+    char procFilePath[48];
+    FILE *procFile = NULL;
+    bool bWritten;
+
+    if(sprintf(procFilePath, "/proc/%d/coredump_filter", pid) < 0){
+        return false;
+    }
+    if((procFile = fopen(procFilePath, "w")) == NULL){
+        Trace("SetCoredumpFilter: failed to open %s.", procFilePath);
+        return false;
+    }
+
+    bWritten = fprintf(procFile, "0x%x", filter) > 0;
+    if(fclose(procFile) != 0){
+        bWritten = false;
+    }
+    return bWritten;
+}
+
+//--------------------------------------------------------------------
+//
+// SetOomScoreAdj - /proc/[pid]/oom_score_adj, -1000 (never) to 1000 (first) to be OOM killed
+//
+//      Lowering it needs CAP_SYS_RESOURCE, raising it does not. Safe to
+//      call between fork and exec.
+//
+//--------------------------------------------------------------------
+bool SetOomScoreAdj(pid_t pid, int value)
+{
+    char procFilePath[48];
+    char valueBuffer[16];
+    int length = snprintf(valueBuffer, sizeof(valueBuffer), "%d", value);
+    bool bWritten;
+    int fd;
+
+    if(sprintf(procFilePath, "/proc/%d/oom_score_adj", pid) < 0){
+        return false;
+    }
+    if((fd = open(procFilePath, O_WRONLY | O_CLOEXEC)) == -1){
+        return false;
+    }
+
+    bWritten = write(fd, valueBuffer, length) == length;
+    close(fd);
+    return bWritten;
+}
@@ -0,0 +1,972 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Sampling profiler: the target's thread stacks as folded stacks
+//
+//      At every tick every thread of the target is seized and interrupted
+//      (PTRACE_SEIZE, PTRACE_INTERRUPT) first, then they are polled
+//      together: each one's registers are read and it is detached as soon
+//      as its stop is seen, so a thread is stopped for about one poll
+//      interval and the loop waits for the slowest thread only once. A
+//      tick that overruns the period skips the ticks it ran into. The
+//      stack is unwound afterwards by
+//      following the frame pointer chain through a copy of the top of
+//      the stack taken with process_vm_readv, so code built without
+//      frame pointers shows up truncated.
+//
+//      Identical stacks are counted in a table that is mapped once, so
+//      sampling doesn't allocate. Stacks are symbolized when they are
+//      written, through an index of each ELF file's function symbols
+//      that is built once per file. Addresses without a symbol are
+//      written as module+file offset, for addr2line.
+//
+//      A thread that does not stop within PROFILE_STOP_TIMEOUT (it is in
+//      an uninterruptible sleep) stays seized and is detached at a later
+//      tick, so the loop never waits on the target.
+//
+//--------------------------------------------------------------------
+
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/ptrace.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include "Logging.h"
+#include "Metrics.h"
+#include "Profiler.h"
+
+#define STACK_READ_CHUNK 4096       // process_vm_readv doesn't split an iovec, so a short read stops at a chunk
+#define STOP_POLL_INTERVAL 20000    // ns between checks for an interrupted thread's stop
+
+static void SampleTick(struct WheelTimer *Timer);
+static void WriteTick(struct WheelTimer *Timer);
+static void ReapLagging(struct Profiler *Profiler);
+static void ReadMappings(struct Profiler *Profiler);
+static bool IsMapped(struct Profiler *Profiler, uint64_t Address);
+
+//--------------------------------------------------------------------
+//
+// ParseProfileSpec - Parse "hz[:triggered]" as given to -P
+//
+// Returns: 0 on success, EINVAL otherwise
+//
+//--------------------------------------------------------------------
+int ParseProfileSpec(const char *Spec, int *Hz, bool *bWhileTriggered)
+{
+    char *end;
+    long hz = strtol(Spec, &end, 10);
+
+    if (end == Spec || hz < 1 || hz > PROFILE_MAX_HZ) {
+        return EINVAL;
+    }
+    if (*end == ':' && strcmp(end + 1, "triggered") == 0) {
+        *bWhileTriggered = true;
+    } else if (*end == '\0') {
+        *bWhileTriggered = false;
+    } else {
+        return EINVAL;
+    }
+
+    *Hz = (int)hz;
+    return 0;
+}
+
+//--------------------------------------------------------------------
+//
+// OpenProfiler - Prepare to profile Pid at Hz, writing folded stacks to Path
+//
+// Returns: 0 on success, errno otherwise
+//
+//--------------------------------------------------------------------
+int OpenProfiler(struct Profiler *Profiler, pid_t Pid, const char *Name, int Hz, const char *Path)
+{
+    char tasks[32];
+    int rc;
+
+    Profiler->Pid = Pid;
+    Profiler->Name = Name;
+    snprintf(Profiler->Path, sizeof(Profiler->Path), "%s", Path);
+    Profiler->Period = 1000 / Hz;
+    Profiler->Loop = NULL;
+    Profiler->Gate = NULL;
+    Profiler->Context = NULL;
+    Profiler->nLagging = 0;
+    Profiler->nStacks = 0;
+    Profiler->nFrames = 0;
+    Profiler->nSamples = 0;
+    Profiler->nDropped = 0;
+    Profiler->Maps = NULL;
+    Profiler->nMaps = 0;
+    Profiler->Modules = NULL;
+    Profiler->nModules = 0;
+    Profiler->bDenied = false;
+    InitWheelTimer(&Profiler->SampleTimer, SampleTick, Profiler);
+    InitWheelTimer(&Profiler->WriteTimer, WriteTick, Profiler);
+
+#if !defined(__x86_64__) && !defined(__aarch64__)
+    Trace("OpenProfiler: frame pointer unwinding is only implemented for x86_64 and aarch64.");
+    Profiler->Memory = NULL;
+    return ENOTSUP;
+#endif
+
+    snprintf(tasks, sizeof(tasks), "/proc/%d/task", Pid);
+    if ((Profiler->Tasks = opendir(tasks)) == NULL) {
+        Trace("OpenProfiler: failed to open %s.", tasks);
+        Profiler->Memory = NULL;
+        return errno;
+    }
+
+    Profiler->MemorySize = PROFILE_MAX_STACKS * sizeof(struct ProfileStack) + PROFILE_FRAME_POOL * sizeof(uint64_t) +
+                           PROFILE_MAX_THREADS * sizeof(struct ProfileThread) + PROFILE_STACK_COPY;
+    Profiler->Memory = mmap(NULL, Profiler->MemorySize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (Profiler->Memory == MAP_FAILED) {
+        rc = errno;
+        Trace("OpenProfiler: failed to map the stack table.");
+        closedir(Profiler->Tasks);
+        Profiler->Memory = NULL;
+        return rc;
+    }
+
+    Profiler->Stacks = (struct ProfileStack *)Profiler->Memory;
+    Profiler->Pool = (uint64_t *)(Profiler->Stacks + PROFILE_MAX_STACKS);
+    Profiler->Threads = (struct ProfileThread *)(Profiler->Pool + PROFILE_FRAME_POOL);
+    Profiler->StackCopy = (char *)(Profiler->Threads + PROFILE_MAX_THREADS);
+    return 0;
+}
+
+//--------------------------------------------------------------------
+//
+// StartProfiler - Take the first sample now and the rest on Loop
+//
+//      Holds a reference on the loop until stopped, so profiling alone
+//      keeps procdump running.
+//
+//--------------------------------------------------------------------
+void StartProfiler(struct Profiler *Profiler, struct EventLoop *Loop)
+{
+    if (Profiler->Memory == NULL || Profiler->Loop != NULL) {
+        return;
+    }
+
+    Profiler->Loop = Loop;
+    RetainEventLoop(Loop);
+    ScheduleTimer(&Loop->Timers, &Profiler->WriteTimer, PROFILE_WRITE_INTERVAL);
+    RunTimerNow(&Loop->Timers, &Profiler->SampleTimer);
+}
+
+//--------------------------------------------------------------------
+//
+// StopProfiler - Stop sampling and write the folded stacks
+//
+//--------------------------------------------------------------------
+void StopProfiler(struct Profiler *Profiler)
+{
+    struct EventLoop *loop = Profiler->Loop;
+    int rc;
+
+    if (loop == NULL) {
+        return;
+    }
+
+    CancelTimer(&loop->Timers, &Profiler->SampleTimer);
+    CancelTimer(&loop->Timers, &Profiler->WriteTimer);
+    Profiler->Loop = NULL;
+
+    // a thread still seized is detached by the kernel when procdump exits, but
+    // would hold up the target's exit until then
+    for (uint64_t deadline = MetricClock() + PROFILE_STOP_TIMEOUT * 1000000ULL;
+         Profiler->nLagging != 0 && MetricClock() < deadline; ) {
+        struct timespec poll = { 0, STOP_POLL_INTERVAL };
+        ReapLagging(Profiler);
+        nanosleep(&poll, NULL);
+    }
+
+    if ((rc = WriteProfile(Profiler)) == 0) {
+        Log(info, "Profile of %llu stacks written to %s", (unsigned long long)Profiler->nSamples, Profiler->Path);
+    } else {
+        Log(error, "Unable to write profile %s: %s", Profiler->Path, strerror(rc));
+    }
+    if (Profiler->nDropped != 0) {
+        Log(warn, "Profile stack table full, %llu stacks were dropped", (unsigned long long)Profiler->nDropped);
+    }
+
+    ReleaseEventLoop(loop);
+}
+
+//--------------------------------------------------------------------
+//
+// CloseProfiler - Stop and release everything, including the symbol cache
+//
+//--------------------------------------------------------------------
+void CloseProfiler(struct Profiler *Profiler)
+{
+    if (Profiler->Memory == NULL) {
+        return;
+    }
+
+    StopProfiler(Profiler);
+
+    closedir(Profiler->Tasks);
+    munmap(Profiler->Memory, Profiler->MemorySize);
+    Profiler->Memory = NULL;
+
+    for (int i = 0; i < Profiler->nModules; i++) {
+        struct SymbolIndex *module = &Profiler->Modules[i];
+        if (module->Image != NULL) {
+            munmap(module->Image, module->ImageSize);
+        }
+        free(module->Symbols);
+        free(module->Path);
+    }
+    free(Profiler->Modules);
+    free(Profiler->Maps);
+    Profiler->Modules = NULL;
+    Profiler->Maps = NULL;
+}
+
+//--------------------------------------------------------------------
+//
+// SampleTick - Sample on the loop thread, unless the gate is closed
+//
+//--------------------------------------------------------------------
+static void SampleTick(struct WheelTimer *Timer)
+{
+    struct Profiler *profiler = (struct Profiler *)Timer->Context;
+    uint64_t startedAt = MetricClock();
+    uint64_t elapsed;
+
+    if (profiler->Gate == NULL || profiler->Gate(profiler->Context)) {
+        // the mappings are needed to symbolize a target that exits before the first write
+        if (profiler->Maps == NULL) {
+            ReadMappings(profiler);
+        }
+        if (SampleProfiler(profiler) == 0 && kill(profiler->Pid, 0) != 0) {
+            StopProfiler(profiler);         // the target is gone
+            return;
+        }
+    }
+
+    // the wheel's clock stood still while sampling: skip the ticks the pass ran into
+    elapsed = (MetricClock() - startedAt) / 1000000;
+    RescheduleTimer(&profiler->Loop->Timers, &profiler->SampleTimer, profiler->Period * (1 + elapsed / profiler->Period));
+}
+
+//--------------------------------------------------------------------
+//
+// WriteTick - Rewrite the folded stacks, so a crash loses little
+//
+//--------------------------------------------------------------------
+static void WriteTick(struct WheelTimer *Timer)
+{
+    struct Profiler *profiler = (struct Profiler *)Timer->Context;
+    int rc;
+
+    if ((rc = WriteProfile(profiler)) != 0) {
+        Trace("WriteTick: failed to write %s: %s", profiler->Path, strerror(rc));
+    }
+
+    ScheduleTimer(&profiler->Loop->Timers, &profiler->WriteTimer, PROFILE_WRITE_INTERVAL);
+}
+
+//--------------------------------------------------------------------
+//
+// ReadTarget - Copy Size bytes at Address out of the target
+//
+//--------------------------------------------------------------------
+static bool ReadTarget(pid_t Pid, uint64_t Address, void *Buffer, size_t Size)
+{
+    struct iovec local = { Buffer, Size };
+    struct iovec remote = { (void *)(uintptr_t)Address, Size };
+
+    return syscall(SYS_process_vm_readv, Pid, &local, 1, &remote, 1, 0) == (long)Size;
+}
+
+//--------------------------------------------------------------------
+//
+// GetThreadRegisters - Program counter, frame pointer and stack pointer
+//                      of a stopped tracee
+//
+//--------------------------------------------------------------------
+static bool GetThreadRegisters(pid_t Tid, uint64_t *Pc, uint64_t *Fp, uint64_t *Sp)
+{
+#if defined(__x86_64__) || defined(__aarch64__)
+    struct user_regs_struct regs;
+    struct iovec iov = { &regs, sizeof(regs) };
+
+    // a 32 bit tracee has a smaller register set
+    if (ptrace(PTRACE_GETREGSET, Tid, (void *)NT_PRSTATUS, &iov) != 0 || iov.iov_len != sizeof(regs)) {
+        return false;
+    }
+#if defined(__x86_64__)
+    *Pc = regs.rip;
+    *Fp = regs.rbp;
+    *Sp = regs.rsp;
+#else
+    *Pc = regs.pc;
+    *Fp = regs.regs[29];
+    *Sp = regs.sp;
+#endif
+    return true;
+#else
+    return false;
+#endif
+}
+
+//--------------------------------------------------------------------
+//
+// UnwindStack - Follow the frame pointer chain from Fp
+//
+//      Every frame record is the caller's frame pointer followed by the
+//      return address, on x86_64 and aarch64 alike.
+//
+// Returns: the number of frames, innermost (Pc) first
+//
+//--------------------------------------------------------------------
+static int UnwindStack(struct Profiler *Profiler, uint64_t Pc, uint64_t Fp, uint64_t Sp, uint64_t *Frames)
+{
+    struct iovec local = { Profiler->StackCopy, PROFILE_STACK_COPY };
+    struct iovec remote[PROFILE_STACK_COPY / STACK_READ_CHUNK + 1];
+    uint64_t address = Sp;
+    size_t left = PROFILE_STACK_COPY;
+    long copied;
+    int nRemote = 0;
+    int depth = 0;
+
+    Frames[depth++] = Pc;
+
+    // one read of the top of the stack, which usually holds every frame
+    // record; in page sized pieces so that the end of the stack only
+    // shortens it
+    while (left > 0) {
+        size_t chunk = STACK_READ_CHUNK - (address % STACK_READ_CHUNK);
+        chunk = (chunk < left) ? chunk : left;
+        remote[nRemote].iov_base = (void *)(uintptr_t)address;
+        remote[nRemote].iov_len = chunk;
+        nRemote++;
+        address += chunk;
+        left -= chunk;
+    }
+    if ((copied = syscall(SYS_process_vm_readv, Profiler->Pid, &local, 1, remote, nRemote, 0)) < 0) {
+        copied = 0;
+    }
+
+    while (depth < PROFILE_MAX_DEPTH && Fp != 0 && (Fp % sizeof(uint64_t)) == 0) {
+        uint64_t record[2];
+
+        if (Fp >= Sp && Fp - Sp + sizeof(record) <= (uint64_t)copied) {
+            memcpy(record, Profiler->StackCopy + (Fp - Sp), sizeof(record));
+        } else if (!ReadTarget(Profiler->Pid, Fp, record, sizeof(record))) {
+            break;
+        }
+
+        // code built without frame pointers uses the register for data, so the
+        // walk would go on through garbage: stop at the first return address
+        // outside the file mappings (as of the last write)
+        if (record[1] == 0 || (Profiler->nMaps != 0 && !IsMapped(Profiler, record[1]))) {
+            break;
+        }
+        Frames[depth++] = record[1];
+
+        // callers' frames are further up the stack; anything else is not a frame record
+        if (record[0] <= Fp) {
+            break;
+        }
+        Fp = record[0];
+    }
+
+    return depth;
+}
+
+//--------------------------------------------------------------------
+//
+// RecordStack - Count one occurrence of the stack Frames[0..Depth)
+//
+//--------------------------------------------------------------------
+static void RecordStack(struct Profiler *Profiler, const uint64_t *Frames, int Depth)
+{
+    uint64_t hash = 14695981039346656037ULL;        // FNV-1a
+    struct ProfileStack *stack;
+    size_t slot;
+
+    for (int i = 0; i < Depth; i++) {
+        hash = (hash ^ Frames[i]) * 1099511628211ULL;
+    }
+
+    for (slot = hash & (PROFILE_MAX_STACKS - 1); Profiler->Stacks[slot].Depth != 0; slot = (slot + 1) & (PROFILE_MAX_STACKS - 1)) {
+        stack = &Profiler->Stacks[slot];
+        if (stack->Hash == hash && stack->Depth == (uint32_t)Depth &&
+            memcmp(&Profiler->Pool[stack->Frames], Frames, Depth * sizeof(uint64_t)) == 0) {
+            stack->Count++;
+            Profiler->nSamples++;
+            return;
+        }
+    }
+
+    // a new stack; at most 3/4 full keeps the probes short and a free slot in reach
+    if (Profiler->nStacks >= PROFILE_MAX_STACKS / 4 * 3 || Profiler->nFrames + Depth > PROFILE_FRAME_POOL) {
+        Profiler->nDropped++;
+        return;
+    }
+
+    stack = &Profiler->Stacks[slot];
+    memcpy(&Profiler->Pool[Profiler->nFrames], Frames, Depth * sizeof(uint64_t));
+    stack->Hash = hash;
+    stack->Frames = (uint32_t)Profiler->nFrames;
+    stack->Depth = (uint32_t)Depth;
+    stack->Count = 1;
+    Profiler->nFrames += Depth;
+    Profiler->nStacks++;
+    Profiler->nSamples++;
+}
+
+//--------------------------------------------------------------------
+//
+// DetachStopped - Wait (without blocking) for a seized thread's stop
+//                 and detach it
+//
+//      A signal that arrived before the interrupt stops the thread
+//      first; it is handed back on detach.
+//
+// Returns: 1 if stopped and detached, -1 if it exited, 0 if still running
+//
+//--------------------------------------------------------------------
+static int DetachStopped(pid_t Tid, uint64_t *Pc, uint64_t *Fp, uint64_t *Sp, bool *bRegisters)
+{
+    int status;
+    int signal = 0;
+    pid_t rc = waitpid(Tid, &status, WNOHANG | __WALL);
+
+    if (rc == 0) {
+        return 0;
+    }
+    if (rc != Tid || !WIFSTOPPED(status)) {
+        return -1;
+    }
+
+    if ((status >> 16) != PTRACE_EVENT_STOP) {
+        signal = WSTOPSIG(status);
+    }
+    if (bRegisters != NULL) {
+        *bRegisters = GetThreadRegisters(Tid, Pc, Fp, Sp);
+    }
+    ptrace(PTRACE_DETACH, Tid, NULL, (void *)(long)signal);
+    return 1;
+}
+
+//--------------------------------------------------------------------
+//
+// ReapLagging - Detach the threads that have stopped since they lagged
+//
+//--------------------------------------------------------------------
+static void ReapLagging(struct Profiler *Profiler)
+{
+    for (int i = 0; i < Profiler->nLagging; ) {
+        if (DetachStopped(Profiler->Lagging[i], NULL, NULL, NULL, NULL) != 0) {
+            Profiler->Lagging[i] = Profiler->Lagging[--Profiler->nLagging];
+        } else {
+            i++;
+        }
+    }
+}
+
+//--------------------------------------------------------------------
+//
+// IsLagging - Is Tid still seized from an earlier tick?
+//
+//--------------------------------------------------------------------
+static bool IsLagging(struct Profiler *Profiler, pid_t Tid)
+{
+    for (int i = 0; i < Profiler->nLagging; i++) {
+        if (Profiler->Lagging[i] == Tid) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//--------------------------------------------------------------------
+//
+// InterruptThreads - Seize and interrupt every thread of the target
+//
+// Returns: the number of threads interrupted, in Profiler->Threads
+//
+//--------------------------------------------------------------------
+static int InterruptThreads(struct Profiler *Profiler)
+{
+    struct dirent *entry;
+    int nThreads = 0;
+
+    rewinddir(Profiler->Tasks);
+    while ((entry = readdir(Profiler->Tasks)) != NULL && nThreads < PROFILE_MAX_THREADS) {
+        struct ProfileThread *thread = &Profiler->Threads[nThreads];
+        pid_t tid;
+
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        tid = (pid_t)atoi(entry->d_name);
+        if (IsLagging(Profiler, tid)) {
+            continue;
+        }
+
+        // seizing doesn't stop the thread, the interrupt does
+        if (ptrace(PTRACE_SEIZE, tid, NULL, NULL) != 0) {
+            if (errno == EPERM && nThreads == 0 && !Profiler->bDenied) {
+                Profiler->bDenied = true;
+                Log(warn, "Not permitted to profile %d: %s", Profiler->Pid, strerror(errno));
+            }
+            continue;                       // exited, or traced already (gcore)
+        }
+        ptrace(PTRACE_INTERRUPT, tid, NULL, NULL);
+
+        thread->Tid = tid;
+        thread->bWaiting = true;
+        thread->bRegisters = false;
+        nThreads++;
+    }
+
+    return nThreads;
+}
+
+//--------------------------------------------------------------------
+//
+// DetachThreads - Take the registers of the interrupted threads as they
+//                 stop and let them go
+//
+//      Threads that do not stop within PROFILE_STOP_TIMEOUT are left
+//      seized, to be detached at a later tick.
+//
+//--------------------------------------------------------------------
+static void DetachThreads(struct Profiler *Profiler, int nThreads)
+{
+    uint64_t deadline = MetricClock() + PROFILE_STOP_TIMEOUT * 1000000ULL;
+
+    for (int waiting = nThreads; waiting > 0; ) {
+        // sleeping rather than yielding, the threads may be queued behind each other
+        struct timespec poll = { 0, STOP_POLL_INTERVAL };
+
+        waiting = 0;
+        for (int i = 0; i < nThreads; i++) {
+            struct ProfileThread *thread = &Profiler->Threads[i];
+            int rc;
+
+            if (!thread->bWaiting) {
+                continue;
+            }
+            if ((rc = DetachStopped(thread->Tid, &thread->Pc, &thread->Fp, &thread->Sp, &thread->bRegisters)) == 0) {
+                waiting++;
+                continue;
+            }
+            thread->bWaiting = false;
+            thread->bRegisters = rc > 0 && thread->bRegisters;
+        }
+
+        if (waiting > 0 && MetricClock() > deadline) {
+            for (int i = 0; i < nThreads; i++) {
+                if (!Profiler->Threads[i].bWaiting) {
+                    continue;
+                }
+                if (Profiler->nLagging < PROFILE_MAX_LAGGING) {
+                    Profiler->Lagging[Profiler->nLagging++] = Profiler->Threads[i].Tid;
+                }
+                Trace("DetachThreads: thread %d did not stop in time.", Profiler->Threads[i].Tid);
+            }
+            return;
+        }
+        if (waiting > 0) {
+            nanosleep(&poll, NULL);
+        }
+    }
+}
+
+//--------------------------------------------------------------------
+//
+// SampleProfiler - Record the stack of every thread of the target once
+//
+// Returns: the number of threads sampled
+//
+//--------------------------------------------------------------------
+int SampleProfiler(struct Profiler *Profiler)
+{
+    uint64_t frames[PROFILE_MAX_DEPTH];
+    int nThreads;
+    int nSampled = 0;
+
+    ReapLagging(Profiler);
+
+    nThreads = InterruptThreads(Profiler);
+    DetachThreads(Profiler, nThreads);
+
+    // the threads run again while their stacks are unwound
+    for (int i = 0; i < nThreads; i++) {
+        struct ProfileThread *thread = &Profiler->Threads[i];
+
+        if (thread->bRegisters) {
+            RecordStack(Profiler, frames, UnwindStack(Profiler, thread->Pc, thread->Fp, thread->Sp, frames));
+            nSampled++;
+        }
+    }
+
+    return nSampled;
+}
+
+//--------------------------------------------------------------------
+//
+// CompareSymbols - qsort order of a symbol index
+//
+//--------------------------------------------------------------------
+static int CompareSymbols(const void *a, const void *b)
+{
+    const struct ProfileSymbol *x = (const struct ProfileSymbol *)a;
+    const struct ProfileSymbol *y = (const struct ProfileSymbol *)b;
+
+    return (x->Address > y->Address) - (x->Address < y->Address);
+}
+
+//--------------------------------------------------------------------
+//
+// InImage - Is [Offset, Offset + Length) inside the mapped file?
+//
+//      The ELF fields are untrusted (the file comes through the target's
+//      root): the check is written so that it cannot wrap.
+//
+//--------------------------------------------------------------------
+static bool InImage(const struct SymbolIndex *Module, uint64_t Offset, uint64_t Length)
+{
+    return Offset <= Module->ImageSize && Length <= Module->ImageSize - Offset;
+}
+
+//--------------------------------------------------------------------
+//
+// LoadSymbolIndex - Index the function symbols of Path as the target sees it
+//
+//      The file is mapped and kept mapped, symbol names point into it.
+//      .symtab and .dynsym are both read; a file that can't be read or
+//      parsed gets an empty index, so it is only tried once.
+//
+//--------------------------------------------------------------------
+static void LoadSymbolIndex(pid_t Pid, const char *Path, struct SymbolIndex *Module)
+{
+    char file[PATH_MAX + 32];
+    const Elf64_Ehdr *header;
+    const Elf64_Shdr *sections;
+    struct stat st;
+    size_t count = 0;
+    int fd;
+
+    memset(Module, 0, sizeof(*Module));
+    Module->Path = strdup(Path);
+
+    // through the target's root, it may be in another mount namespace
+    snprintf(file, sizeof(file), "/proc/%d/root%s", Pid, Path);
+    if ((fd = open(file, O_RDONLY | O_CLOEXEC)) == -1) {
+        Trace("LoadSymbolIndex: failed to open %s.", file);
+        return;
+    }
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(Elf64_Ehdr)) {
+        Module->Image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        Module->ImageSize = st.st_size;
+    }
+    close(fd);
+    if (Module->Image == NULL || Module->Image == MAP_FAILED) {
+        Module->Image = NULL;
+        return;
+    }
+
+    header = (const Elf64_Ehdr *)Module->Image;
+    if (memcmp(header->e_ident, ELFMAG, SELFMAG) != 0 || header->e_ident[EI_CLASS] != ELFCLASS64 ||
+        !InImage(Module, header->e_phoff, (uint64_t)header->e_phnum * sizeof(Elf64_Phdr)) ||
+        !InImage(Module, header->e_shoff, (uint64_t)header->e_shnum * sizeof(Elf64_Shdr))) {
+        Trace("LoadSymbolIndex: %s is not a 64 bit ELF file.", Path);
+        return;
+    }
+
+    // file offsets of the mappings are turned into link time addresses through the loadable segments
+    for (int i = 0; i < header->e_phnum && Module->nLoads < PROFILE_MAX_LOADS; i++) {
+        const Elf64_Phdr *segment = (const Elf64_Phdr *)((const char *)Module->Image + header->e_phoff) + i;
+        if (segment->p_type == PT_LOAD) {
+            Module->Loads[Module->nLoads].Offset = segment->p_offset;
+            Module->Loads[Module->nLoads].Address = segment->p_vaddr;
+            Module->Loads[Module->nLoads].Size = segment->p_filesz;
+            Module->nLoads++;
+        }
+    }
+
+    sections = (const Elf64_Shdr *)((const char *)Module->Image + header->e_shoff);
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < header->e_shnum; i++) {
+            const Elf64_Shdr *table = &sections[i];
+            const Elf64_Shdr *strings;
+            const Elf64_Sym *symbols;
+
+            if ((table->sh_type != SHT_SYMTAB && table->sh_type != SHT_DYNSYM) || table->sh_link >= header->e_shnum ||
+                !InImage(Module, table->sh_offset, table->sh_size)) {
+                continue;
+            }
+
+            // names are printed with %s: the string table must end in a NUL inside the file
+            strings = &sections[table->sh_link];
+            if (strings->sh_size == 0 || !InImage(Module, strings->sh_offset, strings->sh_size) ||
+                ((const char *)Module->Image)[strings->sh_offset + strings->sh_size - 1] != '\0') {
+                continue;
+            }
+
+            symbols = (const Elf64_Sym *)((const char *)Module->Image + table->sh_offset);
+            for (size_t s = 0; s < table->sh_size / sizeof(Elf64_Sym); s++) {
+                if (ELF64_ST_TYPE(symbols[s].st_info) != STT_FUNC || symbols[s].st_value == 0 ||
+                    symbols[s].st_name >= strings->sh_size) {
+                    continue;
+                }
+                // the first pass counts, the second fills
+                if (pass == 1) {
+                    Module->Symbols[Module->nSymbols].Address = symbols[s].st_value;
+                    Module->Symbols[Module->nSymbols].Size = symbols[s].st_size;
+                    Module->Symbols[Module->nSymbols].Name = (const char *)Module->Image + strings->sh_offset + symbols[s].st_name;
+                    Module->nSymbols++;
+                } else {
+                    count++;
+                }
+            }
+        }
+
+        if (pass == 0) {
+            if (count == 0 || (Module->Symbols = malloc(count * sizeof(struct ProfileSymbol))) == NULL) {
+                return;
+            }
+        }
+    }
+
+    qsort(Module->Symbols, Module->nSymbols, sizeof(struct ProfileSymbol), CompareSymbols);
+}
+
+//--------------------------------------------------------------------
+//
+// FindModule - Index of Path's symbol index, loaded on first use
+//
+// Returns: the index, -1 once PROFILE_MAX_MODULES are loaded
+//
+//--------------------------------------------------------------------
+static int FindModule(struct Profiler *Profiler, const char *Path)
+{
+    for (int i = 0; i < Profiler->nModules; i++) {
+        if (strcmp(Profiler->Modules[i].Path, Path) == 0) {
+            return i;
+        }
+    }
+    if (Profiler->nModules == PROFILE_MAX_MODULES) {
+        return -1;
+    }
+
+    LoadSymbolIndex(Profiler->Pid, Path, &Profiler->Modules[Profiler->nModules]);
+    return Profiler->nModules++;
+}
+
+//--------------------------------------------------------------------
+//
+// ReadMappings - The target's executable file mappings, for symbolization
+//
+//      Kept from the last successful read, so stacks can still be
+//      symbolized once the target has exited.
+//
+//--------------------------------------------------------------------
+static void ReadMappings(struct Profiler *Profiler)
+{
+    char mapsPath[32];
+    char *line = NULL;
+    size_t lineSize = 0;
+    struct ProfileMapping *maps = NULL;
+    size_t nMaps = 0, capacity = 0;
+    FILE *file;
+
+    if (Profiler->Modules == NULL &&
+        (Profiler->Modules = calloc(PROFILE_MAX_MODULES, sizeof(struct SymbolIndex))) == NULL) {
+        Log(error, INTERNAL_ERROR);
+        Trace("ReadMappings: failed to allocate memory.");
+        exit(-1);
+    }
+
+    snprintf(mapsPath, sizeof(mapsPath), "/proc/%d/maps", Profiler->Pid);
+    if ((file = fopen(mapsPath, "r")) == NULL) {
+        return;
+    }
+
+    while (getline(&line, &lineSize, file) != -1) {
+        unsigned long long start, end, offset;
+        char permissions[5];
+        int pathStart = 0;
+        char *path;
+        int module;
+
+        if (sscanf(line, "%llx-%llx %4s %llx %*s %*s %n", &start, &end, permissions, &offset, &pathStart) < 4 ||
+            pathStart == 0 || permissions[2] != 'x' || line[pathStart] != '/') {
+            continue;
+        }
+        path = line + pathStart;
+        path[strcspn(path, "\n")] = '\0';
+        if (strstr(path, " (deleted)") != NULL || (module = FindModule(Profiler, path)) == -1) {
+            continue;
+        }
+
+        if (nMaps == capacity) {
+            struct ProfileMapping *grown;
+            capacity = capacity ? capacity * 2 : 64;
+            if ((grown = realloc(maps, capacity * sizeof(struct ProfileMapping))) == NULL) {
+                break;
+            }
+            maps = grown;
+        }
+        maps[nMaps].Start = start;
+        maps[nMaps].End = end;
+        maps[nMaps].Offset = offset;
+        maps[nMaps].Module = module;
+        nMaps++;
+    }
+
+    free(line);
+    fclose(file);
+
+    if (nMaps != 0) {
+        free(Profiler->Maps);
+        Profiler->Maps = maps;
+        Profiler->nMaps = nMaps;
+    } else {
+        free(maps);
+    }
+}
+
+//--------------------------------------------------------------------
+//
+// IsMapped - Is Address in one of the target's executable file mappings?
+//
+//--------------------------------------------------------------------
+static bool IsMapped(struct Profiler *Profiler, uint64_t Address)
+{
+    for (size_t m = 0; m < Profiler->nMaps; m++) {
+        if (Address >= Profiler->Maps[m].Start && Address < Profiler->Maps[m].End) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//--------------------------------------------------------------------
+//
+// Symbolize - Name the function Address is in
+//
+//      function, or module+0xoffset (a file offset) without a symbol,
+//      or [unknown] outside of every file mapping.
+//
+//--------------------------------------------------------------------
+static void Symbolize(struct Profiler *Profiler, uint64_t Address, char *Buffer, size_t Size)
+{
+    for (size_t m = 0; m < Profiler->nMaps; m++) {
+        const struct ProfileMapping *map = &Profiler->Maps[m];
+        const struct SymbolIndex *module;
+        uint64_t offset;
+
+        if (Address < map->Start || Address >= map->End) {
+            continue;
+        }
+        module = &Profiler->Modules[map->Module];
+        offset = Address - map->Start + map->Offset;
+
+        for (int l = 0; l < module->nLoads; l++) {
+            uint64_t linked;
+            size_t low = 0, high = module->nSymbols;
+
+            if (offset < module->Loads[l].Offset || offset >= module->Loads[l].Offset + module->Loads[l].Size) {
+                continue;
+            }
+            linked = offset - module->Loads[l].Offset + module->Loads[l].Address;
+
+            // the last symbol starting at or before linked
+            while (low < high) {
+                size_t middle = (low + high) / 2;
+                if (module->Symbols[middle].Address <= linked) {
+                    low = middle + 1;
+                } else {
+                    high = middle;
+                }
+            }
+            if (low > 0 && linked < module->Symbols[low - 1].Address + module->Symbols[low - 1].Size) {
+                snprintf(Buffer, Size, "%s", module->Symbols[low - 1].Name);
+                return;
+            }
+            break;
+        }
+
+        snprintf(Buffer, Size, "%s+0x%llx", strrchr(module->Path, '/') + 1, (unsigned long long)offset);
+        return;
+    }
+
+    snprintf(Buffer, Size, "[unknown]");
+}
+
+//--------------------------------------------------------------------
+//
+// WriteProfile - Write every stack seen so far to Path as folded stacks
+//
+//      One line per distinct stack, "name;outermost;...;innermost count",
+//      as read by flamegraph.pl and most flame graph tools. The file is
+//      replaced atomically. Runs on the loop thread and is the only part
+//      of profiling that allocates: the mappings and the symbol indexes.
+//
+// Returns: 0 on success, errno otherwise
+//
+//--------------------------------------------------------------------
+int WriteProfile(struct Profiler *Profiler)
+{
+    char temporary[PATH_MAX + 8];
+    char symbol[PROFILE_SYMBOL_LENGTH];
+    FILE *output;
+    int rc = 0;
+
+    if (Profiler->Memory == NULL) {
+        return EINVAL;
+    }
+
+    ReadMappings(Profiler);
+
+    snprintf(temporary, sizeof(temporary), "%s.tmp", Profiler->Path);
+    if ((output = fopen(temporary, "w")) == NULL) {
+        return errno;
+    }
+
+    for (size_t slot = 0; slot < PROFILE_MAX_STACKS; slot++) {
+        const struct ProfileStack *stack = &Profiler->Stacks[slot];
+
+        if (stack->Depth == 0) {
+            continue;
+        }
+
+        fputs(Profiler->Name, output);
+        for (int i = (int)stack->Depth - 1; i >= 0; i--) {
+            // return addresses point after the call, look up the call itself
+            uint64_t address = Profiler->Pool[stack->Frames + i] - (i > 0 ? 1 : 0);
+            Symbolize(Profiler, address, symbol, sizeof(symbol));
+            fputc(';', output);
+            fputs(symbol, output);
+        }
+        fprintf(output, " %llu\n", (unsigned long long)stack->Count);
+    }
+
+    if (fclose(output) != 0 || rename(temporary, Profiler->Path) != 0) {
+        rc = errno;
+        unlink(temporary);
+    }
+    return rc;
+}
@@ -0,0 +1,110 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Quick counting semaphore implementation
+//
+//--------------------------------------------------------------------
+
+#include "Semaphores.h"
+#include "Futex.h"
+#include "Logging.h"
+
+
+//--------------------------------------------------------------------
+//
+// InitSemaphore - Initialize a semaphore with InitialCount slots
+//
+//--------------------------------------------------------------------
+void InitSemaphore(struct Semaphore *Semaphore, int InitialCount)
+{
+    Semaphore->nWaiters = 0;
+    __atomic_store_n(&Semaphore->Count, InitialCount, __ATOMIC_RELEASE);
+}
+
+
+//--------------------------------------------------------------------
+//
+// DestroySemaphore - Clean up a semaphore
+//
+//--------------------------------------------------------------------
+void DestroySemaphore(struct Semaphore *Semaphore)
+{
+    // The semaphore owns no resources; just note if somebody is still parked on it
+    if (__atomic_load_n(&Semaphore->nWaiters, __ATOMIC_ACQUIRE) != 0) {
+        Trace("DestroySemaphore: semaphore destroyed while threads are waiting on it.");
+    }
+}
+
+
+//--------------------------------------------------------------------
+//
+// ReleaseSemaphore - Return a slot to the semaphore (sem_post)
+//
+// Return - A boolean indicating success of the release
+//
+//--------------------------------------------------------------------
+bool ReleaseSemaphore(struct Semaphore *Semaphore)
+{
+    __atomic_add_fetch(&Semaphore->Count, 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&Semaphore->nWaiters, __ATOMIC_SEQ_CST) != 0) {
+        FutexWake(&Semaphore->Count, 1);
+    }
+
+    return true;
+}
+
+
+//--------------------------------------------------------------------
+//
+// TryAcquireSemaphore - Take a slot if one is available without blocking
+//
+//--------------------------------------------------------------------
+static bool TryAcquireSemaphore(struct Semaphore *Semaphore)
+{
+    int count = __atomic_load_n(&Semaphore->Count, __ATOMIC_RELAXED);
+
+    while (count > 0) {
+        if (__atomic_compare_exchange_n(&Semaphore->Count, &count, count - 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+//--------------------------------------------------------------------
+//
+// WaitForSemaphore - Block until a slot is available or the deadline passes
+//
+// Parameters:
+//      -Semaphore -> the semaphore to decrement
+//      -Deadline -> absolute WAIT_CLOCK deadline, NULL waits forever
+//
+// Return - 0 on success, ETIMEDOUT on timeout, other errno on failure
+//
+//--------------------------------------------------------------------
+int WaitForSemaphore(struct Semaphore *Semaphore, const struct timespec *Deadline)
+{
+    int rc = 0;
+
+    while (!TryAcquireSemaphore(Semaphore)) {
+        if (rc != 0 && rc != EINTR) {
+            return rc;
+        }
+
+        // a poll, or a deadline gone by, never sleeps: don't have setters wake us for nothing
+        if (DeadlinePassed(Deadline)) {
+            return ETIMEDOUT;
+        }
+
+        __atomic_add_fetch(&Semaphore->nWaiters, 1, __ATOMIC_SEQ_CST);
+        rc = FutexWait(&Semaphore->Count, 0, Deadline);
+        __atomic_sub_fetch(&Semaphore->nWaiters, 1, __ATOMIC_SEQ_CST);
+    }
+
+    return 0;
+}
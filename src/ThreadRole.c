@@ -0,0 +1,279 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Scheduling, CPU affinity and I/O priority of procdump's own threads
+//
+//      Every thread procdump starts has a role and applies the tuning
+//      given for it with -T when it starts:
+//
+//          sampler     the event loop (main) thread
+//          writer      the dump workers; gcore and gdb are forked from
+//                      them and keep only the I/O priority, so an idle
+//                      writer does not keep the target stopped for longer
+//          logger      the log flusher
+//
+//      The main thread applies its tuning last, once the other threads
+//      have been created, so they do not inherit it.
+//
+//--------------------------------------------------------------------
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+
+#include "Logging.h"
+#include "ThreadRole.h"
+
+#define CPU_BITS (8 * sizeof(unsigned long))
+
+static const char *RoleNames[THREAD_ROLES] = { "sampler", "writer", "logger" };
+
+// names shown by top -H; the sampler keeps procdump's so the process name doesn't change
+static const char *ThreadNames[THREAD_ROLES] = { NULL, "procdump-writer", "procdump-logger" };
+
+// procdump's own, saved before any role's tuning is applied
+static struct ThreadTuning startTuning = {
+    .Policy = THREAD_POLICY_UNCHANGED,
+    .Nice = THREAD_NICE_UNCHANGED,
+    .IoClass = IOPRIO_CLASS_NONE
+};
+static bool bStartSaved = false;
+
+static struct ThreadTuning roleTuning[THREAD_ROLES] = {
+    [0 ... THREAD_ROLES - 1] = {
+        .Policy = THREAD_POLICY_UNCHANGED,
+        .Nice = THREAD_NICE_UNCHANGED,
+        .IoClass = IOPRIO_CLASS_NONE
+    }
+};
+
+//--------------------------------------------------------------------
+//
+// ParseCpuRange - Add "N" or "N-M" to Tuning's CPU set
+//
+// Returns: true if Range was valid
+//
+//--------------------------------------------------------------------
+static bool ParseCpuRange(const char *Range, struct ThreadTuning *Tuning)
+{
+    char *end;
+    long first, last;
+
+    first = last = strtol(Range, &end, 10);
+    if (*end == '-') {
+        last = strtol(end + 1, &end, 10);
+    }
+    if (end == Range || *end != '\0' || first < 0 || last < first || last >= THREAD_ROLE_MAX_CPUS) {
+        return false;
+    }
+
+    for (long cpu = first; cpu <= last; cpu++) {
+        if ((Tuning->Cpus[cpu / CPU_BITS] & (1UL << (cpu % CPU_BITS))) == 0) {
+            Tuning->Cpus[cpu / CPU_BITS] |= 1UL << (cpu % CPU_BITS);
+            Tuning->nCpus++;
+        }
+    }
+    return true;
+}
+
+//--------------------------------------------------------------------
+//
+// ParseThreadTuning - Parse "role:key=value,..." as given to -T
+//
+//      sched=other|batch|idle, nice=-20..19, ioprio=idle|be[:0-7]|rt[:0-7]
+//      and cpus=0,2-3. Commas also separate the CPUs of cpus=, so
+//      anything without '=' continues the CPU list.
+//
+// Returns: 0 on success, EINVAL otherwise
+//
+//--------------------------------------------------------------------
+int ParseThreadTuning(const char *Spec, enum ThreadRole *Role, struct ThreadTuning *Tuning)
+{
+    const char *options = strchr(Spec, ':');
+    char *copy, *pair, *savePtr = NULL;
+    bool bCpus = false;
+    int rc = 0;
+
+    memset(Tuning, 0, sizeof(*Tuning));
+    Tuning->Policy = THREAD_POLICY_UNCHANGED;
+    Tuning->Nice = THREAD_NICE_UNCHANGED;
+    Tuning->IoClass = IOPRIO_CLASS_NONE;
+
+    if (options == NULL) {
+        return EINVAL;
+    }
+    for (*Role = 0; *Role < THREAD_ROLES; (*Role)++) {
+        if (strncmp(Spec, RoleNames[*Role], options - Spec) == 0 && RoleNames[*Role][options - Spec] == '\0') {
+            break;
+        }
+    }
+    if (*Role == THREAD_ROLES) {
+        return EINVAL;
+    }
+
+    copy = strdup(options + 1);
+    for (pair = strtok_r(copy, ",", &savePtr); pair != NULL && rc == 0; pair = strtok_r(NULL, ",", &savePtr)) {
+        char *value = strchr(pair, '=');
+        char *end;
+
+        if (value == NULL) {
+            rc = bCpus && ParseCpuRange(pair, Tuning) ? 0 : EINVAL;
+            continue;
+        }
+        *value++ = '\0';
+        bCpus = false;
+
+        if (strcmp(pair, "sched") == 0) {
+            if (strcmp(value, "other") == 0) {
+                Tuning->Policy = SCHED_OTHER;
+            } else if (strcmp(value, "batch") == 0) {
+                Tuning->Policy = SCHED_BATCH;
+            } else if (strcmp(value, "idle") == 0) {
+                Tuning->Policy = SCHED_IDLE;
+            } else {
+                rc = EINVAL;
+            }
+        } else if (strcmp(pair, "nice") == 0) {
+            long nice = strtol(value, &end, 10);
+            if (*value == '\0' || *end != '\0' || nice < -20 || nice > 19) {
+                rc = EINVAL;
+            } else {
+                Tuning->Nice = (int)nice;
+            }
+        } else if (strcmp(pair, "ioprio") == 0) {
+            char *level = strchr(value, ':');
+            if (level != NULL) {
+                *level++ = '\0';
+                Tuning->IoLevel = (int)strtol(level, &end, 10);
+                if (*level == '\0' || *end != '\0' || Tuning->IoLevel < 0 || Tuning->IoLevel > 7) {
+                    rc = EINVAL;
+                }
+            } else {
+                Tuning->IoLevel = 4;        // the kernel's default within a class
+            }
+
+            if (strcmp(value, "idle") == 0 && level == NULL) {
+                Tuning->IoClass = IOPRIO_CLASS_IDLE;
+                Tuning->IoLevel = 0;
+            } else if (strcmp(value, "be") == 0) {
+                Tuning->IoClass = IOPRIO_CLASS_BE;
+            } else if (strcmp(value, "rt") == 0) {
+                Tuning->IoClass = IOPRIO_CLASS_RT;
+            } else {
+                rc = EINVAL;
+            }
+        } else if (strcmp(pair, "cpus") == 0) {
+            bCpus = ParseCpuRange(value, Tuning);
+            rc = bCpus ? 0 : EINVAL;
+        } else {
+            rc = EINVAL;
+        }
+    }
+    free(copy);
+
+    return rc;
+}
+
+//--------------------------------------------------------------------
+//
+// SetThreadTuning - Tuning for threads entering Role from now on
+//
+//--------------------------------------------------------------------
+void SetThreadTuning(enum ThreadRole Role, const struct ThreadTuning *Tuning)
+{
+    // still single threaded: the main thread's settings are everyone's
+    if (!bStartSaved) {
+        errno = 0;
+        startTuning.Policy = sched_getscheduler(0);
+        startTuning.Nice = getpriority(PRIO_PROCESS, 0);
+        if (errno != 0) {
+            startTuning.Nice = THREAD_NICE_UNCHANGED;
+        }
+        if (syscall(SYS_sched_getaffinity, 0, sizeof(startTuning.Cpus), startTuning.Cpus) > 0) {
+            startTuning.nCpus = 1;
+        }
+        bStartSaved = true;
+    }
+
+    roleTuning[Role] = *Tuning;
+}
+
+//--------------------------------------------------------------------
+//
+// EnterThreadRole - Apply Role's tuning to the calling thread
+//
+//      All of these are per thread on Linux. A setting the kernel
+//      refuses (nice below 0 or rt without privileges, CPUs that are
+//      offline or outside our cpuset) is logged and skipped.
+//
+// Returns: 0 if everything was applied, the last errno otherwise
+//
+//--------------------------------------------------------------------
+int EnterThreadRole(enum ThreadRole Role)
+{
+    const struct ThreadTuning *tuning = &roleTuning[Role];
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+    int rc = 0;
+
+    if (ThreadNames[Role] != NULL) {
+        prctl(PR_SET_NAME, ThreadNames[Role], 0, 0, 0);
+    }
+
+    if (tuning->Policy != THREAD_POLICY_UNCHANGED) {
+        struct sched_param param = { .sched_priority = 0 };
+        if (sched_setscheduler(0, tuning->Policy, &param) != 0) {
+            rc = errno;
+            Log(warn, "Unable to set the scheduling policy of the %s thread: %s", RoleNames[Role], strerror(rc));
+        }
+    }
+
+    if (tuning->Nice != THREAD_NICE_UNCHANGED && setpriority(PRIO_PROCESS, tid, tuning->Nice) != 0) {
+        rc = errno;
+        Log(warn, "Unable to set the nice value of the %s thread: %s", RoleNames[Role], strerror(rc));
+    }
+
+    if (tuning->IoClass != IOPRIO_CLASS_NONE &&
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, (tuning->IoClass << IOPRIO_CLASS_SHIFT) | tuning->IoLevel) != 0) {
+        rc = errno;
+        Log(warn, "Unable to set the I/O priority of the %s thread: %s", RoleNames[Role], strerror(rc));
+    }
+
+    if (tuning->nCpus != 0 && syscall(SYS_sched_setaffinity, 0, sizeof(tuning->Cpus), tuning->Cpus) != 0) {
+        rc = errno;
+        Log(warn, "Unable to set the CPU affinity of the %s thread: %s", RoleNames[Role], strerror(rc));
+    }
+
+    Trace("EnterThreadRole: thread %d is the %s.", tid, RoleNames[Role]);
+    return rc;
+}
+
+//--------------------------------------------------------------------
+//
+// LeaveThreadRole - Give the calling thread back procdump's own policy,
+//                   nice value and affinity where Role changed them
+//
+//      For a child forked from a thread of Role, so only async signal
+//      safe calls and nothing is logged; the I/O priority is kept.
+//      Raising the priority back may be refused without privileges.
+//
+//--------------------------------------------------------------------
+void LeaveThreadRole(enum ThreadRole Role)
+{
+    const struct ThreadTuning *tuning = &roleTuning[Role];
+
+    if (tuning->Policy != THREAD_POLICY_UNCHANGED && startTuning.Policy != THREAD_POLICY_UNCHANGED) {
+        struct sched_param param = { .sched_priority = 0 };
+        sched_setscheduler(0, startTuning.Policy, &param);
+    }
+    if (tuning->Nice != THREAD_NICE_UNCHANGED && startTuning.Nice != THREAD_NICE_UNCHANGED) {
+        setpriority(PRIO_PROCESS, 0, startTuning.Nice);
+    }
+    if (tuning->nCpus != 0 && startTuning.nCpus != 0) {
+        syscall(SYS_sched_setaffinity, 0, sizeof(startTuning.Cpus), startTuning.Cpus);
+    }
+}
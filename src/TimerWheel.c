@@ -0,0 +1,339 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Hierarchical timer wheel for trigger sampling, snooze and timed dumps
+//
+//--------------------------------------------------------------------
+
+#include "TimerWheel.h"
+
+#define EXPIRED_LEVEL WHEEL_LEVELS              // Level of a timer about to run its callback
+#define LEVEL_SHIFT(L) (WHEEL_BITS * (L))
+
+//--------------------------------------------------------------------
+//
+// LinkTimer / UnlinkTimer - O(1) list surgery, keeping the occupancy bitmaps current
+//
+//--------------------------------------------------------------------
+static void LinkTimer(struct TimerWheel *Wheel, struct WheelTimer *Timer, int Level, int Slot)
+{
+    struct WheelTimer **head = &Wheel->Slots[Level][Slot];
+
+    Timer->Next = *head;
+    if (*head != NULL) {
+        (*head)->Prev = &Timer->Next;
+    }
+    *head = Timer;
+    Timer->Prev = head;
+    Timer->Level = Level;
+    Timer->Slot = Slot;
+    Wheel->Occupied[Level] |= (1ULL << Slot);
+}
+
+static void UnlinkTimer(struct TimerWheel *Wheel, struct WheelTimer *Timer)
+{
+    *Timer->Prev = Timer->Next;
+    if (Timer->Next != NULL) {
+        Timer->Next->Prev = Timer->Prev;
+    }
+
+    if (Timer->Level != EXPIRED_LEVEL && Wheel->Slots[Timer->Level][Timer->Slot] == NULL) {
+        Wheel->Occupied[Timer->Level] &= ~(1ULL << Timer->Slot);
+    }
+
+    Timer->Next = NULL;
+    Timer->Prev = NULL;
+    Timer->Level = NO_TIMER;
+}
+
+//--------------------------------------------------------------------
+//
+// PlaceTimer - Put a timer on the lowest level whose span covers its expiry
+//
+//--------------------------------------------------------------------
+static void PlaceTimer(struct TimerWheel *Wheel, struct WheelTimer *Timer)
+{
+    uint64_t expires = Timer->Expires;
+    uint64_t delta;
+    int level = 0;
+
+    if (expires < Wheel->Next) {
+        expires = Wheel->Next; // already due, run on the next processed tick
+    }
+
+    delta = expires - Wheel->Next;
+    if (delta >= WHEEL_RANGE) {
+        // park beyond-range timers in the last slot; they are re-placed when it cascades
+        expires = Wheel->Next + WHEEL_RANGE - 1;
+        delta = WHEEL_RANGE - 1;
+    }
+
+    while (delta >= (1ULL << LEVEL_SHIFT(level + 1))) {
+        level++;
+    }
+
+    LinkTimer(Wheel, Timer, level, (expires >> LEVEL_SHIFT(level)) & WHEEL_MASK);
+}
+
+//--------------------------------------------------------------------
+//
+// CascadeSlot - Re-place every timer of a higher level slot (they move down)
+//
+//--------------------------------------------------------------------
+static void CascadeSlot(struct TimerWheel *Wheel, int Level, int Slot)
+{
+    struct WheelTimer *timer = Wheel->Slots[Level][Slot];
+
+    Wheel->Slots[Level][Slot] = NULL;
+    Wheel->Occupied[Level] &= ~(1ULL << Slot);
+
+    while (timer != NULL) {
+        struct WheelTimer *next = timer->Next;
+        PlaceTimer(Wheel, timer);
+        timer = next;
+    }
+}
+
+//--------------------------------------------------------------------
+//
+// InitTimerWheel - Empty wheel whose tick 0 is "now" on CLOCK_MONOTONIC
+//
+//--------------------------------------------------------------------
+void InitTimerWheel(struct TimerWheel *Wheel)
+{
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        Wheel->Occupied[level] = 0;
+        for (int slot = 0; slot < WHEEL_SLOTS; slot++) {
+            Wheel->Slots[level][slot] = NULL;
+        }
+    }
+
+    Wheel->nTimers = 0;
+    Wheel->Expired = NULL;
+    Wheel->Next = 1; // tick 0 counts as processed
+    clock_gettime(CLOCK_MONOTONIC, &Wheel->Base);
+}
+
+//--------------------------------------------------------------------
+//
+// InitWheelTimer - Prepare an idle timer
+//
+//--------------------------------------------------------------------
+void InitWheelTimer(struct WheelTimer *Timer, TimerCallback Callback, void *Context)
+{
+    Timer->Next = NULL;
+    Timer->Prev = NULL;
+    Timer->Expires = 0;
+    Timer->Callback = Callback;
+    Timer->Context = Context;
+    Timer->Level = NO_TIMER;
+    Timer->Slot = 0;
+}
+
+//--------------------------------------------------------------------
+//
+// ScheduleTimerAt - (Re)schedule Timer to fire at tick Expires. O(1)
+//
+//--------------------------------------------------------------------
+void ScheduleTimerAt(struct TimerWheel *Wheel, struct WheelTimer *Timer, uint64_t Expires)
+{
+    CancelTimer(Wheel, Timer);
+
+    Timer->Expires = Expires;
+    PlaceTimer(Wheel, Timer);
+    Wheel->nTimers++;
+}
+
+//--------------------------------------------------------------------
+//
+// ScheduleTimer - (Re)schedule Timer to fire Milliseconds from the last processed tick
+//
+//--------------------------------------------------------------------
+void ScheduleTimer(struct TimerWheel *Wheel, struct WheelTimer *Timer, uint64_t Milliseconds)
+{
+    ScheduleTimerAt(Wheel, Timer, Wheel->Next - 1 + Milliseconds);
+}
+
+//--------------------------------------------------------------------
+//
+// RescheduleTimer - Fixed-rate re-arm: Period after the previous expiry
+//
+//      Periods that were missed entirely (e.g. the loop was blocked) are
+//      skipped rather than fired back to back.
+//
+//--------------------------------------------------------------------
+void RescheduleTimer(struct TimerWheel *Wheel, struct WheelTimer *Timer, uint64_t Period)
+{
+    uint64_t expires = Timer->Expires + Period;
+
+    if (Period != 0 && expires < Wheel->Next) {
+        expires += ((Wheel->Next - expires + Period - 1) / Period) * Period;
+    }
+
+    ScheduleTimerAt(Wheel, Timer, expires);
+}
+
+//--------------------------------------------------------------------
+//
+// CancelTimer - Unschedule Timer if it is pending. O(1)
+//
+//--------------------------------------------------------------------
+void CancelTimer(struct TimerWheel *Wheel, struct WheelTimer *Timer)
+{
+    if (Timer->Level == NO_TIMER) {
+        return;
+    }
+
+    UnlinkTimer(Wheel, Timer);
+    Wheel->nTimers--;
+}
+
+//--------------------------------------------------------------------
+//
+// RunTimerNow - Run Timer's callback right away, as if it had expired
+//               on the last processed tick
+//
+//      Scheduling for 0 ms waits for the next tick, up to 1 ms. The
+//      callback may re-arm the timer with RescheduleTimer as usual.
+//
+//--------------------------------------------------------------------
+void RunTimerNow(struct TimerWheel *Wheel, struct WheelTimer *Timer)
+{
+    CancelTimer(Wheel, Timer);
+    Timer->Expires = Wheel->Next - 1;
+    Timer->Callback(Timer);
+}
+
+//--------------------------------------------------------------------
+//
+// IsTimerScheduled - Is Timer waiting to fire?
+//
+//--------------------------------------------------------------------
+bool IsTimerScheduled(struct WheelTimer *Timer)
+{
+    return Timer->Level != NO_TIMER && Timer->Level != EXPIRED_LEVEL;
+}
+
+//--------------------------------------------------------------------
+//
+// AdvanceTimerWheel - Process every tick up to and including Now, running callbacks
+//
+//      Empty stretches of level 0 are skipped using the occupancy bitmap, so the
+//      cost is proportional to expiring timers and block boundaries, not to ticks.
+//
+//--------------------------------------------------------------------
+void AdvanceTimerWheel(struct TimerWheel *Wheel, uint64_t Now)
+{
+    while (Wheel->Next <= Now) {
+        uint64_t tick = Wheel->Next;
+        int slot = tick & WHEEL_MASK;
+
+        if (slot != 0 && !(Wheel->Occupied[0] & (1ULL << slot))) {
+            // jump to the next occupied slot in this block, or the block boundary
+            uint64_t rest = Wheel->Occupied[0] & (~0ULL << slot);
+            uint64_t target = rest ? (tick & ~(uint64_t)WHEEL_MASK) + __builtin_ctzll(rest) : (tick | WHEEL_MASK) + 1;
+            Wheel->Next = (target <= Now) ? target : Now + 1;
+            continue;
+        }
+
+        // entering a new block: pull the matching higher level slots down
+        if (slot == 0) {
+            for (int level = 1; level < WHEEL_LEVELS; level++) {
+                int index = (tick >> LEVEL_SHIFT(level)) & WHEEL_MASK;
+                CascadeSlot(Wheel, level, index);
+                if (index != 0) {
+                    break;
+                }
+            }
+        }
+
+        // timers scheduled by the callbacks below land on later ticks
+        Wheel->Next = tick + 1;
+
+        if ((Wheel->Expired = Wheel->Slots[0][slot]) == NULL) {
+            continue;
+        }
+        Wheel->Slots[0][slot] = NULL;
+        Wheel->Occupied[0] &= ~(1ULL << slot);
+        Wheel->Expired->Prev = &Wheel->Expired;
+        for (struct WheelTimer *timer = Wheel->Expired; timer != NULL; timer = timer->Next) {
+            timer->Level = EXPIRED_LEVEL;
+        }
+
+        // pop one at a time so a callback may cancel a sibling that expired with it
+        while (Wheel->Expired != NULL) {
+            struct WheelTimer *timer = Wheel->Expired;
+            UnlinkTimer(Wheel, timer);
+            Wheel->nTimers--;
+            timer->Callback(timer);
+        }
+    }
+}
+
+//--------------------------------------------------------------------
+//
+// NextTimerDelay - Milliseconds from Now until the wheel next needs processing
+//
+// Returns: -1 if no timer is pending, 0 if processing is already due.
+//          Higher levels report their next cascade, which is a lower bound.
+//
+//--------------------------------------------------------------------
+int64_t NextTimerDelay(struct TimerWheel *Wheel, uint64_t Now)
+{
+    uint64_t earliest = UINT64_MAX;
+
+    if (Wheel->nTimers == 0) {
+        return -1;
+    }
+
+    if (Wheel->Occupied[0] != 0) {
+        int slot = Wheel->Next & WHEEL_MASK;
+        uint64_t block = Wheel->Next & ~(uint64_t)WHEEL_MASK;
+        uint64_t rest = Wheel->Occupied[0] & (~0ULL << slot);
+
+        earliest = rest ? block + __builtin_ctzll(rest) : block + WHEEL_SLOTS + __builtin_ctzll(Wheel->Occupied[0]);
+    }
+
+    for (int level = 1; level < WHEEL_LEVELS; level++) {
+        uint64_t occupied = Wheel->Occupied[level];
+        uint64_t block = Wheel->Next >> LEVEL_SHIFT(level);
+        bool atBoundary = (Wheel->Next & ((1ULL << LEVEL_SHIFT(level)) - 1)) == 0;
+        int first;
+        uint64_t rotated;
+        uint64_t cascade;
+
+        if (occupied == 0) {
+            continue;
+        }
+
+        // slot s cascades when we enter block s; unless we are sitting on the
+        // (unprocessed) start of the current block, its slot already did
+        first = atBoundary ? (block & WHEEL_MASK) : ((block + 1) & WHEEL_MASK);
+        rotated = first ? (occupied >> first) | (occupied << (WHEEL_SLOTS - first)) : occupied;
+        cascade = (block + (atBoundary ? 0 : 1) + __builtin_ctzll(rotated)) << LEVEL_SHIFT(level);
+        if (cascade < earliest) {
+            earliest = cascade;
+        }
+    }
+
+    return (earliest <= Now) ? 0 : (int64_t)(earliest - Now);
+}
+
+//--------------------------------------------------------------------
+//
+// TimerWheelClock - Current CLOCK_MONOTONIC time in wheel ticks (ms)
+//
+//--------------------------------------------------------------------
+uint64_t TimerWheelClock(struct TimerWheel *Wheel)
+{
+    struct timespec now;
+    int64_t elapsed;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    // normalize to ns before dividing: a negative nsec difference alone would truncate toward zero
+    elapsed = (int64_t)(now.tv_sec - Wheel->Base.tv_sec) * 1000000000LL + (now.tv_nsec - Wheel->Base.tv_nsec);
+    return (uint64_t)(elapsed / 1000000);
+}
@@ -3,155 +3,473 @@
 
 //--------------------------------------------------------------------
 //
-// thread processes
+// trigger processes
 //
 //--------------------------------------------------------------------
 
 #include "TriggerThreadProcs.h"
 
-void *CommitThread(void *thread_args /* struct ProcDumpConfiguration* */)
+static void TriggerTick(struct WheelTimer *Timer);
+static void ArmTrigger(struct Trigger *self);
+static void DumpWork(struct WorkItem *Item);
+static void DumpComplete(struct WorkItem *Item);
+static bool TargetGone(struct ProcDumpConfiguration *config);
+
+//--------------------------------------------------------------------
+//
+// NewTrigger - Helper function for newing a struct Trigger that dumps through writer
+//
+//      Allocated from the target arena of the writer's config.
+//
+// Returns: struct Trigger *
+//
+//--------------------------------------------------------------------
+struct Trigger *NewTrigger(struct CoreDumpWriter *writer)
 {
-    Trace("CommitThread: Starting Trigger Thread");
-    struct ProcDumpConfiguration *config = (struct ProcDumpConfiguration *)thread_args;
+    struct Trigger *trigger = (struct Trigger *)ArenaAlloc(&writer->Config->TargetArena, sizeof(struct Trigger));
+    if (trigger == NULL) {
+        Log(error, INTERNAL_ERROR);
+        Trace("NewTrigger: failed to allocate memory.");
+        exit(-1);
+    }
 
-    long pageSize_kb;
-    unsigned long memUsage = 0;
-    struct ProcessStat proc = {0};
-    int rc = 0;
-    struct CoreDumpWriter *writer = NewCoreDumpWriter(COMMIT, config); 
+    trigger->Config = writer->Config;
+    trigger->Writer = writer;
+    trigger->bActive = false;
+    trigger->bArmed = false;
+    trigger->bPaused = false;
+    trigger->bDumpPending = false;
+    trigger->bConditionHeld = false;
+    trigger->HeldSince = 0;
+    trigger->Tasks = NULL;
+    trigger->SamplingInterval = writer->Config->SamplingInterval;
+
+    switch (writer->Type) {
+        case COMMIT:
+            trigger->Evaluate = CommitTrigger;
+            break;
+        case CPU:
+            trigger->Evaluate = CpuTrigger;
+            break;
+        case TIME:
+            trigger->Evaluate = TimerTrigger;
+            trigger->SamplingInterval = 0; // dump right away, then once per snooze period
+            break;
+        case BLOCKED:
+            trigger->Evaluate = BlockedTrigger;
+            break;
+        default:
+            Log(error, INTERNAL_ERROR);
+            Trace("NewTrigger: unsupported trigger type %d.", writer->Type);
+            exit(-1);
+    }
 
-    pageSize_kb = sysconf(_SC_PAGESIZE) >> 10; // convert bytes to kilobytes (2^10)
+    if (writer->Type == CPU) {
+        SetMetricGauge(&trigger->Config->Metrics, METRIC_TRIGGER_THRESHOLD, CPU, trigger->Config->CpuThreshold);
+    } else if (writer->Type == COMMIT) {
+        SetMetricGauge(&trigger->Config->Metrics, METRIC_TRIGGER_THRESHOLD, COMMIT, trigger->Config->MemoryThreshold);
+    } else if (writer->Type == BLOCKED) {
+        SetMetricGauge(&trigger->Config->Metrics, METRIC_TRIGGER_THRESHOLD, BLOCKED, trigger->Config->BlockedThreshold);
+    }
 
-    if ((rc = WaitForQuitOrEvent(config, &config->evtStartMonitoring, INFINITE_WAIT)) == WAIT_OBJECT_0 + 1)
-    {
-        while ((rc = WaitForQuit(config, 1000)) == WAIT_TIMEOUT)
-        {
-            if (GetProcessStat(config->ProcessId, &proc))
-            {
-                // Calc Commit
-                memUsage = (proc.rss * pageSize_kb) >> 10;    // get Resident Set Size
-                memUsage += (proc.nswap * pageSize_kb) >> 10; // get Swap size
-
-                // Commit Trigger
-                if ((config->bMemoryTriggerBelowValue && (memUsage < config->MemoryThreshold)) ||
-                    (!config->bMemoryTriggerBelowValue && (memUsage >= config->MemoryThreshold)))
-                {
-                    Log(info, "Commit: %ld MB", memUsage);
-                    rc = WriteCoreDump(writer);
-
-                    if ((rc = WaitForQuit(config, config->ThresholdSeconds * 1000)) != WAIT_TIMEOUT)
-                    {
-                        break;
-                    }
-                }
-            }
-            else
-            {
-                Log(error, "An error occured while parsing procfs\n");
-                exit(-1);
-            }            
-        }
+    trigger->DumpWork.Work = DumpWork;
+    trigger->DumpWork.Complete = DumpComplete;
+    trigger->DumpWork.Context = trigger;
+
+    InitWheelTimer(&trigger->Timer, TriggerTick, trigger);
+
+    return trigger;
+}
+
+//--------------------------------------------------------------------
+//
+// StartTrigger - Take the trigger's first sample, later ones are ticks on
+//                the loop's timer wheel
+//
+//      Called on the loop thread (or before the loop runs).
+//
+// Returns: 0 on success
+//
+//--------------------------------------------------------------------
+int StartTrigger(struct Trigger *self)
+{
+    Trace("StartTrigger: Starting %s Trigger", CoreDumpTypeStrings[self->Writer->Type]);
+
+    self->bActive = true;
+    RetainEventLoop(self->Config->Loop);
+
+    // the first sample is taken now, not one interval (or one wheel tick) in
+    RunTimerNow(&self->Config->Loop->Timers, &self->Timer);
+    return 0;
+}
+
+//--------------------------------------------------------------------
+//
+// StopTrigger - Stop sampling; the loop no longer waits on this trigger
+//
+//--------------------------------------------------------------------
+void StopTrigger(struct Trigger *self)
+{
+    if (!self->bActive) {
+        return;
+    }
+
+    Trace("StopTrigger: Stopping %s Trigger", CoreDumpTypeStrings[self->Writer->Type]);
+    self->bActive = false;
+    CancelTimer(&self->Config->Loop->Timers, &self->Timer);
+    ReleaseEventLoop(self->Config->Loop);
+}
+
+//--------------------------------------------------------------------
+//
+// FreeTrigger - Release a stopped trigger
+//
+//      The trigger and its writer go with the config's target arena.
+//
+//--------------------------------------------------------------------
+void FreeTrigger(struct Trigger *self)
+{
+    StopTrigger(self);
+    if (self->Tasks != NULL) {
+        closedir(self->Tasks);
+        self->Tasks = NULL;
+    }
+}
+
+//--------------------------------------------------------------------
+//
+// TriggerTick - Sampling timer fired: evaluate and hand off a dump if due
+//
+//--------------------------------------------------------------------
+static void TriggerTick(struct WheelTimer *Timer)
+{
+    struct Trigger *self = (struct Trigger *)Timer->Context;
+    enum ECoreDumpType type = self->Writer->Type;
+    uint64_t start;
+    bool bDue;
+
+    if (!self->bActive) {
+        return;
+    }
+
+    // quit, dump limit or target gone
+    if (WaitForQuit(self->Config, 0) != WAIT_TIMEOUT) {
+        StopMonitoring(self->Config);
+        return;
+    }
+
+    if (self->bPaused) {
+        RescheduleTimer(&self->Config->Loop->Timers, &self->Timer, self->Config->SamplingInterval);
+        return;
+    }
+
+    start = MetricClock();
+    bDue = self->Evaluate(self);
+    if (!self->bActive) {
+        return;     // the target went away while it was sampled
+    }
+    self->bConditionHeld = bDue || self->HeldSince != 0;   // -B: blocked, for not long enough yet
+    ObserveMetric(METRIC_SAMPLE_DURATION, type, MetricClock() - start);
+    CountMetric(METRIC_SAMPLES, type, 1);
+    if (!self->bArmed) {
+        ArmTrigger(self);
+    }
+
+    if (bDue && IsQuotaExhausted(self->Config)) {
+        // counted as fired, but nothing is written until the quota is raised on reload
+        CountMetric(METRIC_TRIGGERS_FIRED, type, 1);
+        Log(warn, "Dump quota of %llu MB reached, not dumping %d", (unsigned long long)(self->Config->Quota->LimitBytes >> 20), self->Config->ProcessId);
+        ScheduleTimer(&self->Config->Loop->Timers, &self->Timer, self->Config->ThresholdSeconds * 1000);
+    } else if (bDue) {
+        // no more samples until the dump is written and the snooze has passed
+        CountMetric(METRIC_TRIGGERS_FIRED, type, 1);
+        self->Writer->TriggeredAt = MetricClock();
+        self->bDumpPending = true;
+        QueueWorkItem(self->Config->DumpWorkers, &self->DumpWork);
+    } else if (self->SamplingInterval != 0) {
+        // fixed rate, so the sampling period does not drift by the sampling cost
+        RescheduleTimer(&self->Config->Loop->Timers, &self->Timer, self->SamplingInterval);
+    }
+}
 
-        // handle exit cases
-        if (rc == WAIT_ABANDONED || rc == WAIT_OBJECT_0)
-        {
-            // clean up!
+//--------------------------------------------------------------------
+//
+// ArmTrigger - The trigger took its first sample
+//
+//      Once every trigger of the target has, monitoring is armed: a
+//      condition that already holds would have fired. Time to armed is
+//      counted from StartedAt, so it is procdump's own startup cost;
+//      the rest of the startup work is done after it.
+//
+//--------------------------------------------------------------------
+static void ArmTrigger(struct Trigger *self)
+{
+    struct ProcDumpConfiguration *config = self->Config;
+    uint64_t now = MetricClock();
+
+    self->bArmed = true;
+    ObserveMetric(METRIC_TIME_TO_ARMED, self->Writer->Type, now - config->StartedAt);
+
+    for (int i = 0; i < config->nTriggers; i++) {
+        if (!config->Triggers[i]->bArmed) {
+            return;
         }
     }
+    config->ArmedAt = now;
+    Log(info, "Armed in %.2f ms: %s (%d)", (now - config->StartedAt) / 1e6, config->ProcessName, config->ProcessId);
+
+    PrepareForLowMemory();
+}
+
+//--------------------------------------------------------------------
+//
+// DumpWork - Runs on a dump worker, may block for as long as gcore takes
+//
+//--------------------------------------------------------------------
+static void DumpWork(struct WorkItem *Item)
+{
+    struct Trigger *self = (struct Trigger *)Item->Context;
+    uint64_t start = MetricClock();
 
-    free(writer);
-    Trace("CommitThread: Exiting Trigger Thread");
-    pthread_exit(NULL);
+    Item->Result = WriteCoreDump(self->Writer);
+    ObserveMetric(METRIC_DUMP_DURATION, self->Writer->Type, MetricClock() - start);
 }
 
-void *CpuThread(void *thread_args /* struct ProcDumpConfiguration* */)
+//--------------------------------------------------------------------
+//
+// DumpComplete - Back on the loop: snooze, then resume sampling
+//
+//--------------------------------------------------------------------
+static void DumpComplete(struct WorkItem *Item)
 {
-    Trace("CpuThread: Starting Trigger Thread");
-    struct ProcDumpConfiguration *config = (struct ProcDumpConfiguration *)thread_args;
+    struct Trigger *self = (struct Trigger *)Item->Context;
+
+    self->bDumpPending = false;
+    if (!self->bActive) {
+        return;
+    }
 
+    if (WaitForQuit(self->Config, 0) != WAIT_TIMEOUT) {
+        StopMonitoring(self->Config);
+        return;
+    }
+
+    ScheduleTimer(&self->Config->Loop->Timers, &self->Timer, self->Config->ThresholdSeconds * 1000);
+}
+
+//--------------------------------------------------------------------
+//
+// TargetGone - The target's stat could not be read: it exited between samples
+//
+//      Stops monitoring the same way the target's exit event does; the
+//      trigger reports not due.
+//
+//--------------------------------------------------------------------
+static bool TargetGone(struct ProcDumpConfiguration *config)
+{
+    if (!config->bTerminated) {
+        config->bTerminated = true;
+        Log(error, "Target process is no longer alive");
+    }
+    StopMonitoring(config);
+    return false;
+}
+
+//--------------------------------------------------------------------
+//
+// CommitTrigger - Memory commit (RSS + swap) above / below threshold
+//
+//--------------------------------------------------------------------
+bool CommitTrigger(struct Trigger *self)
+{
+    struct ProcDumpConfiguration *config = self->Config;
+    long pageSize_kb = sysconf(_SC_PAGESIZE) >> 10; // convert bytes to kilobytes (2^10)
+    unsigned long memUsage = 0;
+    struct ProcessStat proc = {0};
+
+    if (!GetProcessStat(config->ProcessId, &proc)) {
+        return TargetGone(config);
+    }
+
+    // Calc Commit
+    memUsage = (proc.rss * pageSize_kb) >> 10;    // get Resident Set Size
+    memUsage += (proc.nswap * pageSize_kb) >> 10; // get Swap size
+    SetMetricGauge(&config->Metrics, METRIC_TRIGGER_VALUE, COMMIT, memUsage);
+
+    // Commit Trigger
+    if ((config->bMemoryTriggerBelowValue && (memUsage < config->MemoryThreshold)) ||
+        (!config->bMemoryTriggerBelowValue && (memUsage >= config->MemoryThreshold)))
+    {
+        Log(info, "Commit: %ld MB", memUsage);
+        return true;
+    }
+
+    return false;
+}
+
+//--------------------------------------------------------------------
+//
+// CpuTrigger - Lifetime CPU usage above / below threshold
+//
+//--------------------------------------------------------------------
+bool CpuTrigger(struct Trigger *self)
+{
+    struct ProcDumpConfiguration *config = self->Config;
     unsigned long totalTime = 0;
     unsigned long elapsedTime = 0;
     struct sysinfo sysInfo;
     int cpuUsage;
-    struct CoreDumpWriter *writer = NewCoreDumpWriter(CPU, config);
-
-    int rc = 0;
     struct ProcessStat proc = {0};
 
-    if ((rc = WaitForQuitOrEvent(config, &config->evtStartMonitoring, INFINITE_WAIT)) == WAIT_OBJECT_0 + 1)
-    {
-        while ((rc = WaitForQuit(config, 1000)) == WAIT_TIMEOUT)
-        {
-            sysinfo(&sysInfo);
-
-            if (GetProcessStat(config->ProcessId, &proc))
-            {
-                // Calc CPU
-                totalTime = (unsigned long)((proc.utime + proc.stime) / HZ);
-                elapsedTime = (unsigned long)(sysInfo.uptime - (long)(proc.starttime / HZ));
-                cpuUsage = (int)(100 * ((double)totalTime / elapsedTime));
-
-                // CPU Trigger
-                if ((config->bCpuTriggerBelowValue && (cpuUsage < config->CpuThreshold)) ||
-                    (!config->bCpuTriggerBelowValue && (cpuUsage >= config->CpuThreshold)))
-                {
-                    Log(info, "CPU:\t%d%%", cpuUsage);
-                    rc = WriteCoreDump(writer);
-
-                    if ((rc = WaitForQuit(config, config->ThresholdSeconds * 1000)) != WAIT_TIMEOUT)
-                    {
-                        break;
-                    }       
-                }
-            }
-            else
-            {
-                Log(error, "An error occured while parsing procfs\n");
-                exit(-1);
-            }
-        }
+    sysinfo(&sysInfo);
 
-        // handle exit cases
-        if (rc == WAIT_ABANDONED || rc == WAIT_OBJECT_0)
-        {
-            // clean up!
-        }
+    if (!GetProcessStat(config->ProcessId, &proc)) {
+        return TargetGone(config);
+    }
+
+    // Calc CPU
+    totalTime = (unsigned long)((proc.utime + proc.stime) / HZ);
+    elapsedTime = (unsigned long)(sysInfo.uptime - (long)(proc.starttime / HZ));
+    cpuUsage = (int)(100 * ((double)totalTime / elapsedTime));
+    SetMetricGauge(&config->Metrics, METRIC_TRIGGER_VALUE, CPU, cpuUsage);
+
+    // CPU Trigger
+    if ((config->bCpuTriggerBelowValue && (cpuUsage < config->CpuThreshold)) ||
+        (!config->bCpuTriggerBelowValue && (cpuUsage >= config->CpuThreshold)))
+    {
+        Log(info, "CPU:\t%d%%", cpuUsage);
+        return true;
     }
 
-    free(writer);
-    Trace("CpuThread: Exiting Trigger Thread");
-    pthread_exit(NULL);
+    return false;
 }
 
-void *TimerThread(void *thread_args /* struct ProcDumpConfiguration* */)
+//--------------------------------------------------------------------
+//
+// TimerTrigger - Always due; the timer period is the snooze (-s)
+//
+//--------------------------------------------------------------------
+bool TimerTrigger(struct Trigger *self)
+{
+    Log(info, "Timed:");
+    return true;
+}
+
+//--------------------------------------------------------------------
+//
+// BlockedTrigger - More than -B threads blocked for -B seconds on end
+//
+//      Blocked is in uninterruptible sleep (D), or with :wchan also
+//      sleeping in the same kernel wait channel, which catches threads
+//      deadlocked on one lock or stuck behind one I/O. Hangs like these
+//      show no CPU and flat memory. The D state threads are logged with
+//      their wait channels. The dump then has their stacks, or with -S
+//      only the stacks.
+//
+//--------------------------------------------------------------------
+bool BlockedTrigger(struct Trigger *self)
 {
-    Trace("TimerThread: Starting Trigger Thread");
+    struct ProcDumpConfiguration *config = self->Config;
+    struct BlockedThreads blocked;
+    uint64_t now = MetricClock();
+    char tasks[32];
+    int count;
+
+    if (self->Tasks == NULL) {
+        snprintf(tasks, sizeof(tasks), "/proc/%d/task", config->ProcessId);
+        self->Tasks = opendir(tasks);
+    }
 
-    struct ProcDumpConfiguration *config = (struct ProcDumpConfiguration *)thread_args;
-    struct CoreDumpWriter *writer = NewCoreDumpWriter(TIME, config);
+    // gone: the target's event source stops monitoring
+    if (self->Tasks == NULL || !GetBlockedThreads(config->ProcessId, self->Tasks, config->bBlockedOnWchan, &blocked)) {
+        self->HeldSince = 0;
+        return false;
+    }
 
-    int rc = 0;
+    count = blocked.onWchan > blocked.uninterruptible ? blocked.onWchan : blocked.uninterruptible;
+    SetMetricGauge(&config->Metrics, METRIC_TRIGGER_VALUE, BLOCKED, count);
 
-    if ((rc = WaitForQuitOrEvent(config, &config->evtStartMonitoring, INFINITE_WAIT)) == WAIT_OBJECT_0 + 1)
-    {
-        while ((rc = WaitForQuit(config, 0)) == WAIT_TIMEOUT)
-        {
-            Log(info, "Timed:");
-            rc = WriteCoreDump(writer);
+    if (count <= config->BlockedThreshold) {
+        self->HeldSince = 0;
+        return false;
+    }
 
-            if ((rc = WaitForQuit(config, config->ThresholdSeconds * 1000)) != WAIT_TIMEOUT) {
-                break;
+    // samples are the sampling interval apart, allow for one landing a little early
+    if (self->HeldSince == 0) {
+        self->HeldSince = now;
+    }
+    if ((now - self->HeldSince) / 1000000 + config->SamplingInterval / 2 < (uint64_t)config->BlockedSeconds * 1000) {
+        return false;
+    }
+
+    if (config->bBlockedOnWchan) {
+        Log(info, "Blocked: %d of %d threads in D state, %d in %s for %d seconds",
+            blocked.uninterruptible, blocked.threads, blocked.onWchan, blocked.wchan, config->BlockedSeconds);
+    } else {
+        Log(info, "Blocked: %d of %d threads in D state for %d seconds",
+            blocked.uninterruptible, blocked.threads, config->BlockedSeconds);
+    }
+    for (int i = 0; i < blocked.listed; i++) {
+        Log(info, "Blocked:\t%d in %s", blocked.list[i].tid, blocked.list[i].wchan[0] ? blocked.list[i].wchan : "?");
+    }
+
+    // after the snooze the threads have to stay blocked for the whole period again
+    self->HeldSince = 0;
+    return true;
+}
+
+//--------------------------------------------------------------------
+//
+// ParseBlockedSpec - -B threads[:seconds][:wchan]
+//
+// Returns: 0 on success, -1 if Spec is not valid
+//
+//--------------------------------------------------------------------
+int ParseBlockedSpec(const char *Spec, int *Threads, int *Seconds, bool *bOnWchan)
+{
+    const char *field = Spec;
+    bool bSeconds = false;
+    char *end;
+    long value;
+
+    if (!isdigit((unsigned char)*field) || (value = strtol(field, &end, 10)) > BLOCKED_MAX_THREADS ||
+        (*end != '\0' && *end != ':')) {
+        return -1;
+    }
+    *Threads = (int)value;
+    *Seconds = BLOCKED_DEFAULT_SECONDS;
+    *bOnWchan = false;
+
+    // seconds, then wchan, each at most once
+    while (*end == ':') {
+        field = end + 1;
+        if (isdigit((unsigned char)*field) && !bSeconds && !*bOnWchan) {
+            if ((value = strtol(field, &end, 10)) < 1 || value > 24 * 60 * 60) {
+                return -1;
             }
+            *Seconds = (int)value;
+            bSeconds = true;
+        } else if (strncmp(field, "wchan", 5) == 0 && !*bOnWchan) {
+            *bOnWchan = true;
+            end = (char *)field + 5;
+        } else {
+            return -1;
         }
-
-        // handle exit cases
-        if (rc == WAIT_ABANDONED || rc == WAIT_OBJECT_0)
-        {
-            // clean up!
+        if (*end != '\0' && *end != ':') {
+            return -1;
         }
     }
 
-    free(writer);
-    Trace("TimerThread: Exiting Trigger Thread");
-    pthread_exit(NULL);
-}
\ No newline at end of file
+    return 0;
+}
+
+//--------------------------------------------------------------------
+//
+// IsQuotaExhausted - Has the target written all the dump bytes it may?
+//
+//--------------------------------------------------------------------
+bool IsQuotaExhausted(struct ProcDumpConfiguration *config)
+{
+    return config->Quota != NULL && config->Quota->LimitBytes != 0 &&
+           __atomic_load_n(&config->Quota->UsedBytes, __ATOMIC_RELAXED) >= config->Quota->LimitBytes;
+}
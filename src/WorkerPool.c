@@ -0,0 +1,184 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Worker threads for blocking work (dump writing) driven by the event loop
+//
+//--------------------------------------------------------------------
+
+#include "WorkerPool.h"
+
+
+//--------------------------------------------------------------------
+//
+// WorkerThread - Pull work items off the queue until the pool shuts down
+//
+//--------------------------------------------------------------------
+static void *WorkerThread(void *input)
+{
+    struct WorkerPool *pool = (struct WorkerPool *)input;
+    struct WorkItem *item;
+    uint64_t one = 1;
+
+    EnterThreadRole(pool->Role);
+
+    while (WaitForSingleObject(&pool->semWorkAvailable, INFINITE_WAIT) == WAIT_OBJECT_0) {
+        pthread_mutex_lock(&pool->QueueLock);
+        if ((item = pool->QueueHead) != NULL) {
+            pool->QueueHead = item->Next;
+            if (pool->QueueHead == NULL) {
+                pool->QueueTail = NULL;
+            }
+        }
+        pthread_mutex_unlock(&pool->QueueLock);
+
+        if (item == NULL) {
+            break; // woken without work: we're shutting down
+        }
+
+        item->Work(item);
+
+        // hand the item back to the loop thread
+        item->Next = __atomic_load_n(&pool->Completed, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&pool->Completed, &item->Next, item, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+        if (write(pool->CompletionSource.fd, &one, sizeof(one)) != sizeof(one)) {
+            Trace("WorkerThread: failed to signal completion.");
+        }
+    }
+
+    return NULL;
+}
+
+
+//--------------------------------------------------------------------
+//
+// CompletionHandler - Loop side: run Complete for every finished item
+//
+//--------------------------------------------------------------------
+static void CompletionHandler(struct EventSource *Source, uint32_t Events)
+{
+    struct WorkerPool *pool = (struct WorkerPool *)Source->Context;
+    struct WorkItem *item, *reversed = NULL;
+    uint64_t count;
+
+    if (read(Source->fd, &count, sizeof(count)) != sizeof(count)) {
+        return;
+    }
+
+    item = __atomic_exchange_n(&pool->Completed, NULL, __ATOMIC_ACQUIRE);
+
+    // the stack is LIFO, complete in submission order
+    while (item != NULL) {
+        struct WorkItem *next = item->Next;
+        item->Next = reversed;
+        reversed = item;
+        item = next;
+    }
+
+    while ((item = reversed) != NULL) {
+        reversed = item->Next;
+        item->Complete(item);
+        ReleaseEventLoop(pool->Loop);
+    }
+}
+
+
+//--------------------------------------------------------------------
+//
+// InitWorkerPool - Start nThreads workers, tuned for Role, reporting back to Loop
+//
+// Returns: 0 on success, error code otherwise
+//
+//--------------------------------------------------------------------
+int InitWorkerPool(struct WorkerPool *Pool, struct EventLoop *Loop, int nThreads, enum ThreadRole Role)
+{
+    int rc;
+
+    Pool->Loop = Loop;
+    Pool->Role = Role;
+    Pool->nThreads = 0;
+    Pool->bShutdown = false;
+    Pool->QueueHead = Pool->QueueTail = Pool->Completed = NULL;
+    pthread_mutex_init(&Pool->QueueLock, NULL);
+    InitSemaphore(&Pool->semWorkAvailable.semaphore, 0);
+    Pool->semWorkAvailable.type = SEMAPHORE;
+
+    Pool->CompletionSource.Handler = CompletionHandler;
+    Pool->CompletionSource.Context = Pool;
+    if ((Pool->CompletionSource.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+        Pool->CompletionSource.fd = NO_FD;
+        Trace("InitWorkerPool: eventfd failed.");
+        return errno;
+    }
+    if ((rc = AddEventSource(Loop, &Pool->CompletionSource, EPOLLIN)) != 0) {
+        return rc;
+    }
+
+    Pool->Threads = (pthread_t *)malloc(sizeof(pthread_t) * nThreads);
+    if (Pool->Threads == NULL) {
+        Log(error, INTERNAL_ERROR);
+        Trace("InitWorkerPool: failed memory allocation.");
+        exit(-1);
+    }
+
+    for (int i = 0; i < nThreads; i++) {
+        if ((rc = pthread_create(&Pool->Threads[i], NULL, WorkerThread, (void *)Pool)) != 0) {
+            Trace("InitWorkerPool: failed to create WorkerThread.");
+            return rc;
+        }
+        Pool->nThreads++;
+    }
+
+    return 0;
+}
+
+
+//--------------------------------------------------------------------
+//
+// DestroyWorkerPool - Wake every worker with an empty queue and join them
+//
+//--------------------------------------------------------------------
+void DestroyWorkerPool(struct WorkerPool *Pool)
+{
+    Pool->bShutdown = true;
+    for (int i = 0; i < Pool->nThreads; i++) {
+        ReleaseSemaphore(&Pool->semWorkAvailable.semaphore);
+    }
+    for (int i = 0; i < Pool->nThreads; i++) {
+        if (pthread_join(Pool->Threads[i], NULL) != 0) {
+            Log(error, "An error occured while joining worker threads\n");
+            exit(-1);
+        }
+    }
+
+    free(Pool->Threads);
+    RemoveEventSource(Pool->Loop, &Pool->CompletionSource);
+    DestroySemaphore(&Pool->semWorkAvailable.semaphore);
+    pthread_mutex_destroy(&Pool->QueueLock);
+}
+
+
+//--------------------------------------------------------------------
+//
+// QueueWorkItem - Hand Item to a worker; Item->Complete runs on the loop afterwards
+//
+//      The loop is kept alive until the item has completed.
+//
+//--------------------------------------------------------------------
+void QueueWorkItem(struct WorkerPool *Pool, struct WorkItem *Item)
+{
+    RetainEventLoop(Pool->Loop);
+
+    Item->Next = NULL;
+    pthread_mutex_lock(&Pool->QueueLock);
+    if (Pool->QueueTail != NULL) {
+        Pool->QueueTail->Next = Item;
+    } else {
+        Pool->QueueHead = Item;
+    }
+    Pool->QueueTail = Item;
+    pthread_mutex_unlock(&Pool->QueueLock);
+
+    ReleaseSemaphore(&Pool->semWorkAvailable.semaphore);
+}
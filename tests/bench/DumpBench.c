@@ -0,0 +1,372 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Dump capture benchmark: dump synthetic targets of growing size and
+// report the wall time, how long the target was stopped, the bytes
+// written and procdump's (and gcore's) peak RSS
+//
+//      DumpBench [-S] [-z zero%] [-d dirty%] [-f file%] [-t threads]
+//                [-H] [-w swap%] [-o results.json] [size[G] ...]
+//
+// Sizes are in MB (64 and 256 by default, G for GB). The targets are
+// bin/ProcDumpTestApplication target; -S takes mini dumps, which is
+// also what is measured when gcore is not installed.
+//
+//--------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "Process.h"
+
+#define BENCH_MAX_SIZES 16
+#define BENCH_STOP_POLL_US 1000     // how often the target's state is sampled during a dump
+#define BENCH_REPORT_SIZE 4096
+
+struct DumpRun {
+    unsigned long Mb;
+    double SetupMs;                 // the target building its memory
+    double WallMs;                  // procdump started to exited
+    double StoppedMs;               // the target seen in a stopped state
+    double ReportedStoppedMs;       // target_stopped_ms of the dump report
+    double CoreBytes;
+    double BytesWritten;
+    double ProcdumpRssKb;
+    double GcoreRssKb;
+    bool bDumped;
+};
+
+struct StopWatch {
+    pid_t Target;
+    bool bDone;
+    uint64_t StoppedNs;
+};
+
+static uint64_t NowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool IsInPath(const char *Program)
+{
+    char path[PATH_MAX];
+    char *dirs = getenv("PATH");
+
+    while (dirs != NULL && *dirs != '\0') {
+        size_t length = strcspn(dirs, ":");
+
+        snprintf(path, sizeof(path), "%.*s/%s", (int)length, dirs, Program);
+        if (access(path, X_OK) == 0) {
+            return true;
+        }
+        dirs += length + (dirs[length] == ':');
+    }
+    return false;
+}
+
+static double JsonNumber(const char *Json, const char *Key)
+{
+    char quoted[64];
+    const char *value;
+
+    snprintf(quoted, sizeof(quoted), "\"%s\":", Key);
+    return (value = strstr(Json, quoted)) != NULL ? strtod(value + strlen(quoted), NULL) : 0;
+}
+
+//--------------------------------------------------------------------
+//
+// StartTarget - Run the target generator and wait until its memory is built
+//
+//--------------------------------------------------------------------
+static pid_t StartTarget(const char *Application, unsigned long Mb, char **Shape, double *SetupMs)
+{
+    char *argv[16] = { "ProcDumpTestApplication", "target" };
+    char size[32], line[64];
+    uint64_t start = NowNs();
+    size_t length = 0;
+    int fds[2], argc = 2;
+    pid_t target;
+
+    snprintf(size, sizeof(size), "%lu", Mb);
+    argv[argc++] = size;
+    while (*Shape != NULL && argc < 15) {
+        argv[argc++] = *Shape++;
+    }
+
+    if (pipe(fds) != 0) {
+        return -1;
+    }
+    if ((target = fork()) == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execv(Application, argv);
+        _exit(127);
+    }
+    close(fds[1]);
+
+    while (length < sizeof(line) - 1) {
+        ssize_t n = read(fds[0], line + length, sizeof(line) - 1 - length);
+        if (n <= 0) {
+            break;
+        }
+        length += n;
+        line[length] = '\0';
+        if (strstr(line, "ready\n") != NULL) {
+            close(fds[0]);
+            *SetupMs = (NowNs() - start) / 1e6;
+            return target;
+        }
+    }
+
+    close(fds[0]);
+    kill(target, SIGKILL);
+    waitpid(target, NULL, 0);
+    return -1;
+}
+
+// the time the target's main thread is seen stopped (ptrace or SIGSTOP)
+static void *WatchStops(void *Context)
+{
+    struct StopWatch *watch = Context;
+    char path[32], stat[1024];
+    uint64_t last = NowNs();
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", watch->Target);
+    while (!__atomic_load_n(&watch->bDone, __ATOMIC_ACQUIRE)) {
+        uint64_t now;
+        char *state;
+
+        usleep(BENCH_STOP_POLL_US);
+        now = NowNs();
+        if (ReadProcFile(path, stat, sizeof(stat)) > 0 && (state = strrchr(stat, ')')) != NULL &&
+            (state[2] == 't' || state[2] == 'T')) {
+            watch->StoppedNs += now - last;
+        }
+        last = now;
+    }
+    return NULL;
+}
+
+// the dump report procdump left next to the core, then empty the directory
+static bool CollectReport(const char *Directory, struct DumpRun *Run)
+{
+    char path[PATH_MAX + NAME_MAX + 2];
+    char report[BENCH_REPORT_SIZE];
+    struct dirent *entry;
+    bool bFound = false;
+    DIR *dir;
+
+    if ((dir = opendir(Directory)) == NULL) {
+        return false;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        size_t length = strlen(entry->d_name);
+
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", Directory, entry->d_name);
+        if (length > 5 && strcmp(entry->d_name + length - 5, ".json") == 0 &&
+            ReadProcFile(path, report, sizeof(report)) > 0) {
+            Run->ReportedStoppedMs = JsonNumber(report, "target_stopped_ms");
+            Run->CoreBytes = JsonNumber(report, "core_bytes");
+            Run->BytesWritten = JsonNumber(report, "bytes_written");
+            Run->ProcdumpRssKb = JsonNumber(report, "procdump_peak_rss_kb");
+            Run->GcoreRssKb = JsonNumber(report, "gcore_peak_rss_kb");
+            bFound = Run->CoreBytes > 0;
+        }
+        unlink(path);
+    }
+    closedir(dir);
+    return bFound;
+}
+
+//--------------------------------------------------------------------
+//
+// RunDump - One procdump of Target, from a scratch directory
+//
+//--------------------------------------------------------------------
+static void RunDump(const char *Procdump, pid_t Target, bool bMini, struct DumpRun *Run)
+{
+    char directory[] = "/tmp/procdump_dumpbench_XXXXXX";
+    struct StopWatch watch = { .Target = Target };
+    struct rusage usage;
+    pthread_t watcher;
+    char pid[16];
+    uint64_t start;
+    pid_t procdump;
+    int status;
+
+    snprintf(pid, sizeof(pid), "%d", Target);
+    if (mkdtemp(directory) == NULL) {
+        return;
+    }
+
+    pthread_create(&watcher, NULL, WatchStops, &watch);
+    start = NowNs();
+    if ((procdump = fork()) == 0) {
+        int null = open("/dev/null", O_WRONLY);
+
+        dup2(null, STDOUT_FILENO);
+        if (chdir(directory) != 0) {
+            _exit(127);
+        }
+        if (bMini) {
+            execl(Procdump, "procdump", "-S", "-p", pid, (char *)NULL);
+        } else {
+            execl(Procdump, "procdump", "-p", pid, (char *)NULL);
+        }
+        _exit(127);
+    }
+    wait4(procdump, &status, 0, &usage);
+    Run->WallMs = (NowNs() - start) / 1e6;
+    __atomic_store_n(&watch.bDone, true, __ATOMIC_RELEASE);
+    pthread_join(watcher, NULL);
+    Run->StoppedMs = watch.StoppedNs / 1e6;
+
+    Run->bDumped = WIFEXITED(status) && CollectReport(directory, Run);
+    rmdir(directory);
+}
+
+static bool WriteResults(const char *Path, struct DumpRun *Runs, int Count, bool bMini, char **Shape)
+{
+    FILE *out;
+
+    if ((out = fopen(Path, "w")) == NULL) {
+        return false;
+    }
+    fprintf(out, "{\"benchmark\": \"DumpBench\", \"dump\": \"%s\", \"shape\": \"", bMini ? "mini" : "gcore");
+    for (char **arg = Shape; *arg != NULL; arg++) {
+        fprintf(out, "%s%s", *arg, arg[1] != NULL ? " " : "");
+    }
+    fprintf(out, "\", \"results\": [\n");
+    for (int i = 0; i < Count; i++) {
+        struct DumpRun *run = &Runs[i];
+        fprintf(out, "  {\"size_mb\": %lu, \"dumped\": %s, \"setup_ms\": %.1f, \"wall_ms\": %.1f, \"stopped_ms\": %.1f, "
+                "\"reported_stopped_ms\": %.1f, \"core_bytes\": %.0f, \"bytes_written\": %.0f, "
+                "\"procdump_peak_rss_kb\": %.0f, \"gcore_peak_rss_kb\": %.0f}%s\n",
+                run->Mb, run->bDumped ? "true" : "false", run->SetupMs, run->WallMs, run->StoppedMs,
+                run->ReportedStoppedMs, run->CoreBytes, run->BytesWritten, run->ProcdumpRssKb, run->GcoreRssKb,
+                (i + 1 < Count) ? "," : "");
+    }
+    fprintf(out, "]}\n");
+    return fclose(out) == 0;
+}
+
+int main(int argc, char *argv[])
+{
+    char procdump[PATH_MAX + 16], application[PATH_MAX + 32], results[PATH_MAX + 32];
+    char arg0[PATH_MAX], bin[PATH_MAX];
+    char shapeArgs[6][32];
+    char *shape[8] = { NULL };
+    struct DumpRun runs[BENCH_MAX_SIZES] = { 0 };
+    unsigned long sizes[BENCH_MAX_SIZES] = { 64, 256 };
+    int zero = 20, dirty = 60, file = 10, threads = 8, swap = 0;
+    int nSizes = 2, nShape = 0, failures = 0, c;
+    const char *output = NULL;
+    bool bMini = false, bHuge = false;
+
+    while ((c = getopt(argc, argv, "Sz:d:f:t:Hw:o:")) != -1) {
+        switch (c) {
+            case 'S': bMini = true; break;
+            case 'z': zero = atoi(optarg); break;
+            case 'd': dirty = atoi(optarg); break;
+            case 'f': file = atoi(optarg); break;
+            case 't': threads = atoi(optarg); break;
+            case 'H': bHuge = true; break;
+            case 'w': swap = atoi(optarg); break;
+            case 'o': output = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-S] [-z zero%%] [-d dirty%%] [-f file%%] [-t threads] [-H] [-w swap%%] [-o results.json] [size[G] ...]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (optind < argc) {
+        for (nSizes = 0; optind < argc && nSizes < BENCH_MAX_SIZES; optind++) {
+            char *unit;
+            sizes[nSizes] = strtoul(argv[optind], &unit, 10);
+            sizes[nSizes] <<= (*unit == 'G' || *unit == 'g') ? 10 : 0;
+            nSizes += sizes[nSizes] != 0;
+        }
+    }
+
+    snprintf(shapeArgs[0], sizeof(shapeArgs[0]), "zero=%d", zero);
+    snprintf(shapeArgs[1], sizeof(shapeArgs[1]), "dirty=%d", dirty);
+    snprintf(shapeArgs[2], sizeof(shapeArgs[2]), "file=%d", file);
+    snprintf(shapeArgs[3], sizeof(shapeArgs[3]), "threads=%d", threads);
+    snprintf(shapeArgs[4], sizeof(shapeArgs[4]), "swap=%d", swap);
+    for (nShape = 0; nShape < 5; nShape++) {
+        shape[nShape] = shapeArgs[nShape];
+    }
+    if (bHuge) {
+        shape[nShape++] = "huge";
+    }
+
+    // bin/DumpBench runs bin/procdump on bin/ProcDumpTestApplication
+    snprintf(arg0, sizeof(arg0), "%s", argv[0]);
+    if (realpath(dirname(arg0), bin) == NULL) {
+        return 1;
+    }
+    snprintf(procdump, sizeof(procdump), "%s/procdump", bin);
+    snprintf(application, sizeof(application), "%s/ProcDumpTestApplication", bin);
+    snprintf(results, sizeof(results), "%s/DumpBench.json", bin);
+    if (access(procdump, X_OK) != 0 || access(application, X_OK) != 0) {
+        fprintf(stderr, "%s or %s not found, build them first\n", procdump, application);
+        return 1;
+    }
+    if (!bMini && !IsInPath("gcore")) {
+        printf("gcore not found, measuring mini dumps (-S)\n");
+        bMini = true;
+    }
+
+    for (int i = 0; i < nSizes; i++) {
+        struct DumpRun *run = &runs[i];
+        pid_t target;
+
+        run->Mb = sizes[i];
+        if ((target = StartTarget(application, run->Mb, shape, &run->SetupMs)) == -1) {
+            fprintf(stderr, "FAIL: could not build a %lu MB target\n", run->Mb);
+            failures++;
+            continue;
+        }
+
+        RunDump(procdump, target, bMini, run);
+        kill(target, SIGKILL);
+        waitpid(target, NULL, 0);
+
+        if (!run->bDumped) {
+            fprintf(stderr, "FAIL: no dump of the %lu MB target\n", run->Mb);
+            failures++;
+            continue;
+        }
+        printf("%6lu MB %s dump: %9.1f ms wall, target stopped %9.1f ms (%.1f reported), %8.1f MB written, "
+               "peak RSS procdump %.1f MB gcore %.1f MB\n",
+               run->Mb, bMini ? "mini" : "gcore", run->WallMs, run->StoppedMs, run->ReportedStoppedMs,
+               run->CoreBytes / (1024 * 1024), run->ProcdumpRssKb / 1024, run->GcoreRssKb / 1024);
+    }
+
+    if (!WriteResults(output != NULL ? output : results, runs, nSizes, bMini, shape)) {
+        fprintf(stderr, "FAIL: could not write %s\n", output != NULL ? output : results);
+        failures++;
+    }
+
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,314 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Monitoring overhead benchmark: procdump's steady state cost with K
+// idle targets, per monitored target
+//
+//      OverheadBench [-s seconds] [-o results.json] [K ...]
+//
+// Starts K idle ProcDumpTestApplication processes (1, 100 and 1000 by
+// default), monitors them all with procdump -D on CPU and memory
+// thresholds they never reach, and once every target is monitored,
+// measures procdump over -s seconds (10 by default): CPU time,
+// context switches (all threads), read and write class syscalls
+// (/proc/<pid>/io syscr and syscw) and RSS.
+//
+//--------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <libgen.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "Daemon.h"
+#include "Process.h"
+
+#define BENCH_MAX_COUNTS 8
+#define BENCH_MAX_TARGETS 4096
+#define BENCH_START_TIMEOUT_MS 60000    // for the daemon to pick up every target
+#define BENCH_CPU_BUDGET_US 200         // procdump CPU per target per second, from 100 targets up
+
+// procdump's counters at one instant
+struct Usage {
+    uint64_t At;                    // ns, CLOCK_MONOTONIC
+    uint64_t CpuTicks;              // utime + stime, all threads
+    uint64_t ContextSwitches;       // voluntary + involuntary, of the threads alive now
+    uint64_t Syscalls;              // syscr + syscw
+    long RssKb;
+};
+
+struct OverheadRun {
+    int Targets;
+    double Seconds;
+    double CpuMs;
+    double ContextSwitches;
+    double Syscalls;
+    long RssKb;
+    bool bMonitored;
+};
+
+static uint64_t NowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t StatusField(const char *Status, const char *Field)
+{
+    const char *line = strstr(Status, Field);
+    return line != NULL ? strtoull(line + strlen(Field), NULL, 10) : 0;
+}
+
+static bool ReadUsage(pid_t Pid, struct Usage *Usage)
+{
+    char path[64], buffer[4096];
+    struct ProcessStat stat;
+    struct dirent *entry;
+    DIR *tasks;
+
+    Usage->At = NowNs();
+    snprintf(path, sizeof(path), "/proc/%d/stat", Pid);
+    if (ReadProcFile(path, buffer, sizeof(buffer)) <= 0 || !ParseProcessStat(buffer, &stat)) {
+        return false;
+    }
+    Usage->CpuTicks = stat.utime + stat.stime;
+
+    snprintf(path, sizeof(path), "/proc/%d/io", Pid);
+    if (ReadProcFile(path, buffer, sizeof(buffer)) <= 0) {
+        return false;
+    }
+    Usage->Syscalls = StatusField(buffer, "syscr: ") + StatusField(buffer, "syscw: ");
+
+    snprintf(path, sizeof(path), "/proc/%d/status", Pid);
+    if (ReadProcFile(path, buffer, sizeof(buffer)) <= 0) {
+        return false;
+    }
+    Usage->RssKb = StatusField(buffer, "VmRSS:");
+
+    // a thread's switches are only in its own status
+    Usage->ContextSwitches = 0;
+    snprintf(path, sizeof(path), "/proc/%d/task", Pid);
+    if ((tasks = opendir(path)) == NULL) {
+        return false;
+    }
+    while ((entry = readdir(tasks)) != NULL) {
+        int tid = atoi(entry->d_name);
+
+        snprintf(path, sizeof(path), "/proc/%d/task/%d/status", Pid, tid);
+        if (tid > 0 && ReadProcFile(path, buffer, sizeof(buffer)) > 0) {
+            Usage->ContextSwitches += StatusField(buffer, "voluntary_ctxt_switches:") +
+                                      StatusField(buffer, "nonvoluntary_ctxt_switches:");
+        }
+    }
+    closedir(tasks);
+    return true;
+}
+
+// lines of the daemon's log that say a target is now monitored
+static int CountMonitored(const char *Log)
+{
+    char line[1024];
+    int count = 0;
+    FILE *file;
+
+    if ((file = fopen(Log, "r")) == NULL) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), file) != NULL) {
+        count += strstr(line, "] Monitoring ") != NULL;
+    }
+    fclose(file);
+    return count;
+}
+
+//--------------------------------------------------------------------
+//
+// RunOverhead - K idle targets under a procdump daemon, measured once
+//               they are all monitored
+//
+//--------------------------------------------------------------------
+static void RunOverhead(const char *Procdump, const char *Application, const char *Directory, int Seconds, struct OverheadRun *Run)
+{
+    char config[PATH_MAX], log[PATH_MAX];
+    static pid_t targets[BENCH_MAX_TARGETS];
+    struct Usage before, after;
+    uint64_t start;
+    pid_t procdump;
+    FILE *rules;
+
+    for (int i = 0; i < Run->Targets; i++) {
+        if ((targets[i] = fork()) == 0) {
+            execl(Application, "ProcDumpTestApplication", "idle", (char *)NULL);
+            _exit(127);
+        }
+    }
+
+    // thresholds an idle process never reaches: sampled, never dumped
+    snprintf(config, sizeof(config), "%s/overhead.conf", Directory);
+    snprintf(log, sizeof(log), "%s/procdump.log", Directory);
+    if ((rules = fopen(config, "w")) == NULL) {
+        return;
+    }
+    fprintf(rules, "[bench]\nname = ProcDumpTestApplication\ncpu = 100\nmemory = 1000000\n");
+    fclose(rules);
+
+    if ((procdump = fork()) == 0) {
+        int out = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        dup2(out, STDOUT_FILENO);
+        if (chdir(Directory) != 0) {
+            _exit(127);
+        }
+        execl(Procdump, "procdump", "-D", config, (char *)NULL);
+        _exit(127);
+    }
+
+    start = NowNs();
+    while (CountMonitored(log) < Run->Targets && (NowNs() - start) / 1000000 < BENCH_START_TIMEOUT_MS) {
+        usleep(100000);
+    }
+    Run->bMonitored = CountMonitored(log) >= Run->Targets;
+
+    // past the scan that found the last of them
+    usleep(DAEMON_SCAN_INTERVAL * 1000);
+    if (Run->bMonitored && ReadUsage(procdump, &before)) {
+        sleep(Seconds);
+        if (ReadUsage(procdump, &after)) {
+            Run->Seconds = (after.At - before.At) / 1e9;
+            Run->CpuMs = (after.CpuTicks - before.CpuTicks) * 1000.0 / sysconf(_SC_CLK_TCK);
+            Run->ContextSwitches = after.ContextSwitches - before.ContextSwitches;
+            Run->Syscalls = after.Syscalls - before.Syscalls;
+            Run->RssKb = after.RssKb;
+        } else {
+            Run->bMonitored = false;
+        }
+    }
+
+    kill(procdump, SIGTERM);
+    waitpid(procdump, NULL, 0);
+    for (int i = 0; i < Run->Targets; i++) {
+        kill(targets[i], SIGKILL);
+        waitpid(targets[i], NULL, 0);
+    }
+    unlink(config);
+    unlink(log);
+}
+
+static bool WriteResults(const char *Path, struct OverheadRun *Runs, int Count)
+{
+    const char *separator = "";
+    FILE *out;
+
+    if ((out = fopen(Path, "w")) == NULL) {
+        return false;
+    }
+    fprintf(out, "{\"benchmark\": \"OverheadBench\", \"results\": [\n");
+    for (int i = 0; i < Count; i++) {
+        struct OverheadRun *run = &Runs[i];
+        double targetSeconds = run->Targets * run->Seconds;
+
+        if (!run->bMonitored) {
+            continue;
+        }
+
+        fprintf(out, "%s  {\"targets\": %d, \"seconds\": %.1f, \"cpu_ms\": %.1f, \"context_switches\": %.0f, "
+                "\"io_syscalls\": %.0f, \"rss_kb\": %ld, \"cpu_us_per_target_s\": %.2f, "
+                "\"context_switches_per_target_s\": %.3f, \"io_syscalls_per_target_s\": %.2f, \"rss_kb_per_target\": %.1f}",
+                separator, run->Targets, run->Seconds, run->CpuMs, run->ContextSwitches, run->Syscalls, run->RssKb,
+                run->CpuMs * 1000 / targetSeconds, run->ContextSwitches / targetSeconds, run->Syscalls / targetSeconds,
+                (double)run->RssKb / run->Targets);
+        separator = ",\n";
+    }
+    fprintf(out, "\n]}\n");
+    return fclose(out) == 0;
+}
+
+int main(int argc, char *argv[])
+{
+    char procdump[PATH_MAX + 16], application[PATH_MAX + 32], results[PATH_MAX + 32];
+    char directory[] = "/tmp/procdump_overhead_XXXXXX";
+    char arg0[PATH_MAX], bin[PATH_MAX];
+    int counts[BENCH_MAX_COUNTS] = { 1, 100, 1000 };
+    struct OverheadRun runs[BENCH_MAX_COUNTS] = { 0 };
+    int nCounts = 3, seconds = 10, failures = 0, c;
+    const char *output = NULL;
+
+    while ((c = getopt(argc, argv, "s:o:")) != -1) {
+        switch (c) {
+            case 's': seconds = atoi(optarg); break;
+            case 'o': output = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-s seconds] [-o results.json] [K ...]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (optind < argc) {
+        for (nCounts = 0; optind < argc && nCounts < BENCH_MAX_COUNTS; optind++) {
+            counts[nCounts] = atoi(argv[optind]);
+            nCounts += counts[nCounts] > 0 && counts[nCounts] <= BENCH_MAX_TARGETS;
+        }
+    }
+    if (seconds < 1 || nCounts == 0) {
+        fprintf(stderr, "usage: %s [-s seconds] [-o results.json] [K ...], K up to %d\n", argv[0], BENCH_MAX_TARGETS);
+        return 1;
+    }
+
+    // bin/OverheadBench runs bin/procdump on bin/ProcDumpTestApplication
+    snprintf(arg0, sizeof(arg0), "%s", argv[0]);
+    if (realpath(dirname(arg0), bin) == NULL || mkdtemp(directory) == NULL) {
+        return 1;
+    }
+    snprintf(procdump, sizeof(procdump), "%s/procdump", bin);
+    snprintf(application, sizeof(application), "%s/ProcDumpTestApplication", bin);
+    snprintf(results, sizeof(results), "%s/OverheadBench.json", bin);
+    if (access(procdump, X_OK) != 0 || access(application, X_OK) != 0) {
+        fprintf(stderr, "%s or %s not found, build them first\n", procdump, application);
+        return 1;
+    }
+
+    for (int i = 0; i < nCounts; i++) {
+        struct OverheadRun *run = &runs[i];
+        double targetSeconds;
+
+        run->Targets = counts[i];
+        RunOverhead(procdump, application, directory, seconds, run);
+        if (!run->bMonitored) {
+            fprintf(stderr, "FAIL: procdump did not monitor all %d targets\n", run->Targets);
+            failures++;
+            continue;
+        }
+
+        targetSeconds = run->Targets * run->Seconds;
+        printf("%5d targets: %7.1f ms CPU over %.1f s (%6.2f us/target/s), %6.3f context switches/target/s, "
+               "%7.2f io syscalls/target/s, RSS %ld KB (%.1f KB/target)\n",
+               run->Targets, run->CpuMs, run->Seconds, run->CpuMs * 1000 / targetSeconds,
+               run->ContextSwitches / targetSeconds, run->Syscalls / targetSeconds,
+               run->RssKb, (double)run->RssKb / run->Targets);
+
+        if (run->CpuMs * 1000 / targetSeconds > BENCH_CPU_BUDGET_US && run->Targets >= 100) {
+            fprintf(stderr, "FAIL: %.2f us of CPU per target per second, budget %d\n",
+                    run->CpuMs * 1000 / targetSeconds, BENCH_CPU_BUDGET_US);
+            failures++;
+        }
+    }
+    rmdir(directory);
+
+    if (!WriteResults(output != NULL ? output : results, runs, nCounts)) {
+        fprintf(stderr, "FAIL: could not write %s\n", output != NULL ? output : results);
+        failures++;
+    }
+
+    return (failures == 0) ? 0 : 1;
+}
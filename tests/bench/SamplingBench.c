@@ -0,0 +1,482 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Sampling path microbenchmarks: procfs parsing (recorded fixtures and
+// the live /proc/self), the Handle wait primitives and log capture.
+//
+// Each is reported in ns/op, allocations/op and syscalls/op, and written
+// as JSON (bin/SamplingBench.json, or the path given) for comparing
+// builds. Allocations and syscalls are exact counts and have budgets;
+// going over one fails the run.
+//
+//--------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "Arena.h"
+#include "Handle.h"
+#include "Logging.h"
+#include "Process.h"
+#include "ProcDumpConfiguration.h"
+
+#define BENCH_OPS 20000             // timed operations per benchmark
+#define BENCH_WARMUP 1000           // untimed, for libc's lazy state and the caches
+#define BENCH_BATCH 64              // operations between drains, under LOG_RING_SIZE
+#define BENCH_TRACED_OPS 1024       // operations whose syscalls are counted, under ptrace
+#define BENCH_NO_BUDGET -1
+
+// struct ptrace_syscall_info of linux/ptrace.h, as far as the entry arguments
+// (the uapi header clashes with glibc's sys/ptrace.h)
+#define BENCH_SYSCALL_INFO_ENTRY 1
+struct SyscallInfo {
+    uint8_t Op;
+    uint8_t Pad[3];
+    uint32_t Arch;
+    uint64_t InstructionPointer;
+    uint64_t StackPointer;
+    uint64_t Nr;
+    uint64_t Args[6];
+};
+
+struct Fixture {
+    const char *File;
+    char Data[MAX_CMDLINE_LEN];
+    ssize_t Length;
+};
+
+struct Bench {
+    const char *Name;
+    void (*Setup)(const void *Context);
+    void (*Op)(const void *Context);
+    void (*Drain)();                // every BENCH_BATCH operations, not measured
+    void (*Teardown)();
+    const void *Context;
+    double MaxAllocs;               // per op
+    double MaxSyscalls;
+    double NsPerOp;
+    double AllocsPerOp;
+    double SyscallsPerOp;
+};
+
+static int failures = 0;
+
+#define CHECK(cond, ...) \
+    do { if (!(cond)) { fprintf(stderr, "FAIL: " __VA_ARGS__); fprintf(stderr, "\n"); failures++; } } while (0)
+
+// glibc's own entry points, wrapped below to count the calls of this thread
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static __thread bool bCounting = false;
+static __thread long allocations = 0;
+
+void *malloc(size_t size)
+{
+    allocations += bCounting;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+    allocations += bCounting;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    allocations += bCounting;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    __libc_free(ptr);
+}
+
+static uint64_t NowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct Fixture statFixtures[] = {
+    { "short.stat" },               // a plain comm
+    { "threaded.stat" },            // a comm with spaces and parentheses, large counters
+    { "kthread.stat" },             // a kernel thread: zeroed memory fields
+};
+
+static struct Fixture cmdlineFixtures[] = {
+    { "sudo.cmdline" },             // started through sudo
+    { "java.cmdline" },             // a long classpath
+};
+
+static pid_t self;
+static struct Arena *scratch;
+static struct Handle event = HANDLE_MANUAL_RESET_EVENT_INITIALIZER("SamplingBench");
+static struct Handle unset = HANDLE_MANUAL_RESET_EVENT_INITIALIZER("SamplingBenchUnset");
+static struct Handle semaphore = { .type = SEMAPHORE };
+static int savedStdout = -1;
+
+static bool LoadFixture(const char *Directory, struct Fixture *Fixture)
+{
+    char path[2 * PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s/%s", Directory, Fixture->File);
+    Fixture->Length = ReadProcFile(path, Fixture->Data, sizeof(Fixture->Data));
+    return Fixture->Length > 0;
+}
+
+//--------------------------------------------------------------------
+//
+// The operations
+//
+//--------------------------------------------------------------------
+static void ParseStatOp(const void *Context)
+{
+    const struct Fixture *fixture = Context;
+    struct ProcessStat proc;
+    char buffer[1024];
+
+    memcpy(buffer, fixture->Data, fixture->Length + 1);    // parsed in place
+    ParseProcessStat(buffer, &proc);
+}
+
+static void LiveStatOp(const void *Context)
+{
+    struct ProcessStat proc;
+
+    GetProcessStat(self, &proc);
+}
+
+static void ParseNameOp(const void *Context)
+{
+    const struct Fixture *fixture = Context;
+
+    ParseProcessName(fixture->Data, fixture->Length, scratch);
+    ResetArena(scratch);
+}
+
+static void LiveNameOp(const void *Context)
+{
+    GetProcessName(self, scratch);
+    ResetArena(scratch);
+}
+
+static void WaitSignaledOp(const void *Context)
+{
+    WaitForSingleObject(&event, 0);
+}
+
+static void WaitTimeoutOp(const void *Context)
+{
+    WaitForSingleObject(&unset, 0);
+}
+
+static void SemaphoreOp(const void *Context)
+{
+    ReleaseSemaphore(&semaphore.semaphore);
+    WaitForSingleObject(&semaphore, INFINITE_WAIT);
+}
+
+static void WaitMultipleOp(const void *Context)
+{
+    struct Handle *handles[] = { &event, &event };
+
+    // both signaled: no waiter thread is left behind sleeping
+    WaitForMultipleObjects(2, handles, false, INFINITE_WAIT);
+}
+
+static void LogOp(const void *Context)
+{
+    Log(info, "Trigger: CPU usage:%d%% on process ID: %d (%s)", 42, self, "sample");
+}
+
+//--------------------------------------------------------------------
+//
+// Setup and teardown
+//
+//--------------------------------------------------------------------
+static void CheckStatFixture(const void *Context)
+{
+    const struct Fixture *fixture = Context;
+    struct ProcessStat proc;
+    char buffer[1024];
+
+    memcpy(buffer, fixture->Data, fixture->Length + 1);
+    CHECK(ParseProcessStat(buffer, &proc) && proc.pid == atoi(fixture->Data) && proc.num_threads > 0,
+          "%s did not parse", fixture->File);
+}
+
+static void CheckNameFixture(const void *Context)
+{
+    const struct Fixture *fixture = Context;
+    const char *name = ParseProcessName(fixture->Data, fixture->Length, scratch);
+
+    CHECK(strcmp(name, "dotnet") == 0 || strcmp(name, "java") == 0, "%s parsed as %s", fixture->File, name);
+    ResetArena(scratch);
+}
+
+static void SetupEvents(const void *Context)
+{
+    SetEvent(&event.event);
+    ResetEvent(&unset.event);
+    InitSemaphore(&semaphore.semaphore, 0);
+}
+
+// the log goes to /dev/null, so the flusher's writes cost what they would to a file
+static void SetupLog(const void *Context)
+{
+    int null = open("/dev/null", O_WRONLY);
+
+    fflush(stdout);
+    savedStdout = dup(STDOUT_FILENO);
+    dup2(null, STDOUT_FILENO);
+    close(null);
+    if (Context != NULL) {
+        StartLogger();
+    }
+}
+
+static void DrainLog()
+{
+    FlushLog();
+}
+
+static void TeardownLog()
+{
+    StopLogger();
+    FlushLog();
+    dup2(savedStdout, STDOUT_FILENO);
+    close(savedStdout);
+}
+
+static struct Bench benches[] = {
+    { "ParseProcessStat/short",    CheckStatFixture, ParseStatOp,    NULL,     NULL,        &statFixtures[0],    0, 0 },
+    { "ParseProcessStat/threaded", CheckStatFixture, ParseStatOp,    NULL,     NULL,        &statFixtures[1],    0, 0 },
+    { "ParseProcessStat/kthread",  CheckStatFixture, ParseStatOp,    NULL,     NULL,        &statFixtures[2],    0, 0 },
+    { "GetProcessStat/self",       NULL,             LiveStatOp,     NULL,     NULL,        NULL,                0, 4 },    // open, 2 reads, close
+    { "ParseProcessName/sudo",     CheckNameFixture, ParseNameOp,    NULL,     NULL,        &cmdlineFixtures[0], 0, 0 },
+    { "ParseProcessName/java",     CheckNameFixture, ParseNameOp,    NULL,     NULL,        &cmdlineFixtures[1], 0, 0 },
+    { "GetProcessName/self",       NULL,             LiveNameOp,     NULL,     NULL,        NULL,                0, 4 },
+    { "WaitForSingleObject/set",   SetupEvents,      WaitSignaledOp, NULL,     NULL,        NULL,                0, 0 },
+    { "WaitForSingleObject/0ms",   SetupEvents,      WaitTimeoutOp,  NULL,     NULL,        NULL,                0, 0 },
+    { "WaitForSingleObject/sem",   SetupEvents,      SemaphoreOp,    NULL,     NULL,        NULL,                0, 0 },
+    // a thread per handle: reported, not budgeted, nothing on the sampling path uses it
+    { "WaitForMultipleObjects/2",  SetupEvents,      WaitMultipleOp, NULL,     NULL,        NULL,                BENCH_NO_BUDGET, BENCH_NO_BUDGET },
+    { "LogFormatter/queued",       SetupLog,         LogOp,          DrainLog, TeardownLog, "queued",            0, 1 },    // at most the flusher's wakeup
+    // before StartLogger the caller writes: stdout, and syslog (which reconnects each time without a syslog daemon)
+    { "LogFormatter/inline",       SetupLog,         LogOp,          NULL,     TeardownLog, NULL,                0, 4 },
+};
+
+#define BENCH_COUNT (sizeof(benches) / sizeof(benches[0]))
+
+//--------------------------------------------------------------------
+//
+// RunOps - Run Count operations of Bench, draining between batches
+//
+//      Measure is called with true before and false after each batch.
+//
+//--------------------------------------------------------------------
+static void RunOps(struct Bench *Bench, int Count, void (*Measure)(struct Bench *, bool))
+{
+    for (int done = 0; done < Count; done += BENCH_BATCH) {
+        int batch = (Count - done < BENCH_BATCH) ? Count - done : BENCH_BATCH;
+
+        if (Measure != NULL) {
+            Measure(Bench, true);
+        }
+        for (int i = 0; i < batch; i++) {
+            Bench->Op(Bench->Context);
+        }
+        if (Measure != NULL) {
+            Measure(Bench, false);
+        }
+        if (Bench->Drain != NULL) {
+            Bench->Drain();
+        }
+    }
+}
+
+static uint64_t batchStart, elapsed;
+
+static void MeasureTimeAndAllocations(struct Bench *Bench, bool bStart)
+{
+    if (bStart) {
+        bCounting = true;
+        batchStart = NowNs();
+    } else {
+        elapsed += NowNs() - batchStart;
+        bCounting = false;
+    }
+}
+
+// the tracer counts the syscalls between two of these, the argument names the benchmark
+static void MarkSyscalls(struct Bench *Bench, bool bStart)
+{
+    syscall(SYS_getppid, (long)(Bench - benches));
+}
+
+static void RunBench(struct Bench *Bench, int Count, void (*Measure)(struct Bench *, bool))
+{
+    if (Bench->Setup != NULL) {
+        Bench->Setup(Bench->Context);
+    }
+    RunOps(Bench, BENCH_WARMUP, NULL);
+    RunOps(Bench, Count, Measure);
+    if (Bench->Teardown != NULL) {
+        Bench->Teardown();
+    }
+}
+
+//--------------------------------------------------------------------
+//
+// CountSyscalls - Run every benchmark in a child traced with
+//                 PTRACE_SYSCALL and count the syscalls of its thread
+//
+//      Only the benchmarking thread is traced: the flusher and the
+//      waiter threads of WaitForMultipleObjects are not this thread's cost.
+//
+//--------------------------------------------------------------------
+static bool CountSyscalls()
+{
+    long counts[BENCH_COUNT] = { 0 };
+    long current = -1;
+    int status;
+    pid_t child;
+
+    if ((child = fork()) == 0) {
+        ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+        raise(SIGSTOP);
+        for (int b = 0; b < BENCH_COUNT; b++) {
+            RunBench(&benches[b], BENCH_TRACED_OPS, MarkSyscalls);
+        }
+        _exit(0);
+    }
+
+    if (waitpid(child, &status, 0) != child || !WIFSTOPPED(status) ||
+        ptrace(PTRACE_SETOPTIONS, child, NULL, PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL) != 0) {
+        fprintf(stderr, "FAIL: could not trace the benchmark child\n");
+        kill(child, SIGKILL);
+        waitpid(child, NULL, 0);
+        return false;
+    }
+
+    ptrace(PTRACE_SYSCALL, child, NULL, NULL);
+    while (waitpid(child, &status, __WALL) == child && WIFSTOPPED(status)) {
+        int signal = 0;
+
+        if (WSTOPSIG(status) == (SIGTRAP | 0x80)) {
+            struct SyscallInfo info;
+
+            if (ptrace(PTRACE_GET_SYSCALL_INFO, child, (void *)sizeof(info), &info) > 0 && info.Op == BENCH_SYSCALL_INFO_ENTRY) {
+                if (info.Nr == SYS_getppid && info.Args[0] < BENCH_COUNT) {
+                    current = (current == -1) ? (long)info.Args[0] : -1;
+                } else if (current != -1) {
+                    counts[current]++;
+                }
+            }
+        } else if (WSTOPSIG(status) != SIGSTOP) {
+            signal = WSTOPSIG(status);
+        }
+        ptrace(PTRACE_SYSCALL, child, NULL, signal);
+    }
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "FAIL: the traced benchmark child did not finish\n");
+        return false;
+    }
+    for (int b = 0; b < BENCH_COUNT; b++) {
+        benches[b].SyscallsPerOp = (double)counts[b] / BENCH_TRACED_OPS;
+    }
+    return true;
+}
+
+static bool WriteResults(const char *Path)
+{
+    FILE *out;
+
+    if ((out = fopen(Path, "w")) == NULL) {
+        return false;
+    }
+    fprintf(out, "{\"benchmark\": \"SamplingBench\", \"ops\": %d, \"results\": [\n", BENCH_OPS);
+    for (int b = 0; b < BENCH_COUNT; b++) {
+        fprintf(out, "  {\"name\": \"%s\", \"ns_per_op\": %.1f, \"allocs_per_op\": %.3f, \"syscalls_per_op\": %.3f}%s\n",
+                benches[b].Name, benches[b].NsPerOp, benches[b].AllocsPerOp, benches[b].SyscallsPerOp,
+                (b + 1 < BENCH_COUNT) ? "," : "");
+    }
+    fprintf(out, "]}\n");
+    return fclose(out) == 0;
+}
+
+int main(int argc, char *argv[])
+{
+    char results[PATH_MAX + 32];
+    char fixtures[PATH_MAX + 32];
+    char arg0[PATH_MAX];
+    char bin[PATH_MAX];
+
+    // bin/SamplingBench reads tests/bench/fixtures and writes bin/SamplingBench.json
+    snprintf(arg0, sizeof(arg0), "%s", argv[0]);
+    if (realpath(dirname(arg0), bin) == NULL) {
+        return 1;
+    }
+    snprintf(fixtures, sizeof(fixtures), "%s/../tests/bench/fixtures", bin);
+    snprintf(results, sizeof(results), "%s/SamplingBench.json", bin);
+
+    for (int i = 0; i < sizeof(statFixtures) / sizeof(statFixtures[0]); i++) {
+        CHECK(LoadFixture(fixtures, &statFixtures[i]), "fixture %s/%s not found", fixtures, statFixtures[i].File);
+    }
+    for (int i = 0; i < sizeof(cmdlineFixtures) / sizeof(cmdlineFixtures[0]); i++) {
+        CHECK(LoadFixture(fixtures, &cmdlineFixtures[i]), "fixture %s/%s not found", fixtures, cmdlineFixtures[i].File);
+    }
+    if (failures != 0) {
+        return 1;
+    }
+
+    self = getpid();
+    scratch = ScratchArena();
+
+    // before the logger thread exists: a fork only carries the calling thread
+    CountSyscalls();
+
+    for (int b = 0; b < BENCH_COUNT; b++) {
+        struct Bench *bench = &benches[b];
+
+        elapsed = 0;
+        allocations = 0;
+        RunBench(bench, BENCH_OPS, MeasureTimeAndAllocations);
+        bench->NsPerOp = (double)elapsed / BENCH_OPS;
+        bench->AllocsPerOp = (double)allocations / BENCH_OPS;
+
+        printf("%-28s %10.1f ns/op %8.3f allocs/op %8.3f syscalls/op\n",
+               bench->Name, bench->NsPerOp, bench->AllocsPerOp, bench->SyscallsPerOp);
+
+        CHECK(bench->MaxAllocs == BENCH_NO_BUDGET || bench->AllocsPerOp <= bench->MaxAllocs,
+              "%s: %.3f allocs/op, budget %.0f", bench->Name, bench->AllocsPerOp, bench->MaxAllocs);
+        CHECK(bench->MaxSyscalls == BENCH_NO_BUDGET || bench->SyscallsPerOp <= bench->MaxSyscalls,
+              "%s: %.3f syscalls/op, budget %.0f", bench->Name, bench->SyscallsPerOp, bench->MaxSyscalls);
+    }
+
+    CHECK(WriteResults(argc > 1 ? argv[1] : results), "could not write %s", argc > 1 ? argv[1] : results);
+    printf("results written to %s\n", argc > 1 ? argv[1] : results);
+
+    return (failures == 0) ? 0 : 1;
+}
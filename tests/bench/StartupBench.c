@@ -0,0 +1,159 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Startup benchmark: how long after being started procdump is armed
+//
+//      Starts bin/procdump against an idle target over and over and
+//      reads two numbers per run: the time to armed procdump reports
+//      ("Armed in N ms", from main to every trigger's first sample)
+//      and the time from fork to that line showing up on its stdout,
+//      which adds exec, the dynamic loader and the log flusher. The
+//      run fails if the median reported time is over budget.
+//
+//--------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <limits.h>
+#include <sys/wait.h>
+
+#define BENCH_RUNS 25
+#define BENCH_BUDGET_MS 5.0         // median time to armed
+#define BENCH_TIMEOUT_MS 5000       // per run, for a procdump that never arms
+
+static uint64_t NowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int CompareDoubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+//--------------------------------------------------------------------
+//
+// RunOnce - Start procdump on Target from Directory, wait until it is armed
+//
+// Returns: true with both times in ms, false if it did not arm
+//
+//--------------------------------------------------------------------
+static bool RunOnce(const char *Procdump, const char *Directory, pid_t Target, double *Reported, double *Observed)
+{
+    char pid[16];
+    char output[4096];
+    size_t length = 0;
+    uint64_t start;
+    int fds[2];
+    pid_t procdump;
+    bool bArmed = false;
+
+    snprintf(pid, sizeof(pid), "%d", Target);
+    if (pipe(fds) != 0) {
+        return false;
+    }
+
+    start = NowNs();
+    if ((procdump = fork()) == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        if (chdir(Directory) != 0) {
+            _exit(127);
+        }
+        // a commit threshold no idle target reaches: sampled, never fired
+        execl(Procdump, "procdump", "-M", "100000000", "-p", pid, (char *)NULL);
+        _exit(127);
+    }
+    close(fds[1]);
+
+    while (!bArmed && length < sizeof(output) - 1 && (NowNs() - start) / 1000000 < BENCH_TIMEOUT_MS) {
+        ssize_t n = read(fds[0], output + length, sizeof(output) - 1 - length);
+        char *armed;
+
+        if (n <= 0) {
+            break;
+        }
+        length += n;
+        output[length] = '\0';
+        if ((armed = strstr(output, "Armed in ")) != NULL && strchr(armed, '\n') != NULL) {
+            *Observed = (NowNs() - start) / 1e6;
+            *Reported = atof(armed + strlen("Armed in "));
+            bArmed = true;
+        }
+    }
+
+    kill(procdump, SIGTERM);
+    waitpid(procdump, NULL, 0);
+    close(fds[0]);
+
+    if (!bArmed) {
+        fprintf(stderr, "procdump did not arm:\n%s\n", output);
+    }
+    return bArmed;
+}
+
+int main(int argc, char *argv[])
+{
+    char procdump[PATH_MAX + 16];
+    char directory[] = "/tmp/procdump_startup_XXXXXX";
+    char recorder[PATH_MAX];
+    char self[PATH_MAX];
+    char bin[PATH_MAX];
+    double reported[BENCH_RUNS], observed[BENCH_RUNS];
+    pid_t target;
+    int runs = 0;
+
+    // bin/StartupBench runs bin/procdump, from a scratch directory
+    snprintf(self, sizeof(self), "%s", argv[0]);
+    if (realpath(dirname(self), bin) == NULL) {
+        return 1;
+    }
+    snprintf(procdump, sizeof(procdump), "%s/procdump", bin);
+    if (access(procdump, X_OK) != 0) {
+        fprintf(stderr, "%s not found, build it first\n", procdump);
+        return 1;
+    }
+    if (mkdtemp(directory) == NULL) {
+        return 1;
+    }
+
+    if ((target = fork()) == 0) {
+        pause();
+        _exit(0);
+    }
+
+    while (runs < BENCH_RUNS && RunOnce(procdump, directory, target, &reported[runs], &observed[runs])) {
+        runs++;
+    }
+
+    kill(target, SIGKILL);
+    waitpid(target, NULL, 0);
+    snprintf(recorder, sizeof(recorder), "%s/procdump_%d.flight", directory, target);
+    unlink(recorder);
+    rmdir(directory);
+
+    if (runs < BENCH_RUNS) {
+        return 1;
+    }
+
+    qsort(reported, runs, sizeof(double), CompareDoubles);
+    qsort(observed, runs, sizeof(double), CompareDoubles);
+    printf("time to armed: median %.2f ms, max %.2f ms over %d starts (budget %.1f ms)\n",
+           reported[runs / 2], reported[runs - 1], runs, BENCH_BUDGET_MS);
+    printf("fork to armed on stdout: median %.2f ms, max %.2f ms\n", observed[runs / 2], observed[runs - 1]);
+
+    return (reported[runs / 2] <= BENCH_BUDGET_MS) ? 0 : 1;
+}
@@ -0,0 +1,97 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Timer wheel benchmark: schedule, cancel and expire 10k trigger timers
+//
+//--------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "TimerWheel.h"
+
+#define BENCH_TIMERS 10000
+#define BENCH_MAX_DELAY 600000      // ms, ten minutes of trigger intervals and snoozes
+
+static struct TimerWheel wheel;
+static struct WheelTimer timers[BENCH_TIMERS];
+static uint64_t loopNow;            // the emulated event loop's clock
+static long fired = 0;
+static long late = 0;
+static long early = 0;
+
+static uint64_t NowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void Expired(struct WheelTimer *Timer)
+{
+    fired++;
+    if (wheel.Next - 1 < Timer->Expires) {
+        early++;
+    } else if (loopNow > Timer->Expires) {
+        late++; // the loop slept past the expiry: NextTimerDelay was not a lower bound
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t start, elapsed;
+    long wakeups = 0;
+    long expected = BENCH_TIMERS;
+
+    srand(42);
+    InitTimerWheel(&wheel);
+    for (int i = 0; i < BENCH_TIMERS; i++) {
+        InitWheelTimer(&timers[i], Expired, NULL);
+    }
+
+    // schedule
+    start = NowNs();
+    for (int i = 0; i < BENCH_TIMERS; i++) {
+        ScheduleTimer(&wheel, &timers[i], 1 + rand() % BENCH_MAX_DELAY);
+    }
+    elapsed = NowNs() - start;
+    printf("schedule %d timers: %.1f ns/op\n", BENCH_TIMERS, (double)elapsed / BENCH_TIMERS);
+
+    // cancel every other timer, then reschedule a quarter of them (snooze style)
+    start = NowNs();
+    for (int i = 0; i < BENCH_TIMERS; i += 2) {
+        CancelTimer(&wheel, &timers[i]);
+    }
+    elapsed = NowNs() - start;
+    printf("cancel %d timers: %.1f ns/op\n", BENCH_TIMERS / 2, (double)elapsed / (BENCH_TIMERS / 2));
+    expected -= BENCH_TIMERS / 2;
+
+    for (int i = 0; i < BENCH_TIMERS; i += 4) {
+        ScheduleTimer(&wheel, &timers[i], 1 + rand() % BENCH_MAX_DELAY);
+        expected++;
+    }
+
+    // run the wheel the way the event loop does: sleep NextTimerDelay, then advance
+    start = NowNs();
+    loopNow = wheel.Next - 1;
+    while (wheel.nTimers > 0) {
+        int64_t delay = NextTimerDelay(&wheel, loopNow);
+        loopNow += (delay > 0) ? delay : 1;
+        AdvanceTimerWheel(&wheel, loopNow);
+        wakeups++;
+    }
+    elapsed = NowNs() - start;
+    printf("expire %ld timers: %.1f ns/op (%ld loop wakeups over %llu ms)\n",
+           fired, (double)elapsed / (fired ? fired : 1), wakeups, (unsigned long long)loopNow);
+
+    if (fired != expected || early != 0 || late != 0) {
+        printf("FAIL: fired %ld of %ld timers, %ld early, %ld late\n", fired, expected, early, late);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,304 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Trigger latency benchmark: the target crosses a CPU or memory
+// threshold at an instant it records (CLOCK_MONOTONIC, in a shared
+// file); measure the delay until procdump logs the trigger and until
+// the dump file appears, per trigger type and sampling interval (-i)
+//
+//      TriggerLatencyBench [-r trials] [-g] [-o results.json] [interval ms ...]
+//
+// Intervals default to 100 and 1000 ms; -g dumps with gcore instead of
+// mini dumps (-S). The memory trigger must log within one interval
+// (plus scheduling slack) of the crossing; the CPU trigger is a lifetime
+// average, its latency is reported, not budgeted.
+//
+//--------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <libgen.h>
+#include <limits.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define BENCH_MAX_TRIALS 100
+#define BENCH_MAX_INTERVALS 8
+#define BENCH_TIMEOUT_MS 30000      // per trial, for the trigger to fire and the dump to appear
+#define BENCH_SLACK_MS 250          // over one interval, for the memory trigger's budget
+#define BENCH_CROSS_MB 64           // touched by the memory crossing, the -M threshold
+
+struct Case {
+    const char *Type;               // cpu or mem, as the test application takes it
+    int Interval;
+    int nTrials;
+    double LogMs[BENCH_MAX_TRIALS];
+    double FileMs[BENCH_MAX_TRIALS];
+};
+
+static uint64_t NowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int CompareDoubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// nearest rank percentile of the sorted Values
+static double Percentile(const double *Values, int Count, int P)
+{
+    int rank = (P * Count + 99) / 100;
+    return Values[rank > 0 ? rank - 1 : 0];
+}
+
+// the core is named after the target; its report and sample history are not it
+static bool HasDumpFile(const char *Directory)
+{
+    const char *prefix = "ProcDumpTestApplication_";
+    struct dirent *entry;
+    bool bFound = false;
+    DIR *dir;
+
+    if ((dir = opendir(Directory)) == NULL) {
+        return false;
+    }
+    while (!bFound && (entry = readdir(dir)) != NULL) {
+        const char *extension = strrchr(entry->d_name, '.');
+        bFound = strncmp(entry->d_name, prefix, strlen(prefix)) == 0 &&
+                 (extension == NULL || (strcmp(extension, ".json") != 0 && strcmp(extension, ".samples") != 0));
+    }
+    closedir(dir);
+    return bFound;
+}
+
+static void EmptyDirectory(const char *Directory)
+{
+    char path[PATH_MAX + NAME_MAX + 2];
+    struct dirent *entry;
+    DIR *dir;
+
+    if ((dir = opendir(Directory)) == NULL) {
+        return;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            snprintf(path, sizeof(path), "%s/%s", Directory, entry->d_name);
+            unlink(path);
+        }
+    }
+    closedir(dir);
+}
+
+//--------------------------------------------------------------------
+//
+// RunTrial - Start a crossing target and procdump on it, and time the
+//            trigger's log line and the dump file from the crossing
+//
+//--------------------------------------------------------------------
+static bool RunTrial(const char *Procdump, const char *Application, const char *Directory, bool bGcore, struct Case *Case)
+{
+    char shared[] = "/tmp/procdump_crossing_XXXXXX";
+    char delay[16], interval[16], pid[16], threshold[16], mb[16];
+    char output[16384];
+    size_t length = 0;
+    volatile uint64_t *crossedAt;
+    uint64_t loggedAt = 0, fileAt = 0, start;
+    bool bCpu = strcmp(Case->Type, "cpu") == 0;
+    pid_t target, procdump;
+    int fd, fds[2];
+
+    if ((fd = mkstemp(shared)) == -1 || ftruncate(fd, sizeof(*crossedAt)) != 0 ||
+        (crossedAt = mmap(NULL, sizeof(*crossedAt), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        return false;
+    }
+    close(fd);
+
+    // a random phase against the sampler; the CPU average is kept in whole seconds, so idle for at least one
+    snprintf(delay, sizeof(delay), "%d", bCpu ? 1000 + rand() % 1000 : 200 + rand() % 500);
+    snprintf(mb, sizeof(mb), "%d", BENCH_CROSS_MB);
+    if ((target = fork()) == 0) {
+        execl(Application, "ProcDumpTestApplication", "cross", Case->Type, delay, shared, mb, (char *)NULL);
+        _exit(127);
+    }
+
+    snprintf(pid, sizeof(pid), "%d", target);
+    snprintf(interval, sizeof(interval), "%d", Case->Interval);
+    snprintf(threshold, sizeof(threshold), "%d", bCpu ? 50 : BENCH_CROSS_MB);
+    if (pipe(fds) != 0) {
+        return false;
+    }
+    if ((procdump = fork()) == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        if (chdir(Directory) != 0) {
+            _exit(127);
+        }
+        char *args[] = { "procdump", bCpu ? "-C" : "-M", threshold, "-i", interval, "-n", "1", "-p", pid, "-S", NULL };
+
+        args[bGcore ? 9 : 10] = NULL;
+        execv(Procdump, args);
+        _exit(127);
+    }
+    close(fds[1]);
+
+    start = NowNs();
+    while ((loggedAt == 0 || fileAt == 0) && (NowNs() - start) / 1000000 < BENCH_TIMEOUT_MS) {
+        struct pollfd pipeIn = { .fd = fds[0], .events = POLLIN };
+
+        if (poll(&pipeIn, 1, 1) > 0 && length < sizeof(output) - 1) {
+            ssize_t n = read(fds[0], output + length, sizeof(output) - 1 - length);
+            if (n > 0) {
+                length += n;
+                output[length] = '\0';
+            }
+        }
+        if (loggedAt == 0 && strstr(output, bCpu ? "CPU:\t" : "Commit: ") != NULL) {
+            loggedAt = NowNs();
+        }
+        if (fileAt == 0 && HasDumpFile(Directory)) {
+            fileAt = NowNs();
+        }
+    }
+
+    kill(procdump, SIGTERM);
+    waitpid(procdump, NULL, 0);
+    kill(target, SIGKILL);
+    waitpid(target, NULL, 0);
+    close(fds[0]);
+    EmptyDirectory(Directory);
+
+    if (loggedAt != 0 && fileAt != 0 && *crossedAt != 0) {
+        Case->LogMs[Case->nTrials] = ((int64_t)(loggedAt - *crossedAt)) / 1e6;
+        Case->FileMs[Case->nTrials] = ((int64_t)(fileAt - *crossedAt)) / 1e6;
+        Case->nTrials++;
+    } else {
+        fprintf(stderr, "%s trigger at %d ms did not fire:\n%s\n", Case->Type, Case->Interval, output);
+    }
+
+    munmap((void *)crossedAt, sizeof(*crossedAt));
+    unlink(shared);
+    return loggedAt != 0 && fileAt != 0;
+}
+
+static bool WriteResults(const char *Path, struct Case *Cases, int Count, int Trials)
+{
+    FILE *out;
+
+    if ((out = fopen(Path, "w")) == NULL) {
+        return false;
+    }
+    fprintf(out, "{\"benchmark\": \"TriggerLatencyBench\", \"trials\": %d, \"results\": [\n", Trials);
+    for (int i = 0; i < Count; i++) {
+        struct Case *c = &Cases[i];
+        fprintf(out, "  {\"trigger\": \"%s\", \"interval_ms\": %d, \"fired\": %d, "
+                "\"log_ms\": {\"min\": %.1f, \"p50\": %.1f, \"p90\": %.1f, \"max\": %.1f}, "
+                "\"file_ms\": {\"min\": %.1f, \"p50\": %.1f, \"p90\": %.1f, \"max\": %.1f}}%s\n",
+                c->Type, c->Interval, c->nTrials,
+                c->LogMs[0], Percentile(c->LogMs, c->nTrials, 50), Percentile(c->LogMs, c->nTrials, 90), c->LogMs[c->nTrials - 1],
+                c->FileMs[0], Percentile(c->FileMs, c->nTrials, 50), Percentile(c->FileMs, c->nTrials, 90), c->FileMs[c->nTrials - 1],
+                (i + 1 < Count) ? "," : "");
+    }
+    fprintf(out, "]}\n");
+    return fclose(out) == 0;
+}
+
+int main(int argc, char *argv[])
+{
+    char procdump[PATH_MAX + 16], application[PATH_MAX + 32], results[PATH_MAX + 32];
+    char directory[] = "/tmp/procdump_latency_XXXXXX";
+    char arg0[PATH_MAX], bin[PATH_MAX];
+    int intervals[BENCH_MAX_INTERVALS] = { 100, 1000 };
+    struct Case cases[2 * BENCH_MAX_INTERVALS] = { 0 };
+    int nIntervals = 2, nCases = 0, trials = 5, failures = 0, c;
+    const char *output = NULL;
+    bool bGcore = false;
+
+    while ((c = getopt(argc, argv, "r:go:")) != -1) {
+        switch (c) {
+            case 'r': trials = atoi(optarg); break;
+            case 'g': bGcore = true; break;
+            case 'o': output = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-r trials] [-g] [-o results.json] [interval ms ...]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (trials < 1 || trials > BENCH_MAX_TRIALS) {
+        fprintf(stderr, "1-%d trials\n", BENCH_MAX_TRIALS);
+        return 1;
+    }
+    if (optind < argc) {
+        for (nIntervals = 0; optind < argc && nIntervals < BENCH_MAX_INTERVALS; optind++) {
+            intervals[nIntervals] = atoi(argv[optind]);
+            nIntervals += intervals[nIntervals] > 0;
+        }
+    }
+
+    // bin/TriggerLatencyBench runs bin/procdump on bin/ProcDumpTestApplication
+    snprintf(arg0, sizeof(arg0), "%s", argv[0]);
+    if (realpath(dirname(arg0), bin) == NULL || mkdtemp(directory) == NULL) {
+        return 1;
+    }
+    snprintf(procdump, sizeof(procdump), "%s/procdump", bin);
+    snprintf(application, sizeof(application), "%s/ProcDumpTestApplication", bin);
+    snprintf(results, sizeof(results), "%s/TriggerLatencyBench.json", bin);
+    if (access(procdump, X_OK) != 0 || access(application, X_OK) != 0) {
+        fprintf(stderr, "%s or %s not found, build them first\n", procdump, application);
+        return 1;
+    }
+
+    srand(42);
+    for (int t = 0; t < 2; t++) {
+        for (int i = 0; i < nIntervals; i++) {
+            struct Case *c = &cases[nCases++];
+
+            c->Type = (t == 0) ? "mem" : "cpu";
+            c->Interval = intervals[i];
+            for (int trial = 0; trial < trials; trial++) {
+                failures += !RunTrial(procdump, application, directory, bGcore, c);
+            }
+            if (c->nTrials == 0) {
+                nCases--;
+                continue;
+            }
+
+            qsort(c->LogMs, c->nTrials, sizeof(double), CompareDoubles);
+            qsort(c->FileMs, c->nTrials, sizeof(double), CompareDoubles);
+            printf("%s trigger, %5d ms interval: logged p50 %8.1f p90 %8.1f max %8.1f ms, dump file p50 %8.1f p90 %8.1f max %8.1f ms\n",
+                   c->Type, c->Interval,
+                   Percentile(c->LogMs, c->nTrials, 50), Percentile(c->LogMs, c->nTrials, 90), c->LogMs[c->nTrials - 1],
+                   Percentile(c->FileMs, c->nTrials, 50), Percentile(c->FileMs, c->nTrials, 90), c->FileMs[c->nTrials - 1]);
+
+            if (t == 0 && c->LogMs[c->nTrials - 1] > c->Interval + BENCH_SLACK_MS) {
+                fprintf(stderr, "FAIL: memory trigger logged %.1f ms after the crossing, budget %d ms\n",
+                        c->LogMs[c->nTrials - 1], c->Interval + BENCH_SLACK_MS);
+                failures++;
+            }
+        }
+    }
+    rmdir(directory);
+
+    if (!WriteResults(output != NULL ? output : results, cases, nCases, trials)) {
+        fprintf(stderr, "FAIL: could not write %s\n", output != NULL ? output : results);
+        failures++;
+    }
+
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,626 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Integration tests: each scenario starts a controlled target
+// (ProcDumpTestApplication), runs procdump on it, and checks what it
+// did: whether and how soon the trigger fired, and that the dump it
+// wrote is a complete core of that target (ELF header, program headers
+// in bounds, an NT_PRSTATUS note per thread, NT_PRPSINFO of the target)
+// that its report describes
+//
+//      IntegrationTests [-g] [-j jobs] [scenario ...]
+//
+// Scenarios run in parallel, each in its own process and directory;
+// targets that keep a CPU busy are only run together while their load
+// fits the CPUs, and those found by name (-w) run alone. -g dumps with
+// gcore instead of mini dumps (-S).
+//
+//--------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <elf.h>
+#include <libgen.h>
+#include <limits.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/procfs.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "Process.h"
+
+#define TEST_INTERVAL "100"         // ms, procdump's -i in every scenario
+#define TEST_DUMP_TIMEOUT_MS 60000  // after the trigger, for the dump to be written and procdump to exit
+#define TEST_READY_TIMEOUT_MS 10000 // for a target to build its memory
+#define TEST_NAME_DELAY_MS 500      // procdump -w is waiting this long before the target starts
+#define TEST_MAX_ARGS 8
+#define TEST_CROSSING "@crossing"   // in a target's arguments, the file it records its crossing in
+
+struct Scenario {
+    const char *Name;
+    char *Target[TEST_MAX_ARGS];    // ProcDumpTestApplication's arguments
+    int Load;                       // % of a CPU the target keeps busy
+    int WarmupMs;                   // the target runs this long before procdump starts
+    char *Options[TEST_MAX_ARGS];   // procdump's trigger options
+    bool bByName;                   // -w instead of -p, run alone
+    bool bShouldDump;
+    const char *Logged;             // the trigger's log line, when it should dump
+    int MaxLatencyMs;               // from procdump's start (the target's, by name; the crossing) to Logged
+    int WatchMs;                    // when it should not dump, how long procdump is given to
+    int MaxCpuPercent;              // procdump's CPU over the scenario, 0 for unchecked
+};
+
+//
+// The CPU trigger compares a lifetime average kept in whole seconds: a
+// busy target reaches 80% about 5 s in, or 10 s in if it only gets 90%
+// of a CPU while other scenarios share it, and one should not be sampled
+// in its first second, when its average reads 0.
+//
+static struct Scenario Scenarios[] = {
+    { "high_cpu",                       { "load", "100" }, 100, 0, { "-C", "80" }, false, true, "CPU:\t", 15000 },
+    { "high_cpu_by_name",               { "load", "100" }, 100, 0, { "-C", "50" }, true, true, "CPU:\t", 5000 },
+    { "high_cpu_notdump",               { "load", "20" }, 20, 0, { "-C", "80" }, false, false, NULL, 0, 4000 },
+    { "high_cpu_trigger_cpu_memory",    { "load", "100" }, 100, 0, { "-M", "1000", "-C", "80" }, false, true, "CPU:\t", 15000 },
+    { "high_mem",                       { "target", "90", "threads=3" }, 0, 0, { "-M", "80" }, false, true, "Commit: ", 1000 },
+    { "high_mem_notdump",               { "target", "60" }, 0, 0, { "-M", "80" }, false, false, NULL, 0, 2000 },
+    { "high_mem_trigger_cpu_memory",    { "target", "90" }, 0, 0, { "-C", "100", "-M", "80" }, false, true, "Commit: ", 1000 },
+    { "low_cpu",                        { "load", "10" }, 10, 0, { "-c", "20" }, false, true, "CPU:\t", 1000 },
+    { "low_cpu_by_name",                { "idle" }, 0, 0, { "-c", "20" }, true, true, "CPU:\t", 2000 },
+    { "low_cpu_notdump",                { "load", "80" }, 80, 2000, { "-c", "20" }, false, false, NULL, 0, 4000 },
+    { "low_cpu_trigger_cpu_memory",     { "load", "10" }, 10, 0, { "-M", "1000", "-c", "20" }, false, true, "CPU:\t", 1000 },
+    { "low_mem",                        { "target", "40" }, 0, 0, { "-m", "80" }, false, true, "Commit: ", 1000 },
+    { "low_mem_notdump",                { "target", "200" }, 0, 0, { "-m", "80" }, false, false, NULL, 0, 2000 },
+    { "low_mem_trigger_cpu_memory",     { "target", "40" }, 0, 0, { "-C", "100", "-m", "80" }, false, true, "Commit: ", 1000 },
+    { "ondemand",                       { "idle" }, 0, 0, { NULL }, false, true, "Timed:", 1000 },
+    // one interval plus scheduling slack after the target's RSS reaches 64 MB, the end of its crossing
+    { "mem_crossing",                   { "cross", "mem", "500", TEST_CROSSING, "64" }, 0, 0, { "-M", "64" }, false, true, "Commit: ", 350 },
+    // sampling an idle target every 100 ms is close to free
+    { "idle_overhead",                  { "idle" }, 0, 0, { "-C", "100", "-M", "1000000" }, false, false, NULL, 0, 3000, 5 },
+};
+
+#define SCENARIO_COUNT (sizeof(Scenarios) / sizeof(Scenarios[0]))
+
+static char Procdump[PATH_MAX + 16], Application[PATH_MAX + 32];
+static bool bGcore = false;
+
+static uint64_t NowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// the core is named after the target; its report and sample history are not it
+static bool FindDumpFile(const char *Directory, char *Path, size_t Size)
+{
+    const char *prefix = "ProcDumpTestApplication_";
+    struct dirent *entry;
+    bool bFound = false;
+    DIR *dir;
+
+    if ((dir = opendir(Directory)) == NULL) {
+        return false;
+    }
+    while (!bFound && (entry = readdir(dir)) != NULL) {
+        const char *extension = strrchr(entry->d_name, '.');
+        bFound = strncmp(entry->d_name, prefix, strlen(prefix)) == 0 &&
+                 (extension == NULL || (strcmp(extension, ".json") != 0 && strcmp(extension, ".samples") != 0));
+        if (bFound) {
+            snprintf(Path, Size, "%s/%s", Directory, entry->d_name);
+        }
+    }
+    closedir(dir);
+    return bFound;
+}
+
+static void RemoveDirectory(const char *Directory)
+{
+    char path[PATH_MAX + NAME_MAX + 2];
+    struct dirent *entry;
+    DIR *dir;
+
+    if ((dir = opendir(Directory)) == NULL) {
+        return;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            snprintf(path, sizeof(path), "%s/%s", Directory, entry->d_name);
+            unlink(path);
+        }
+    }
+    closedir(dir);
+    rmdir(Directory);
+}
+
+static long ProcField(pid_t Pid, const char *File, const char *Field)
+{
+    char path[64], buffer[4096];
+    const char *line;
+
+    snprintf(path, sizeof(path), "/proc/%d/%s", Pid, File);
+    if (ReadProcFile(path, buffer, sizeof(buffer)) <= 0 || (line = strstr(buffer, Field)) == NULL) {
+        return -1;
+    }
+    return strtol(line + strlen(Field), NULL, 10);
+}
+
+static long CpuMs(pid_t Pid)
+{
+    char path[64], buffer[4096];
+    struct ProcessStat stat;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", Pid);
+    if (ReadProcFile(path, buffer, sizeof(buffer)) <= 0 || !ParseProcessStat(buffer, &stat)) {
+        return -1;
+    }
+    return (stat.utime + stat.stime) * 1000 / sysconf(_SC_CLK_TCK);
+}
+
+//--------------------------------------------------------------------
+//
+// CheckCore - Is Path a complete core of Pid with Threads threads?
+//
+//      Prints what is wrong with it and returns the number of problems.
+//
+//--------------------------------------------------------------------
+static int CheckCore(const char *Path, pid_t Pid, long Threads)
+{
+    const Elf64_Ehdr *header;
+    const unsigned char *image;
+    int failures = 0, loads = 0, prstatus = 0;
+    pid_t psinfoPid = -1;
+    struct stat st;
+    int fd;
+
+    if ((fd = open(Path, O_RDONLY)) == -1 || fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Elf64_Ehdr) ||
+        (image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        printf("FAIL: %s is not readable or shorter than an ELF header\n", Path);
+        if (fd != -1) {
+            close(fd);
+        }
+        return 1;
+    }
+    close(fd);
+
+    header = (const Elf64_Ehdr *)image;
+    if (memcmp(header->e_ident, ELFMAG, SELFMAG) != 0 || header->e_ident[EI_CLASS] != ELFCLASS64 ||
+        header->e_type != ET_CORE || header->e_phentsize != sizeof(Elf64_Phdr) ||
+        header->e_phoff + header->e_phnum * sizeof(Elf64_Phdr) > (uint64_t)st.st_size) {
+        printf("FAIL: %s is not a 64 bit ELF core with its program headers in it\n", Path);
+        munmap((void *)image, st.st_size);
+        return 1;
+    }
+
+    for (int i = 0; i < header->e_phnum; i++) {
+        const Elf64_Phdr *segment = (const Elf64_Phdr *)(image + header->e_phoff) + i;
+
+        if (segment->p_offset + segment->p_filesz > (uint64_t)st.st_size) {
+            printf("FAIL: segment %d ends at %lu, past the end of the core (%ld bytes): truncated\n",
+                   i, (unsigned long)(segment->p_offset + segment->p_filesz), (long)st.st_size);
+            failures++;
+            continue;
+        }
+        if (segment->p_type == PT_LOAD) {
+            loads++;
+        } else if (segment->p_type == PT_NOTE) {
+            uint64_t offset = 0;
+
+            while (offset + sizeof(Elf64_Nhdr) <= segment->p_filesz) {
+                const Elf64_Nhdr *note = (const Elf64_Nhdr *)(image + segment->p_offset + offset);
+                uint64_t descOffset = offset + sizeof(Elf64_Nhdr) + ((note->n_namesz + 3) & ~3UL);
+
+                if (descOffset + note->n_descsz > segment->p_filesz) {
+                    printf("FAIL: note at %lu overruns its segment\n", (unsigned long)offset);
+                    failures++;
+                    break;
+                }
+                if (note->n_type == NT_PRSTATUS) {
+                    prstatus++;
+                } else if (note->n_type == NT_PRPSINFO && note->n_descsz >= sizeof(prpsinfo_t)) {
+                    psinfoPid = ((const prpsinfo_t *)(image + segment->p_offset + descOffset))->pr_pid;
+                }
+                offset = descOffset + ((note->n_descsz + 3) & ~3UL);
+            }
+        }
+    }
+    munmap((void *)image, st.st_size);
+
+    if (loads == 0) {
+        printf("FAIL: no PT_LOAD segment\n");
+        failures++;
+    }
+    if (prstatus != Threads) {
+        printf("FAIL: %d NT_PRSTATUS notes for %ld threads\n", prstatus, Threads);
+        failures++;
+    }
+    if (psinfoPid != Pid) {
+        printf("FAIL: NT_PRPSINFO is of pid %d, not %d\n", psinfoPid, Pid);
+        failures++;
+    }
+    return failures;
+}
+
+//--------------------------------------------------------------------
+//
+// CheckReport - Does the core's JSON report describe it?
+//
+//--------------------------------------------------------------------
+static int CheckReport(const char *Core, pid_t Pid)
+{
+    char path[PATH_MAX + 8], buffer[4096];
+    const char *field;
+    struct stat st;
+    int failures = 0;
+
+    snprintf(path, sizeof(path), "%s.json", Core);
+    if (stat(Core, &st) != 0 || ReadProcFile(path, buffer, sizeof(buffer)) <= 0) {
+        printf("FAIL: no report %s\n", path);
+        return 1;
+    }
+    if ((field = strstr(buffer, "\"pid\": ")) == NULL || atoi(field + 7) != Pid) {
+        printf("FAIL: the report is not of pid %d\n", Pid);
+        failures++;
+    }
+    if ((field = strstr(buffer, "\"core_bytes\": ")) == NULL || strtoll(field + 14, NULL, 10) != st.st_size) {
+        printf("FAIL: the report's core_bytes is not the core's %ld bytes\n", (long)st.st_size);
+        failures++;
+    }
+    return failures;
+}
+
+static pid_t StartTarget(const struct Scenario *Scenario, const char *Crossing, int *Stdout)
+{
+    char *args[TEST_MAX_ARGS + 2] = { "ProcDumpTestApplication" };
+    int fds[2];
+    pid_t pid;
+
+    for (int i = 0; i < TEST_MAX_ARGS && Scenario->Target[i] != NULL; i++) {
+        args[i + 1] = strcmp(Scenario->Target[i], TEST_CROSSING) == 0 ? (char *)Crossing : Scenario->Target[i];
+    }
+    if (pipe(fds) != 0) {
+        return -1;
+    }
+    if ((pid = fork()) == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execv(Application, args);
+        _exit(127);
+    }
+    close(fds[1]);
+    *Stdout = fds[0];
+    return pid;
+}
+
+// a target that builds its memory says when it is done
+static bool WaitReady(int Stdout)
+{
+    char output[64] = "";
+    size_t length = 0;
+    uint64_t start = NowNs();
+
+    while (strstr(output, "ready") == NULL && (NowNs() - start) / 1000000 < TEST_READY_TIMEOUT_MS) {
+        struct pollfd pipeIn = { .fd = Stdout, .events = POLLIN };
+        ssize_t n;
+
+        if (poll(&pipeIn, 1, 10) > 0 && (n = read(Stdout, output + length, sizeof(output) - 1 - length)) > 0) {
+            length += n;
+            output[length] = '\0';
+        }
+    }
+    return strstr(output, "ready") != NULL;
+}
+
+static pid_t StartProcdump(const struct Scenario *Scenario, const char *Directory, pid_t Target, int *Stdout)
+{
+    char *args[TEST_MAX_ARGS + 12] = { "procdump", "-i", TEST_INTERVAL, "-n", "1" };
+    char pid[16];
+    int n = 5, fds[2];
+    pid_t procdump;
+
+    for (int i = 0; i < TEST_MAX_ARGS && Scenario->Options[i] != NULL; i++) {
+        args[n++] = Scenario->Options[i];
+    }
+    if (!bGcore) {
+        args[n++] = "-S";
+    }
+    snprintf(pid, sizeof(pid), "%d", Target);
+    args[n++] = Scenario->bByName ? "-w" : "-p";
+    args[n++] = Scenario->bByName ? "ProcDumpTestApplication" : pid;
+
+    if (pipe(fds) != 0) {
+        return -1;
+    }
+    if ((procdump = fork()) == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        if (chdir(Directory) != 0) {
+            _exit(127);
+        }
+        execv(Procdump, args);
+        _exit(127);
+    }
+    close(fds[1]);
+    *Stdout = fds[0];
+    return procdump;
+}
+
+//--------------------------------------------------------------------
+//
+// RunScenario - Run one scenario and check its outcome
+//
+//      Runs in a process of its own, with stdout captured by the runner.
+//
+// Returns: the number of failed checks
+//
+//--------------------------------------------------------------------
+static int RunScenario(const struct Scenario *Scenario)
+{
+    char directory[] = "/tmp/procdump_integration_XXXXXX";
+    char crossing[sizeof(directory) + 16], core[PATH_MAX];
+    char output[65536];
+    size_t length = 0;
+    volatile uint64_t *crossedAt = NULL;
+    uint64_t startedAt, loggedAt = 0, deadline;
+    long threads = -1, cpuMs = -1;
+    int failures = 0, targetOut = -1, procdumpOut, status, fd;
+    pid_t target = -1, procdump;
+    bool bExited = false;
+
+    if (mkdtemp(directory) == NULL) {
+        printf("FAIL: mkdtemp: %m\n");
+        return 1;
+    }
+    snprintf(crossing, sizeof(crossing), "%s/crossing", directory);
+    if ((fd = open(crossing, O_RDWR | O_CREAT, 0600)) == -1 || ftruncate(fd, sizeof(*crossedAt)) != 0 ||
+        (crossedAt = mmap(NULL, sizeof(*crossedAt), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        printf("FAIL: %s: %m\n", crossing);
+        return 1;
+    }
+    close(fd);
+
+    if (!Scenario->bByName) {
+        target = StartTarget(Scenario, crossing, &targetOut);
+        if (strcmp(Scenario->Target[0], "target") == 0 && !WaitReady(targetOut)) {
+            printf("FAIL: the target did not get ready in %d ms\n", TEST_READY_TIMEOUT_MS);
+            failures++;
+        }
+        usleep(Scenario->WarmupMs * 1000);
+    }
+    procdump = StartProcdump(Scenario, directory, target, &procdumpOut);
+    startedAt = NowNs();
+    if (Scenario->bByName) {
+        usleep(TEST_NAME_DELAY_MS * 1000);
+        target = StartTarget(Scenario, crossing, &targetOut);
+        startedAt = NowNs();
+    }
+
+    // until procdump is done with its one dump, or has been watched long enough
+    deadline = startedAt + (uint64_t)(Scenario->bShouldDump ? Scenario->MaxLatencyMs + TEST_DUMP_TIMEOUT_MS : Scenario->WatchMs) * 1000000;
+    while (!bExited && NowNs() < deadline) {
+        struct pollfd pipeIn = { .fd = procdumpOut, .events = POLLIN };
+        ssize_t n;
+
+        if (poll(&pipeIn, 1, 10) > 0 && length < sizeof(output) - 1 &&
+            (n = read(procdumpOut, output + length, sizeof(output) - 1 - length)) > 0) {
+            length += n;
+            output[length] = '\0';
+        }
+        if (loggedAt == 0 && Scenario->Logged != NULL && strstr(output, Scenario->Logged) != NULL) {
+            loggedAt = NowNs();
+            threads = ProcField(target, "status", "Threads:");     // as it is dumped
+        }
+        bExited = waitpid(procdump, &status, WNOHANG) == procdump;
+    }
+
+    if (!bExited) {
+        cpuMs = CpuMs(procdump);
+        kill(procdump, SIGTERM);
+        waitpid(procdump, &status, 0);
+    }
+    kill(target, SIGKILL);
+    waitpid(target, NULL, 0);
+
+    if (Scenario->bShouldDump) {
+        uint64_t from = startedAt;
+
+        if (strcmp(Scenario->Target[0], "cross") == 0) {
+            from = *crossedAt;
+        }
+        if (loggedAt == 0) {
+            printf("FAIL: \"%s\" was not logged\n", Scenario->Logged);
+            failures++;
+        } else if (from == 0) {
+            printf("FAIL: \"%s\" was logged before the target crossed\n", Scenario->Logged);
+            failures++;
+        } else if ((int64_t)(loggedAt - from) / 1000000 > Scenario->MaxLatencyMs) {
+            printf("FAIL: \"%s\" logged %.1f ms in, over %d ms\n", Scenario->Logged, ((int64_t)(loggedAt - from)) / 1e6, Scenario->MaxLatencyMs);
+            failures++;
+        } else {
+            printf("triggered %.1f ms in (budget %d ms)\n", ((int64_t)(loggedAt - from)) / 1e6, Scenario->MaxLatencyMs);
+        }
+        if (!bExited || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            printf("FAIL: procdump did not exit cleanly after its dump\n");
+            failures++;
+        }
+        if (!FindDumpFile(directory, core, sizeof(core))) {
+            printf("FAIL: no dump\n");
+            failures++;
+        } else {
+            failures += CheckCore(core, target, threads) + CheckReport(core, target);
+        }
+    } else {
+        if (bExited) {
+            printf("FAIL: procdump exited before the %d ms it was watched\n", Scenario->WatchMs);
+            failures++;
+        }
+        if (FindDumpFile(directory, core, sizeof(core))) {
+            printf("FAIL: dumped %s\n", core);
+            failures++;
+        }
+        if (Scenario->MaxCpuPercent > 0) {
+            double percent = cpuMs * 100.0 / Scenario->WatchMs;
+
+            if (cpuMs < 0 || percent > Scenario->MaxCpuPercent) {
+                printf("FAIL: procdump used %ld ms of CPU in %d ms, over %d%%\n", cpuMs, Scenario->WatchMs, Scenario->MaxCpuPercent);
+                failures++;
+            } else {
+                printf("procdump used %ld ms of CPU in %d ms\n", cpuMs, Scenario->WatchMs);
+            }
+        }
+    }
+
+    if (failures > 0) {
+        printf("procdump output:\n%s\n", output);
+    }
+    close(procdumpOut);
+    close(targetOut);
+    munmap((void *)crossedAt, sizeof(*crossedAt));
+    RemoveDirectory(directory);
+    return failures;
+}
+
+struct Running {
+    pid_t Pid;
+    int Index;
+    uint64_t StartedAt;
+    FILE *Output;
+};
+
+static bool CanStart(const struct Scenario *Scenario, struct Running *Running, int nRunning, int Jobs, int Capacity)
+{
+    int load = 0;
+
+    if (nRunning == 0) {
+        return true;
+    }
+    if (Scenario->bByName || nRunning >= Jobs) {
+        return false;
+    }
+    for (int i = 0; i < nRunning; i++) {
+        if (Scenarios[Running[i].Index].bByName) {
+            return false;
+        }
+        load += Scenarios[Running[i].Index].Load;
+    }
+    return load + Scenario->Load <= Capacity;
+}
+
+int main(int argc, char *argv[])
+{
+    struct Running running[SCENARIO_COUNT];
+    bool selected[SCENARIO_COUNT], started[SCENARIO_COUNT] = { false };
+    int nRunning = 0, remaining = 0, total, failed = 0, jobs = SCENARIO_COUNT, c;
+    int capacity = 100 * sysconf(_SC_NPROCESSORS_ONLN);
+    char arg0[PATH_MAX], bin[PATH_MAX];
+    uint64_t start = NowNs();
+
+    while ((c = getopt(argc, argv, "gj:")) != -1) {
+        switch (c) {
+            case 'g': bGcore = true; break;
+            case 'j': jobs = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-g] [-j jobs] [scenario ...]\n", argv[0]);
+                return 1;
+        }
+    }
+    for (size_t i = 0; i < SCENARIO_COUNT; i++) {
+        selected[i] = (optind == argc);
+        for (int j = optind; j < argc; j++) {
+            selected[i] |= strcmp(argv[j], Scenarios[i].Name) == 0;
+        }
+        remaining += selected[i];
+    }
+    total = remaining;
+    if (remaining == 0 || jobs < 1) {
+        fprintf(stderr, "usage: %s [-g] [-j jobs] [scenario ...]\n", argv[0]);
+        return 1;
+    }
+
+    // procdump has to be able to attach to the targets
+    if (geteuid() != 0) {
+        char *args[argc + 2];
+
+        args[0] = "sudo";
+        memcpy(&args[1], argv, argc * sizeof(char *));
+        args[argc + 1] = NULL;
+        execvp("sudo", args);
+        fprintf(stderr, "These tests must be run as root\n");
+        return 1;
+    }
+
+    // bin/IntegrationTests runs bin/procdump on bin/ProcDumpTestApplication
+    snprintf(arg0, sizeof(arg0), "%s", argv[0]);
+    if (realpath(dirname(arg0), bin) == NULL) {
+        return 1;
+    }
+    snprintf(Procdump, sizeof(Procdump), "%s/procdump", bin);
+    snprintf(Application, sizeof(Application), "%s/ProcDumpTestApplication", bin);
+    if (access(Procdump, X_OK) != 0 || access(Application, X_OK) != 0) {
+        fprintf(stderr, "%s or %s not found, build them first\n", Procdump, Application);
+        return 1;
+    }
+    if (bGcore && system("command -v gcore > /dev/null") != 0) {
+        fprintf(stderr, "gcore not found, install gdb or drop -g\n");
+        return 1;
+    }
+
+    while (remaining > 0) {
+        char line[1024];
+        int status;
+        pid_t pid;
+
+        for (size_t i = 0; i < SCENARIO_COUNT; i++) {
+            if (selected[i] && !started[i] && CanStart(&Scenarios[i], running, nRunning, jobs, capacity)) {
+                struct Running *slot = &running[nRunning++];
+
+                fflush(stdout);
+                slot->Index = i;
+                slot->StartedAt = NowNs();
+                slot->Output = tmpfile();
+                if ((slot->Pid = fork()) == 0) {
+                    dup2(fileno(slot->Output), STDOUT_FILENO);
+                    exit(RunScenario(&Scenarios[i]) == 0 ? 0 : 1);
+                }
+                started[i] = true;
+            }
+        }
+
+        if ((pid = wait(&status)) == -1) {
+            break;
+        }
+        for (int i = 0; i < nRunning; i++) {
+            struct Running *slot = &running[i];
+            bool bPassed = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+            if (slot->Pid != pid) {
+                continue;
+            }
+            printf("%s %s (%.1f s)\n", bPassed ? "PASS" : "FAIL", Scenarios[slot->Index].Name, (NowNs() - slot->StartedAt) / 1e9);
+            rewind(slot->Output);
+            while (fgets(line, sizeof(line), slot->Output) != NULL) {
+                printf("    %s", line);
+            }
+            fclose(slot->Output);
+            failed += !bPassed;
+            remaining--;
+            *slot = running[--nRunning];
+            break;
+        }
+    }
+
+    printf("\n%d of %d scenarios failed in %.1f s\n", failed, total, (NowNs() - start) / 1e9);
+    return (failed == 0) ? 0 : 1;
+}
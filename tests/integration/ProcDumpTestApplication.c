@@ -1,6 +1,183 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#ifndef MADV_PAGEOUT
+#define MADV_PAGEOUT 21
+#endif
+
+#define PAGE 4096UL
+
+// target <MB> [zero=%] [dirty=%] [file=%] [threads=N] [huge] [swap=%]
+//
+// A synthetic dump target of MB megabytes: file% of it a shared file mapping
+// (written, so in the page cache), and of the anonymous rest zero% only read
+// (the shared zero page), dirty% (default: the rest) written and the remainder
+// never touched.
+// huge asks for transparent huge pages on the anonymous memory, swap% of the
+// dirty pages are paged out (needs swap, else they stay resident).
+// Prints "ready" once built and sleeps until killed.
+struct TargetSpec {
+	unsigned long mb;
+	int zero, dirty, file, threads, swap;
+	bool huge;
+};
+
+static void *Sleeper(void *arg){
+	while(1) pause();
+	return NULL;
+}
+
+static int ParseTargetSpec(int argc, char *argv[], struct TargetSpec *spec){
+	memset(spec, 0, sizeof(*spec));
+	spec->dirty = -1;
+	if (argc < 3 || (spec->mb = strtoul(argv[2], NULL, 10)) == 0){
+		return -1;
+	}
+	for (int i = 3; i < argc; i++){
+		if (sscanf(argv[i], "zero=%d", &spec->zero) == 1 || sscanf(argv[i], "dirty=%d", &spec->dirty) == 1 ||
+		    sscanf(argv[i], "file=%d", &spec->file) == 1 || sscanf(argv[i], "threads=%d", &spec->threads) == 1 ||
+		    sscanf(argv[i], "swap=%d", &spec->swap) == 1){
+			continue;
+		}
+		if (strcmp(argv[i], "huge") == 0){
+			spec->huge = true;
+			continue;
+		}
+		return -1;
+	}
+	if (spec->dirty == -1){
+		spec->dirty = 100 - spec->zero;	// whatever is not zero
+	}
+	if (spec->zero < 0 || spec->dirty < 0 || spec->zero + spec->dirty > 100 ||
+	    spec->file < 0 || spec->file > 100 || spec->swap < 0 || spec->swap > 100 || spec->threads < 0){
+		return -1;
+	}
+	return 0;
+}
+
+static int RunTarget(struct TargetSpec *spec){
+	unsigned long total = spec->mb << 20;
+	unsigned long fileBytes = total / 100 * spec->file;
+	unsigned long anonBytes = total - fileBytes;
+	unsigned long zeroBytes = anonBytes / 100 * spec->zero / PAGE * PAGE;
+	unsigned long dirtyBytes = anonBytes / 100 * spec->dirty / PAGE * PAGE;
+	volatile char sink = 0;
+	pthread_t thread;
+	char *anon;
+
+	if (anonBytes > 0){
+		if ((anon = mmap(NULL, anonBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED){
+			perror("mmap");
+			return 1;
+		}
+		if (spec->huge){
+			madvise(anon, anonBytes, MADV_HUGEPAGE);
+		}
+		for (unsigned long offset = 0; offset < dirtyBytes; offset += PAGE){
+			anon[offset] = (char)(offset / PAGE) | 1;	// no two pages alike, none all zero
+		}
+		for (unsigned long offset = dirtyBytes; offset < dirtyBytes + zeroBytes; offset += PAGE){
+			sink += anon[offset];
+		}
+		if (spec->swap > 0){
+			madvise(anon, dirtyBytes / 100 * spec->swap / PAGE * PAGE, MADV_PAGEOUT);
+		}
+	}
+
+	if (fileBytes > 0){
+		char path[] = "/tmp/procdump_target_XXXXXX";
+		int fd = mkstemp(path);
+		char *file;
+
+		if (fd == -1 || ftruncate(fd, fileBytes) != 0 ||
+		    (file = mmap(NULL, fileBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED){
+			perror("file mapping");
+			return 1;
+		}
+		unlink(path);
+		close(fd);
+		for (unsigned long offset = 0; offset < fileBytes; offset += PAGE){
+			file[offset] = (char)(offset / PAGE) | 1;
+		}
+	}
+
+	for (int i = 0; i < spec->threads; i++){
+		pthread_create(&thread, NULL, Sleeper, NULL);
+	}
+
+	printf("ready\n");
+	fflush(stdout);
+	Sleeper(NULL);
+	return 0;
+}
+
+// cross <cpu|mem> <delay ms> <file> [MB]
+//
+// Idle for delay ms, then cross a threshold: burn a CPU, or touch MB megabytes
+// (64 by default). The CLOCK_MONOTONIC ns of the crossing is written to the
+// first 8 bytes of file, for the trigger latency benchmark. Runs until killed.
+static int RunCrossing(int argc, char *argv[]){
+	unsigned long mb = argc > 5 ? strtoul(argv[5], NULL, 10) : 64;
+	volatile uint64_t *crossedAt;
+	struct timespec now;
+	int fd;
+
+	if (argc < 5 || (strcmp(argv[2], "cpu") != 0 && strcmp(argv[2], "mem") != 0) || mb == 0 ||
+	    (fd = open(argv[4], O_RDWR)) == -1 ||
+	    (crossedAt = mmap(NULL, sizeof(*crossedAt), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED){
+		fprintf(stderr, "usage: %s cross <cpu|mem> <delay ms> <file> [MB]\n", argv[0]);
+		return 1;
+	}
+	close(fd);
+
+	usleep(atoi(argv[3]) * 1000);
+	if (strcmp(argv[2], "mem") == 0){
+		char *memory = mmap(NULL, mb << 20, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+
+		// populated in one call: resident from here, the crossing is the end of it
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		*crossedAt = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+		if (memory == MAP_FAILED){
+			return 1;
+		}
+		Sleeper(NULL);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	*crossedAt = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+	while(1);
+}
+
+// load <percent>
+//
+// Keep percent of a CPU busy, in 10 ms periods, until killed.
+static int RunLoad(int argc, char *argv[]){
+	int percent = argc > 2 ? atoi(argv[2]) : -1;
+	struct timespec start, now, idle = { 0, 0 };
+
+	if (percent < 0 || percent > 100){
+		fprintf(stderr, "usage: %s load <percent>\n", argv[0]);
+		return 1;
+	}
+	idle.tv_nsec = (100 - percent) * 100000L;
+	while(1){
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		do {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+		} while ((now.tv_sec - start.tv_sec) * 1000000000L + now.tv_nsec - start.tv_nsec < percent * 100000L);
+		if (idle.tv_nsec > 0){
+			nanosleep(&idle, NULL);
+		}
+	}
+}
 
 int main(int argc, char *argv[]){
 	if (argc > 1){
@@ -9,6 +186,20 @@ int main(int argc, char *argv[]){
 		} else if (strcmp("burn", argv[1]) == 0){
 			alarm(5);
 			while(1);
+		} else if (strcmp("idle", argv[1]) == 0){
+			Sleeper(NULL);	// until killed
+		} else if (strcmp("target", argv[1]) == 0){
+			struct TargetSpec spec;
+
+			if (ParseTargetSpec(argc, argv, &spec) != 0){
+				fprintf(stderr, "usage: %s target <MB> [zero=%%] [dirty=%%] [file=%%] [threads=N] [huge] [swap=%%]\n", argv[0]);
+				return 1;
+			}
+			return RunTarget(&spec);
+		} else if (strcmp("cross", argv[1]) == 0){
+			return RunCrossing(argc, argv);
+		} else if (strcmp("load", argv[1]) == 0){
+			return RunLoad(argc, argv);
 		}
 	}
 }
@@ -1,14 +0,0 @@
-#!/bin/bash
-DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )";
-runProcDumpAndValidate=$(readlink -m "$DIR/../runProcDumpAndValidate.sh");
-source $runProcDumpAndValidate
-
-TESTPROGNAME="ProcDumpTestApplication"
-TESTPROGMODE="burn"
-
-stressPercentage=90
-procDumpType="-C"
-procDumpTrigger=50
-shouldDump=true
-
-runProcDumpAndValidate $stressPercentage $procDumpType $procDumpTrigger $shouldDump
@@ -0,0 +1,233 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Heap profile of steady state monitoring: sampling, scanning and the
+// per-dump sample history must not touch the general heap
+//
+//--------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "Arena.h"
+#include "CoreDumpWriter.h"
+#include "FlightRecorder.h"
+#include "ProcDumpConfiguration.h"
+#include "TriggerThreadProcs.h"
+
+#define SAMPLE_ROUNDS 1000
+#define SNAPSHOT_ROUNDS 100
+
+static int failures = 0;
+
+#define CHECK(cond, ...) \
+    do { if (!(cond)) { fprintf(stderr, "FAIL: " __VA_ARGS__); fprintf(stderr, "\n"); __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED); } } while (0)
+
+// glibc's own entry points, wrapped below to count the calls of this thread
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static __thread bool bCounting = false;
+static __thread long allocations = 0;
+
+void *malloc(size_t size)
+{
+    allocations += bCounting;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+    allocations += bCounting;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    allocations += bCounting;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    __libc_free(ptr);
+}
+
+static void StartCounting()
+{
+    allocations = 0;
+    bCounting = true;
+}
+
+static long StopCounting()
+{
+    bCounting = false;
+    return allocations;
+}
+
+//--------------------------------------------------------------------
+//
+// Arena: alignment, exhaustion and reset
+//
+//--------------------------------------------------------------------
+static void TestArena()
+{
+    struct Arena arena;
+    char memory[256];
+    char *a, *b, *c;
+
+    InitArenaOver(&arena, memory + 1, sizeof(memory) - 1);
+    a = ArenaAlloc(&arena, 1);
+    b = ArenaAlloc(&arena, 1);
+    CHECK(a != NULL && (size_t)a % ARENA_ALIGNMENT == 0, "first allocation not aligned");
+    CHECK(b != NULL && (size_t)b % ARENA_ALIGNMENT == 0 && b > a, "second allocation not aligned after the first");
+
+    CHECK(ArenaAlloc(&arena, sizeof(memory)) == NULL, "allocation larger than the arena succeeded");
+    while (ArenaAlloc(&arena, ARENA_ALIGNMENT) != NULL);
+    CHECK(ArenaStrdup(&arena, "x") == NULL, "full arena handed out memory");
+
+    ResetArena(&arena);
+    CHECK(ArenaAlloc(&arena, 1) == a, "reset arena did not start over");
+    c = ArenaCalloc(&arena, 64);
+    CHECK(c != NULL && c[0] == 0 && c[63] == 0, "ArenaCalloc did not zero");
+    c = ArenaStrdup(&arena, "procdump");
+    CHECK(c != NULL && strcmp(c, "procdump") == 0, "ArenaStrdup copied '%s'", c ? c : "(null)");
+
+    CHECK(InitArena(&arena, 1000) == 0 && arena.Size % ARENA_ALIGNMENT == 0, "InitArena without a reserve failed");
+}
+
+//--------------------------------------------------------------------
+//
+// Sampling: trigger evaluation, the flight recorder and the daemon's
+//           per process reads, once warmed up
+//
+//--------------------------------------------------------------------
+static struct ProcDumpConfiguration config;
+static char recorderPath[] = "/tmp/procdump_alloc_XXXXXX";
+static pid_t target;
+
+static void TestSteadyStateSampling()
+{
+    struct Trigger *cpu, *commit, *blocked;
+    struct Arena *scratch;
+    struct ProcessStat proc;
+    struct ProcessIdentity id;
+    char cgroup[PATH_MAX];
+    char *name = NULL;
+    long count;
+
+    HZ = sysconf(_SC_CLK_TCK);
+    MAXIMUM_CPU = 100 * (int)sysconf(_SC_NPROCESSORS_ONLN);
+    InitTargetConfiguration(&config);
+    config.ProcessId = target;
+    config.CpuThreshold = INT_MAX;          // never fires, never logs
+    config.MemoryThreshold = INT_MAX;
+    config.BlockedThreshold = INT_MAX;
+    config.bBlockedOnWchan = true;
+
+    CHECK(mkstemp(recorderPath) != -1, "mkstemp failed");
+    CHECK(OpenFlightRecorder(&config.Recorder, target, recorderPath, &config.TargetArena) == 0, "OpenFlightRecorder failed");
+    scratch = ScratchArena();
+
+    StartCounting();
+    cpu = NewTrigger(NewCoreDumpWriter(CPU, &config));
+    commit = NewTrigger(NewCoreDumpWriter(COMMIT, &config));
+    blocked = NewTrigger(NewCoreDumpWriter(BLOCKED, &config));
+    count = StopCounting();
+    CHECK(count == 0, "%ld allocations creating triggers", count);
+
+    for (int round = 0; round <= SAMPLE_ROUNDS; round++) {
+        if (round == 1) {
+            StartCounting();                // round 0 warms up stdio's and libc's lazy state
+        }
+
+        cpu->Evaluate(cpu);
+        commit->Evaluate(commit);
+        blocked->Evaluate(blocked);
+        if (GetProcessStat(target, &proc)) {
+            RecordSample(&config.Recorder, &proc);
+        }
+
+        ResetArena(scratch);
+        GetProcessIdentity(target, &id);
+        GetProcessCgroup(target, cgroup, sizeof(cgroup));
+        name = GetProcessName(target, scratch);
+    }
+    count = StopCounting();
+
+    CHECK(count == 0, "%ld allocations in %d samples", count, SAMPLE_ROUNDS);
+    CHECK(strcmp(name, "AllocationStressTest") == 0, "target named '%s'", name);
+}
+
+//--------------------------------------------------------------------
+//
+// Dump: the sample history snapshot streams through the scratch arena
+//
+//--------------------------------------------------------------------
+static void TestSnapshot()
+{
+    char snapshotPath[sizeof(recorderPath) + sizeof(FLIGHT_RECORDER_EXTENSION)];
+    struct FlightRecorderHeader header = {0};
+    struct Arena *scratch = ScratchArena();
+    FILE *snapshot;
+    long count;
+
+    sprintf(snapshotPath, "%s%s", recorderPath, FLIGHT_RECORDER_EXTENSION);
+
+    for (int round = 0; round <= SNAPSHOT_ROUNDS; round++) {
+        if (round == 1) {
+            StartCounting();
+        }
+        ResetArena(scratch);
+        CHECK(SnapshotFlightRecorder(&config.Recorder, snapshotPath, FLIGHT_SNAPSHOT_SECONDS, scratch) == 0, "snapshot failed");
+    }
+    count = StopCounting();
+    CHECK(count == 0, "%ld allocations in %d snapshots", count, SNAPSHOT_ROUNDS);
+
+    if ((snapshot = fopen(snapshotPath, "r")) != NULL) {
+        CHECK(fread(&header, sizeof(header), 1, snapshot) == 1, "snapshot has no header");
+        CHECK(header.Head == SAMPLE_ROUNDS + 1, "snapshot has %llu of %d samples", (unsigned long long)header.Head, SAMPLE_ROUNDS + 1);
+        fseek(snapshot, 0, SEEK_END);
+        CHECK(ftell(snapshot) == (long)(sizeof(header) + header.Head * sizeof(struct SampleRecord)), "snapshot size does not match its header");
+        fclose(snapshot);
+    }
+    unlink(snapshotPath);
+}
+
+int main(int argc, char *argv[])
+{
+    struct {
+        const char *name;
+        void (*run)();
+    } tests[] = {
+        { "Arena",                  TestArena },
+        { "SteadyStateSampling",    TestSteadyStateSampling },
+        { "Snapshot",               TestSnapshot },
+    };
+
+    if ((target = fork()) == 0) {
+        pause();
+        _exit(0);
+    }
+
+    for (int i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        int before = failures;
+        tests[i].run();
+        printf("%s %s\n", tests[i].name, (failures == before) ? "passed" : "failed");
+    }
+
+    CloseFlightRecorder(&config.Recorder);
+    unlink(recorderPath);
+    kill(target, SIGKILL);
+    waitpid(target, NULL, 0);
+
+    return (failures == 0) ? 0 : 1;
+}
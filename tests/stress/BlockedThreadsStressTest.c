@@ -0,0 +1,317 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Blocked threads: a child with threads held in D state (vfork parents)
+// and threads sleeping on one wait channel, scanned over and over while
+// other threads come and go; the trigger fires only once the threads
+// stay blocked for its period
+//
+//--------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "MiniDump.h"
+#include "ProcDumpConfiguration.h"
+#include "TriggerThreadProcs.h"
+
+#define VFORK_THREADS 3                     // each waits in D state for its vfork child
+#define PAUSED_THREADS 6                    // each sleeps in pause()
+#define SCAN_ROUNDS 2000
+
+static int failures = 0;
+
+#define CHECK(cond, ...) \
+    do { if (!(cond)) { fprintf(stderr, "FAIL: " __VA_ARGS__); fprintf(stderr, "\n"); __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED); } } while (0)
+
+static void *VforkWorker(void *Context)
+{
+    // the parent thread is in uninterruptible (killable) sleep until the child execs or exits
+    if (vfork() == 0) {
+        syscall(SYS_pause);
+        _exit(0);
+    }
+    return NULL;
+}
+
+static void *PausedWorker(void *Context)
+{
+    for (;;) {
+        pause();
+    }
+    return NULL;
+}
+
+static void *ChurnWorker(void *Context)
+{
+    return NULL;
+}
+
+static void RunTarget()
+{
+    pthread_t thread;
+
+    setpgid(0, 0);                          // killed with its vfork children
+    for (int i = 0; i < VFORK_THREADS; i++) {
+        pthread_create(&thread, NULL, VforkWorker, NULL);
+    }
+    for (int i = 0; i < PAUSED_THREADS; i++) {
+        pthread_create(&thread, NULL, PausedWorker, NULL);
+    }
+
+    // threads exiting under the scans
+    for (;;) {
+        if (pthread_create(&thread, NULL, ChurnWorker, NULL) == 0) {
+            pthread_join(thread, NULL);
+        }
+        usleep(100);
+    }
+}
+
+static pid_t StartTarget()
+{
+    pid_t pid;
+
+    if ((pid = fork()) == 0) {
+        RunTarget();
+        _exit(0);
+    }
+    usleep(100000);                         // the workers are blocked
+    return pid;
+}
+
+// Number of Pid's threads in State, or traced (TracerPid not 0) for State 0
+static int CountThreads(pid_t Pid, char State)
+{
+    struct dirent *entry;
+    char path[64];
+    char buffer[2048];
+    int count = 0;
+    DIR *tasks;
+
+    snprintf(path, sizeof(path), "/proc/%d/task", Pid);
+    if ((tasks = opendir(path)) == NULL) {
+        return -1;
+    }
+    while ((entry = readdir(tasks)) != NULL) {
+        pid_t tid = (pid_t)atoi(entry->d_name);
+        char *field;
+
+        if (tid <= 0) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/proc/%d/task/%d/%s", Pid, tid, State ? "stat" : "status");
+        if (ReadProcFile(path, buffer, sizeof(buffer)) <= 0) {
+            continue;
+        }
+        if (State != 0) {
+            count += (field = strrchr(buffer, ')')) != NULL && field[2] == State;
+        } else {
+            count += (field = strstr(buffer, "TracerPid:")) != NULL && atoi(field + strlen("TracerPid:")) != 0;
+        }
+    }
+    closedir(tasks);
+    return count;
+}
+
+//--------------------------------------------------------------------
+//
+// Spec: -B argument parsing
+//
+//--------------------------------------------------------------------
+static void TestSpec()
+{
+    int threads = -1, seconds = 0;
+    bool bWchan = true;
+
+    CHECK(ParseBlockedSpec("4", &threads, &seconds, &bWchan) == 0 && threads == 4 &&
+          seconds == BLOCKED_DEFAULT_SECONDS && !bWchan, "4 parsed as %d:%d", threads, seconds);
+    CHECK(ParseBlockedSpec("0:30", &threads, &seconds, &bWchan) == 0 && threads == 0 && seconds == 30 && !bWchan,
+          "0:30 parsed as %d:%d", threads, seconds);
+    CHECK(ParseBlockedSpec("8:wchan", &threads, &seconds, &bWchan) == 0 && threads == 8 &&
+          seconds == BLOCKED_DEFAULT_SECONDS && bWchan, "8:wchan parsed as %d:%d", threads, seconds);
+    CHECK(ParseBlockedSpec("8:60:wchan", &threads, &seconds, &bWchan) == 0 && threads == 8 && seconds == 60 && bWchan,
+          "8:60:wchan parsed as %d:%d", threads, seconds);
+    CHECK(ParseBlockedSpec("8:wchan:60", &threads, &seconds, &bWchan) != 0, "seconds after wchan accepted");
+    CHECK(ParseBlockedSpec("8:0", &threads, &seconds, &bWchan) != 0, "0 seconds accepted");
+    CHECK(ParseBlockedSpec("8:10:20", &threads, &seconds, &bWchan) != 0, "seconds twice accepted");
+    CHECK(ParseBlockedSpec("-1", &threads, &seconds, &bWchan) != 0, "negative threads accepted");
+    CHECK(ParseBlockedSpec("8:io", &threads, &seconds, &bWchan) != 0, "unknown mode accepted");
+    CHECK(ParseBlockedSpec("", &threads, &seconds, &bWchan) != 0, "empty spec accepted");
+}
+
+//--------------------------------------------------------------------
+//
+// Scan: every scan sees the D state threads and the paused ones on
+//       one wait channel, whatever else exits meanwhile
+//
+//--------------------------------------------------------------------
+static pid_t target;
+
+static void TestScan()
+{
+    struct BlockedThreads blocked;
+    char path[32];
+    DIR *tasks;
+    int exact = 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/task", target);
+    if ((tasks = opendir(path)) == NULL) {
+        CHECK(false, "no %s", path);
+        return;
+    }
+
+    for (int round = 0; round < SCAN_ROUNDS; round++) {
+        bool bWchan = (round % 2) == 1;
+
+        CHECK(GetBlockedThreads(target, tasks, bWchan, &blocked), "scan %d failed", round);
+        CHECK(blocked.threads >= 1 + VFORK_THREADS + PAUSED_THREADS, "%d threads scanned", blocked.threads);
+        CHECK(blocked.uninterruptible >= VFORK_THREADS && blocked.listed == blocked.uninterruptible,
+              "%d in D state, %d listed", blocked.uninterruptible, blocked.listed);
+        for (int i = 0; i < blocked.listed; i++) {
+            CHECK(blocked.list[i].state == 'D' && blocked.list[i].tid > target, "listed %d in state %c",
+                  blocked.list[i].tid, blocked.list[i].state);
+        }
+        if (bWchan) {
+            CHECK(blocked.onWchan >= PAUSED_THREADS && blocked.wchan[0] != '\0',
+                  "%d threads on the busiest wait channel '%s'", blocked.onWchan, blocked.wchan);
+        } else {
+            CHECK(blocked.onWchan == 0, "wait channels counted when not asked for");
+        }
+        exact += blocked.uninterruptible == VFORK_THREADS;
+    }
+
+    // a churn thread may be caught in D state now and then, not every time
+    CHECK(exact > SCAN_ROUNDS / 2, "exactly %d D state threads in %d of %d scans", VFORK_THREADS, exact, SCAN_ROUNDS);
+    closedir(tasks);
+}
+
+//--------------------------------------------------------------------
+//
+// Dump: a mini dump does not wait on the D state threads, dumps them
+//       asleep, and lets every thread go, including once they wake
+//
+//--------------------------------------------------------------------
+static void TestDump()
+{
+    char path[] = "/tmp/procdump_blocked_XXXXXX";
+    struct MiniDumpResult result;
+    struct ProcessIdentity id;
+    struct dirent *entry;
+    pid_t dumped = StartTarget();
+    int traced = -1, waking = -1;
+    DIR *proc;
+    int rc;
+
+    CHECK(mkdtemp(path) != NULL, "mkdtemp failed");
+    strcat(path, "/core");
+    CHECK((rc = WriteMiniDump(dumped, path, &result)) == 0, "WriteMiniDump failed: %s", strerror(rc));
+    CHECK(result.Threads >= 1 + VFORK_THREADS + PAUSED_THREADS && result.Asleep >= VFORK_THREADS,
+          "%d threads dumped, %d asleep", result.Threads, result.Asleep);
+    CHECK(result.ResumedAt - result.StoppedAt < 1000000000ULL, "target stopped for %.1f ms", (result.ResumedAt - result.StoppedAt) / 1e6);
+    unlink(path);
+    rmdir(dirname(path));
+
+    // the threads that never stopped are let go once the dump thread has exited
+    for (int i = 0; i < 100 && (traced = CountThreads(dumped, 0)) != 0; i++) {
+        usleep(10000);
+    }
+    CHECK(traced == 0, "%d threads still traced", traced);
+    CHECK(CountThreads(dumped, 'D') >= VFORK_THREADS, "D state threads woke up");
+
+    // woken, they run on rather than stop for the interrupt of the dump
+    if ((proc = opendir("/proc")) != NULL) {
+        while ((entry = readdir(proc)) != NULL) {
+            pid_t pid = (pid_t)atoi(entry->d_name);
+            if (pid > 0 && GetProcessIdentity(pid, &id) && id.ppid == dumped) {
+                kill(pid, SIGKILL);
+            }
+        }
+        closedir(proc);
+    }
+    for (int i = 0; i < 100 && (waking = CountThreads(dumped, 'D') + CountThreads(dumped, 't')) != 0; i++) {
+        usleep(10000);
+    }
+    CHECK(waking == 0, "%d threads still blocked or stopped after waking", waking);
+
+    kill(-dumped, SIGKILL);
+    waitpid(dumped, NULL, 0);
+}
+
+//--------------------------------------------------------------------
+//
+// Trigger: due only once more than the threshold stay blocked for the
+//          whole period, and the period starts over after it fired
+//
+//--------------------------------------------------------------------
+static void TestTrigger()
+{
+    static struct ProcDumpConfiguration config;
+    struct Trigger *trigger;
+    uint64_t second = 1000000000ULL;
+
+    InitTargetConfiguration(&config);
+    config.ProcessId = target;
+    config.BlockedThreshold = VFORK_THREADS - 1;
+    config.BlockedSeconds = 2;
+    trigger = NewTrigger(NewCoreDumpWriter(BLOCKED, &config));
+
+    CHECK(!trigger->Evaluate(trigger) && trigger->HeldSince != 0, "fired on the first sample");
+    trigger->HeldSince -= 1 * second;
+    CHECK(!trigger->Evaluate(trigger), "fired after 1 of 2 seconds");
+    trigger->HeldSince -= 1 * second;
+    CHECK(trigger->Evaluate(trigger), "not fired after 2 seconds");
+    CHECK(trigger->HeldSince == 0, "period not restarted after firing");
+
+    // above the threshold by wait channel only
+    config.BlockedThreshold = VFORK_THREADS;
+    CHECK(!trigger->Evaluate(trigger) && trigger->HeldSince == 0, "fired at the threshold");
+    config.bBlockedOnWchan = true;
+    CHECK(!trigger->Evaluate(trigger) && trigger->HeldSince != 0, "paused threads not counted by wait channel");
+    trigger->HeldSince -= 2 * second;
+    CHECK(trigger->Evaluate(trigger), "not fired on the paused threads' wait channel");
+
+    // no longer blocked: the period is reset
+    config.BlockedThreshold = BLOCKED_MAX_THREADS;
+    trigger->HeldSince = MetricClock() - 10 * second;
+    CHECK(!trigger->Evaluate(trigger) && trigger->HeldSince == 0, "period kept below the threshold");
+
+    // the target exits
+    kill(-target, SIGKILL);
+    waitpid(target, NULL, 0);
+    config.BlockedThreshold = 0;
+    CHECK(!trigger->Evaluate(trigger), "fired on an exited target");
+    FreeTrigger(trigger);
+}
+
+int main(int argc, char *argv[])
+{
+    struct {
+        const char *name;
+        void (*run)();
+    } tests[] = {
+        { "Spec",       TestSpec },
+        { "Scan",       TestScan },
+        { "Dump",       TestDump },
+        { "Trigger",    TestTrigger },
+    };
+
+    target = StartTarget();
+    for (int i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        int before = failures;
+        tests[i].run();
+        printf("%s %s\n", tests[i].name, (failures == before) ? "passed" : "failed");
+    }
+
+    return (failures == 0) ? 0 : 1;
+}
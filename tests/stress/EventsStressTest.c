@@ -0,0 +1,243 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Multi-threaded stress harness for the Event/Semaphore primitives
+//
+//--------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "Handle.h"
+
+#define STRESS_THREADS 16
+#define STRESS_ITERATIONS 20000
+#define SEMAPHORE_SLOTS 3
+#define LOST_WAKEUP_TIMEOUT 10000   // ms, any wait this long means a wakeup was lost
+
+static int failures = 0;
+
+#define CHECK(cond, ...) \
+    do { if (!(cond)) { fprintf(stderr, "FAIL: " __VA_ARGS__); fprintf(stderr, "\n"); __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED); } } while (0)
+
+
+//--------------------------------------------------------------------
+//
+// Manual-reset broadcast: every waiter must be released by one SetEvent
+//
+//--------------------------------------------------------------------
+static struct Handle broadcastEvent;
+static int broadcastReleased = 0;
+
+static void *BroadcastWaiter(void *arg)
+{
+    int rc = WaitForSingleObject(&broadcastEvent, LOST_WAKEUP_TIMEOUT);
+    CHECK(rc == WAIT_OBJECT_0, "broadcast waiter returned %d", rc);
+    __atomic_add_fetch(&broadcastReleased, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+static void TestManualResetBroadcast()
+{
+    pthread_t threads[STRESS_THREADS];
+
+    for (int round = 0; round < 200; round++) {
+        broadcastEvent.type = EVENT;
+        InitNamedEvent(&broadcastEvent.event, true, false, "Broadcast");
+        broadcastReleased = 0;
+
+        for (int t = 0; t < STRESS_THREADS; t++) {
+            pthread_create(&threads[t], NULL, BroadcastWaiter, NULL);
+        }
+        SetEvent(&broadcastEvent.event);
+        for (int t = 0; t < STRESS_THREADS; t++) {
+            pthread_join(threads[t], NULL);
+        }
+
+        CHECK(broadcastReleased == STRESS_THREADS, "round %d released %d of %d waiters", round, broadcastReleased, STRESS_THREADS);
+        CHECK(WaitForSingleObject(&broadcastEvent, 0) == WAIT_OBJECT_0, "manual-reset event did not stay set");
+        ResetEvent(&broadcastEvent.event);
+        CHECK(WaitForSingleObject(&broadcastEvent, 0) == WAIT_TIMEOUT, "ResetEvent did not clear the event");
+        DestroyEvent(&broadcastEvent.event);
+    }
+}
+
+
+//--------------------------------------------------------------------
+//
+// Auto-reset ping-pong: each SetEvent must be consumed by exactly one wait
+//
+//--------------------------------------------------------------------
+struct PingPong {
+    struct Handle ping;
+    struct Handle pong;
+};
+
+static void *Ponger(void *arg)
+{
+    struct PingPong *pair = (struct PingPong *)arg;
+
+    for (int i = 0; i < STRESS_ITERATIONS; i++) {
+        int rc = WaitForSingleObject(&pair->ping, LOST_WAKEUP_TIMEOUT);
+        CHECK(rc == WAIT_OBJECT_0, "ponger lost a wakeup at iteration %d (rc %d)", i, rc);
+        if (rc != WAIT_OBJECT_0) break;
+        SetEvent(&pair->pong.event);
+    }
+    return NULL;
+}
+
+static void *Pinger(void *arg)
+{
+    struct PingPong *pair = (struct PingPong *)arg;
+
+    for (int i = 0; i < STRESS_ITERATIONS; i++) {
+        SetEvent(&pair->ping.event);
+        int rc = WaitForSingleObject(&pair->pong, LOST_WAKEUP_TIMEOUT);
+        CHECK(rc == WAIT_OBJECT_0, "pinger lost a wakeup at iteration %d (rc %d)", i, rc);
+        if (rc != WAIT_OBJECT_0) break;
+    }
+    return NULL;
+}
+
+static void TestAutoResetPingPong()
+{
+    struct PingPong pairs[STRESS_THREADS / 2];
+    pthread_t threads[STRESS_THREADS];
+
+    for (int p = 0; p < STRESS_THREADS / 2; p++) {
+        pairs[p].ping.type = EVENT;
+        pairs[p].pong.type = EVENT;
+        InitNamedEvent(&pairs[p].ping.event, false, false, "Ping");
+        InitNamedEvent(&pairs[p].pong.event, false, false, "Pong");
+        pthread_create(&threads[2 * p], NULL, Ponger, &pairs[p]);
+        pthread_create(&threads[2 * p + 1], NULL, Pinger, &pairs[p]);
+    }
+
+    for (int t = 0; t < STRESS_THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    for (int p = 0; p < STRESS_THREADS / 2; p++) {
+        CHECK(WaitForSingleObject(&pairs[p].ping, 0) == WAIT_TIMEOUT, "pair %d ping left triggered", p);
+        CHECK(WaitForSingleObject(&pairs[p].pong, 0) == WAIT_TIMEOUT, "pair %d pong left triggered", p);
+    }
+}
+
+
+//--------------------------------------------------------------------
+//
+// Semaphore conservation: never more than SEMAPHORE_SLOTS holders
+//
+//--------------------------------------------------------------------
+static struct Handle slots;
+static int holders = 0;
+static long acquisitions = 0;
+
+static void *SlotWorker(void *arg)
+{
+    for (int i = 0; i < STRESS_ITERATIONS / 4; i++) {
+        int rc = WaitForSingleObject(&slots, LOST_WAKEUP_TIMEOUT);
+        CHECK(rc == WAIT_OBJECT_0, "semaphore wait returned %d", rc);
+        if (rc != WAIT_OBJECT_0) break;
+
+        int inside = __atomic_add_fetch(&holders, 1, __ATOMIC_SEQ_CST);
+        CHECK(inside <= SEMAPHORE_SLOTS, "%d holders inside a %d slot semaphore", inside, SEMAPHORE_SLOTS);
+        __atomic_add_fetch(&acquisitions, 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&holders, 1, __ATOMIC_SEQ_CST);
+
+        ReleaseSemaphore(&slots.semaphore);
+    }
+    return NULL;
+}
+
+static void TestSemaphoreConservation()
+{
+    pthread_t threads[STRESS_THREADS];
+
+    slots.type = SEMAPHORE;
+    InitSemaphore(&slots.semaphore, SEMAPHORE_SLOTS);
+
+    for (int t = 0; t < STRESS_THREADS; t++) {
+        pthread_create(&threads[t], NULL, SlotWorker, NULL);
+    }
+    for (int t = 0; t < STRESS_THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    CHECK(acquisitions == (long)STRESS_THREADS * (STRESS_ITERATIONS / 4), "only %ld acquisitions completed", acquisitions);
+    CHECK(slots.semaphore.Count == SEMAPHORE_SLOTS, "semaphore count drifted to %d", slots.semaphore.Count);
+    for (int s = 0; s < SEMAPHORE_SLOTS; s++) {
+        CHECK(WaitForSingleObject(&slots, 0) == WAIT_OBJECT_0, "slot %d missing after the run", s);
+    }
+    CHECK(WaitForSingleObject(&slots, 0) == WAIT_TIMEOUT, "semaphore handed out an extra slot");
+    DestroySemaphore(&slots.semaphore);
+}
+
+
+//--------------------------------------------------------------------
+//
+// Timed waits: an untriggered wait must time out, not return early or fail.
+// The odd timeouts push tv_nsec past a full second when added to "now".
+//
+//--------------------------------------------------------------------
+static long TimedWaitElapsed(struct Handle *handle, int milliseconds, int *rc)
+{
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    *rc = WaitForSingleObject(handle, milliseconds);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+}
+
+static void TestTimedWait()
+{
+    const int timeouts[] = { 1, 250, 999, 1001, 1999 };
+    struct Handle event = { .type = EVENT };
+    struct Handle semaphore = { .type = SEMAPHORE };
+    long elapsed;
+    int rc;
+
+    InitNamedEvent(&event.event, true, false, "Timed");
+    InitSemaphore(&semaphore.semaphore, 0);
+
+    for (int i = 0; i < sizeof(timeouts) / sizeof(timeouts[0]); i++) {
+        elapsed = TimedWaitElapsed(&event, timeouts[i], &rc);
+        CHECK(rc == WAIT_TIMEOUT, "%d ms event wait returned %d", timeouts[i], rc);
+        CHECK(elapsed >= timeouts[i] - 1, "%d ms event wait returned after only %ld ms", timeouts[i], elapsed);
+
+        elapsed = TimedWaitElapsed(&semaphore, timeouts[i], &rc);
+        CHECK(rc == WAIT_TIMEOUT, "%d ms semaphore wait returned %d", timeouts[i], rc);
+        CHECK(elapsed >= timeouts[i] - 1, "%d ms semaphore wait returned after only %ld ms", timeouts[i], elapsed);
+    }
+
+    DestroyEvent(&event.event);
+    DestroySemaphore(&semaphore.semaphore);
+}
+
+
+int main(int argc, char *argv[])
+{
+    struct {
+        const char *name;
+        void (*run)();
+    } tests[] = {
+        { "ManualResetBroadcast",   TestManualResetBroadcast },
+        { "AutoResetPingPong",      TestAutoResetPingPong },
+        { "SemaphoreConservation",  TestSemaphoreConservation },
+        { "TimedWait",              TestTimedWait },
+    };
+
+    for (int i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        int before = failures;
+        tests[i].run();
+        printf("%s %s\n", tests[i].name, (failures == before) ? "passed" : "failed");
+    }
+
+    return (failures == 0) ? 0 : 1;
+}
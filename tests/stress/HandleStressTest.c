@@ -0,0 +1,560 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// History stress harness for the Handle layer: threads set, reset and
+// wait on shared events and a semaphore (one or several objects at a
+// time) with random timeouts, record each operation with its start and
+// end time, and the histories are then checked against what atomic
+// events and semaphores could have done
+//
+//      HandleStressTest [seed]
+//
+//--------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "Handle.h"
+
+#define HISTORY_THREADS 8
+#define HISTORY_OPS 2000            // per thread
+#define HISTORY_MANUAL 2            // events 0 and 1 are manual-reset, 2 and 3 auto-reset
+#define HISTORY_EVENTS 4
+#define HISTORY_SEMAPHORE HISTORY_EVENTS
+#define HISTORY_OBJECTS (HISTORY_EVENTS + 1)
+#define SEMAPHORE_SLOTS 2
+#define MULTI_WAITERS 6
+#define MULTI_TOGGLERS 2
+#define MULTI_OPS 300               // per waiter
+#define LIFETIME_THREADS 4
+#define LIFETIME_WAITS 2000         // per thread
+#define TIMEOUT_SLACK_MS 1          // a timed out wait may come back this much early, rounding
+#define LEFTOVER_TIMEOUT_MS 15000   // for WaitForMultipleObjects' waiter threads to exit
+#define LONG_TIMEOUT_MS 60000       // a wait any that returns long before its waiters would time out
+
+static int failures = 0;
+
+#define CHECK(cond, ...) \
+    do { if (!(cond)) { fprintf(stderr, "FAIL: " __VA_ARGS__); fprintf(stderr, "\n"); __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED); } } while (0)
+
+enum OpType {
+    OP_SET,
+    OP_RESET,
+    OP_WAIT,                        // WaitForSingleObject
+    OP_RELEASE,
+    OP_WAIT_ANY,                    // WaitForMultipleObjects
+    OP_WAIT_ALL
+};
+
+struct Op {
+    enum OpType Type;
+    int Objects[HISTORY_EVENTS];    // Objects[0] unless a multiple wait
+    int Count;
+    int Timeout;                    // ms
+    int Result;
+    uint64_t Start;                 // ns, CLOCK_MONOTONIC, before the call
+    uint64_t End;                   // after it returned
+};
+
+struct History {
+    struct Op Ops[HISTORY_OPS];
+    int nOps;
+    unsigned int Seed;
+};
+
+static struct Handle objects[HISTORY_OBJECTS];
+static struct History histories[HISTORY_THREADS];
+static unsigned int baseSeed;
+
+static const int timeouts[] = { 0, 0, 1, 2, 5 };
+static const int multiTimeouts[] = { 0, 1, 5, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, INFINITE_WAIT };
+
+static uint64_t NowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int ThreadCount()
+{
+    char line[256];
+    int threads = -1;
+    FILE *status = fopen("/proc/self/status", "r");
+
+    while (status != NULL && fgets(line, sizeof(line), status) != NULL) {
+        if (sscanf(line, "Threads: %d", &threads) == 1) {
+            break;
+        }
+    }
+    if (status != NULL) {
+        fclose(status);
+    }
+    return threads;
+}
+
+// WaitForMultipleObjects leaves its waiter threads behind; they have to go once the handles are set
+static void CheckNoLeftoverThreads(int Baseline)
+{
+    uint64_t start = NowNs();
+
+    while (ThreadCount() > Baseline && (NowNs() - start) / 1000000 < LEFTOVER_TIMEOUT_MS) {
+        usleep(10000);
+    }
+    CHECK(ThreadCount() == Baseline, "%d threads left %d ms after the last wait, %d expected", ThreadCount(), LEFTOVER_TIMEOUT_MS, Baseline);
+}
+
+static void InitObjects(int ManualEvents)
+{
+    for (int i = 0; i < HISTORY_EVENTS; i++) {
+        objects[i].type = EVENT;
+        InitNamedEvent(&objects[i].event, i < ManualEvents, false, "History");
+    }
+    objects[HISTORY_SEMAPHORE].type = SEMAPHORE;
+    InitSemaphore(&objects[HISTORY_SEMAPHORE].semaphore, SEMAPHORE_SLOTS);
+}
+
+static struct Op *Record(struct History *History, enum OpType Type, int Object, int Timeout)
+{
+    struct Op *op = &History->Ops[History->nOps++];
+
+    op->Type = Type;
+    op->Objects[0] = Object;
+    op->Count = 1;
+    op->Timeout = Timeout;
+    op->Start = NowNs();
+    return op;
+}
+
+
+//--------------------------------------------------------------------
+//
+// History checks. A recorded operation took effect at some instant
+// between its Start and End; each check looks for an order of those
+// instants that a correct object allows, or proves there is none.
+//
+//--------------------------------------------------------------------
+static int ByStart(const void *a, const void *b)
+{
+    const struct Op *x = *(const struct Op **)a, *y = *(const struct Op **)b;
+    return (x->Start > y->Start) - (x->Start < y->Start);
+}
+
+static int ByEnd(const void *a, const void *b)
+{
+    const struct Op *x = *(const struct Op **)a, *y = *(const struct Op **)b;
+    return (x->End > y->End) - (x->End < y->End);
+}
+
+// every operation of Type on Object (successful ones only, for waits), sorted
+static int Collect(enum OpType Type, int Object, int (*Order)(const void *, const void *), struct Op **Out)
+{
+    int n = 0;
+
+    for (int t = 0; t < HISTORY_THREADS; t++) {
+        for (int i = 0; i < histories[t].nOps; i++) {
+            struct Op *op = &histories[t].Ops[i];
+
+            if (op->Type == Type && op->Objects[0] == Object && (Type != OP_WAIT || op->Result == WAIT_OBJECT_0)) {
+                Out[n++] = op;
+            }
+        }
+    }
+    qsort(Out, n, sizeof(*Out), Order);
+    return n;
+}
+
+//
+// Set or released before it was taken: the k-th successful wait (by end)
+// needs k supplies started before it ended, counting the initial ones
+// (auto-reset events and the semaphore). Resets only lower the bound.
+//
+static void CheckConsumption(int Object, enum OpType Supply, int Initial, struct Op **Consumed, struct Op **Supplies)
+{
+    int nConsumed = Collect(OP_WAIT, Object, ByEnd, Consumed);
+    int nSupplies = Collect(Supply, Object, ByStart, Supplies);
+    int supplied = 0;
+
+    for (int k = 0; k < nConsumed; k++) {
+        while (supplied < nSupplies && Supplies[supplied]->Start < Consumed[k]->End) {
+            supplied++;
+        }
+        if (k + 1 > supplied + Initial) {
+            CHECK(false, "object %d: wait %d of %d succeeded with only %d supplies before it", Object, k + 1, nConsumed, supplied + Initial);
+            return;
+        }
+    }
+}
+
+//
+// Manual-reset events: a successful wait needs a set started before it
+// ended, and a wait must not time out if a set finished before it started
+// and no reset can fall between that set and the wait's end.
+//
+static void CheckManualEvent(int Object, struct Op **Sets, struct Op **Resets)
+{
+    int nSets = Collect(OP_SET, Object, ByEnd, Sets);
+    int nResets = Collect(OP_RESET, Object, ByStart, Resets);
+    uint64_t firstSet = UINT64_MAX, latestSetStart = 0, latestResetEnd = 0;
+
+    for (int i = 0; i < nSets; i++) {
+        firstSet = Sets[i]->Start < firstSet ? Sets[i]->Start : firstSet;
+    }
+
+    for (int t = 0; t < HISTORY_THREADS; t++) {
+        for (int i = 0; i < histories[t].nOps; i++) {
+            struct Op *wait = &histories[t].Ops[i];
+            int set = 0, reset = 0;
+
+            if (wait->Type != OP_WAIT || wait->Objects[0] != Object) {
+                continue;
+            }
+            if (wait->Result == WAIT_OBJECT_0) {
+                CHECK(firstSet < wait->End, "event %d: wait succeeded before any set", Object);
+                continue;
+            }
+
+            // the set that finished before the wait with the latest start, and the resets that could follow it
+            latestSetStart = 0;
+            for (set = 0; set < nSets && Sets[set]->End < wait->Start; set++) {
+                latestSetStart = Sets[set]->Start > latestSetStart ? Sets[set]->Start : latestSetStart;
+            }
+            latestResetEnd = 0;
+            for (reset = 0; reset < nResets && Resets[reset]->Start < wait->End; reset++) {
+                latestResetEnd = Resets[reset]->End > latestResetEnd ? Resets[reset]->End : latestResetEnd;
+            }
+            CHECK(set == 0 || latestResetEnd > latestSetStart,
+                  "event %d: a %d ms wait timed out although the event was set throughout it", Object, wait->Timeout);
+        }
+    }
+}
+
+static void CheckResults()
+{
+    for (int t = 0; t < HISTORY_THREADS; t++) {
+        for (int i = 0; i < histories[t].nOps; i++) {
+            struct Op *op = &histories[t].Ops[i];
+            bool bWait = op->Type == OP_WAIT || op->Type == OP_WAIT_ANY || op->Type == OP_WAIT_ALL;
+            bool bSucceeded = op->Type == OP_WAIT_ANY ? (op->Result >= 0 && op->Result < op->Count) : op->Result == WAIT_OBJECT_0;
+
+            if (!bWait) {
+                continue;
+            }
+            CHECK(bSucceeded || op->Result == WAIT_TIMEOUT, "thread %d op %d: wait returned %d", t, i, op->Result);
+            if (op->Result == WAIT_TIMEOUT) {
+                CHECK(op->Timeout != INFINITE_WAIT, "thread %d op %d: infinite wait timed out", t, i);
+                CHECK((int64_t)(op->End - op->Start) / 1000000 >= op->Timeout - TIMEOUT_SLACK_MS,
+                      "thread %d op %d: %d ms wait timed out after %.3f ms", t, i, op->Timeout, (op->End - op->Start) / 1e6);
+            }
+        }
+    }
+}
+
+
+//--------------------------------------------------------------------
+//
+// Single object history: set, reset and timed waits on every event,
+// waits and releases on the semaphore
+//
+//--------------------------------------------------------------------
+static void *SingleWorker(void *arg)
+{
+    struct History *history = (struct History *)arg;
+
+    while (history->nOps < HISTORY_OPS - 1) {
+        int object = rand_r(&history->Seed) % HISTORY_OBJECTS;
+        int r = rand_r(&history->Seed) % 100;
+        int timeout = timeouts[rand_r(&history->Seed) % (sizeof(timeouts) / sizeof(timeouts[0]))];
+        struct Op *op;
+
+        if (object == HISTORY_SEMAPHORE) {
+            op = Record(history, OP_WAIT, object, timeout);
+            op->Result = WaitForSingleObject(&objects[object], timeout);
+            op->End = NowNs();
+            if (op->Result == WAIT_OBJECT_0) {
+                op = Record(history, OP_RELEASE, object, 0);
+                ReleaseSemaphore(&objects[object].semaphore);
+                op->End = NowNs();
+            }
+        } else if (r < 30) {
+            op = Record(history, OP_SET, object, 0);
+            SetEvent(&objects[object].event);
+            op->End = NowNs();
+        } else if (r < 40) {
+            op = Record(history, OP_RESET, object, 0);
+            ResetEvent(&objects[object].event);
+            op->End = NowNs();
+        } else {
+            op = Record(history, OP_WAIT, object, timeout);
+            op->Result = WaitForSingleObject(&objects[object], timeout);
+            op->End = NowNs();
+        }
+    }
+    return NULL;
+}
+
+static void TestSingleObjectHistory()
+{
+    static struct Op *scratch[2][HISTORY_THREADS * HISTORY_OPS];
+    pthread_t threads[HISTORY_THREADS];
+
+    InitObjects(HISTORY_MANUAL);
+    for (int t = 0; t < HISTORY_THREADS; t++) {
+        histories[t].nOps = 0;
+        histories[t].Seed = baseSeed + t;
+        pthread_create(&threads[t], NULL, SingleWorker, &histories[t]);
+    }
+    for (int t = 0; t < HISTORY_THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    CheckResults();
+    for (int i = 0; i < HISTORY_EVENTS; i++) {
+        if (i < HISTORY_MANUAL) {
+            CheckManualEvent(i, scratch[0], scratch[1]);
+        } else {
+            CheckConsumption(i, OP_SET, 0, scratch[0], scratch[1]);
+        }
+    }
+    CheckConsumption(HISTORY_SEMAPHORE, OP_RELEASE, SEMAPHORE_SLOTS, scratch[0], scratch[1]);
+    CHECK(objects[HISTORY_SEMAPHORE].semaphore.Count == SEMAPHORE_SLOTS, "semaphore count ended at %d, not %d",
+          objects[HISTORY_SEMAPHORE].semaphore.Count, SEMAPHORE_SLOTS);
+
+    for (int i = 0; i < HISTORY_EVENTS; i++) {
+        DestroyEvent(&objects[i].event);
+    }
+    DestroySemaphore(&objects[HISTORY_SEMAPHORE].semaphore);
+}
+
+
+//--------------------------------------------------------------------
+//
+// Multiple object history: WaitForMultipleObjects on random subsets of
+// the manual-reset events, any or all, with random timeouts, while
+// togglers set and reset them
+//
+//--------------------------------------------------------------------
+static int togglersDone = 0;
+
+static void *Toggler(void *arg)
+{
+    struct History *history = (struct History *)arg;
+
+    while (!__atomic_load_n(&togglersDone, __ATOMIC_ACQUIRE) && history->nOps < HISTORY_OPS - HISTORY_EVENTS) {
+        int object = rand_r(&history->Seed) % HISTORY_EVENTS;
+        bool bSet = rand_r(&history->Seed) % 100 < 60;
+        struct Op *op = Record(history, bSet ? OP_SET : OP_RESET, object, 0);
+
+        if (bSet) {
+            SetEvent(&objects[object].event);
+        } else {
+            ResetEvent(&objects[object].event);
+        }
+        op->End = NowNs();
+        usleep(rand_r(&history->Seed) % 2000);
+    }
+
+    // out of history before the waiters are done: leave every event set, so infinite waits still end
+    for (int object = 0; object < HISTORY_EVENTS; object++) {
+        struct Op *op = Record(history, OP_SET, object, 0);
+
+        SetEvent(&objects[object].event);
+        op->End = NowNs();
+    }
+    return NULL;
+}
+
+static void *MultiWaiter(void *arg)
+{
+    struct History *history = (struct History *)arg;
+
+    for (int i = 0; i < MULTI_OPS; i++) {
+        int order[HISTORY_EVENTS] = { 0, 1, 2, 3 };
+        struct Handle *handles[HISTORY_EVENTS];
+        int count = 1 + rand_r(&history->Seed) % HISTORY_EVENTS;
+        bool bWaitAll = rand_r(&history->Seed) % 2;
+        int timeout = multiTimeouts[rand_r(&history->Seed) % (sizeof(multiTimeouts) / sizeof(multiTimeouts[0]))];
+        struct Op *op;
+
+        // a random subset, in a random order
+        for (int k = 0; k < count; k++) {
+            int pick = k + rand_r(&history->Seed) % (HISTORY_EVENTS - k);
+            int swap = order[k];
+
+            order[k] = order[pick];
+            order[pick] = swap;
+            handles[k] = &objects[order[k]];
+        }
+
+        op = Record(history, bWaitAll ? OP_WAIT_ALL : OP_WAIT_ANY, order[0], timeout);
+        memcpy(op->Objects, order, sizeof(order));
+        op->Count = count;
+        op->Result = WaitForMultipleObjects(count, handles, bWaitAll, timeout);
+        op->End = NowNs();
+    }
+    return NULL;
+}
+
+// a handle that satisfied the wait was set before the wait returned
+static void CheckMultipleWaits()
+{
+    for (int t = 0; t < HISTORY_THREADS; t++) {
+        for (int i = 0; i < histories[t].nOps; i++) {
+            struct Op *wait = &histories[t].Ops[i];
+
+            if ((wait->Type != OP_WAIT_ANY && wait->Type != OP_WAIT_ALL) || wait->Result == WAIT_TIMEOUT) {
+                continue;
+            }
+            for (int k = 0; k < wait->Count; k++) {
+                int object = wait->Objects[k];
+                bool bSetBefore = false;
+
+                if (wait->Type == OP_WAIT_ANY && wait->Result != k) {
+                    continue;
+                }
+                for (int s = 0; s < HISTORY_THREADS && !bSetBefore; s++) {
+                    for (int j = 0; j < histories[s].nOps && !bSetBefore; j++) {
+                        struct Op *set = &histories[s].Ops[j];
+                        bSetBefore = set->Type == OP_SET && set->Objects[0] == object && set->Start < wait->End;
+                    }
+                }
+                CHECK(bSetBefore, "thread %d op %d: wait %s returned with event %d never set before", t, i,
+                      wait->Type == OP_WAIT_ALL ? "all" : "any", object);
+            }
+        }
+    }
+}
+
+static void TestMultipleObjectHistory()
+{
+    pthread_t threads[HISTORY_THREADS];
+    int baseline = ThreadCount();
+
+    InitObjects(HISTORY_EVENTS);
+    togglersDone = 0;
+    for (int t = 0; t < MULTI_TOGGLERS + MULTI_WAITERS; t++) {
+        histories[t].nOps = 0;
+        histories[t].Seed = baseSeed + 100 + t;
+        pthread_create(&threads[t], NULL, t < MULTI_TOGGLERS ? Toggler : MultiWaiter, &histories[t]);
+    }
+    for (int t = MULTI_TOGGLERS; t < MULTI_TOGGLERS + MULTI_WAITERS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    __atomic_store_n(&togglersDone, 1, __ATOMIC_RELEASE);
+    for (int t = 0; t < MULTI_TOGGLERS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    CheckResults();
+    CheckMultipleWaits();
+
+    for (int i = 0; i < HISTORY_EVENTS; i++) {
+        SetEvent(&objects[i].event);
+    }
+    CheckNoLeftoverThreads(baseline);
+    for (int i = 0; i < HISTORY_EVENTS; i++) {
+        DestroyEvent(&objects[i].event);
+    }
+    DestroySemaphore(&objects[HISTORY_SEMAPHORE].semaphore);
+}
+
+
+//--------------------------------------------------------------------
+//
+// Coordinator lifetime: waits on handles that are already set finish
+// as their waiter threads start, so the caller and the last waiter
+// race to tear the coordinator down
+//
+//--------------------------------------------------------------------
+// its own: the detached waiter threads of the tests before it end unsynchronized with a reinit
+static struct Handle lifetimeEvents[2];
+
+static void *LifetimeWaiter(void *arg)
+{
+    struct Handle *handles[2] = { &lifetimeEvents[0], &lifetimeEvents[1] };
+    unsigned int seed = (unsigned int)(uintptr_t)arg;
+
+    for (int i = 0; i < LIFETIME_WAITS; i++) {
+        bool bWaitAll = rand_r(&seed) % 2;
+        int timeout = rand_r(&seed) % 2 ? INFINITE_WAIT : 1000;
+        int rc = WaitForMultipleObjects(2, handles, bWaitAll, timeout);
+
+        CHECK(bWaitAll ? rc == WAIT_OBJECT_0 : (rc == 0 || rc == 1), "wait %s on set events returned %d", bWaitAll ? "all" : "any", rc);
+    }
+    return NULL;
+}
+
+static void TestCoordinatorLifetime()
+{
+    pthread_t threads[LIFETIME_THREADS];
+    int baseline = ThreadCount();
+
+    for (int i = 0; i < 2; i++) {
+        lifetimeEvents[i].type = EVENT;
+        InitNamedEvent(&lifetimeEvents[i].event, true, true, "Lifetime");
+    }
+    for (int t = 0; t < LIFETIME_THREADS; t++) {
+        pthread_create(&threads[t], NULL, LifetimeWaiter, (void *)(uintptr_t)(baseSeed + 200 + t));
+    }
+    for (int t = 0; t < LIFETIME_THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    CheckNoLeftoverThreads(baseline);
+}
+
+
+//--------------------------------------------------------------------
+//
+// Timed waiters: once a long wait any has returned, its waiters on the
+// handles that did not fire must go well before their own timeout
+//
+//--------------------------------------------------------------------
+static void TestTimedWaitersExit()
+{
+    struct Handle events[2] = { { .type = EVENT }, { .type = EVENT } };
+    struct Handle *handles[2] = { &events[0], &events[1] };
+    int baseline = ThreadCount();
+    int rc;
+
+    InitNamedEvent(&events[0].event, true, true, "Fired");
+    InitNamedEvent(&events[1].event, true, false, "Never");
+    for (int i = 0; i < 4; i++) {
+        rc = WaitForMultipleObjects(2, handles, false, LONG_TIMEOUT_MS);
+        CHECK(rc == 0, "wait any on a set event returned %d", rc);
+    }
+    CheckNoLeftoverThreads(baseline);
+}
+
+
+int main(int argc, char *argv[])
+{
+    struct {
+        const char *name;
+        void (*run)();
+    } tests[] = {
+        { "SingleObjectHistory",    TestSingleObjectHistory },
+        { "MultipleObjectHistory",  TestMultipleObjectHistory },
+        { "CoordinatorLifetime",    TestCoordinatorLifetime },
+        { "TimedWaitersExit",       TestTimedWaitersExit },
+    };
+
+    // a failing seed replays the same choices, not the same interleaving
+    baseSeed = argc > 1 ? strtoul(argv[1], NULL, 10) : (unsigned int)time(NULL);
+    printf("seed %u\n", baseSeed);
+
+    for (int i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        int before = failures;
+        tests[i].run();
+        printf("%s %s\n", tests[i].name, (failures == before) ? "passed" : "failed");
+    }
+
+    return (failures == 0) ? 0 : 1;
+}
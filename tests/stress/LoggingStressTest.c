@@ -0,0 +1,193 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Multi-threaded stress harness for the lock-free log ring and its
+// deferred formatting
+//
+//--------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "Logging.h"
+
+#define STRESS_THREADS 8
+#define STRESS_MESSAGES 5000
+
+static int failures = 0;
+
+#define CHECK(cond, ...) \
+    do { if (!(cond)) { fprintf(stderr, "FAIL: " __VA_ARGS__); fprintf(stderr, "\n"); __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED); } } while (0)
+
+
+static void *Producer(void *arg)
+{
+    long id = (long)arg;
+
+    for (int i = 0; i < STRESS_MESSAGES; i++) {
+        Log(info, "stress %ld %d", id, i);
+    }
+
+    return NULL;
+}
+
+//--------------------------------------------------------------------
+//
+// RunProducers - Log from every thread with stdout captured, then check that
+//                each message was written once, in per-thread order, or
+//                accounted for as dropped
+//
+//--------------------------------------------------------------------
+static void RunProducers(bool Background, bool AllowDrops)
+{
+    pthread_t threads[STRESS_THREADS];
+    int lastSeen[STRESS_THREADS];
+    long written = 0;
+    long dropped = 0;
+    char line[LOG_RECORD_SIZE + 96];
+    FILE *capture = tmpfile();
+    int savedStdout = dup(STDOUT_FILENO);
+
+    fflush(stdout);
+    dup2(fileno(capture), STDOUT_FILENO);
+
+    if (Background) {
+        CHECK(StartLogger() == 0, "StartLogger failed");
+    }
+    for (long t = 0; t < STRESS_THREADS; t++) {
+        pthread_create(&threads[t], NULL, Producer, (void *)t);
+    }
+    for (int t = 0; t < STRESS_THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    if (Background) {
+        StopLogger();
+    }
+    FlushLog();
+
+    fflush(stdout);
+    dup2(savedStdout, STDOUT_FILENO);
+    close(savedStdout);
+
+    for (int t = 0; t < STRESS_THREADS; t++) {
+        lastSeen[t] = -1;
+    }
+
+    rewind(capture);
+    while (fgets(line, sizeof(line), capture) != NULL) {
+        char *text = strstr(line, "]: ");
+        long id, n;
+        int i;
+
+        if (text == NULL) {
+            CHECK(false, "malformed log line '%s'", line);
+        } else if (sscanf(text, "]: stress %ld %d", &id, &i) == 2 && id >= 0 && id < STRESS_THREADS) {
+            CHECK(i > lastSeen[id], "thread %ld message %d written after %d", id, i, lastSeen[id]);
+            lastSeen[id] = i;
+            written++;
+        } else if (sscanf(text, "]: %ld log messages dropped", &n) == 1) {
+            dropped += n;
+        } else {
+            CHECK(false, "unexpected log line '%s'", line);
+        }
+    }
+    fclose(capture);
+
+    CHECK(written + dropped == STRESS_THREADS * STRESS_MESSAGES, "%ld written + %ld dropped of %d", written, dropped, STRESS_THREADS * STRESS_MESSAGES);
+    CHECK(AllowDrops || dropped == 0, "%ld messages dropped", dropped);
+}
+
+//--------------------------------------------------------------------
+//
+// Deferred formatting: captured arguments must render exactly like printf,
+//                      even after the caller's buffers have changed
+//
+//--------------------------------------------------------------------
+#define EXPECT_LOG(expected, format, ...) \
+    do { \
+        snprintf(expected[nExpected++], sizeof(expected[0]), format, ##__VA_ARGS__); \
+        Log(info, format, ##__VA_ARGS__); \
+    } while (0)
+
+static void TestDeferredFormatting()
+{
+    char expected[16][LOG_RECORD_SIZE];
+    char line[LOG_RECORD_SIZE + 96];
+    char scratch[32] = "transient";
+    int nExpected = 0;
+    int nSeen = 0;
+    FILE *capture = tmpfile();
+    int savedStdout = dup(STDOUT_FILENO);
+
+    fflush(stdout);
+    dup2(fileno(capture), STDOUT_FILENO);
+
+    // the flusher formats these whenever it gets to them, typically after scratch changes
+    CHECK(StartLogger() == 0, "StartLogger failed");
+    EXPECT_LOG(expected, "plain text, 100%% literal");
+    EXPECT_LOG(expected, "ints %d %i %5d %-5d| %+d %05d", -42, 7, 3, 4, 5, -6);
+    EXPECT_LOG(expected, "lengths %hhd %hd %ld %lld %zu %hhx %hx", (signed char)-1, (short)-2, -3L, -4LL, (size_t)5, (unsigned char)255, (unsigned short)65535);
+    EXPECT_LOG(expected, "unsigned %u %o %x %X %#x %lu", 4000000000u, 8, 255, 255, 255, 18446744073709551615UL);
+    EXPECT_LOG(expected, "stars %*d|%-*d|%.*f|%*.*s|", 6, 1, 4, 2, 2, 3.14159, 8, 3, "abcdef");
+    EXPECT_LOG(expected, "floats %f %.2e %g %Lf %a", 1.5, 12345.678, 0.0001, (long double)2.25, 1.0);
+    EXPECT_LOG(expected, "chars %c%c %5c", 'o', 'k', 'x');
+    EXPECT_LOG(expected, "strings '%s' '%10s' '%-10s' '%.3s'", scratch, "right", "left", "truncate");
+    EXPECT_LOG(expected, "pointer %p", (void *)scratch);
+    strcpy(scratch, "overwritten");
+    StopLogger();
+
+    fflush(stdout);
+    dup2(savedStdout, STDOUT_FILENO);
+    close(savedStdout);
+
+    rewind(capture);
+    while (fgets(line, sizeof(line), capture) != NULL) {
+        char *text = strstr(line, "]: ");
+
+        line[strcspn(line, "\n")] = '\0';
+        if (text == NULL || nSeen >= nExpected) {
+            CHECK(false, "unexpected log line '%s'", line);
+            continue;
+        }
+        CHECK(strcmp(text + 3, expected[nSeen]) == 0, "rendered '%s', printf gives '%s'", text + 3, expected[nSeen]);
+        nSeen++;
+    }
+    fclose(capture);
+
+    CHECK(nSeen == nExpected, "%d of %d records written", nSeen, nExpected);
+}
+
+static void TestSynchronous()
+{
+    RunProducers(false, false);
+}
+
+static void TestBackgroundFlusher()
+{
+    RunProducers(true, true);
+}
+
+int main(int argc, char *argv[])
+{
+    struct {
+        const char *name;
+        void (*run)();
+    } tests[] = {
+        { "DeferredFormatting", TestDeferredFormatting },
+        { "Synchronous",        TestSynchronous },
+        { "BackgroundFlusher",  TestBackgroundFlusher },
+    };
+
+    for (int i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        int before = failures;
+        tests[i].run();
+        printf("%s %s\n", tests[i].name, (failures == before) ? "passed" : "failed");
+    }
+
+    return (failures == 0) ? 0 : 1;
+}
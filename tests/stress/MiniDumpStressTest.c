@@ -0,0 +1,214 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Mini dumps of a multithreaded child: the core must be a well formed
+// ELF core with every thread's registers and the stack data they point
+// at, the module map, and the child must carry on afterwards
+//
+//--------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <limits.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/procfs.h>
+#include <sys/stat.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+
+#include "Metrics.h"
+#include "MiniDump.h"
+
+#define WORKER_THREADS 8
+#define DUMP_ROUNDS 50
+#define STACK_MARKER 0x6d696e6964756d70ULL     // "minidump"
+
+#ifndef NT_FILE
+#define NT_FILE 0x46494c45
+#endif
+
+static int failures = 0;
+
+#define CHECK(cond, ...) \
+    do { if (!(cond)) { fprintf(stderr, "FAIL: " __VA_ARGS__); fprintf(stderr, "\n"); __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED); } } while (0)
+
+// every thread of the child blocks with a marker in its innermost frame
+static void *Worker(void *Context)
+{
+    volatile uint64_t marker[4] = { STACK_MARKER, STACK_MARKER, STACK_MARKER, STACK_MARKER };
+
+    while (marker[0] == STACK_MARKER) {
+        pause();
+    }
+    return NULL;
+}
+
+static void RunTarget()
+{
+    pthread_t thread;
+
+    for (int i = 0; i < WORKER_THREADS; i++) {
+        pthread_create(&thread, NULL, Worker, NULL);
+    }
+    Worker(NULL);
+}
+
+//--------------------------------------------------------------------
+//
+// CheckCore - Parse the core at Path as a debugger would
+//
+//--------------------------------------------------------------------
+static void CheckCore(const char *Path, pid_t Target, const char *Executable)
+{
+    const Elf64_Ehdr *header;
+    const Elf64_Phdr *segments;
+    const char *image;
+    struct stat st;
+    int nStatus = 0, nMarkers = 0;
+    bool bPsinfo = false, bAuxv = false, bExecutable = false;
+    FILE *core;
+
+    if ((core = fopen(Path, "r")) == NULL || fstat(fileno(core), &st) != 0) {
+        CHECK(false, "no core at %s", Path);
+        return;
+    }
+    image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(core), 0);
+    fclose(core);
+    header = (const Elf64_Ehdr *)image;
+    segments = (const Elf64_Phdr *)(image + header->e_phoff);
+
+    CHECK(memcmp(header->e_ident, ELFMAG, SELFMAG) == 0 && header->e_type == ET_CORE, "not an ELF core");
+    CHECK(header->e_phnum > 1 && segments[0].p_type == PT_NOTE, "no PT_NOTE first");
+    CHECK(st.st_size < (off_t)(WORKER_THREADS + 2) * MINI_DUMP_STACK_SIZE + 1024 * 1024, "core of %ld bytes", (long)st.st_size);
+
+    for (size_t offset = 0; offset < segments[0].p_filesz; ) {
+        const Elf64_Nhdr *note = (const Elf64_Nhdr *)(image + segments[0].p_offset + offset);
+        const char *desc = (const char *)(note + 1) + ((note->n_namesz + 3) & ~3);
+
+        if (note->n_type == NT_PRSTATUS && note->n_descsz == sizeof(struct elf_prstatus)) {
+            const struct elf_prstatus *status = (const struct elf_prstatus *)desc;
+            const struct user_regs_struct *regs = (const struct user_regs_struct *)&status->pr_reg;
+#if defined(__x86_64__)
+            uint64_t sp = regs->rsp;
+#else
+            uint64_t sp = regs->sp;
+#endif
+            CHECK(nStatus > 0 || status->pr_pid == Target, "first thread is %d, not the main thread", status->pr_pid);
+
+            // the marker is in a frame just above the stack pointer, in a PT_LOAD
+            for (int s = 1; s < header->e_phnum; s++) {
+                if (sp >= segments[s].p_vaddr && sp < segments[s].p_vaddr + segments[s].p_filesz) {
+                    const uint64_t *words = (const uint64_t *)(image + segments[s].p_offset + (sp - segments[s].p_vaddr));
+                    size_t nWords = (segments[s].p_vaddr + segments[s].p_filesz - sp) / sizeof(uint64_t);
+                    for (size_t w = 0; w + 3 < nWords && w < 1024; w++) {
+                        if (words[w] == STACK_MARKER && words[w + 3] == STACK_MARKER) {
+                            nMarkers++;
+                            break;
+                        }
+                    }
+                }
+            }
+            nStatus++;
+        } else if (note->n_type == NT_PRPSINFO && note->n_descsz == sizeof(struct elf_prpsinfo)) {
+            const struct elf_prpsinfo *info = (const struct elf_prpsinfo *)desc;
+            bPsinfo = info->pr_pid == Target && strcmp(info->pr_fname, "MiniDumpStressT") == 0;
+        } else if (note->n_type == NT_AUXV) {
+            bAuxv = note->n_descsz > 0;
+        } else if (note->n_type == NT_FILE) {
+            const uint64_t *counts = (const uint64_t *)desc;
+            const char *names = desc + (2 + 3 * counts[0]) * sizeof(uint64_t);
+            for (uint64_t f = 0; f < counts[0] && names < desc + note->n_descsz; f++) {
+                bExecutable |= strcmp(names, Executable) == 0;
+                names += strlen(names) + 1;
+            }
+        }
+        offset += sizeof(*note) + ((note->n_namesz + 3) & ~3) + ((note->n_descsz + 3) & ~3);
+    }
+
+    CHECK(nStatus == WORKER_THREADS + 1, "%d of %d threads in the core", nStatus, WORKER_THREADS + 1);
+    CHECK(nMarkers == WORKER_THREADS + 1, "stack marker found for %d of %d threads", nMarkers, WORKER_THREADS + 1);
+    CHECK(bPsinfo, "NT_PRPSINFO missing or wrong");
+    CHECK(bAuxv, "NT_AUXV missing");
+    CHECK(bExecutable, "%s not in NT_FILE", Executable);
+
+    munmap((void *)image, st.st_size);
+}
+
+//--------------------------------------------------------------------
+//
+// Dumps: repeated mini dumps, each complete and quick, the target unharmed
+//
+//--------------------------------------------------------------------
+static void TestDumps()
+{
+    char path[] = "/tmp/procdump_mini_XXXXXX";
+    char executable[PATH_MAX];
+    struct MiniDumpResult result;
+    uint64_t slowest = 0;
+    ssize_t length;
+    pid_t target;
+    int status;
+
+    length = readlink("/proc/self/exe", executable, sizeof(executable) - 1);
+    executable[length > 0 ? length : 0] = '\0';
+
+    if ((target = fork()) == 0) {
+        RunTarget();
+        _exit(0);
+    }
+    usleep(100000);                         // the workers are started
+    CHECK(mkdtemp(path) != NULL, "mkdtemp failed");
+
+    for (int round = 0; round < DUMP_ROUNDS; round++) {
+        char core[sizeof(path) + 16];
+        int rc;
+
+        snprintf(core, sizeof(core), "%s/core.%d", path, round);
+        CHECK((rc = WriteMiniDump(target, core, &result)) == 0, "WriteMiniDump failed: %s", strerror(rc));
+        CHECK(result.Threads == WORKER_THREADS + 1, "%d threads dumped", result.Threads);
+        if (result.ResumedAt - result.StoppedAt > slowest) {
+            slowest = result.ResumedAt - result.StoppedAt;
+        }
+        if (round == 0) {
+            CheckCore(core, target, executable);
+        }
+        unlink(core);
+
+        // every thread was let go: none is left stopped or traced
+        CHECK(waitpid(target, &status, WNOHANG | __WALL) == 0, "target stopped or exited after dump %d", round);
+    }
+    CHECK(WriteMiniDump(target, path, &result) != 0, "dump over an existing path succeeded");
+    rmdir(path);
+    printf("slowest of %d mini dumps stopped the target for %.2f ms\n", DUMP_ROUNDS, slowest / 1e6);
+
+    kill(target, SIGKILL);
+    waitpid(target, NULL, 0);
+    CHECK(WriteMiniDump(target, "/tmp/procdump_mini_gone", &result) != 0 && access("/tmp/procdump_mini_gone", F_OK) != 0,
+          "dump of an exited target left a file");
+}
+
+int main(int argc, char *argv[])
+{
+    struct {
+        const char *name;
+        void (*run)();
+    } tests[] = {
+        { "Dumps",      TestDumps },
+    };
+
+    for (int i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        int before = failures;
+        tests[i].run();
+        printf("%s %s\n", tests[i].name, (failures == before) ? "passed" : "failed");
+    }
+
+    return (failures == 0) ? 0 : 1;
+}
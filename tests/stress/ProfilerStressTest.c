@@ -0,0 +1,181 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License
+
+//--------------------------------------------------------------------
+//
+// Profiler: samples a busy child with known frames many times over,
+// checks the folded stacks name them in order and the child survives
+//
+//--------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "Profiler.h"
+
+#define SAMPLE_ROUNDS 500
+#define WORKER_THREADS 4
+
+static int failures = 0;
+
+#define CHECK(cond, ...) \
+    do { if (!(cond)) { fprintf(stderr, "FAIL: " __VA_ARGS__); fprintf(stderr, "\n"); __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED); } } while (0)
+
+// the child's call chain; built without optimization, so with frame pointers
+static volatile unsigned long spins = 0;
+
+__attribute__((noinline)) static void ProfiledLeaf()
+{
+    for (int i = 0; i < 1000; i++) {
+        spins++;
+    }
+}
+
+__attribute__((noinline)) static void ProfiledMiddle()
+{
+    ProfiledLeaf();
+}
+
+__attribute__((noinline)) static void *ProfiledOuter(void *Context)
+{
+    for (;;) {
+        ProfiledMiddle();
+    }
+    return NULL;
+}
+
+static void RunTarget()
+{
+    pthread_t thread;
+
+    for (int i = 1; i < WORKER_THREADS; i++) {
+        pthread_create(&thread, NULL, ProfiledOuter, NULL);
+    }
+    ProfiledOuter(NULL);
+}
+
+static char GetState(pid_t Pid)
+{
+    char path[32];
+    char state = 0;
+    FILE *stat;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", Pid);
+    if ((stat = fopen(path, "r")) != NULL) {
+        if (fscanf(stat, "%*d (%*[^)]) %c", &state) != 1) {
+            state = 0;
+        }
+        fclose(stat);
+    }
+    return state;
+}
+
+//--------------------------------------------------------------------
+//
+// Spec: -P argument parsing
+//
+//--------------------------------------------------------------------
+static void TestSpec()
+{
+    int hz = 0;
+    bool bTriggered = true;
+
+    CHECK(ParseProfileSpec("49", &hz, &bTriggered) == 0 && hz == 49 && !bTriggered, "49 parsed as %d", hz);
+    CHECK(ParseProfileSpec("10:triggered", &hz, &bTriggered) == 0 && hz == 10 && bTriggered, "10:triggered parsed as %d", hz);
+    CHECK(ParseProfileSpec("0", &hz, &bTriggered) != 0, "0 Hz accepted");
+    CHECK(ParseProfileSpec("1000", &hz, &bTriggered) != 0, "1000 Hz accepted");
+    CHECK(ParseProfileSpec("10:always", &hz, &bTriggered) != 0, "unknown mode accepted");
+    CHECK(ParseProfileSpec("fast", &hz, &bTriggered) != 0, "non number accepted");
+}
+
+//--------------------------------------------------------------------
+//
+// Sampling: every thread is sampled each round, the stacks unwind
+//           through ProfiledOuter, ProfiledMiddle and ProfiledLeaf
+//
+//--------------------------------------------------------------------
+static void TestSampling()
+{
+    char path[] = "/tmp/procdump_profile_XXXXXX";
+    static struct Profiler profiler;
+    char line[8192];
+    unsigned long long counted = 0;
+    bool bUnwound = false;
+    int sampled = 0;
+    FILE *folded;
+    pid_t target;
+
+    if ((target = fork()) == 0) {
+        RunTarget();
+        _exit(0);
+    }
+    usleep(100000);                         // the workers are started
+
+    CHECK(mkstemp(path) != -1, "mkstemp failed");
+    CHECK(OpenProfiler(&profiler, target, "target", PROFILE_MAX_HZ, path) == 0, "OpenProfiler failed");
+
+    for (int round = 0; round < SAMPLE_ROUNDS; round++) {
+        sampled += SampleProfiler(&profiler);
+    }
+    // a thread queued behind its siblings for longer than PROFILE_STOP_TIMEOUT is skipped
+    CHECK(sampled >= SAMPLE_ROUNDS * WORKER_THREADS / 2, "%d of %d threads sampled", sampled, SAMPLE_ROUNDS * WORKER_THREADS);
+    CHECK(profiler.nSamples == (uint64_t)sampled, "%llu stacks recorded for %d samples", (unsigned long long)profiler.nSamples, sampled);
+    CHECK(WriteProfile(&profiler) == 0, "WriteProfile failed");
+
+    // the target survived being sampled
+    CHECK(GetState(target) != 'Z' && GetState(target) != 0, "target exited while profiled");
+
+    if ((folded = fopen(path, "r")) != NULL) {
+        while (fgets(line, sizeof(line), folded) != NULL) {
+            char *count = strrchr(line, ' ');
+            CHECK(strncmp(line, "target;", 7) == 0 && count != NULL, "malformed line: %s", line);
+            if (count != NULL) {
+                counted += strtoull(count + 1, NULL, 10);
+            }
+            bUnwound |= strstr(line, ";ProfiledOuter;ProfiledMiddle;ProfiledLeaf ") != NULL;
+        }
+        fclose(folded);
+    }
+    CHECK(counted == profiler.nSamples, "folded counts add up to %llu of %llu", counted, (unsigned long long)profiler.nSamples);
+    CHECK(bUnwound, "no stack unwound through ProfiledOuter;ProfiledMiddle;ProfiledLeaf");
+
+    // threads still seized from the last rounds are reaped once they exit
+    kill(target, SIGKILL);
+    for (int i = 0; i < 100 && profiler.nLagging != 0; i++) {
+        SampleProfiler(&profiler);
+        usleep(1000);
+    }
+    CHECK(profiler.nLagging == 0, "%d threads still seized", profiler.nLagging);
+    waitpid(target, NULL, 0);
+
+    // symbols were cached while the target was alive
+    CHECK(WriteProfile(&profiler) == 0, "WriteProfile after exit failed");
+    CHECK(SampleProfiler(&profiler) == 0, "sampled an exited target");
+    CloseProfiler(&profiler);
+    unlink(path);
+}
+
+int main(int argc, char *argv[])
+{
+    struct {
+        const char *name;
+        void (*run)();
+    } tests[] = {
+        { "Spec",       TestSpec },
+        { "Sampling",   TestSampling },
+    };
+
+    for (int i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        int before = failures;
+        tests[i].run();
+        printf("%s %s\n", tests[i].name, (failures == before) ? "passed" : "failed");
+    }
+
+    return (failures == 0) ? 0 : 1;
+}